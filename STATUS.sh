@@ -20,7 +20,7 @@ cat << 'EOF'
 ✅ x86-64 VM            - Complete (16 registers, Linux syscalls)
 ✅ Interactive Launcher - Complete (5 menu options)
 ✅ GUI Visualization    - Complete (SDL2 graphics)
-✅ Image Generator      - Complete (C-based, no Python)
+✅ Assembler            - Labels, macros, peephole optimizer
 ✅ QEMU Integration     - Complete (Full Ubuntu support)
 ✅ Documentation        - Complete (4 guides)
 
@@ -38,7 +38,7 @@ Step 3: Choose Your Emulator
     1) 8-bit RISC VM          ← Start here (simple)
     2) 8-bit RISC VM + GUI    ← Visual mode
     3) x86-64 VM              ← Advanced
-    4) Image Generator        ← Create binaries
+    4) Assembler              ← Create binaries
     5) Ubuntu with QEMU       ← Full OS (need ISO)
 
 📁 DELIVERABLES
@@ -49,7 +49,7 @@ Source Code (12 files):
   ✓ vm64.h / vm64.c       - x86-64 core
   ✓ main.c / main64.c     - CLI interfaces
   ✓ gui.c                 - SDL2 graphics
-  ✓ imggen.c              - Binary generator
+  ✓ vmasm.c               - Assembler
   ✓ launcher.c            - Interactive menu
 
 Build System:
@@ -108,7 +108,7 @@ make launcher       # Just the menu
 make cli            # 8-bit emulator
 make vm64           # x86-64 emulator
 make gui            # With SDL2 (requires: brew install sdl2)
-make imggen         # Image generator
+make vmasm          # Assembler
 make clean          # Remove binaries
 make help           # Show all options
 
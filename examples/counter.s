@@ -0,0 +1,16 @@
+; counter.s - print the digits 0 through 9
+;
+;   ./bin/vmasm examples/counter.s -o images/counter.bin
+
+COUNT = 10
+
+        MOVI    r0, '0'                 ; current digit
+        MOVI    r1, COUNT               ; digits left
+        MOVI    r2, 1
+loop:   OUT     r0
+        ADD     r0, r2
+        SUB     r1, r2
+        JNZ     r1, loop
+        MOVI    r0, '\n'
+        OUT     r0
+        HALT
@@ -0,0 +1,49 @@
+; fibonacci.s - print the first ten Fibonacci numbers in decimal
+;
+;   ./bin/vmasm examples/fibonacci.s -o images/fibonacci.bin
+
+.equ TERMS, 10
+
+        MOVI    r0, 1                   ; F(n)
+        MOVI    r1, 1                   ; F(n+1)
+        MOVI    r2, TERMS
+        MOVI    r6, 1
+loop:   CALL    print_num
+        MOVI    r3, 0                   ; r3 = r0 + r1
+        ADD     r3, r0
+        ADD     r3, r1
+        SUB     r0, r0                  ; r0 = r1, r1 = r3
+        ADD     r0, r1
+        SUB     r1, r1
+        ADD     r1, r3
+        SUB     r2, r6
+        JNZ     r2, loop
+        HALT
+
+; print_num: print r0 in decimal followed by a newline (r0-r2 preserved)
+print_num:
+        PUSH    r0
+        PUSH    r1
+        PUSH    r2
+        MOVI    r1, 10
+        MOVI    r3, 0                   ; digits pushed
+        MOVI    r4, 1
+.digit: SUB     r5, r5                  ; r5 = r0 % 10
+        ADD     r5, r0
+        MOD     r5, r1
+        MOVI    r2, '0'
+        ADD     r5, r2
+        PUSH    r5
+        ADD     r3, r4
+        DIV     r0, r1
+        JNZ     r0, .digit
+.emit:  POP     r5
+        OUT     r5
+        SUB     r3, r4
+        JNZ     r3, .emit
+        MOVI    r5, '\n'
+        OUT     r5
+        POP     r2
+        POP     r1
+        POP     r0
+        RET
@@ -0,0 +1,22 @@
+; hello.s - print a string by walking a pointer over it
+;
+;   ./bin/vmasm examples/hello.s -o images/hello.bin
+;   ./bin/emulator images/hello.bin
+
+; PUTS ptr_reg: print the NUL-terminated string at ptr_reg (clobbers r0, r7)
+.macro PUTS ptr
+        MOVI    r7, 1
+loop\@: LOAD.B  r0, [\ptr]
+        JZ      r0, done\@
+        OUT     r0
+        ADD     \ptr, r7
+        JMP     loop\@
+done\@:
+.endm
+
+start:  MOVI    r1, message
+        PUTS    r1
+        HALT
+
+message:
+        .asciz  "HELLO WORLD\n"
@@ -0,0 +1,24 @@
+; hello64.s - VM64 hello world through the write and exit_group syscalls
+;
+;   ./bin/vmasm examples/hello64.s -o images/hello64.bin
+;   ./bin/vm64 images/hello64.bin
+
+.isa vm64
+.base 0x400000
+
+SYS_WRITE = 1                           ; Linux numbering (4 on macOS)
+SYS_EXIT_GROUP = 231
+
+        MOVI    rax, SYS_WRITE
+        MOVI    rdi, 1                  ; stdout
+        MOVI    rsi, msg
+        MOVI    rdx, len
+        SYSCALL
+        MOVI    rax, SYS_EXIT_GROUP
+        MOVI    rdi, 0
+        SYSCALL
+        HALT
+
+msg:    .ascii  "Hello from VM64\n"
+msg_end:
+len = msg_end - msg
@@ -0,0 +1,24 @@
+; wide.s - store a message a word at a time with STOREX, then print it
+; by walking a pointer register with byte loads
+;
+;   ./bin/vmasm examples/wide.s -o images/wide.bin
+
+BUFFER = 0x1000
+
+        MOVI    r1, BUFFER
+        MOVI    r0, 0x57494445          ; "WIDE"
+        STORE.D r0, [r1]
+        MOVI    r0, 0x204C4F41          ; " LOA"
+        STORE.D r0, [r1+4]
+        MOVI    r0, 0x44530A00          ; "DS\n\0"
+        STORE.D r0, [r1+8]
+
+        MOVI    r2, 1                   ; pointer step
+loop:   LOAD.B  r0, [r1]
+        JZ      r0, done
+        OUT     r0
+        ADD     r1, r2
+        JMP     loop
+
+done:   LOAD.D  r3, [BUFFER]            ; the first word as one 32-bit load
+        HALT
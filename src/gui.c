@@ -1,4 +1,7 @@
 #include "vm.h"
+#include "ring.h"
+#include "gui_font.h"
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -12,47 +15,235 @@
 #define CHAR_HEIGHT 16
 #define OUTPUT_ROWS 30
 #define OUTPUT_COLS 120
+#define OUTPUT_VISIBLE_COLS ((WINDOW_WIDTH - 20) / CHAR_WIDTH)
+#define OUTPUT_X 10
+#define OUTPUT_Y 10
+#define STATUS_Y (OUTPUT_Y + OUTPUT_ROWS * CHAR_HEIGHT + 20)
+#define REGS_Y (STATUS_Y + 40)
+#define HUD_WIDTH 272
+#define HUD_X (WINDOW_WIDTH - 10 - HUD_WIDTH)
+#define HUD_HEAT 256                       /* Heatmap side, one pixel per RAM byte */
+#define HUD_GRAPH 48                       /* MIPS graph height */
+
+/* The VM runs on its own thread. OUT bytes and state
+ * snapshots reach the render thread through SPSC rings (ring.h), and key
+ * presses go the other way as atomic command bits, so neither side ever
+ * waits for the other except when the output ring is full. */
+
+#define GUI_BATCH 4096                     /* Instructions between command checks */
+#define GUI_OUTPUT_RING (64 * 1024)
+#define GUI_SNAPSHOTS 16                   /* Snapshot ring capacity in records */
+#define GUI_SNAPSHOT_MS 8                  /* Snapshot interval while running */
+#define GUI_IDLE_MS 2                      /* Command poll interval when stopped */
+#define GUI_QUIT_WAIT_MS 200               /* How long to wait for the VM thread */
+#define GUI_BUDGET 90                      /* Default share of each frame for the VM, % */
+#define GUI_REFRESH 60                     /* Assumed when the display does not say */
+#define GUI_TURBO_RENDER_MS 250            /* Redraw interval in turbo mode */
+#define GUI_RATE_MS 500                    /* MIPS measurement window */
+
+#define GUI_SCROLLBACK (1u << 20)          /* Default scrollback in lines */
+#define GUI_SCROLLBACK_TEXT 32             /* Text bytes reserved per line */
+#define GUI_WHEEL_LINES 3
+
+#define GUI_HEAT_EPOCH_MS 16               /* Profile epoch length */
+#define GUI_HEAT_FADE 64                   /* Epochs for an access to fade out */
+#define GUI_HEAT_BAND 32                   /* Heatmap rows refreshed per frame */
+#define GUI_HUD_SAMPLES 128                /* MIPS history, one per GUI_RATE_MS */
+#define GUI_HUD_OPCODES 6                  /* Histogram rows */
+
+#define GUI_CMD_PAUSE 0x01u                /* Toggle pause */
+#define GUI_CMD_STEP  0x02u                /* One instruction (when paused) */
+#define GUI_CMD_RESET 0x04u                /* Reload the image and run */
+
+/* In the output ring: the VM thread only queues bytes the screen shows,
+ * so this control byte marks a reset in order with the output */
+#define GUI_OUT_RESET '\f'
+
+/* VM state as of the end of a batch */
+typedef struct {
+    uint64_t regs[VM_REG_COUNT];
+    uint64_t cycles;
+    double mips;                           /* Achieved rate over the last window */
+    uint16_t pc, sp;
+    uint8_t halted, paused;
+    uint8_t turbo, budget;
+} GuiSnapshot;
+
+/* Output history: line start offsets and text in two rings. Lines are
+ * numbered from the start of output; a newline is O(1), and the oldest
+ * lines are dropped when either ring fills. */
+typedef struct {
+    char* text;
+    uint64_t text_mask;
+    uint64_t text_head;                    /* Bytes written */
+    uint64_t* start;                       /* Per line, offset into text */
+    uint64_t line_mask;
+    uint64_t first, last;                  /* Lines kept; last is being written */
+} GuiScrollback;
 
 typedef struct {
     SDL_Window* window;
     SDL_Renderer* renderer;
-    SDL_Texture* font_texture;
+    SDL_Texture* font_texture;             /* Glyph atlas, one row of 8x8 cells */
+    SDL_Texture* screen;                   /* Last frame; only changes are redrawn */
     
-    /* Output buffer */
-    char output[OUTPUT_ROWS][OUTPUT_COLS];
-    int output_line;
-    int output_col;
+    /* Output (render thread) */
+    GuiScrollback history;
+    uint64_t scroll;                       /* Lines above the newest, 0 = follow */
+    uint64_t row_line[OUTPUT_ROWS];        /* What each screen row shows */
+    uint32_t row_len[OUTPUT_ROWS];
+    uint8_t dirty[OUTPUT_ROWS];            /* Rows to redraw into screen */
+    uint64_t drawn_scroll;
+    int panel_dirty;                       /* Redraw status line and registers */
+    GuiSnapshot drawn;                     /* State the panel shows */
+    GuiSnapshot state;                     /* Latest snapshot */
     
-    /* Execution state */
-    int running;
+    /* HUD (render thread) */
+    SDL_Texture* heat_texture;             /* RAM heatmap, refreshed a band at a time */
+    uint32_t heat_row;                     /* Next band */
+    double mips_history[GUI_HUD_SAMPLES];
+    uint32_t samples;                      /* Samples taken */
+    uint32_t last_sample;
+    uint64_t op_seen[256];                 /* Profile counts at the last sample */
+    uint64_t reads_seen, writes_seen;
+    uint8_t top_op[GUI_HUD_OPCODES];       /* Most executed since the last sample */
+    uint64_t top_count[GUI_HUD_OPCODES];
+    uint64_t op_total;
+    double read_rate, write_rate;          /* Bytes per second */
+    
+    /* Shared with the VM thread */
+    Ring out;                              /* OUT bytes and resets, VM -> render */
+    Ring snapshots;                        /* GuiSnapshot records, VM -> render */
+    uint32_t commands;                     /* GUI_CMD_* bits, render -> VM */
+    int turbo;                             /* Run flat out, redraw rarely */
+    int budget;                            /* Otherwise: % of each frame to run */
+    uint32_t frame_us;                     /* Display frame time, set at start */
+    int hud;                               /* Overlay shown, so profile the VM */
+    VMProfile* profile;
+    int quit;
+    int vm_done;
+    
+    /* VM thread */
+    VM* vm;
+    const uint8_t* image;                  /* RAM as loaded, for reset */
     int paused;
-    int step_mode;
-    int speed;  /* Cycles per frame */
+    double mips;
+    
+    int running;
 } GUI;
 
-/* Simple font rendering (8x16 bitmap font) */
-void render_char(GUI* gui, char c, int x, int y, SDL_Color color) {
-    SDL_Rect dst = {x, y, CHAR_WIDTH, CHAR_HEIGHT};
-    
-    /* Create a simple rectangle for each character */
-    if (c >= 32 && c < 127) {
-        SDL_SetRenderDrawColor(gui->renderer, color.r, color.g, color.b, 255);
-        SDL_RenderFillRect(gui->renderer, &dst);
-        
-        /* Draw character using simple lines (ASCII art style) */
-        SDL_SetRenderDrawColor(gui->renderer, 
-                              255 - color.r, 255 - color.g, 255 - color.b, 255);
-        SDL_RenderDrawRect(gui->renderer, &dst);
+/* Draw text from the glyph atlas, each 8x8 glyph doubled in height. SDL
+ * batches the copies, since they all come from one texture. */
+static void gui_draw_text(GUI* gui, int x, int y, const char* text, size_t len,
+                          SDL_Color color) {
+    SDL_SetTextureColorMod(gui->font_texture, color.r, color.g, color.b);
+    for (size_t i = 0; i < len; i++, x += CHAR_WIDTH) {
+        unsigned char c = (unsigned char)text[i];
+        if (c <= GUI_FONT_FIRST || c >= GUI_FONT_FIRST + GUI_FONT_COUNT) continue;
+        SDL_Rect src = {(c - GUI_FONT_FIRST) * GUI_FONT_SIZE, 0, GUI_FONT_SIZE, GUI_FONT_SIZE};
+        SDL_Rect dst = {x, y, CHAR_WIDTH, CHAR_HEIGHT};
+        SDL_RenderCopy(gui->renderer, gui->font_texture, &src, &dst);
     }
 }
 
-void gui_init(GUI* gui) {
+/* Bake gui_font into a white-on-transparent atlas, tinted when drawn */
+static SDL_Texture* gui_create_font(SDL_Renderer* renderer) {
+    static uint32_t pixels[GUI_FONT_SIZE][GUI_FONT_COUNT * GUI_FONT_SIZE];
+    for (int g = 0; g < GUI_FONT_COUNT; g++) {
+        for (int y = 0; y < GUI_FONT_SIZE; y++) {
+            for (int x = 0; x < GUI_FONT_SIZE; x++) {
+                int on = (gui_font[g][y] >> x) & 1;
+                pixels[y][g * GUI_FONT_SIZE + x] = on ? 0xFFFFFFFFu : 0xFFFFFF00u;
+            }
+        }
+    }
+    SDL_Texture* atlas = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_RGBA8888,
+                                           SDL_TEXTUREACCESS_STATIC,
+                                           GUI_FONT_COUNT * GUI_FONT_SIZE, GUI_FONT_SIZE);
+    if (!atlas) return NULL;
+    SDL_UpdateTexture(atlas, NULL, pixels, (int)sizeof(pixels[0]));
+    SDL_SetTextureBlendMode(atlas, SDL_BLENDMODE_BLEND);
+    return atlas;
+}
+
+static void gui_invalidate(GUI* gui) {
+    memset(gui->dirty, 1, sizeof(gui->dirty));
+    gui->panel_dirty = 1;
+}
+
+static uint64_t pow2_at_least(uint64_t n) {
+    uint64_t cap = 64;
+    while (cap < n) cap <<= 1;
+    return cap;
+}
+
+static int scrollback_init(GuiScrollback* h, uint64_t lines) {
+    memset(h, 0, sizeof(*h));
+    uint64_t nlines = pow2_at_least(lines);
+    uint64_t ntext = pow2_at_least(lines * GUI_SCROLLBACK_TEXT);
+    h->start = (uint64_t*)calloc(nlines, sizeof(uint64_t));
+    h->text = (char*)malloc(ntext);
+    if (!h->start || !h->text) {
+        free(h->start);
+        free(h->text);
+        return -1;
+    }
+    h->line_mask = nlines - 1;
+    h->text_mask = ntext - 1;
+    return 0;
+}
+
+static void scrollback_free(GuiScrollback* h) {
+    free(h->start);
+    free(h->text);
+}
+
+static uint64_t scrollback_len(const GuiScrollback* h, uint64_t line) {
+    uint64_t end = line == h->last ? h->text_head : h->start[(line + 1) & h->line_mask];
+    return end - h->start[line & h->line_mask];
+}
+
+static void scrollback_newline(GuiScrollback* h) {
+    h->last++;
+    if (h->last - h->first > h->line_mask) h->first++;
+    h->start[h->last & h->line_mask] = h->text_head;
+}
+
+/* Append to the current line, up to OUTPUT_COLS characters */
+static int scrollback_putc(GuiScrollback* h, char c) {
+    if (scrollback_len(h, h->last) >= OUTPUT_COLS) return 0;
+    while (h->first < h->last && h->text_head - h->start[h->first & h->line_mask] > h->text_mask) {
+        h->first++;
+    }
+    h->text[h->text_head & h->text_mask] = c;
+    h->text_head++;
+    return 1;
+}
+
+/* Copy up to size characters of a line into out */
+static size_t scrollback_get(const GuiScrollback* h, uint64_t line, char* out, size_t size) {
+    uint64_t len = scrollback_len(h, line);
+    uint64_t pos = h->start[line & h->line_mask];
+    if (len > size) len = size;
+    for (uint64_t i = 0; i < len; i++) out[i] = h->text[(pos + i) & h->text_mask];
+    return (size_t)len;
+}
+
+int gui_init(GUI* gui, uint64_t scrollback) {
     memset(gui, 0, sizeof(GUI));
-    memset(gui->output, ' ', sizeof(gui->output));
     gui->running = 1;
-    gui->speed = 100;  /* 100 cycles per frame */
+    if (scrollback_init(&gui->history, scrollback) != 0) return -1;
+    if (ring_init(&gui->out, GUI_OUTPUT_RING) != 0 ||
+        ring_init(&gui->snapshots, GUI_SNAPSHOTS * sizeof(GuiSnapshot)) != 0) {
+        ring_free(&gui->out);
+        scrollback_free(&gui->history);
+        return -1;
+    }
+    return 0;
 }
 
+void gui_close(GUI* gui);
+
 int gui_create_window(GUI* gui) {
     if (SDL_Init(SDL_INIT_VIDEO) < 0) {
         fprintf(stderr, "SDL_Init Error: %s\n", SDL_GetError());
@@ -85,91 +276,438 @@ int gui_create_window(GUI* gui) {
         return -1;
     }
     
+    gui->font_texture = gui_create_font(gui->renderer);
+    gui->screen = SDL_CreateTexture(gui->renderer, SDL_PIXELFORMAT_RGBA8888,
+                                    SDL_TEXTUREACCESS_TARGET, WINDOW_WIDTH, WINDOW_HEIGHT);
+    gui->heat_texture = SDL_CreateTexture(gui->renderer, SDL_PIXELFORMAT_RGBA8888,
+                                          SDL_TEXTUREACCESS_STREAMING, HUD_HEAT, HUD_HEAT);
+    if (!gui->font_texture || !gui->screen || !gui->heat_texture) {
+        fprintf(stderr, "SDL_CreateTexture Error: %s\n", SDL_GetError());
+        gui_close(gui);
+        return -1;
+    }
+    
+    /* First frame draws everything */
+    SDL_SetRenderTarget(gui->renderer, gui->screen);
     SDL_SetRenderDrawColor(gui->renderer, 0, 0, 0, 255);
+    SDL_RenderClear(gui->renderer);
+    SDL_SetRenderTarget(gui->renderer, NULL);
+    gui_invalidate(gui);
+    
+    SDL_DisplayMode mode;
+    int refresh = SDL_GetWindowDisplayMode(gui->window, &mode) == 0 && mode.refresh_rate > 0
+                  ? mode.refresh_rate : GUI_REFRESH;
+    gui->frame_us = 1000000u / (uint32_t)refresh;
     
     return 0;
 }
 
 void gui_close(GUI* gui) {
+    if (gui->heat_texture) SDL_DestroyTexture(gui->heat_texture);
+    if (gui->screen) SDL_DestroyTexture(gui->screen);
+    if (gui->font_texture) SDL_DestroyTexture(gui->font_texture);
     if (gui->renderer) SDL_DestroyRenderer(gui->renderer);
     if (gui->window) SDL_DestroyWindow(gui->window);
     SDL_Quit();
 }
 
-void gui_output_char(GUI* gui, char c) {
-    if (c == '\n') {
-        gui->output_line++;
-        gui->output_col = 0;
-        if (gui->output_line >= OUTPUT_ROWS) {
-            /* Scroll up */
-            for (int i = 0; i < OUTPUT_ROWS - 1; i++) {
-                memcpy(gui->output[i], gui->output[i+1], OUTPUT_COLS);
+/* --- VM thread --- */
+
+/* Queue a byte, waiting while the render thread catches up */
+static void gui_vm_put(GUI* gui, uint8_t byte) {
+    while (!ring_put(&gui->out, byte)) {
+        if (__atomic_load_n(&gui->quit, __ATOMIC_ACQUIRE)) return;
+        SDL_Delay(1);
+    }
+}
+
+/* OUT hook: only bytes gui_output_char shows, leaving GUI_OUT_RESET free */
+static void gui_vm_output(void* ctx, uint8_t byte) {
+    if (byte == '\n' || (byte >= 32 && byte < 127)) gui_vm_put((GUI*)ctx, byte);
+}
+
+/* Publish the VM state; dropped if the render thread is that far behind */
+static void gui_publish(GUI* gui) {
+    GuiSnapshot s;
+    memset(&s, 0, sizeof(s));
+    memcpy(s.regs, gui->vm->regs, sizeof(s.regs));
+    s.cycles = gui->vm->cycle_count;
+    s.pc = gui->vm->pc;
+    s.sp = gui->vm->sp;
+    s.mips = gui->mips;
+    s.halted = (uint8_t)gui->vm->halted;
+    s.paused = (uint8_t)gui->paused;
+    s.turbo = (uint8_t)__atomic_load_n(&gui->turbo, __ATOMIC_RELAXED);
+    s.budget = (uint8_t)__atomic_load_n(&gui->budget, __ATOMIC_RELAXED);
+    if (ring_space(&gui->snapshots) >= sizeof(s)) ring_write(&gui->snapshots, &s, sizeof(s));
+}
+
+/* Runs batches of GUI_BATCH instructions. In budget mode the clock is
+ * checked after each batch, and once the frame's share is used up the
+ * thread sleeps until the next frame starts. Turbo mode never sleeps. */
+static void* gui_vm_thread(void* arg) {
+    GUI* gui = (GUI*)arg;
+    VM* vm = gui->vm;
+    uint64_t freq = SDL_GetPerformanceFrequency();
+    uint64_t frame = freq * gui->frame_us / 1000000;
+    uint64_t frame_start = SDL_GetPerformanceCounter();
+    uint64_t rate_start = frame_start, rate_cycles = vm->cycle_count;
+    uint32_t last_publish = 0, last_epoch = 0;
+    gui_publish(gui);
+    
+    while (!__atomic_load_n(&gui->quit, __ATOMIC_ACQUIRE)) {
+        uint32_t cmd = __atomic_exchange_n(&gui->commands, 0, __ATOMIC_ACQ_REL);
+        int changed = cmd != 0;
+        if (cmd & GUI_CMD_RESET) {
+            vm_reset(vm);
+            memcpy(vm->ram, gui->image, VM_RAM_SIZE);
+            gui_vm_put(gui, GUI_OUT_RESET);
+            gui->paused = 0;
+        }
+        if (cmd & GUI_CMD_PAUSE) gui->paused = !gui->paused;
+        /* Profiling costs a little per instruction, so only while shown */
+        VMProfile* profile = __atomic_load_n(&gui->hud, __ATOMIC_RELAXED) ? gui->profile : NULL;
+        if ((cmd & GUI_CMD_STEP) && gui->paused && !vm->halted) {
+            if (profile) vm_execute_profiled(vm, profile);
+            else vm_execute_one(vm);
+        }
+        
+        uint64_t now = SDL_GetPerformanceCounter();
+        if (gui->paused || vm->halted) {
+            gui->mips = 0;
+            rate_start = frame_start = now;
+            rate_cycles = vm->cycle_count;
+            if (changed) gui_publish(gui);
+            SDL_Delay(GUI_IDLE_MS);
+            continue;
+        }
+        
+        if (!__atomic_load_n(&gui->turbo, __ATOMIC_RELAXED)) {
+            uint64_t budget = frame *
+                              (uint64_t)__atomic_load_n(&gui->budget, __ATOMIC_RELAXED) / 100;
+            if (now - frame_start >= frame) {
+                /* Next frame; after a long stall start afresh */
+                frame_start = now - frame_start >= 2 * frame ? now : frame_start + frame;
+            } else if (now - frame_start >= budget) {
+                uint32_t ms = (uint32_t)((frame - (now - frame_start)) * 1000 / freq);
+                SDL_Delay(ms ? ms : 1);
+                continue;
             }
-            memset(gui->output[OUTPUT_ROWS-1], ' ', OUTPUT_COLS);
-            gui->output_line = OUTPUT_ROWS - 1;
         }
-    } else if (c >= 32 && c < 127) {
-        if (gui->output_col < OUTPUT_COLS) {
-            gui->output[gui->output_line][gui->output_col++] = c;
+        
+        if (profile) {
+            for (int i = 0; i < GUI_BATCH && !vm->halted; i++) vm_execute_profiled(vm, profile);
+        } else {
+            for (int i = 0; i < GUI_BATCH && !vm->halted; i++) vm_execute_one(vm);
+        }
+        
+        now = SDL_GetPerformanceCounter();
+        if (vm->cycle_count < rate_cycles) rate_cycles = 0;      /* Reset */
+        if ((now - rate_start) * 1000 >= freq * GUI_RATE_MS) {
+            gui->mips = (double)(vm->cycle_count - rate_cycles) * (double)freq /
+                        (double)(now - rate_start) / 1e6;
+            rate_start = now;
+            rate_cycles = vm->cycle_count;
+        }
+        uint32_t ticks = SDL_GetTicks();
+        if (profile && ticks - last_epoch >= GUI_HEAT_EPOCH_MS) {
+            __atomic_store_n(&profile->epoch, profile->epoch + 1, __ATOMIC_RELAXED);
+            last_epoch = ticks;
+        }
+        if (changed || vm->halted || ticks - last_publish >= GUI_SNAPSHOT_MS) {
+            gui_publish(gui);
+            last_publish = ticks;
         }
     }
+    __atomic_store_n(&gui->vm_done, 1, __ATOMIC_RELEASE);
+    return NULL;
 }
 
-void gui_render(GUI* gui, VM* vm) {
-    SDL_SetRenderDrawColor(gui->renderer, 0, 0, 0, 255);
-    SDL_RenderClear(gui->renderer);
-    
-    SDL_Color text_color = {0, 255, 0};  /* Green on black */
-    SDL_Color bg_color = {0, 0, 0};
+static void gui_command(GUI* gui, uint32_t cmd) {
+    __atomic_fetch_or(&gui->commands, cmd, __ATOMIC_ACQ_REL);
+}
+
+/* --- Render thread --- */
+
+/* Scrolling stops when the oldest line reaches the top row */
+static uint64_t gui_scroll_max(const GUI* gui) {
+    uint64_t lines = gui->history.last - gui->history.first;
+    return lines > OUTPUT_ROWS - 1 ? lines - (OUTPUT_ROWS - 1) : 0;
+}
+
+void gui_output_char(GUI* gui, char c) {
+    GuiScrollback* h = &gui->history;
+    if (c == '\n') {
+        scrollback_newline(h);
+        /* A scrolled-back view stays on the same lines */
+        if (gui->scroll && gui->scroll < gui_scroll_max(gui)) gui->scroll++;
+    } else if (c >= 32 && c < 127) {
+        scrollback_putc(h, c);
+    }
+}
+
+static void gui_clear_output(GUI* gui) {
+    scrollback_newline(&gui->history);
+    gui->history.first = gui->history.last;
+    gui->scroll = 0;
+}
+
+static void gui_scroll(GUI* gui, int64_t lines) {
+    uint64_t max = gui_scroll_max(gui);
+    if (gui->scroll > max) gui->scroll = max;
+    if (lines < 0) {
+        uint64_t down = (uint64_t)-lines;
+        gui->scroll = down > gui->scroll ? 0 : gui->scroll - down;
+    } else {
+        uint64_t up = (uint64_t)lines;
+        gui->scroll = up > max - gui->scroll ? max : gui->scroll + up;
+    }
+}
+
+/* Take the newest snapshot and all queued output. Output from before the
+ * latest reset is skipped, so the screen starts empty again. */
+static void gui_drain(GUI* gui) {
+    GuiSnapshot s;
+    while (ring_read(&gui->snapshots, &s, sizeof(s)) == sizeof(s)) gui->state = s;
     
-    /* Render output */
-    int y_offset = 10;
-    for (int row = 0; row < OUTPUT_ROWS; row++) {
-        for (int col = 0; col < OUTPUT_COLS && col < 100; col++) {
-            char c = gui->output[row][col];
-            if (c != ' ') {
-                int x = 10 + col * CHAR_WIDTH;
-                int y = y_offset + row * CHAR_HEIGHT;
-                render_char(gui, c, x, y, text_color);
-            }
+    const uint8_t *p1, *p2;
+    size_t n1, n2;
+    size_t used = ring_peek(&gui->out, &p1, &n1, &p2, &n2);
+    size_t from = 0;
+    for (size_t i = used; i > 0; i--) {
+        if ((i <= n1 ? p1[i - 1] : p2[i - 1 - n1]) == GUI_OUT_RESET) {
+            gui_clear_output(gui);
+            from = i;
+            break;
         }
     }
+    for (size_t i = from; i < used; i++) {
+        gui_output_char(gui, (char)(i < n1 ? p1[i] : p2[i - n1]));
+    }
+    ring_consume(&gui->out, used);
+}
+
+/* Status line and register boxes, redrawn when the snapshot changes */
+static void gui_render_panel(GUI* gui) {
+    const GuiSnapshot* vm = &gui->state;
+    GuiSnapshot* old = &gui->drawn;
+    SDL_Color status_color = {200, 200, 200, 255};
+    SDL_Color reg_color = {100, 150, 200, 255};
+    char text[128];
+    int full = gui->panel_dirty;
     
-    /* Render register state */
-    int reg_y = y_offset + OUTPUT_ROWS * CHAR_HEIGHT + 20;
-    SDL_Color reg_color = {200, 200, 200};
-    
-    /* Draw register info (text-based) */
-    char reg_str[512];
-    snprintf(reg_str, sizeof(reg_str),
-            "PC: 0x%04X | SP: 0x%04X | Cycles: %llu | %s",
-            vm->pc, vm->sp, vm->cycle_count,
-            vm->halted ? "HALTED" : "RUNNING");
-    
-    /* Simple text rendering by displaying register values */
-    SDL_Rect status_rect = {10, reg_y, WINDOW_WIDTH - 20, 30};
-    SDL_SetRenderDrawColor(gui->renderer, 50, 50, 50, 255);
-    SDL_RenderFillRect(gui->renderer, &status_rect);
+    if (full || vm->pc != old->pc || vm->sp != old->sp || vm->cycles != old->cycles ||
+        vm->halted != old->halted || vm->paused != old->paused || vm->mips != old->mips ||
+        vm->turbo != old->turbo || vm->budget != old->budget ||
+        gui->scroll != gui->drawn_scroll) {
+        SDL_Rect status_rect = {10, STATUS_Y, WINDOW_WIDTH - 20, 30};
+        SDL_SetRenderDrawColor(gui->renderer, 50, 50, 50, 255);
+        SDL_RenderFillRect(gui->renderer, &status_rect);
+        char mode[16];
+        if (vm->turbo) snprintf(mode, sizeof(mode), "TURBO");
+        else snprintf(mode, sizeof(mode), "BUDGET %u%%", vm->budget);
+        int len = snprintf(text, sizeof(text),
+                           "PC: 0x%04X | SP: 0x%04X | Cycles: %llu | %s | %.1f MIPS | %s",
+                           vm->pc, vm->sp, (unsigned long long)vm->cycles,
+                           vm->halted ? "HALTED" : vm->paused ? "PAUSED" : "RUNNING",
+                           vm->mips, mode);
+        if (gui->scroll && len < (int)sizeof(text)) {
+            len += snprintf(text + len, sizeof(text) - (size_t)len, " | Scrolled back %llu",
+                            (unsigned long long)gui->scroll);
+            if (len >= (int)sizeof(text)) len = (int)sizeof(text) - 1;
+        }
+        gui_draw_text(gui, 18, STATUS_Y + 7, text, (size_t)len, status_color);
+        gui->drawn_scroll = gui->scroll;
+    }
     
-    /* Render registers */
-    int reg_y_base = reg_y + 40;
     for (int i = 0; i < VM_REG_COUNT; i++) {
-        snprintf(reg_str, sizeof(reg_str), "R%d: 0x%016llX", i, vm->regs[i]);
+        if (!full && vm->regs[i] == old->regs[i]) continue;
         /* Each register gets a small area */
         int reg_x = 10 + (i % 4) * (WINDOW_WIDTH / 4);
-        int reg_y_val = reg_y_base + (i / 4) * 30;
-        
-        SDL_Rect reg_rect = {reg_x, reg_y_val, WINDOW_WIDTH/4 - 5, 25};
+        int reg_y = REGS_Y + (i / 4) * 30;
+        SDL_Rect reg_rect = {reg_x, reg_y, WINDOW_WIDTH/4 - 5, 25};
         SDL_SetRenderDrawColor(gui->renderer, 30, 30, 50, 255);
         SDL_RenderFillRect(gui->renderer, &reg_rect);
-        SDL_SetRenderDrawColor(gui->renderer, 100, 150, 200, 255);
+        SDL_SetRenderDrawColor(gui->renderer, reg_color.r, reg_color.g, reg_color.b, 255);
         SDL_RenderDrawRect(gui->renderer, &reg_rect);
+        int len = snprintf(text, sizeof(text), "R%d: 0x%016llX", i,
+                           (unsigned long long)vm->regs[i]);
+        gui_draw_text(gui, reg_x + 8, reg_y + 4, text, (size_t)len, reg_color);
+    }
+    *old = *vm;
+    gui->panel_dirty = 0;
+}
+
+/* Brightness of an access made at stamp: full when new, dim when old */
+static uint32_t gui_heat_level(uint32_t epoch, uint32_t stamp) {
+    if (!stamp) return 0;
+    uint32_t age = epoch - stamp;
+    return age >= GUI_HEAT_FADE ? 40 : 255 - age * (255 - 40) / GUI_HEAT_FADE;
+}
+
+/* Recolour the next band of the heatmap: red writes, green executes, blue
+ * reads. A full pass takes HUD_HEAT / GUI_HEAT_BAND frames. */
+static void gui_update_heat(GUI* gui) {
+    static uint32_t pixels[GUI_HEAT_BAND * HUD_HEAT];
+    const VMProfile* p = gui->profile;
+    uint32_t epoch = __atomic_load_n(&p->epoch, __ATOMIC_RELAXED);
+    uint32_t base = gui->heat_row * HUD_HEAT;
+    for (uint32_t i = 0; i < GUI_HEAT_BAND * HUD_HEAT; i++) {
+        uint32_t a = base + i;
+        uint32_t w = gui_heat_level(epoch, __atomic_load_n(&p->write[a], __ATOMIC_RELAXED));
+        uint32_t x = gui_heat_level(epoch, __atomic_load_n(&p->exec[a], __ATOMIC_RELAXED));
+        uint32_t r = gui_heat_level(epoch, __atomic_load_n(&p->read[a], __ATOMIC_RELAXED));
+        pixels[i] = (w << 24) | (x << 16) | (r << 8) | 0xFF;
+    }
+    SDL_Rect band = {0, (int)gui->heat_row, HUD_HEAT, GUI_HEAT_BAND};
+    SDL_UpdateTexture(gui->heat_texture, &band, pixels, HUD_HEAT * (int)sizeof(uint32_t));
+    gui->heat_row = (gui->heat_row + GUI_HEAT_BAND) % HUD_HEAT;
+}
+
+/* Every GUI_RATE_MS: record MIPS, and rank opcodes and access rates by
+ * what happened since the previous sample */
+static void gui_sample(GUI* gui) {
+    uint32_t now = SDL_GetTicks();
+    uint32_t elapsed = now - gui->last_sample;
+    if (elapsed < GUI_RATE_MS) return;
+    gui->last_sample = now;
+    gui->mips_history[gui->samples++ % GUI_HUD_SAMPLES] = gui->state.mips;
+    
+    const VMProfile* p = gui->profile;
+    memset(gui->top_count, 0, sizeof(gui->top_count));
+    gui->op_total = 0;
+    for (int op = 0; op < 256; op++) {
+        uint64_t count = __atomic_load_n(&p->opcodes[op], __ATOMIC_RELAXED);
+        uint64_t delta = count - gui->op_seen[op];
+        gui->op_seen[op] = count;
+        gui->op_total += delta;
+        int k = GUI_HUD_OPCODES;
+        while (k > 0 && delta > gui->top_count[k - 1]) {
+            if (k < GUI_HUD_OPCODES) {
+                gui->top_op[k] = gui->top_op[k - 1];
+                gui->top_count[k] = gui->top_count[k - 1];
+            }
+            k--;
+        }
+        if (k < GUI_HUD_OPCODES) {
+            gui->top_op[k] = (uint8_t)op;
+            gui->top_count[k] = delta;
+        }
+    }
+    uint64_t reads = __atomic_load_n(&p->reads, __ATOMIC_RELAXED);
+    uint64_t writes = __atomic_load_n(&p->writes, __ATOMIC_RELAXED);
+    gui->read_rate = (double)(reads - gui->reads_seen) * 1000.0 / elapsed;
+    gui->write_rate = (double)(writes - gui->writes_seen) * 1000.0 / elapsed;
+    gui->reads_seen = reads;
+    gui->writes_seen = writes;
+}
+
+/* Overlay over the right of the output: RAM heatmap, MIPS graph and the
+ * opcode histogram. Drawn over the cached screen each frame, never into it. */
+static void gui_render_hud(GUI* gui) {
+    SDL_Color label = {200, 200, 200, 255};
+    SDL_Color write = {255, 80, 80, 255}, exec = {80, 255, 80, 255}, read = {80, 140, 255, 255};
+    char text[64];
+    int bands = gui->turbo ? HUD_HEAT / GUI_HEAT_BAND : 1;
+    for (int i = 0; i < bands; i++) gui_update_heat(gui);
+    
+    SDL_Rect panel = {HUD_X, OUTPUT_Y, HUD_WIDTH, OUTPUT_ROWS * CHAR_HEIGHT};
+    SDL_SetRenderDrawColor(gui->renderer, 20, 20, 30, 255);
+    SDL_RenderFillRect(gui->renderer, &panel);
+    SDL_SetRenderDrawColor(gui->renderer, 100, 150, 200, 255);
+    SDL_RenderDrawRect(gui->renderer, &panel);
+    int x = HUD_X + 8, y = OUTPUT_Y + 4;
+    
+    gui_draw_text(gui, x, y, "RAM", 3, label);
+    gui_draw_text(gui, x + 5 * CHAR_WIDTH, y, "exec", 4, exec);
+    gui_draw_text(gui, x + 10 * CHAR_WIDTH, y, "read", 4, read);
+    gui_draw_text(gui, x + 15 * CHAR_WIDTH, y, "write", 5, write);
+    y += CHAR_HEIGHT + 2;
+    SDL_Rect heat = {x, y, HUD_HEAT, HUD_HEAT};
+    SDL_RenderCopy(gui->renderer, gui->heat_texture, NULL, &heat);
+    y += HUD_HEAT + 4;
+    int len = snprintf(text, sizeof(text), "rd %.1fM/s  wr %.1fM/s",
+                       gui->read_rate / 1e6, gui->write_rate / 1e6);
+    gui_draw_text(gui, x, y, text, (size_t)len, label);
+    y += CHAR_HEIGHT;
+    
+    /* MIPS history, oldest on the left, scaled to the peak */
+    uint32_t n = gui->samples < GUI_HUD_SAMPLES ? gui->samples : GUI_HUD_SAMPLES;
+    double peak = 0;
+    for (uint32_t i = 0; i < n; i++) {
+        if (gui->mips_history[i] > peak) peak = gui->mips_history[i];
+    }
+    len = snprintf(text, sizeof(text), "MIPS %.1f  peak %.1f", gui->state.mips, peak);
+    gui_draw_text(gui, x, y, text, (size_t)len, label);
+    y += CHAR_HEIGHT;
+    SDL_Rect graph = {x, y, HUD_HEAT, HUD_GRAPH};
+    SDL_SetRenderDrawColor(gui->renderer, 35, 35, 50, 255);
+    SDL_RenderFillRect(gui->renderer, &graph);
+    if (n > 1 && peak > 0) {
+        SDL_Point points[GUI_HUD_SAMPLES];
+        for (uint32_t i = 0; i < n; i++) {
+            double v = gui->mips_history[(gui->samples - n + i) % GUI_HUD_SAMPLES];
+            points[i].x = x + (int)(i * (HUD_HEAT - 1) / (GUI_HUD_SAMPLES - 1));
+            points[i].y = y + HUD_GRAPH - 1 - (int)(v / peak * (HUD_GRAPH - 1));
+        }
+        SDL_SetRenderDrawColor(gui->renderer, 0, 255, 0, 255);
+        SDL_RenderDrawLines(gui->renderer, points, (int)n);
+    }
+    y += HUD_GRAPH + 4;
+    
+    /* Opcode mix since the last sample */
+    for (int k = 0; k < GUI_HUD_OPCODES && gui->top_count[k]; k++) {
+        const char* name = vm_mnemonic(gui->top_op[k]);
+        double share = (double)gui->top_count[k] / (double)gui->op_total;
+        len = snprintf(text, sizeof(text), "%-6s %5.1f%%", name ? name : "?", share * 100.0);
+        gui_draw_text(gui, x, y, text, (size_t)len, label);
+        SDL_Rect bar = {x + 14 * CHAR_WIDTH, y + 3,
+                        (int)(share * (HUD_HEAT - 14 * CHAR_WIDTH)), CHAR_HEIGHT - 6};
+        SDL_SetRenderDrawColor(gui->renderer, 100, 150, 200, 255);
+        SDL_RenderFillRect(gui->renderer, &bar);
+        y += CHAR_HEIGHT;
+    }
+}
+
+/* Redraw what changed into the cached screen texture, then show it */
+void gui_render(GUI* gui) {
+    SDL_Color text_color = {0, 255, 0, 255};  /* Green on black */
+    
+    /* Only the visible lines are looked at. A row is redrawn when it shows
+     * another line, or its line grew. */
+    const GuiScrollback* h = &gui->history;
+    uint64_t bottom = h->last - gui->scroll;
+    SDL_SetRenderTarget(gui->renderer, gui->screen);
+    for (int row = 0; row < OUTPUT_ROWS; row++) {
+        uint64_t line = bottom - (uint64_t)(OUTPUT_ROWS - 1 - row);
+        int visible = bottom >= (uint64_t)(OUTPUT_ROWS - 1 - row) && line >= h->first;
+        uint64_t id = visible ? line : UINT64_MAX;
+        uint32_t len = visible ? (uint32_t)scrollback_len(h, line) : 0;
+        if (!gui->dirty[row] && gui->row_line[row] == id && gui->row_len[row] == len) continue;
+        
+        int y = OUTPUT_Y + row * CHAR_HEIGHT;
+        SDL_Rect rect = {OUTPUT_X, y, OUTPUT_VISIBLE_COLS * CHAR_WIDTH, CHAR_HEIGHT};
+        SDL_SetRenderDrawColor(gui->renderer, 0, 0, 0, 255);
+        SDL_RenderFillRect(gui->renderer, &rect);
+        if (visible) {
+            char text[OUTPUT_COLS];
+            size_t n = scrollback_get(h, line, text, OUTPUT_VISIBLE_COLS);
+            gui_draw_text(gui, OUTPUT_X, y, text, n, text_color);
+        }
+        gui->row_line[row] = id;
+        gui->row_len[row] = len;
+        gui->dirty[row] = 0;
     }
+    gui_render_panel(gui);
+    SDL_SetRenderTarget(gui->renderer, NULL);
     
+    SDL_RenderCopy(gui->renderer, gui->screen, NULL, NULL);
+    gui_sample(gui);
+    if (gui->hud) gui_render_hud(gui);
     SDL_RenderPresent(gui->renderer);
 }
 
-void gui_handle_events(GUI* gui, VM* vm) {
+void gui_handle_events(GUI* gui) {
     SDL_Event event;
     
     while (SDL_PollEvent(&event)) {
@@ -178,33 +716,61 @@ void gui_handle_events(GUI* gui, VM* vm) {
                 gui->running = 0;
                 break;
             
+            case SDL_MOUSEWHEEL:
+                gui_scroll(gui, (int64_t)event.wheel.y * GUI_WHEEL_LINES);
+                break;
+            
+            case SDL_RENDER_TARGETS_RESET:
+            case SDL_RENDER_DEVICE_RESET:
+                /* The cached screen was lost */
+                gui_invalidate(gui);
+                break;
+            
             case SDL_KEYDOWN:
                 switch (event.key.keysym.sym) {
                     case SDLK_SPACE:
-                        gui->paused = !gui->paused;
+                        gui_command(gui, GUI_CMD_PAUSE);
                         break;
                     case SDLK_s:
-                        if (gui->paused) {
-                            vm_execute_one(vm);
-                        }
+                        gui_command(gui, GUI_CMD_STEP);
                         break;
                     case SDLK_r:
-                        vm_reset(vm);
-                        memset(gui->output, ' ', sizeof(gui->output));
-                        gui->output_line = 0;
-                        gui->output_col = 0;
-                        gui->paused = 0;
+                        gui_command(gui, GUI_CMD_RESET);
+                        break;
+                    case SDLK_h:
+                        __atomic_store_n(&gui->hud, !gui->hud, __ATOMIC_RELAXED);
                         break;
+                    case SDLK_t:
+                        __atomic_store_n(&gui->turbo, !gui->turbo, __ATOMIC_RELAXED);
+                        break;
+                    case SDLK_EQUALS:
+                    case SDLK_MINUS: {
+                        int step = event.key.keysym.sym == SDLK_MINUS ? -10 : 10;
+                        int budget = gui->budget + step;
+                        budget = budget < 10 ? 10 : budget > 100 ? 100 : budget;
+                        __atomic_store_n(&gui->budget, budget, __ATOMIC_RELAXED);
+                        break;
+                    }
                     case SDLK_ESCAPE:
                         gui->running = 0;
                         break;
                     case SDLK_UP:
-                        gui->speed = (gui->speed < 1000) ? gui->speed + 100 : 1000;
-                        printf("Speed: %d cycles/frame\n", gui->speed);
+                        gui_scroll(gui, 1);
                         break;
                     case SDLK_DOWN:
-                        gui->speed = (gui->speed > 1) ? gui->speed - 100 : 1;
-                        printf("Speed: %d cycles/frame\n", gui->speed);
+                        gui_scroll(gui, -1);
+                        break;
+                    case SDLK_PAGEUP:
+                        gui_scroll(gui, OUTPUT_ROWS - 1);
+                        break;
+                    case SDLK_PAGEDOWN:
+                        gui_scroll(gui, -(OUTPUT_ROWS - 1));
+                        break;
+                    case SDLK_HOME:
+                        gui_scroll(gui, INT64_MAX);
+                        break;
+                    case SDLK_END:
+                        gui->scroll = 0;
                         break;
                     default:
                         break;
@@ -215,25 +781,62 @@ void gui_handle_events(GUI* gui, VM* vm) {
 }
 
 int main(int argc, char* argv[]) {
+    const char* image_path = NULL;
+    uint64_t scrollback = GUI_SCROLLBACK;
+    int turbo = 0, budget = GUI_BUDGET, hud = 0;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--scrollback") == 0 && i + 1 < argc) {
+            scrollback = strtoull(argv[++i], NULL, 0);
+            if (scrollback < OUTPUT_ROWS) scrollback = OUTPUT_ROWS;
+        } else if (strcmp(argv[i], "--turbo") == 0) {
+            turbo = 1;
+        } else if (strcmp(argv[i], "--hud") == 0) {
+            hud = 1;
+        } else if (strcmp(argv[i], "--budget") == 0 && i + 1 < argc) {
+            budget = atoi(argv[++i]);
+            budget = budget < 10 ? 10 : budget > 100 ? 100 : budget;
+        } else if (argv[i][0] == '-') {
+            fprintf(stderr, "Usage: %s [--scrollback <lines>] [--turbo] [--budget <pct>] "
+                    "[--hud] [image.bin]\n", argv[0]);
+            return EXIT_FAILURE;
+        } else {
+            image_path = argv[i];
+        }
+    }
+    
     GUI gui;
-    gui_init(&gui);
+    if (gui_init(&gui, scrollback) != 0) {
+        fprintf(stderr, "Failed to allocate GUI buffers\n");
+        return EXIT_FAILURE;
+    }
     
     VM* vm = vm_create();
-    if (!vm) {
+    uint8_t* image = (uint8_t*)malloc(VM_RAM_SIZE);
+    VMProfile* profile = (VMProfile*)calloc(1, sizeof(VMProfile));
+    if (!vm || !image || !profile) {
         fprintf(stderr, "Failed to create VM\n");
         return EXIT_FAILURE;
     }
     
     /* Load image */
-    if (argc > 1) {
-        if (vm_load_image(vm, argv[1]) != 0) {
-            fprintf(stderr, "Failed to load image: %s\n", argv[1]);
+    if (image_path) {
+        if (vm_load_image(vm, image_path) != 0) {
+            fprintf(stderr, "Failed to load image: %s\n", image_path);
             vm_destroy(vm);
             return EXIT_FAILURE;
         }
     } else {
         vm_load_builtin_image(vm);
     }
+    memcpy(image, vm->ram, VM_RAM_SIZE);
+    gui.vm = vm;
+    gui.image = image;
+    gui.turbo = turbo;
+    gui.budget = budget;
+    gui.hud = hud;
+    gui.profile = profile;
+    profile->epoch = 1;                    /* Stamp 0 is never accessed */
+    vm_set_output(vm, gui_vm_output, &gui);
     
     /* Create GUI window */
     if (gui_create_window(&gui) != 0) {
@@ -247,40 +850,54 @@ int main(int argc, char* argv[]) {
     printf("  SPACE - Pause/Resume\n");
     printf("  S     - Step (when paused)\n");
     printf("  R     - Reset\n");
-    printf("  UP    - Increase speed\n");
-    printf("  DOWN  - Decrease speed\n");
+    printf("  T     - Turbo (full speed, redraw every %d ms) / frame budget\n",
+           GUI_TURBO_RENDER_MS);
+    printf("  - / = - Frame budget -/+ 10%%\n");
+    printf("  H     - Performance HUD (RAM heatmap, MIPS, opcodes)\n");
+    printf("  UP/DOWN, PGUP/PGDN, HOME/END, wheel - Scroll output\n");
     printf("  ESC   - Quit\n\n");
     
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, gui_vm_thread, &gui) != 0) {
+        fprintf(stderr, "Failed to start VM thread\n");
+        gui_close(&gui);
+        vm_destroy(vm);
+        return EXIT_FAILURE;
+    }
+    
+    uint32_t last_render = 0;
     while (gui.running) {
-        gui_handle_events(&gui, vm);
-        
-        /* Execute cycles */
-        if (!gui.paused && !vm->halted) {
-            for (int i = 0; i < gui.speed && !vm->halted; i++) {
-                uint8_t opcode = vm->ram[vm->pc];
-                
-                /* Capture output in GUI */
-                if (opcode == OP_OUT) {
-                    vm->pc++;
-                    uint8_t reg = vm->ram[vm->pc];
-                    if (reg < VM_REG_COUNT) {
-                        gui_output_char(&gui, (char)(vm->regs[reg] & 0xFF));
-                    }
-                    vm->pc++;
-                    vm->cycle_count++;
-                } else {
-                    vm_execute_one(vm);
-                }
-            }
+        gui_handle_events(&gui);
+        gui_drain(&gui);
+        if (gui.turbo && SDL_GetTicks() - last_render < GUI_TURBO_RENDER_MS) {
+            SDL_Delay(GUI_IDLE_MS);
+            continue;
         }
-        
-        gui_render(&gui, vm);
+        gui_render(&gui);
+        last_render = SDL_GetTicks();
     }
     
+    /* A thread blocked on IN cannot be joined; exiting ends it */
+    __atomic_store_n(&gui.quit, 1, __ATOMIC_RELEASE);
+    int done = 0;
+    for (int ms = 0; ms < GUI_QUIT_WAIT_MS && !done; ms++) {
+        done = __atomic_load_n(&gui.vm_done, __ATOMIC_ACQUIRE);
+        if (!done) SDL_Delay(1);
+    }
+    if (done) pthread_join(thread, NULL);
+    gui_drain(&gui);
     gui_close(&gui);
-    vm_destroy(vm);
     
-    printf("\nVM Halted. Final cycles: %llu\n", vm->cycle_count);
+    uint64_t cycles = done ? vm->cycle_count : gui.state.cycles;
+    printf("\nVM Halted. Final cycles: %llu\n", (unsigned long long)cycles);
     
+    if (done) {
+        vm_destroy(vm);
+        free(image);
+        free(profile);
+        ring_free(&gui.out);
+        ring_free(&gui.snapshots);
+        scrollback_free(&gui.history);
+    }
     return EXIT_SUCCESS;
 }
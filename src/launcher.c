@@ -1,8 +1,13 @@
+#define _GNU_SOURCE
+#include "vmd.h"
+#include <limits.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
+#include <sys/socket.h>
 #include <sys/types.h>
+#include <sys/un.h>
 #include <sys/wait.h>
 
 void print_menu(void) {
@@ -15,7 +20,7 @@ void print_menu(void) {
     printf("  1) 8-bit RISC VM          (./bin/emulator)\n");
     printf("  2) 8-bit RISC VM + GUI    (./bin/emulator-gui)\n");
     printf("  3) x86-64 VM with syscalls (./bin/vm64)\n");
-    printf("  4) Image Generator         (./bin/imggen)\n");
+    printf("  4) Assembler               (./bin/vmasm)\n");
     printf("\n");
     printf("Ubuntu QEMU:\n");
     printf("  5) Download Ubuntu ISO    (./download-ubuntu.sh)\n");
@@ -26,20 +31,131 @@ void print_menu(void) {
     printf("Enter choice [0-6]: ");
 }
 
+/* Hand a batch run to a running vmd instead of starting an emulator.
+ * Only plain runs qualify: "emulator <image>" or "vm64 [--max-insns n]
+ * [--timeout ms] <image> [addr]" with stdin not a terminal. Returns the
+ * exit status, or -1 to fall back to exec. */
+static int vmd_submit(int argc, char* argv[]) {
+    const char* isa = strcmp(argv[1], "vm64") == 0 ? "vm64" : "vm";
+    const char* image = NULL;
+    const char* addr = NULL;
+    char limits[96] = "";
+    size_t used = 0;
+    
+    if (isatty(STDIN_FILENO)) return -1;
+    for (int i = 2; i < argc; i++) {
+        if (isa[2] && (strcmp(argv[i], "--max-insns") == 0 ||
+                       strcmp(argv[i], "--timeout") == 0) && i + 1 < argc) {
+            used += (size_t)snprintf(limits + used, sizeof(limits) - used, " %s=%llu",
+                                     argv[i] + 2, strtoull(argv[i + 1], NULL, 0));
+            if (used >= sizeof(limits)) return -1;
+            i++;
+        } else if (argv[i][0] == '-') {
+            return -1;
+        } else if (!image) {
+            image = argv[i];
+        } else if (!addr && isa[2]) {
+            addr = argv[i];
+        } else {
+            return -1;
+        }
+    }
+    if (!image) return -1;
+    
+    char default_path[64];
+    char full[PATH_MAX];
+    const char* path = vmd_socket_path(default_path, sizeof(default_path));
+    if (!path || !realpath(image, full)) return -1;
+    
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) return -1;
+    struct sockaddr_un sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sun_family = AF_UNIX;
+    strncpy(sa.sun_path, path, sizeof(sa.sun_path) - 1);
+    if (connect(fd, (struct sockaddr*)&sa, sizeof(sa)) != 0) {
+        close(fd);
+        return -1;
+    }
+    
+    /* The daemon wants the input length up front, so slurp stdin */
+    size_t len = 0, cap = 4096;
+    char* input = (char*)malloc(cap);
+    ssize_t n;
+    while (input && (n = read(STDIN_FILENO, input + len, cap - len)) > 0) {
+        len += (size_t)n;
+        if (len == cap) {
+            char* grown = (char*)realloc(input, cap *= 2);
+            if (!grown) free(input);
+            input = grown;
+        }
+    }
+    if (!input) {
+        close(fd);
+        return -1;
+    }
+    
+    dprintf(fd, "RUN %s input=%zu%s%s%s image=%s\n", isa, len, limits,
+            addr ? " addr=" : "", addr ? addr : "", full);
+    for (size_t off = 0; off < len; off += (size_t)n) {
+        n = write(fd, input + off, len - off);
+        if (n <= 0) break;
+    }
+    free(input);
+    
+    /* Stream output, holding back enough to strip the trailer */
+    char buf[4096 + VMD_TRAILER_MAX + 1];
+    size_t held = 0;
+    while ((n = read(fd, buf + held, sizeof(buf) - 1 - held)) > 0) {
+        held += (size_t)n;
+        if (held > VMD_TRAILER_MAX) {
+            fwrite(buf, 1, held - VMD_TRAILER_MAX, stdout);
+            memmove(buf, buf + held - VMD_TRAILER_MAX, VMD_TRAILER_MAX);
+            held = VMD_TRAILER_MAX;
+        }
+    }
+    close(fd);
+    buf[held] = '\0';
+    
+    char* trailer = NULL;
+    for (char* p = buf; (p = memmem(p, held - (size_t)(p - buf), VMD_TRAILER,
+                                    strlen(VMD_TRAILER))) != NULL; p++) {
+        trailer = p;
+    }
+    if (!trailer) {
+        fwrite(buf, 1, held, stdout);
+        fprintf(stderr, "launcher: vmd closed the connection early\n");
+        return 1;
+    }
+    fwrite(buf, 1, (size_t)(trailer - buf), stdout);
+    fflush(stdout);
+    
+    char* status = strstr(trailer, "status=");
+    char* error = strstr(trailer, " error=");
+    if (error) fprintf(stderr, "vmd: %s", error + 7);
+    return status && strncmp(status + 7, "halted", 6) == 0 ? 0 : 1;
+}
+
 int main(int argc, char* argv[]) {
     char choice[10];
     const char* cwd = getcwd(NULL, 0);
     
     if (argc > 1) {
-        /* Direct mode - run specified emulator */
+        /* Direct mode - submit to vmd when it is up, else run specified emulator */
+        if (strcmp(argv[1], "vm64") == 0 || strcmp(argv[1], "emulator") == 0) {
+            int status = vmd_submit(argc, argv);
+            if (status >= 0) return status;
+        }
         if (strcmp(argv[1], "vm64") == 0) {
             execvp("./bin/vm64", &argv[1]);
         } else if (strcmp(argv[1], "emulator") == 0) {
             execvp("./bin/emulator", &argv[1]);
         } else if (strcmp(argv[1], "gui") == 0) {
             execvp("./bin/emulator-gui", &argv[1]);
-        } else if (strcmp(argv[1], "imggen") == 0) {
-            execvp("./bin/imggen", &argv[1]);
+        } else if (strcmp(argv[1], "vmasm") == 0) {
+            execvp("./bin/vmasm", &argv[1]);
+        } else if (strcmp(argv[1], "vmd") == 0) {
+            execvp("./bin/vmd", &argv[1]);
         } else if (strcmp(argv[1], "download-ubuntu") == 0) {
             execvp("bash", (char* const[]){ "bash", "./download-ubuntu.sh", NULL });
         } else if (strcmp(argv[1], "ubuntu") == 0) {
@@ -84,9 +200,9 @@ int main(int argc, char* argv[]) {
             }
             
             case '4': {
-                printf("\n=== Image Generator ===\n");
-                printf("Usage: imggen output.bin [hello|counter|fibonacci]\n");
-                printf("Example: ./bin/imggen images/hello.bin hello\n\n");
+                printf("\n=== Assembler ===\n");
+                printf("Usage: vmasm [-o out.bin] [-m out.map] [-O0] source.s\n");
+                printf("Example: ./bin/vmasm examples/hello.s -o images/hello.bin\n\n");
                 
                 char cmd[256];
                 printf("Enter command: ");
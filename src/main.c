@@ -21,6 +21,7 @@ void cmd_reset(VM* vm, const char* args);
 void cmd_debug(VM* vm, const char* args);
 void cmd_break(VM* vm, const char* args);
 void cmd_cont(VM* vm, const char* args);
+void cmd_disasm(VM* vm, const char* args);
 
 /* Command list */
 const Command commands[] = {
@@ -33,6 +34,7 @@ const Command commands[] = {
     {"debug", "Toggle debug mode: debug [on|off]", cmd_debug},
     {"break", "Add breakpoint: break <addr>", cmd_break},
     {"cont", "Continue from breakpoint", cmd_cont},
+    {"disasm", "Disassemble: disasm [addr] [count]", cmd_disasm},
     {"quit", "Exit the emulator", NULL},
     {NULL, NULL, NULL}
 };
@@ -123,6 +125,19 @@ void cmd_cont(VM* vm, const char* args) {
     vm_run(vm);
 }
 
+void cmd_disasm(VM* vm, const char* args) {
+    unsigned int addr = vm->pc;
+    int count = 10;
+    if (args && strlen(args) > 0) sscanf(args, "%x %d", &addr, &count);
+    
+    for (int i = 0; i < count && addr < VM_RAM_SIZE; i++) {
+        char text[64];
+        int len = vm_disasm(&vm->ram[addr], VM_RAM_SIZE - addr, text, sizeof(text));
+        printf("  0x%04X: %s\n", addr, text);
+        addr += len > 0 ? (unsigned int)len : 1;
+    }
+}
+
 void interactive_shell(VM* vm) {
     char line[256];
     
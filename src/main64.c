@@ -1,8 +1,19 @@
+#define _GNU_SOURCE
 #include "vm64.h"
+#include "vm64_perf.h"
+#include "vm64_ckpt.h"
+#include "vm64_forksrv.h"
+#include "vm64_sched.h"
+#include "vm64_share.h"
+#include "vm64_mmu.h"
+#include "vm64_console.h"
+#include "vm64_trace.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
+#include <signal.h>
+#include <sys/time.h>
 
 void print_help(void) {
     printf("\n=== VM64 x86-64 Linux Emulator ===\n\n");
@@ -10,13 +21,37 @@ void print_help(void) {
     printf("  help           - Show this help\n");
     printf("  load <file>    - Load binary at default address (0x400000)\n");
     printf("  load <file> <addr> - Load binary at specified address\n");
-    printf("  run            - Execute until halt\n");
+    printf("  run            - Execute until halt or breakpoint\n");
+    printf("  step [n]       - Execute n instructions (default 1)\n");
+    printf("  break <addr>   - Add breakpoint (hex)\n");
     printf("  dump           - Show VM state\n");
+    printf("  disasm [addr] [n] - Disassemble n instructions (default RIP, 10)\n");
     printf("  debug [on|off] - Toggle debug mode\n");
+    printf("  checkpoint <file> - Save state (incremental if file is ours)\n");
+    printf("  restore <file> - Restore state from a checkpoint\n");
     printf("  reset          - Reset VM\n");
     printf("  quit           - Exit\n\n");
 }
 
+/* Print count instructions from addr, read through the guest's view of
+ * memory so paged address spaces work too */
+static void disassemble(VM64* vm, uint64_t addr, int count) {
+    for (int i = 0; i < count; i++) {
+        uint8_t code[VM64_MAX_INSN_LEN];
+        size_t avail = 0;
+        while (avail < sizeof(code) &&
+               vm64_read_guest(vm, addr + avail, &code[avail], 1) == 0) {
+            avail++;
+        }
+        if (avail == 0) break;
+        
+        char text[80];
+        int len = vm64_disasm(code, avail, text, sizeof(text));
+        printf("  0x%llX: %s\n", (unsigned long long)addr, text);
+        addr += len > 0 ? (uint64_t)len : 1;
+    }
+}
+
 void interactive_loop(VM64* vm) {
     char line[512];
     
@@ -63,13 +98,35 @@ void interactive_loop(VM64* vm) {
                 }
                 if (vm64_load_image(vm, arg1, addr) != 0) {
                     printf("Failed to load %s\n", arg1);
+                } else {
+                    printf("Loaded %s at 0x%llX\n", arg1,
+                           (unsigned long long)addr);
                 }
             }
         } else if (strcmp(cmd, "run") == 0) {
             printf("Running...\n");
             vm64_run(vm);
+        } else if (strcmp(cmd, "step") == 0) {
+            uint64_t count = strlen(arg1) > 0 ? strtoull(arg1, NULL, 0) : 1;
+            for (uint64_t n = 0; n < count && !vm->halted; n++) {
+                vm64_execute_one(vm);
+            }
+            printf("RIP: 0x%llX%s\n", (unsigned long long)vm->rip,
+                   vm->halted ? " (halted)" : "");
+        } else if (strcmp(cmd, "break") == 0) {
+            if (strlen(arg1) == 0) {
+                printf("Usage: break <address>\n");
+            } else {
+                uint64_t addr = strtoull(arg1, NULL, 16);
+                vm64_add_breakpoint(vm, addr);
+                printf("Breakpoint added at 0x%llX\n", (unsigned long long)addr);
+            }
         } else if (strcmp(cmd, "dump") == 0) {
             vm64_dump_state(vm);
+        } else if (strcmp(cmd, "disasm") == 0) {
+            uint64_t addr = strlen(arg1) > 0 ? strtoull(arg1, NULL, 16) : vm->rip;
+            int count = strlen(arg2) > 0 ? atoi(arg2) : 10;
+            disassemble(vm, addr, count);
         } else if (strcmp(cmd, "debug") == 0) {
             if (strlen(arg1) > 0) {
                 if (strcmp(arg1, "on") == 0) {
@@ -82,6 +139,24 @@ void interactive_loop(VM64* vm) {
             } else {
                 printf("Debug is %s\n", vm->debug_mode ? "ON" : "OFF");
             }
+        } else if (strcmp(cmd, "checkpoint") == 0) {
+            if (strlen(arg1) == 0) {
+                printf("Usage: checkpoint <filename>\n");
+            } else {
+                long pages = vm64_checkpoint(vm, arg1);
+                if (pages < 0) {
+                    printf("Failed to checkpoint to %s\n", arg1);
+                } else {
+                    printf("Checkpoint %s: %ld page(s) written\n", arg1, pages);
+                }
+            }
+        } else if (strcmp(cmd, "restore") == 0) {
+            if (strlen(arg1) == 0) {
+                printf("Usage: restore <filename>\n");
+            } else if (vm64_restore(vm, arg1) == 0) {
+                printf("Restored %s at RIP 0x%llX\n", arg1,
+                       (unsigned long long)vm->rip);
+            }
         } else if (strcmp(cmd, "reset") == 0) {
             vm64_reset(vm);
             printf("VM reset\n");
@@ -97,27 +172,314 @@ void interactive_loop(VM64* vm) {
     }
 }
 
+void print_usage(const char* prog) {
+    printf("Usage: %s [options] [image.bin [load_addr]]\n", prog);
+    printf("Options:\n");
+    printf("  --hugetlb      - Back guest RAM with hugetlbfs pages\n");
+    printf("  --no-thp       - Do not request transparent huge pages\n");
+    printf("  --no-numa      - Do not bind guest RAM to the local NUMA node\n");
+    printf("  --guard        - Unchecked 32-bit guest addressing behind a guard\n");
+    printf("                   region; stray accesses fault via SIGSEGV\n");
+    printf("  --paged        - Sparse 48-bit guest address space (stack below\n");
+    printf("                   0x7ffffffff000, mmap/brk backed by page tables)\n");
+    printf("  --restore <file> - Start from a checkpoint instead of an image\n");
+    printf("  --stop-at <rip> - Run the image only up to <rip> (hex)\n");
+    printf("  --checkpoint <file> - After --stop-at, save a checkpoint and exit\n");
+    printf("  --fork-server <sock|-> - After --stop-at, serve RUN requests by\n");
+    printf("                   fork()ing the warm VM (\"-\" = stdin/stdout)\n");
+    printf("  --instances <n> - Run <n> copies of the image on the M:N scheduler\n");
+    printf("  --threads <n>  - Scheduler worker threads (default: one per core)\n");
+    printf("  --slice <n>    - Scheduler time slice in instructions (default 10000)\n");
+    printf("  --console <block|drop|grow|off> - Guest stdout/stderr go through a\n");
+    printf("                   ring drained by a writer thread; when full the\n");
+    printf("                   guest waits, output is dropped, or the ring grows\n");
+    printf("                   (default block; off = synchronous writes)\n");
+    printf("  --console-size <n> - Console ring size in bytes per stream\n");
+    printf("  --timeout <ms> - Stop the guest after <ms> of wall-clock time\n");
+    printf("                   (per run with --fork-server, for all --instances)\n");
+    printf("  --max-insns <n> - Stop the guest after about <n> instructions\n");
+    printf("                   (per run with --fork-server, per guest with --instances)\n");
+    printf("  --trace <file> - Stream a compressed execution trace to <file>\n");
+    printf("                   (analyze with bin/vm64-trace)\n");
+    printf("  --perf         - Report host perf counters for the run\n");
+    printf("  --perf-interval <n> - Also report every <n> guest instructions\n");
+}
+
+/* --timeout: SIGALRM asks the running VMs to stop at their next block
+ * boundary */
+static VM64** timeout_vms;
+static int timeout_count;
+
+static void timeout_handler(int sig) {
+    (void)sig;
+    for (int i = 0; i < timeout_count; i++) vm64_request_stop(timeout_vms[i]);
+}
+
+static void set_timeout(VM64** vms, int count, unsigned long ms) {
+    struct itimerval it;
+    memset(&it, 0, sizeof(it));
+    it.it_value.tv_sec = (time_t)(ms / 1000);
+    it.it_value.tv_usec = (suseconds_t)(ms % 1000) * 1000;
+    
+    if (ms > 0) {
+        struct sigaction sa;
+        memset(&sa, 0, sizeof(sa));
+        sa.sa_handler = timeout_handler;
+        sigemptyset(&sa.sa_mask);
+        timeout_vms = vms;
+        timeout_count = count;
+        sigaction(SIGALRM, &sa, NULL);
+    }
+    setitimer(ITIMER_REAL, &it, NULL);
+}
+
+/* Run many copies of one image on the M:N scheduler; max_insns applies to
+ * each guest, timeout_ms to the whole run */
+int run_scheduled(const char* image, uint64_t addr, int ram_flags, int paged,
+                  int instances, int threads, uint64_t slice,
+                  uint64_t max_insns, unsigned long timeout_ms) {
+    VM64Sched* sched = vm64_sched_create(threads, slice);
+    VM64** vms = (VM64**)calloc((size_t)instances, sizeof(VM64*));
+    int status = EXIT_SUCCESS;
+    
+    if (!sched || !vms) {
+        fprintf(stderr, "Failed to create scheduler\n");
+        vm64_sched_destroy(sched);
+        free(vms);
+        return EXIT_FAILURE;
+    }
+    
+    for (int i = 0; i < instances; i++) {
+        vms[i] = vm64_create_ex(ram_flags);
+        if (vms[i] && paged) vm64_set_paging(vms[i], 1);
+        if (!vms[i] || vm64_load_image_shared(vms[i], image, addr) != 0) {
+            status = EXIT_FAILURE;
+            break;
+        }
+        vms[i]->max_insns = max_insns;
+        VM64Guest* guest = vm64_sched_add(sched, vms[i]);
+        if (guest) vm64_sched_feed(sched, guest, NULL, 0, 1);
+    }
+    
+    if (status == EXIT_SUCCESS && vm64_sched_start(sched) == 0) {
+        set_timeout(vms, instances, timeout_ms);
+        vm64_sched_wait(sched);
+        set_timeout(NULL, 0, 0);
+        vm64_sched_report(sched, stderr);
+        
+        int stopped = 0;
+        for (int i = 0; i < instances; i++) stopped += !vms[i]->halted;
+        if (stopped) {
+            fprintf(stderr, "  %d guest(s) stopped by the instruction or time limit\n",
+                    stopped);
+            status = EXIT_FAILURE;
+        }
+        
+        VM64MemUsage usage, total = {0, 0};
+        for (int i = 0; i < instances; i++) {
+            vm64_mem_usage(vms[i], &usage);
+            total.shared_bytes += usage.shared_bytes;
+            total.private_bytes += usage.private_bytes;
+        }
+        fprintf(stderr, "  guest RAM: %llu KB mapped from shared image pages, "
+                "%llu KB private\n",
+                (unsigned long long)total.shared_bytes / 1024,
+                (unsigned long long)total.private_bytes / 1024);
+    }
+    
+    vm64_sched_destroy(sched);
+    for (int i = 0; i < instances; i++) {
+        if (vms[i]) vm64_destroy(vms[i]);
+    }
+    free(vms);
+    return status;
+}
+
 int main(int argc, char* argv[]) {
-    VM64* vm = vm64_create();
+    int ram_flags = VM64_RAM_DEFAULT;
+    const char* image = NULL;
+    const char* addr_arg = NULL;
+    const char* restore_file = NULL;
+    const char* ckpt_file = NULL;
+    const char* server_path = NULL;
+    const char* trace_file = NULL;
+    uint64_t stop_rip = 0;
+    int has_stop = 0;
+    int use_perf = 0;
+    unsigned long timeout_ms = 0;
+    uint64_t max_insns = 0;
+    int paged = 0;
+    int console_policy = VM64_CONSOLE_BLOCK;
+    int console_stats = 0;
+    size_t console_size = 0;
+    int instances = 0;
+    int threads = 0;
+    uint64_t slice = 0;
+    int status = EXIT_SUCCESS;
+    VM64Perf perf;
+    memset(&perf, 0, sizeof(perf));
+    
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--hugetlb") == 0) {
+            ram_flags |= VM64_RAM_HUGETLB;
+        } else if (strcmp(argv[i], "--no-thp") == 0) {
+            ram_flags &= ~VM64_RAM_THP;
+        } else if (strcmp(argv[i], "--no-numa") == 0) {
+            ram_flags &= ~VM64_RAM_NUMA_LOCAL;
+        } else if (strcmp(argv[i], "--guard") == 0) {
+            ram_flags |= VM64_RAM_GUARD;
+        } else if (strcmp(argv[i], "--paged") == 0) {
+            paged = 1;
+        } else if (strcmp(argv[i], "--restore") == 0 && i + 1 < argc) {
+            restore_file = argv[++i];
+        } else if (strcmp(argv[i], "--stop-at") == 0 && i + 1 < argc) {
+            stop_rip = strtoull(argv[++i], NULL, 16);
+            has_stop = 1;
+        } else if (strcmp(argv[i], "--checkpoint") == 0 && i + 1 < argc) {
+            ckpt_file = argv[++i];
+        } else if (strcmp(argv[i], "--fork-server") == 0 && i + 1 < argc) {
+            server_path = argv[++i];
+        } else if (strcmp(argv[i], "--instances") == 0 && i + 1 < argc) {
+            instances = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+            threads = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--slice") == 0 && i + 1 < argc) {
+            slice = strtoull(argv[++i], NULL, 0);
+        } else if (strcmp(argv[i], "--console") == 0 && i + 1 < argc) {
+            const char* policy = argv[++i];
+            console_stats = 1;
+            if (strcmp(policy, "block") == 0) {
+                console_policy = VM64_CONSOLE_BLOCK;
+            } else if (strcmp(policy, "drop") == 0) {
+                console_policy = VM64_CONSOLE_DROP;
+            } else if (strcmp(policy, "grow") == 0) {
+                console_policy = VM64_CONSOLE_GROW;
+            } else if (strcmp(policy, "off") == 0) {
+                console_policy = -1;
+                console_stats = 0;
+            } else {
+                fprintf(stderr, "Unknown console policy: %s\n", policy);
+                return EXIT_FAILURE;
+            }
+        } else if (strcmp(argv[i], "--console-size") == 0 && i + 1 < argc) {
+            console_size = strtoull(argv[++i], NULL, 0);
+        } else if (strcmp(argv[i], "--timeout") == 0 && i + 1 < argc) {
+            timeout_ms = strtoul(argv[++i], NULL, 0);
+        } else if (strcmp(argv[i], "--max-insns") == 0 && i + 1 < argc) {
+            max_insns = strtoull(argv[++i], NULL, 0);
+        } else if (strcmp(argv[i], "--trace") == 0 && i + 1 < argc) {
+            trace_file = argv[++i];
+        } else if (strcmp(argv[i], "--perf") == 0) {
+            use_perf = 1;
+        } else if (strcmp(argv[i], "--perf-interval") == 0 && i + 1 < argc) {
+            use_perf = 1;
+            perf.interval = strtoull(argv[++i], NULL, 0);
+        } else if (strcmp(argv[i], "--help") == 0) {
+            print_usage(argv[0]);
+            return EXIT_SUCCESS;
+        } else if (strncmp(argv[i], "--", 2) == 0) {
+            fprintf(stderr, "Unknown option: %s\n", argv[i]);
+            print_usage(argv[0]);
+            return EXIT_FAILURE;
+        } else if (!image) {
+            image = argv[i];
+        } else if (!addr_arg) {
+            addr_arg = argv[i];
+        }
+    }
+    
+    if (instances > 0) {
+        if (!image) {
+            fprintf(stderr, "--instances requires an image\n");
+            return EXIT_FAILURE;
+        }
+        uint64_t addr = 0x400000;
+        if (addr_arg) {
+            sscanf(addr_arg, "%llx", (unsigned long long*)&addr);
+        }
+        return run_scheduled(image, addr, ram_flags, paged, instances, threads, slice,
+                             max_insns, timeout_ms);
+    }
+    
+    VM64* vm = vm64_create_ex(ram_flags);
     if (!vm) {
         fprintf(stderr, "Failed to create VM64\n");
         return EXIT_FAILURE;
     }
+    if (paged && vm64_set_paging(vm, 1) != 0) {
+        fprintf(stderr, "Failed to set up guest page tables\n");
+        vm64_destroy(vm);
+        return EXIT_FAILURE;
+    }
     
-    printf("=== VM64 x86-64 Linux Emulator ===\n");
-    printf("Memory: %d MB\n", (int)(VM64_RAM_SIZE / (1024*1024)));
-    printf("Registers: RAX-R15 (16 x 64-bit)\n");
-    printf("Linux syscall support: write, read, open, close, exit, mmap, brk\n\n");
+    if (!server_path) {
+        printf("=== VM64 x86-64 Linux Emulator ===\n");
+        printf("Memory: %d MB\n", (int)(VM64_RAM_SIZE / (1024*1024)));
+        printf("Registers: RAX-R15 (16 x 64-bit)\n");
+        printf("Linux syscall support: write, read, open, close, exit, mmap, munmap, brk\n\n");
+    }
     
-    /* Load image if provided */
-    if (argc > 1) {
+    /* Load image or checkpoint if provided */
+    if (image || restore_file) {
         uint64_t addr = 0x400000;
-        if (argc > 2) {
-            sscanf(argv[2], "%llx", (unsigned long long*)&addr);
+        if (addr_arg) {
+            sscanf(addr_arg, "%llx", (unsigned long long*)&addr);
         }
         
-        if (vm64_load_image(vm, argv[1], addr) == 0) {
-            vm64_run(vm);
+        int loaded = restore_file ? vm64_restore(vm, restore_file)
+                                  : vm64_load_image(vm, image, addr);
+        if (loaded == 0 && !restore_file && !server_path) {
+            printf("Loaded %s at 0x%llX\n", image, (unsigned long long)addr);
+        }
+        if (loaded == 0 && has_stop && vm64_run_to(vm, stop_rip) != 0) {
+            fprintf(stderr, "Guest halted before reaching RIP 0x%llX\n",
+                    (unsigned long long)stop_rip);
+            loaded = -1;
+        }
+        
+        if (loaded != 0) {
+            status = EXIT_FAILURE;
+        } else if (ckpt_file) {
+            if (vm64_checkpoint(vm, ckpt_file) < 0) status = EXIT_FAILURE;
+        } else if (server_path) {
+            if (vm64_fork_server_ex(vm, server_path, max_insns, timeout_ms) != 0) {
+                status = EXIT_FAILURE;
+            }
+        } else {
+            VM64Console* console = NULL;
+            if (console_policy >= 0) {
+                console = vm64_console_create((VM64ConsolePolicy)console_policy,
+                                              console_size);
+                vm64_console_attach(console, vm);
+            }
+            
+            vm->max_insns = max_insns;
+            set_timeout(&vm, 1, timeout_ms);
+            
+            if (trace_file && vm64_trace_start(vm, trace_file) != 0) {
+                status = EXIT_FAILURE;
+            } else if (use_perf) {
+                vm64_perf_open(&perf);
+                vm64_perf_run(vm, &perf);
+                vm64_perf_close(&perf);
+            } else {
+                vm64_run(vm);
+            }
+            
+            set_timeout(NULL, 0, 0);
+            if (!vm->halted && status == EXIT_SUCCESS) {
+                fprintf(stderr, "Guest stopped: %s limit reached\n",
+                        max_insns && vm->instruction_count >= max_insns
+                            ? "instruction" : "time");
+                status = EXIT_FAILURE;
+            }
+            
+            if (vm->trace && vm64_trace_stop(vm) != 0) status = EXIT_FAILURE;
+            if (console) {
+                vm64_console_flush(console);
+                if (console_stats) vm64_console_report(console, stderr);
+                vm64_console_destroy(console);
+            }
         }
     } else {
         /* Interactive mode */
@@ -126,5 +488,5 @@ int main(int argc, char* argv[]) {
     }
     
     vm64_destroy(vm);
-    return EXIT_SUCCESS;
+    return status;
 }
@@ -0,0 +1,122 @@
+#ifndef RING_H
+#define RING_H
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Lock-free single-producer / single-consumer byte ring.
+ * head is only written by the producer and tail only by the consumer;
+ * each side publishes with a release store and reads the other side with
+ * an acquire load, so no locks are needed. Capacity is a power of two and
+ * head/tail run freely, wrapping via the mask. */
+
+#define RING_CACHE_LINE 64
+
+typedef struct {
+    uint8_t* buf;
+    size_t mask;                           /* Capacity - 1 */
+    char pad0[RING_CACHE_LINE - sizeof(uint8_t*) - sizeof(size_t)];
+    size_t head;                           /* Producer position */
+    char pad1[RING_CACHE_LINE - sizeof(size_t)];
+    size_t tail;                           /* Consumer position */
+    char pad2[RING_CACHE_LINE - sizeof(size_t)];
+} Ring;
+
+/* Allocate a ring holding at least capacity bytes */
+static inline int ring_init(Ring* r, size_t capacity) {
+    size_t cap = 64;
+    while (cap < capacity) cap <<= 1;
+    
+    memset(r, 0, sizeof(*r));
+    r->buf = (uint8_t*)malloc(cap);
+    if (!r->buf) return -1;
+    r->mask = cap - 1;
+    return 0;
+}
+
+static inline void ring_free(Ring* r) {
+    free(r->buf);
+    r->buf = NULL;
+}
+
+static inline size_t ring_capacity(const Ring* r) {
+    return r->mask + 1;
+}
+
+/* Bytes queued; exact for the consumer, an upper bound for the producer */
+static inline size_t ring_used(Ring* r) {
+    return __atomic_load_n(&r->head, __ATOMIC_ACQUIRE) -
+           __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE);
+}
+
+/* Free space; exact for the producer, a lower bound for the consumer */
+static inline size_t ring_space(Ring* r) {
+    return ring_capacity(r) - ring_used(r);
+}
+
+/* Producer: copy in up to len bytes, returns how many fit */
+static inline size_t ring_write(Ring* r, const void* data, size_t len) {
+    size_t head = r->head;
+    size_t tail = __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE);
+    size_t space = ring_capacity(r) - (head - tail);
+    if (len > space) len = space;
+    if (len == 0) return 0;
+    
+    size_t off = head & r->mask;
+    size_t first = ring_capacity(r) - off;
+    if (first > len) first = len;
+    memcpy(r->buf + off, data, first);
+    memcpy(r->buf, (const uint8_t*)data + first, len - first);
+    
+    __atomic_store_n(&r->head, head + len, __ATOMIC_RELEASE);
+    return len;
+}
+
+/* Producer: write a single byte, 0 if the ring is full */
+static inline int ring_put(Ring* r, uint8_t byte) {
+    size_t head = r->head;
+    if (head - __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE) > r->mask) return 0;
+    
+    r->buf[head & r->mask] = byte;
+    __atomic_store_n(&r->head, head + 1, __ATOMIC_RELEASE);
+    return 1;
+}
+
+/* Consumer: up to two contiguous readable regions (the second is non-empty
+ * only when the data wraps). Returns the total readable bytes. */
+static inline size_t ring_peek(Ring* r, const uint8_t** p1, size_t* n1,
+                               const uint8_t** p2, size_t* n2) {
+    size_t tail = r->tail;
+    size_t used = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE) - tail;
+    size_t off = tail & r->mask;
+    size_t first = ring_capacity(r) - off;
+    if (first > used) first = used;
+    
+    *p1 = r->buf + off;
+    *n1 = first;
+    *p2 = r->buf;
+    *n2 = used - first;
+    return used;
+}
+
+/* Consumer: copy out up to len bytes, returns how many were read */
+static inline size_t ring_read(Ring* r, void* data, size_t len) {
+    const uint8_t *p1, *p2;
+    size_t n1, n2;
+    size_t used = ring_peek(r, &p1, &n1, &p2, &n2);
+    if (len > used) len = used;
+    
+    size_t first = len < n1 ? len : n1;
+    memcpy(data, p1, first);
+    memcpy((uint8_t*)data + first, p2, len - first);
+    __atomic_store_n(&r->tail, r->tail + len, __ATOMIC_RELEASE);
+    return len;
+}
+
+/* Consumer: release len bytes after ring_peek */
+static inline void ring_consume(Ring* r, size_t len) {
+    __atomic_store_n(&r->tail, r->tail + len, __ATOMIC_RELEASE);
+}
+
+#endif /* RING_H */
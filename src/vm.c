@@ -4,6 +4,16 @@
 #include <string.h>
 #include <assert.h>
 
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+#define VM_BE16(v) __builtin_bswap16(v)
+#define VM_BE32(v) __builtin_bswap32(v)
+#define VM_BE64(v) __builtin_bswap64(v)
+#else
+#define VM_BE16(v) (v)
+#define VM_BE32(v) (v)
+#define VM_BE64(v) (v)
+#endif
+
 /* Create a new VM instance */
 VM* vm_create(void) {
     VM* vm = (VM*)malloc(sizeof(VM));
@@ -102,6 +112,128 @@ int vm_load_builtin_image(VM* vm) {
     return 0;
 }
 
+/* Big-endian access of 1, 2, 4 or 8 bytes at any alignment. memcpy
+ * compiles to a single unaligned host load or store. */
+static inline uint64_t vm_get_be(const uint8_t* p, unsigned width) {
+    switch (width) {
+        case 1: return p[0];
+        case 2: { uint16_t v; memcpy(&v, p, 2); return VM_BE16(v); }
+        case 4: { uint32_t v; memcpy(&v, p, 4); return VM_BE32(v); }
+        default: { uint64_t v; memcpy(&v, p, 8); return VM_BE64(v); }
+    }
+}
+
+static inline void vm_put_be(uint8_t* p, unsigned width, uint64_t value) {
+    switch (width) {
+        case 1: p[0] = (uint8_t)value; break;
+        case 2: { uint16_t v = VM_BE16((uint16_t)value); memcpy(p, &v, 2); break; }
+        case 4: { uint32_t v = VM_BE32((uint32_t)value); memcpy(p, &v, 4); break; }
+        default: { uint64_t v = VM_BE64(value); memcpy(p, &v, 8); break; }
+    }
+}
+
+/* Resolve a LOADX/STOREX operand. Returns 0 if the base register or
+ * addressing kind is invalid or the access would run past RAM. */
+static int vm_effective_addr(VM* vm, uint8_t mode, uint8_t base, uint16_t disp,
+                             uint32_t* addr) {
+    uint64_t a;
+    switch (VM_AM_KIND(mode)) {
+        case VM_AM_ABS:
+            a = disp;
+            break;
+        case VM_AM_IND:
+            if (base >= VM_REG_COUNT) return 0;
+            a = vm->regs[base];
+            break;
+        case VM_AM_DISP:
+            if (base >= VM_REG_COUNT) return 0;
+            a = vm->regs[base] + (uint64_t)(int64_t)(int16_t)disp;
+            break;
+        default:
+            return 0;
+    }
+    if (a >= VM_RAM_SIZE || VM_AM_WIDTH(mode) > VM_RAM_SIZE - a) return 0;
+    *addr = (uint32_t)a;
+    return 1;
+}
+
+/* How an instruction touches RAM (see vm_insn_access) */
+enum { VM_ACCESS_NONE, VM_ACCESS_READ, VM_ACCESS_WRITE };
+
+/* The RAM an instruction about to run at PC will read or write */
+static int vm_insn_access(VM* vm, const VMInsn* insn, uint32_t* addr, unsigned* width) {
+    switch (insn->opcode) {
+        case OP_LOAD:
+        case OP_STORE:
+            if (insn->r1 >= VM_REG_COUNT) return VM_ACCESS_NONE;
+            *addr = insn->imm;
+            *width = 1;
+            return insn->opcode == OP_LOAD ? VM_ACCESS_READ : VM_ACCESS_WRITE;
+        case OP_LOADX:
+        case OP_STOREX:
+            if (insn->r1 >= VM_REG_COUNT ||
+                !vm_effective_addr(vm, insn->mode, insn->r2, (uint16_t)insn->imm, addr)) {
+                return VM_ACCESS_NONE;
+            }
+            *width = VM_AM_WIDTH(insn->mode);
+            return insn->opcode == OP_LOADX ? VM_ACCESS_READ : VM_ACCESS_WRITE;
+        case OP_CALL:
+            if (vm->sp <= 1) return VM_ACCESS_NONE;
+            *addr = vm->sp - 2u;
+            *width = 2;
+            return VM_ACCESS_WRITE;
+        case OP_RET:
+            if (vm->sp + 1 >= VM_RAM_SIZE) return VM_ACCESS_NONE;
+            *addr = vm->sp;
+            *width = 2;
+            return VM_ACCESS_READ;
+        case OP_PUSH:
+            if (insn->r1 >= VM_REG_COUNT || vm->sp <= 7) return VM_ACCESS_NONE;
+            *addr = vm->sp - 8u;
+            *width = 8;
+            return VM_ACCESS_WRITE;
+        case OP_POP:
+            if (insn->r1 >= VM_REG_COUNT || vm->sp + 8 > VM_RAM_SIZE) return VM_ACCESS_NONE;
+            *addr = vm->sp;
+            *width = 8;
+            return VM_ACCESS_READ;
+        default:
+            return VM_ACCESS_NONE;
+    }
+}
+
+static void vm_profile_access(VMProfile* p, uint32_t* stamps, uint64_t* total,
+                              uint32_t addr, unsigned width) {
+    uint32_t epoch = __atomic_load_n(&p->epoch, __ATOMIC_RELAXED);
+    for (unsigned i = 0; i < width && addr + i < VM_RAM_SIZE; i++) {
+        __atomic_store_n(&stamps[addr + i], epoch, __ATOMIC_RELAXED);
+    }
+    __atomic_store_n(total, *total + width, __ATOMIC_RELAXED);
+}
+
+/* Record the instruction at PC and the memory it is about to touch */
+static void vm_profile_insn(VM* vm, VMProfile* p) {
+    uint8_t opcode = vm->ram[vm->pc];
+    __atomic_store_n(&p->exec[vm->pc], __atomic_load_n(&p->epoch, __ATOMIC_RELAXED),
+                     __ATOMIC_RELAXED);
+    __atomic_store_n(&p->opcodes[opcode], p->opcodes[opcode] + 1, __ATOMIC_RELAXED);
+    
+    VMInsn insn;
+    uint32_t addr;
+    unsigned width;
+    if (!vm_decode(&vm->ram[vm->pc], VM_RAM_SIZE - vm->pc, &insn)) return;
+    switch (vm_insn_access(vm, &insn, &addr, &width)) {
+        case VM_ACCESS_READ:
+            vm_profile_access(p, p->read, &p->reads, addr, width);
+            break;
+        case VM_ACCESS_WRITE:
+            vm_profile_access(p, p->write, &p->writes, addr, width);
+            break;
+        default:
+            break;
+    }
+}
+
 /* Execute a single instruction */
 void vm_execute_one(VM* vm) {
     if (!vm || vm->halted || vm->pc >= VM_RAM_SIZE) {
@@ -325,6 +457,42 @@ void vm_execute_one(VM* vm) {
             break;
         }
         
+        case OP_LOADX: {
+            if (vm->pc + 4 >= VM_RAM_SIZE) {
+                vm->halted = 1;
+                break;
+            }
+            uint8_t mode = vm->ram[vm->pc++];
+            uint8_t dst = vm->ram[vm->pc++];
+            uint8_t base = vm->ram[vm->pc++];
+            uint16_t disp = (vm->ram[vm->pc] << 8) | vm->ram[vm->pc+1];
+            vm->pc += 2;
+            
+            uint32_t addr;
+            if (dst < VM_REG_COUNT && vm_effective_addr(vm, mode, base, disp, &addr)) {
+                vm->regs[dst] = vm_get_be(&vm->ram[addr], VM_AM_WIDTH(mode));
+            }
+            break;
+        }
+        
+        case OP_STOREX: {
+            if (vm->pc + 4 >= VM_RAM_SIZE) {
+                vm->halted = 1;
+                break;
+            }
+            uint8_t mode = vm->ram[vm->pc++];
+            uint8_t src = vm->ram[vm->pc++];
+            uint8_t base = vm->ram[vm->pc++];
+            uint16_t disp = (vm->ram[vm->pc] << 8) | vm->ram[vm->pc+1];
+            vm->pc += 2;
+            
+            uint32_t addr;
+            if (src < VM_REG_COUNT && vm_effective_addr(vm, mode, base, disp, &addr)) {
+                vm_put_be(&vm->ram[addr], VM_AM_WIDTH(mode), vm->regs[src]);
+            }
+            break;
+        }
+        
         case OP_OUT: {
             if (vm->pc >= VM_RAM_SIZE) {
                 vm->halted = 1;
@@ -332,7 +500,9 @@ void vm_execute_one(VM* vm) {
             }
             uint8_t reg = vm->ram[vm->pc++];
             
-            if (reg < VM_REG_COUNT) {
+            if (reg < VM_REG_COUNT && vm->output) {
+                vm->output(vm->output_ctx, (uint8_t)vm->regs[reg]);
+            } else if (reg < VM_REG_COUNT) {
                 putchar((int)(vm->regs[reg] & 0xFF));
                 fflush(stdout);
             }
@@ -347,7 +517,7 @@ void vm_execute_one(VM* vm) {
             uint8_t reg = vm->ram[vm->pc++];
             
             if (reg < VM_REG_COUNT) {
-                int ch = getchar();
+                int ch = vm->input ? vm->input(vm->input_ctx) : getchar();
                 vm->regs[reg] = (ch != EOF) ? ch : 0;
             }
             break;
@@ -506,6 +676,53 @@ void vm_execute_one(VM* vm) {
     }
 }
 
+/* vm_execute_one, recorded in a profile. A separate entry point, so
+ * unprofiled execution does not pay for the check. */
+void vm_execute_profiled(VM* vm, VMProfile* profile) {
+    if (vm && !vm->halted) vm_profile_insn(vm, profile);
+    vm_execute_one(vm);
+}
+
+/* vm_execute_one for a fuzzer: records control transfers in the edge
+ * bitmap and flags the RAM pages the instruction writes. An invalid or
+ * truncated instruction halts the VM without running and returns -1. */
+int vm_execute_fuzz(VM* vm, VMFuzz* fuzz) {
+    if (!vm || vm->halted) return 0;
+    
+    VMInsn insn;
+    uint32_t addr;
+    unsigned width;
+    if (!vm_decode(&vm->ram[vm->pc], VM_RAM_SIZE - vm->pc, &insn)) {
+        vm->halted = 1;
+        return -1;
+    }
+    if (vm_insn_access(vm, &insn, &addr, &width) == VM_ACCESS_WRITE) {
+        uint32_t last = addr + width - 1 < VM_RAM_SIZE ? addr + width - 1 : VM_RAM_SIZE - 1;
+        for (uint32_t page = addr / VM_FUZZ_PAGE; page <= last / VM_FUZZ_PAGE; page++) {
+            fuzz->dirty[page] = 1;
+        }
+    }
+    
+    vm_execute_one(vm);
+    
+    switch (insn.opcode) {
+        case OP_JMP: case OP_JNZ: case OP_JZ: case OP_JLT: case OP_JGT:
+        case OP_CALL: case OP_RET: {
+            /* Taken or not, AFL-style: the edge is (previous, current) */
+            uint16_t cur = (uint16_t)((vm->pc * 0x9E3779B1u) >> 16);
+            uint16_t edge = cur ^ fuzz->prev;
+            uint8_t count = fuzz->map[edge];
+            if (count == 0) fuzz->hits[fuzz->nhits++] = edge;
+            fuzz->map[edge] = (uint8_t)(count + 1 + (count == 255));
+            fuzz->prev = cur >> 1;
+            break;
+        }
+        default:
+            break;
+    }
+    return 0;
+}
+
 /* Run the VM until HALT */
 void vm_run(VM* vm) {
     if (!vm) return;
@@ -542,6 +759,20 @@ void vm_set_debug_mode(VM* vm, int enable) {
     if (vm) vm->debug_mode = enable;
 }
 
+/* Send OUT bytes to fn instead of stdout; vm_reset keeps the hook */
+void vm_set_output(VM* vm, VMOutputFn fn, void* ctx) {
+    if (!vm) return;
+    vm->output = fn;
+    vm->output_ctx = ctx;
+}
+
+/* Take IN bytes from fn instead of stdin; vm_reset keeps the hook */
+void vm_set_input(VM* vm, VMInputFn fn, void* ctx) {
+    if (!vm) return;
+    vm->input = fn;
+    vm->input_ctx = ctx;
+}
+
 /* Add a breakpoint */
 void vm_add_breakpoint(VM* vm, uint16_t addr) {
     if (!vm || vm->breakpoint_count >= VM_MAX_BREAKPOINTS) return;
@@ -575,3 +806,165 @@ int vm_at_breakpoint(VM* vm) {
     }
     return 0;
 }
+
+/* Encoded instruction lengths, 0 for unknown opcodes */
+uint8_t vm_insn_length(uint8_t opcode) {
+    switch (opcode) {
+        case OP_HALT: case OP_RET: return 1;
+        case OP_NOT: case OP_OUT: case OP_IN: case OP_PUSH: case OP_POP: return 2;
+        case OP_ADD: case OP_SUB: case OP_MUL: case OP_DIV: case OP_MOD:
+        case OP_AND: case OP_OR: case OP_XOR: case OP_SHL: case OP_SHR:
+        case OP_CMP: case OP_JMP: case OP_CALL: return 3;
+        case OP_LOAD: case OP_STORE:
+        case OP_JNZ: case OP_JZ: case OP_JLT: case OP_JGT: return 4;
+        case OP_MOVI: case OP_LOADX: case OP_STOREX: return 6;
+        default: return 0;
+    }
+}
+
+/* Decode the instruction at code (avail bytes readable). Returns its
+ * length, or 0 for an unknown opcode or one cut off by the end of code. */
+int vm_decode(const uint8_t* code, size_t avail, VMInsn* insn) {
+    if (!code || !insn || avail == 0) return 0;
+    
+    memset(insn, 0, sizeof(*insn));
+    insn->opcode = code[0];
+    insn->len = vm_insn_length(code[0]);
+    if (insn->len == 0 || insn->len > avail) return 0;
+    
+    switch (insn->opcode) {
+        case OP_MOVI:
+            insn->r1 = code[1];
+            insn->imm = ((uint32_t)code[2] << 24) | ((uint32_t)code[3] << 16) |
+                        ((uint32_t)code[4] << 8) | code[5];
+            break;
+        case OP_LOADX: case OP_STOREX:
+            insn->mode = code[1];
+            insn->r1 = code[2];
+            insn->r2 = code[3];
+            insn->imm = (code[4] << 8) | code[5];
+            break;
+        case OP_LOAD: case OP_STORE:
+        case OP_JNZ: case OP_JZ: case OP_JLT: case OP_JGT:
+            insn->r1 = code[1];
+            insn->imm = (code[2] << 8) | code[3];
+            break;
+        case OP_JMP: case OP_CALL:
+            insn->imm = (code[1] << 8) | code[2];
+            break;
+        case OP_SHL: case OP_SHR:
+            insn->r1 = code[1];
+            insn->imm = code[2];
+            break;
+        default:
+            if (insn->len >= 2) insn->r1 = code[1];
+            if (insn->len == 3) insn->r2 = code[2];
+            break;
+    }
+    return insn->len;
+}
+
+/* Opcode name, or NULL if it is not an opcode */
+const char* vm_mnemonic(uint8_t opcode) {
+    switch (opcode) {
+        case OP_HALT: return "HALT";    case OP_MOVI: return "MOVI";
+        case OP_ADD: return "ADD";      case OP_SUB: return "SUB";
+        case OP_MUL: return "MUL";      case OP_DIV: return "DIV";
+        case OP_MOD: return "MOD";      case OP_AND: return "AND";
+        case OP_OR: return "OR";        case OP_XOR: return "XOR";
+        case OP_NOT: return "NOT";      case OP_SHL: return "SHL";
+        case OP_SHR: return "SHR";      case OP_LOAD: return "LOAD";
+        case OP_STORE: return "STORE";  case OP_LOADX: return "LOADX";
+        case OP_STOREX: return "STOREX"; case OP_OUT: return "OUT";
+        case OP_IN: return "IN";        case OP_JMP: return "JMP";
+        case OP_JNZ: return "JNZ";      case OP_JZ: return "JZ";
+        case OP_JLT: return "JLT";      case OP_JGT: return "JGT";
+        case OP_CMP: return "CMP";      case OP_CALL: return "CALL";
+        case OP_RET: return "RET";      case OP_PUSH: return "PUSH";
+        case OP_POP: return "POP";
+        default: return NULL;
+    }
+}
+
+/* Write one line of disassembly for the instruction at code into out.
+ * Returns the instruction length, or 0 (and a DB line) if it does not
+ * decode. */
+int vm_disasm(const uint8_t* code, size_t avail, char* out, size_t size) {
+    VMInsn insn;
+    if (!out || size == 0) return 0;
+    if (!vm_decode(code, avail, &insn)) {
+        snprintf(out, size, "DB 0x%02X", avail > 0 && code ? code[0] : 0);
+        return 0;
+    }
+    
+    const char* name = vm_mnemonic(insn.opcode);
+    switch (insn.opcode) {
+        case OP_HALT: case OP_RET:
+            snprintf(out, size, "%s", name);
+            break;
+        case OP_MOVI:
+            snprintf(out, size, "%s R%u, 0x%X", name, insn.r1, (unsigned)insn.imm);
+            break;
+        case OP_SHL: case OP_SHR:
+            snprintf(out, size, "%s R%u, %u", name, insn.r1, (unsigned)insn.imm);
+            break;
+        case OP_LOAD: case OP_STORE:
+            snprintf(out, size, "%s R%u, [0x%04X]", name, insn.r1, (unsigned)insn.imm);
+            break;
+        case OP_JNZ: case OP_JZ: case OP_JLT: case OP_JGT:
+            snprintf(out, size, "%s R%u, 0x%04X", name, insn.r1, (unsigned)insn.imm);
+            break;
+        case OP_JMP: case OP_CALL:
+            snprintf(out, size, "%s 0x%04X", name, (unsigned)insn.imm);
+            break;
+        case OP_LOADX: case OP_STOREX: {
+            static const char widths[] = "BWDQ";
+            int16_t disp = (int16_t)insn.imm;
+            char operand[32];
+            switch (VM_AM_KIND(insn.mode)) {
+                case VM_AM_ABS:
+                    snprintf(operand, sizeof(operand), "[0x%04X]", (unsigned)insn.imm);
+                    break;
+                case VM_AM_IND:
+                    snprintf(operand, sizeof(operand), "[R%u]", insn.r2);
+                    break;
+                case VM_AM_DISP:
+                    snprintf(operand, sizeof(operand), "[R%u%c0x%X]", insn.r2,
+                             disp < 0 ? '-' : '+', disp < 0 ? -disp : disp);
+                    break;
+                default:
+                    snprintf(operand, sizeof(operand), "[?]");
+                    break;
+            }
+            snprintf(out, size, "%s.%c R%u, %s", name, widths[insn.mode & 3],
+                     insn.r1, operand);
+            break;
+        }
+        default:
+            if (insn.len == 2) snprintf(out, size, "%s R%u", name, insn.r1);
+            else snprintf(out, size, "%s R%u, R%u", name, insn.r1, insn.r2);
+            break;
+    }
+    return insn.len;
+}
+
+/* Control flow of the instruction at code, for vm_cfg */
+static int vm_flow_decode(const uint8_t* code, size_t avail, VMFlowInsn* out) {
+    VMInsn insn;
+    int len = vm_decode(code, avail, &insn);
+    if (!len) return 0;
+    
+    out->len = (uint8_t)len;
+    out->target = insn.imm;
+    switch (insn.opcode) {
+        case OP_HALT: out->flow = VM_FLOW_HALT; break;
+        case OP_RET: out->flow = VM_FLOW_RET; break;
+        case OP_JMP: out->flow = VM_FLOW_JUMP; break;
+        case OP_CALL: out->flow = VM_FLOW_CALL; break;
+        case OP_JNZ: case OP_JZ: case OP_JLT: case OP_JGT: out->flow = VM_FLOW_BRANCH; break;
+        default: out->flow = VM_FLOW_NEXT; break;
+    }
+    return len;
+}
+
+const VMCfgIsa vm_isa = { "vm", vm_flow_decode, vm_disasm };
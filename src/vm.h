@@ -3,6 +3,7 @@
 
 #include <stdint.h>
 #include <stddef.h>
+#include "vm_cfg.h"
 
 /* VM Configuration */
 #define VM_RAM_SIZE (64 * 1024)  /* 64 KiB */
@@ -26,6 +27,8 @@ typedef enum {
     OP_SHR     = 0x2A,  /* SHR dst, imm8 */
     OP_LOAD    = 0x30,  /* LOAD dst, addr16 */
     OP_STORE   = 0x31,  /* STORE src, addr16 */
+    OP_LOADX   = 0x33,  /* LOADX mode, dst, base, disp16 */
+    OP_STOREX  = 0x34,  /* STOREX mode, src, base, disp16 */
     OP_OUT     = 0x40,  /* OUT reg */
     OP_IN      = 0x41,  /* IN reg (input from stdin) */
     OP_JMP     = 0x50,  /* JMP addr16 */
@@ -40,6 +43,60 @@ typedef enum {
     OP_POP     = 0x81,  /* POP reg */
 } Opcode;
 
+/* LOADX/STOREX mode byte: access width in bits 0-1 (1, 2, 4 or 8 bytes)
+ * and addressing in bits 2-3. Multi-byte values are big-endian like
+ * PUSH/POP, loads zero-extend, and out-of-range accesses are ignored. */
+#define VM_AM_ABS  0x00    /* [disp16] */
+#define VM_AM_IND  0x04    /* [base] */
+#define VM_AM_DISP 0x08    /* [base + signed disp16] */
+#define VM_AM_KIND(mode) ((mode) & 0x0C)
+#define VM_AM_WIDTH(mode) (1u << ((mode) & 3))
+
+/* A decoded instruction (see vm_decode) */
+typedef struct {
+    uint8_t opcode;
+    uint8_t len;                   /* Encoded length in bytes */
+    uint8_t r1;                    /* Destination or only register */
+    uint8_t r2;                    /* Source or base register */
+    uint8_t mode;                  /* LOADX/STOREX mode byte */
+    uint32_t imm;                  /* Immediate, address or displacement */
+} VMInsn;
+
+/* Receives each OUT byte instead of stdout (see vm_set_output) */
+typedef void (*VMOutputFn)(void* ctx, uint8_t byte);
+
+/* Supplies each IN byte instead of stdin; -1 at end of input */
+typedef int (*VMInputFn)(void* ctx);
+
+/* Access profile filled in by vm_execute_profiled. Every RAM byte keeps
+ * the epoch of its last execute, read and write; the owner advances the
+ * epoch. Updates are relaxed atomic stores, so another thread may read
+ * the profile while the VM runs. */
+typedef struct {
+    uint32_t epoch;
+    uint32_t exec[VM_RAM_SIZE];    /* Opcode bytes */
+    uint32_t read[VM_RAM_SIZE];
+    uint32_t write[VM_RAM_SIZE];
+    uint64_t opcodes[256];         /* Instructions executed per opcode */
+    uint64_t reads, writes;        /* Data bytes read and written */
+} VMProfile;
+
+/* Fuzzing state for vm_execute_fuzz. map counts hits per control-flow
+ * edge and hits lists each edge the first time it is hit, so the owner
+ * can read and clear a run's coverage without scanning the whole map;
+ * counters never wrap back to zero. dirty flags the pages written since
+ * the owner last cleared them, so a snapshot can be restored by copying
+ * back only those. */
+#define VM_COVER_SIZE 65536        /* Edge bitmap bytes */
+#define VM_FUZZ_PAGE 256           /* Dirty tracking granularity */
+typedef struct {
+    uint8_t* map;                  /* VM_COVER_SIZE hit counters */
+    uint16_t* hits;                /* VM_COVER_SIZE entries */
+    uint32_t nhits;
+    uint16_t prev;                 /* Previous location, shifted right */
+    uint8_t dirty[VM_RAM_SIZE / VM_FUZZ_PAGE];
+} VMFuzz;
+
 /* VM State */
 typedef struct {
     uint8_t ram[VM_RAM_SIZE];      /* Memory */
@@ -48,6 +105,10 @@ typedef struct {
     uint16_t sp;                   /* Stack pointer */
     int halted;                    /* Execution halted */
     uint64_t cycle_count;          /* Total cycles executed */
+    VMOutputFn output;             /* OUT hook, NULL for stdout */
+    void* output_ctx;
+    VMInputFn input;               /* IN hook, NULL for stdin */
+    void* input_ctx;
     
     /* Debug info */
     int debug_mode;
@@ -62,11 +123,22 @@ void vm_reset(VM* vm);
 int vm_load_image(VM* vm, const char* filename);
 int vm_load_builtin_image(VM* vm);
 void vm_execute_one(VM* vm);
+void vm_execute_profiled(VM* vm, VMProfile* profile);
+int vm_execute_fuzz(VM* vm, VMFuzz* fuzz);
 void vm_run(VM* vm);
 void vm_dump_state(VM* vm);
 void vm_set_debug_mode(VM* vm, int enable);
+void vm_set_output(VM* vm, VMOutputFn fn, void* ctx);
+void vm_set_input(VM* vm, VMInputFn fn, void* ctx);
 void vm_add_breakpoint(VM* vm, uint16_t addr);
 void vm_remove_breakpoint(VM* vm, uint16_t addr);
 int vm_at_breakpoint(VM* vm);
+uint8_t vm_insn_length(uint8_t opcode);
+int vm_decode(const uint8_t* code, size_t avail, VMInsn* insn);
+int vm_disasm(const uint8_t* code, size_t avail, char* out, size_t size);
+const char* vm_mnemonic(uint8_t opcode);
+
+/* Decoder hooks for vm_cfg_build */
+extern const VMCfgIsa vm_isa;
 
 #endif /* VM_H */
@@ -1,9 +1,17 @@
+#define _GNU_SOURCE
 #include "vm64.h"
+#include "vm64_mmu.h"
+#include "vm64_trace.h"
+#include "vm64_vec.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 #include <fcntl.h>
+#include <signal.h>
+#include <setjmp.h>
+#include <pthread.h>
+#include <sys/mman.h>
 
 /* Linux syscall numbers (x86-64) - macOS compatibility */
 #ifdef __APPLE__
@@ -16,25 +24,224 @@
 #define SYS_exit_group 231
 #define SYS_mmap 9
 #define SYS_brk 17
+#define SYS_munmap 11
 #endif
 
+#ifdef __linux__
+#define VM64_MPOL_BIND 2
+#define VM64_MPOL_MF_MOVE (1 << 1)
+#endif
+
+/* Guard mode fault recovery: the VM running on this thread, if any */
+static __thread VM64* vm64_guard_vm;
+static __thread sigjmp_buf* vm64_guard_env;
+static struct sigaction vm64_prev_segv, vm64_prev_bus;
+static pthread_once_t vm64_guard_once = PTHREAD_ONCE_INIT;
+
+/* SIGSEGV/SIGBUS: unwind to the guarded run loop if the fault is inside
+ * the running VM's reservation, otherwise hand over to the old handler */
+static void vm64_guard_handler(int sig, siginfo_t* info, void* ctx) {
+    VM64* vm = vm64_guard_vm;
+    uint8_t* addr = (uint8_t*)info->si_addr;
+    
+    if (vm && vm64_guard_env && addr >= (uint8_t*)vm->ram_map &&
+        addr < (uint8_t*)vm->ram_map + vm->ram_map_size) {
+        /* vm64_guard_ptr already recorded addresses of 4 GB and up */
+        uint64_t off = (uint64_t)(addr - vm->ram);
+        if (off < VM64_GUARD_HIGH) vm->fault_addr = off;
+        siglongjmp(*vm64_guard_env, 1);
+    }
+    
+    struct sigaction* prev = sig == SIGBUS ? &vm64_prev_bus : &vm64_prev_segv;
+    if (prev->sa_flags & SA_SIGINFO) {
+        prev->sa_sigaction(sig, info, ctx);
+    } else if (prev->sa_handler != SIG_IGN && prev->sa_handler != SIG_DFL) {
+        prev->sa_handler(sig);
+    } else {
+        /* Returning re-executes the access and takes the default action */
+        signal(sig, SIG_DFL);
+    }
+}
+
+static void vm64_guard_install(void) {
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_sigaction = vm64_guard_handler;
+    sa.sa_flags = SA_SIGINFO | SA_NODEFER | SA_ONSTACK;
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGSEGV, &sa, &vm64_prev_segv);
+    sigaction(SIGBUS, &sa, &vm64_prev_bus);
+}
+
+/* Reserve VM64_GUARD_RESERVE bytes with only the first VM64_RAM_SIZE usable */
+static int vm64_alloc_guarded(VM64* vm, int flags) {
+    size_t reserve = VM64_GUARD_RESERVE + VM64_HUGE_PAGE_SIZE;
+    uint8_t* p = (uint8_t*)mmap(NULL, reserve, PROT_NONE,
+                                MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE,
+                                -1, 0);
+    if (p == (uint8_t*)MAP_FAILED) return -1;
+    
+    uintptr_t aligned = ((uintptr_t)p + VM64_HUGE_PAGE_SIZE - 1) &
+                        ~(uintptr_t)(VM64_HUGE_PAGE_SIZE - 1);
+    size_t head = aligned - (uintptr_t)p;
+    size_t tail = reserve - head - VM64_GUARD_RESERVE;
+    if (head) munmap(p, head);
+    if (tail) munmap((uint8_t*)aligned + VM64_GUARD_RESERVE, tail);
+    
+    if (mprotect((void*)aligned, VM64_RAM_SIZE, PROT_READ | PROT_WRITE) != 0) {
+        munmap((void*)aligned, VM64_GUARD_RESERVE);
+        return -1;
+    }
+    
+    vm->ram_map = (void*)aligned;
+    vm->ram_map_size = VM64_GUARD_RESERVE;
+    vm->ram = (uint8_t*)aligned;
+    vm->ram_flags = VM64_RAM_GUARD;
+    pthread_once(&vm64_guard_once, vm64_guard_install);
+
+#if defined(__linux__) && defined(MADV_HUGEPAGE)
+    if ((flags & VM64_RAM_THP) &&
+        madvise(vm->ram, VM64_RAM_SIZE, MADV_HUGEPAGE) == 0) {
+        vm->ram_flags |= VM64_RAM_THP;
+    }
+#else
+    (void)flags;
+#endif
+    return 0;
+}
+
+/* Map guest RAM: 2 MB aligned anonymous memory, optionally hugetlbfs */
+static int vm64_alloc_ram(VM64* vm, int flags) {
+    size_t size = VM64_RAM_SIZE;
+    
+    if (flags & VM64_RAM_GUARD) {
+        if (vm64_alloc_guarded(vm, flags) == 0) return 0;
+        fprintf(stderr, "Warning: cannot reserve guard region, "
+                "using bounds-checked RAM\n");
+    }
+
+#if defined(__linux__) && defined(MAP_HUGETLB)
+    if (flags & VM64_RAM_HUGETLB) {
+        size_t huge_size = (size + VM64_HUGE_PAGE_SIZE - 1) &
+                           ~(size_t)(VM64_HUGE_PAGE_SIZE - 1);
+        void* p = mmap(NULL, huge_size, PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if (p != MAP_FAILED) {
+            vm->ram_map = p;
+            vm->ram_map_size = huge_size;
+            vm->ram = (uint8_t*)p;
+            vm->ram_flags = VM64_RAM_HUGETLB;
+            return 0;
+        }
+        fprintf(stderr, "Warning: hugetlbfs pages unavailable, "
+                "falling back to transparent huge pages\n");
+        flags |= VM64_RAM_THP;
+    }
+#endif
+    
+    /* Over-reserve so the usable region can start on a 2 MB boundary */
+    size_t map_size = size + VM64_HUGE_PAGE_SIZE;
+    uint8_t* p = (uint8_t*)mmap(NULL, map_size, PROT_READ | PROT_WRITE,
+                                MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (p == (uint8_t*)MAP_FAILED) {
+        vm->ram = (uint8_t*)calloc(size, 1);
+        vm->ram_flags = 0;
+        return vm->ram ? 0 : -1;
+    }
+    
+    uintptr_t aligned = ((uintptr_t)p + VM64_HUGE_PAGE_SIZE - 1) &
+                        ~(uintptr_t)(VM64_HUGE_PAGE_SIZE - 1);
+    size_t head = aligned - (uintptr_t)p;
+    size_t tail = map_size - head - size;
+    if (head) munmap(p, head);
+    if (tail) munmap((uint8_t*)aligned + size, tail);
+    
+    vm->ram_map = (void*)aligned;
+    vm->ram_map_size = size;
+    vm->ram = (uint8_t*)aligned;
+    vm->ram_flags = 0;
+
+#if defined(__linux__) && defined(MADV_HUGEPAGE)
+    if ((flags & VM64_RAM_THP) &&
+        madvise(vm->ram_map, size, MADV_HUGEPAGE) == 0) {
+        vm->ram_flags |= VM64_RAM_THP;
+    }
+#endif
+    return 0;
+}
+
+#if defined(__linux__) && defined(SYS_getcpu) && defined(SYS_mbind)
+static int vm64_ram_bind_node(VM64* vm, unsigned node) {
+    if (node >= 8 * sizeof(unsigned long)) return -1;
+    
+    unsigned long mask = 1UL << node;
+    if (syscall(SYS_mbind, vm->ram, VM64_RAM_SIZE, VM64_MPOL_BIND,
+                &mask, 8 * sizeof(mask), VM64_MPOL_MF_MOVE) != 0) {
+        return -1;
+    }
+    
+    vm->numa_node = (int)node;
+    vm->ram_flags |= VM64_RAM_NUMA_LOCAL;
+    return 0;
+}
+#endif
+
+/* Bind guest RAM to the NUMA node of the calling thread */
+int vm64_ram_bind_local(VM64* vm) {
+    if (!vm || !vm->ram_map) return -1;
+
+#if defined(__linux__) && defined(SYS_getcpu) && defined(SYS_mbind)
+    unsigned cpu = 0, node = 0;
+    if (syscall(SYS_getcpu, &cpu, &node, NULL) != 0) return -1;
+    return vm64_ram_bind_node(vm, node);
+#else
+    return -1;
+#endif
+}
+
+/* A MAP_FIXED remap of guest RAM drops its mbind policy: bind the new
+ * pages to the same node again, or stop claiming a binding */
+void vm64_ram_rebind(VM64* vm) {
+    if (!vm || !(vm->ram_flags & VM64_RAM_NUMA_LOCAL)) return;
+
+#if defined(__linux__) && defined(SYS_getcpu) && defined(SYS_mbind)
+    if (vm->numa_node >= 0 && vm64_ram_bind_node(vm, (unsigned)vm->numa_node) == 0) {
+        return;
+    }
+#endif
+    vm->ram_flags &= ~VM64_RAM_NUMA_LOCAL;
+    vm->numa_node = -1;
+}
+
 /* Create VM64 instance */
 VM64* vm64_create(void) {
+    return vm64_create_ex(VM64_RAM_DEFAULT);
+}
+
+/* Create VM64 instance with explicit RAM placement flags */
+VM64* vm64_create_ex(int ram_flags) {
     VM64* vm = (VM64*)malloc(sizeof(VM64));
     if (!vm) return NULL;
     
     /* Initialize struct first */
     memset(vm, 0, sizeof(VM64));
+    vm->numa_node = -1;
+    vm->resume_rip = UINT64_MAX;
+    vm64_tlb_flush(vm);
     
     /* Allocate RAM */
-    vm->ram = (uint8_t*)calloc(VM64_RAM_SIZE, 1);
-    if (!vm->ram) {
+    if (vm64_alloc_ram(vm, ram_flags) != 0) {
         fprintf(stderr, "Error: Failed to allocate %llu bytes\n", 
                 (unsigned long long)VM64_RAM_SIZE);
         free(vm);
         return NULL;
     }
     
+    /* Bind before first touch so pages are faulted on the local node */
+    if (ram_flags & VM64_RAM_NUMA_LOCAL) {
+        vm64_ram_bind_local(vm);
+    }
+    
     /* Initialize stack at top of memory */
     vm->rsp = VM64_RAM_SIZE - 8;  /* Align to 8 bytes */
     vm->eflags = 0x202;           /* IF | ZF */
@@ -45,7 +252,10 @@ VM64* vm64_create(void) {
 /* Destroy VM64 */
 void vm64_destroy(VM64* vm) {
     if (vm) {
-        if (vm->ram) free(vm->ram);
+        if (vm->trace) vm64_trace_stop(vm);
+        vm64_mmu_free(vm);
+        if (vm->ram_map) munmap(vm->ram_map, vm->ram_map_size);
+        else if (vm->ram) free(vm->ram);
         free(vm);
     }
 }
@@ -54,19 +264,39 @@ void vm64_destroy(VM64* vm) {
 void vm64_reset(VM64* vm) {
     if (!vm) return;
     
-    memset(vm->ram, 0, VM64_RAM_SIZE);
+    /* Swap in fresh zero pages rather than copying shared ones to clear them */
+    if (!vm->ram_map || (vm->ram_flags & VM64_RAM_HUGETLB) ||
+        mmap(vm->ram, VM64_RAM_SIZE, PROT_READ | PROT_WRITE,
+             MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED, -1, 0) != (void*)vm->ram) {
+        memset(vm->ram, 0, VM64_RAM_SIZE);
+    } else {
+#if defined(__linux__) && defined(MADV_HUGEPAGE)
+        if (vm->ram_flags & VM64_RAM_THP) madvise(vm->ram, VM64_RAM_SIZE, MADV_HUGEPAGE);
+#endif
+        vm64_ram_rebind(vm);
+    }
+    memset(vm->page_flags, VM64_PAGE_DIRTY, sizeof(vm->page_flags));
     memset(vm->regs, 0, sizeof(vm->regs));
+    memset(vm->vregs, 0, sizeof(vm->vregs));
     vm->rip = 0;
     vm->rsp = VM64_RAM_SIZE - 1;
     vm->eflags = 0x202;  /* IF | ZF */
     vm->halted = 0;
     vm->cycle_count = 0;
     vm->instruction_count = 0;
+    vm->fault = 0;
+    vm->fault_addr = 0;
+    vm->syscall_pending = 0;
+    vm->stop_requested = 0;
+    vm->resume_rip = UINT64_MAX;
+    
+    /* A paged VM comes back with a fresh address space */
+    if (vm->paging) vm64_set_paging(vm, 1);
 }
 
 /* Load binary image at specified address */
 int vm64_load_image(VM64* vm, const char* filename, uint64_t load_addr) {
-    if (!vm || !filename || load_addr >= VM64_RAM_SIZE) return -1;
+    if (!vm || !filename || (!vm->paging && load_addr >= VM64_RAM_SIZE)) return -1;
     
     FILE* f = fopen(filename, "rb");
     if (!f) {
@@ -79,14 +309,26 @@ int vm64_load_image(VM64* vm, const char* filename, uint64_t load_addr) {
     long size = ftell(f);
     fseek(f, 0, SEEK_SET);
     
-    if (size <= 0 || load_addr + size > VM64_RAM_SIZE) {
+    if (size <= 0 || (!vm->paging && load_addr + size > VM64_RAM_SIZE)) {
         fprintf(stderr, "Error: File too large or invalid address\n");
         fclose(f);
         return -1;
     }
     
+    if (vm->paging) {
+        uint8_t* data = (uint8_t*)malloc((size_t)size);
+        size_t n = data ? fread(data, 1, (size_t)size, f) : 0;
+        fclose(f);
+        int ret = n == (size_t)size ? vm64_load_buffer(vm, data, n, load_addr) : -1;
+        free(data);
+        if (ret != 0) fprintf(stderr, "Error: Cannot map image at 0x%llX\n",
+                              (unsigned long long)load_addr);
+        return ret;
+    }
+    
     size_t bytes_read = fread(&vm->ram[load_addr], 1, (size_t)size, f);
     fclose(f);
+    vm64_mark_dirty(vm, load_addr, bytes_read);
     
     if ((long)bytes_read != size) {
         fprintf(stderr, "Error: Failed to read entire file\n");
@@ -94,8 +336,35 @@ int vm64_load_image(VM64* vm, const char* filename, uint64_t load_addr) {
     }
     
     vm->rip = load_addr;
-    printf("Loaded %zu bytes at 0x%llX\n", bytes_read, (unsigned long long)load_addr);
+    return 0;
+}
+
+/* Load an in-memory image at specified address */
+int vm64_load_buffer(VM64* vm, const uint8_t* data, size_t size,
+                     uint64_t load_addr) {
+    if (!vm || !data || size == 0) return -1;
     
+    /* Paged: map the image read/write/exec and start the heap after it */
+    if (vm->paging) {
+        if (vm64_map(vm, load_addr, size, VM64_PROT_READ | VM64_PROT_WRITE |
+                                          VM64_PROT_EXEC) != 0 ||
+            vm64_write_guest(vm, load_addr, data, size) != 0) {
+            return -1;
+        }
+        uint64_t end = (load_addr + size + VM64_PAGE_SIZE - 1) &
+                       ~(uint64_t)(VM64_PAGE_SIZE - 1);
+        if (end > vm->brk_start) vm->brk_start = vm->brk = end;
+        vm->rip = load_addr;
+        return 0;
+    }
+    
+    if (load_addr >= VM64_RAM_SIZE || size > VM64_RAM_SIZE - load_addr) {
+        return -1;
+    }
+    
+    memcpy(&vm->ram[load_addr], data, size);
+    vm64_mark_dirty(vm, load_addr, size);
+    vm->rip = load_addr;
     return 0;
 }
 
@@ -119,13 +388,27 @@ void vm64_syscall_handler(VM64* vm) {
             uint64_t buf_addr = vm->regs[RSI];
             uint64_t count = vm->regs[RDX];
             
-            if (buf_addr + count > VM64_RAM_SIZE) {
+            /* Paged buffers may span non-contiguous frames: bounce them */
+            uint8_t* buf = vm64_guest_ptr(vm, buf_addr, count, VM64_PROT_READ);
+            uint8_t* bounce = NULL;
+            if (!buf && vm->paging && count <= VM64_RAM_SIZE &&
+                (bounce = (uint8_t*)malloc(count ? count : 1)) != NULL &&
+                vm64_read_guest(vm, buf_addr, bounce, count) == 0) {
+                buf = bounce;
+            }
+            if (!buf) {
+                free(bounce);
                 vm->regs[RAX] = -1;
                 break;
             }
             
-            ssize_t written = write(fd, &vm->ram[buf_addr], count);
-            vm->regs[RAX] = written;
+            if (vm->io_write) {
+                vm->regs[RAX] = vm->io_write(vm->io_user, fd, buf, count);
+            } else {
+                ssize_t written = write(fd, buf, count);
+                vm->regs[RAX] = written;
+            }
+            free(bounce);
             break;
         }
         
@@ -135,12 +418,24 @@ void vm64_syscall_handler(VM64* vm) {
             uint64_t buf_addr = vm->regs[RSI];
             uint64_t count = vm->regs[RDX];
             
-            if (buf_addr + count > VM64_RAM_SIZE) {
+            uint8_t* buf = vm64_guest_ptr(vm, buf_addr, count, VM64_PROT_WRITE);
+            uint8_t* bounce = NULL;
+            if (!buf && vm->paging && count <= VM64_RAM_SIZE) {
+                buf = bounce = (uint8_t*)malloc(count ? count : 1);
+            }
+            if (!buf) {
                 vm->regs[RAX] = -1;
                 break;
             }
             
-            ssize_t n = read(fd, &vm->ram[buf_addr], count);
+            ssize_t n = vm->io_read
+                ? vm->io_read(vm->io_user, fd, buf, count)
+                : read(fd, buf, count);
+            if (bounce && n > 0 &&
+                vm64_write_guest(vm, buf_addr, bounce, (uint64_t)n) != 0) {
+                n = -1;
+            }
+            free(bounce);
             vm->regs[RAX] = n;
             break;
         }
@@ -158,12 +453,19 @@ void vm64_syscall_handler(VM64* vm) {
             uint64_t filename_addr = vm->regs[RDI];
             int flags = vm->regs[RSI];
             
-            if (filename_addr >= VM64_RAM_SIZE) {
+            char path[4096];
+            size_t len = 0;
+            while (len < sizeof(path) &&
+                   vm64_read_guest(vm, filename_addr + len, &path[len], 1) == 0 &&
+                   path[len] != '\0') {
+                len++;
+            }
+            if (len >= sizeof(path) || path[len] != '\0') {
                 vm->regs[RAX] = -1;
                 break;
             }
             
-            int fd = open((char*)&vm->ram[filename_addr], flags, 0644);
+            int fd = open(path, flags, 0644);
             vm->regs[RAX] = fd;
             break;
         }
@@ -188,14 +490,30 @@ void vm64_syscall_handler(VM64* vm) {
         }
         
         case SYS_mmap: {
-            /* mmap stub - just return the requested address */
-            vm->regs[RAX] = vm->regs[RDI];
+            /* mmap(addr, len, prot, flags, fd, off) - anonymous only when
+             * paged; flat mode just returns the requested address */
+            if (!vm->paging) {
+                vm->regs[RAX] = vm->regs[RDI];
+                break;
+            }
+            if ((int64_t)vm->regs[R8] != -1 && !(vm->regs[R10] & 0x20)) {
+                vm->regs[RAX] = -1;
+                break;
+            }
+            vm->regs[RAX] = vm64_sys_mmap(vm, vm->regs[RDI], vm->regs[RSI],
+                                          (int)(vm->regs[RDX] & 7));
+            break;
+        }
+        
+        case SYS_munmap: {
+            vm->regs[RAX] = vm->paging
+                ? (uint64_t)(int64_t)vm64_sys_munmap(vm, vm->regs[RDI], vm->regs[RSI])
+                : 0;
             break;
         }
         
         case SYS_brk: {
-            /* brk stub */
-            vm->regs[RAX] = vm->regs[RDI];
+            vm->regs[RAX] = vm64_sys_brk(vm, vm->regs[RDI]);
             break;
         }
         
@@ -205,21 +523,310 @@ void vm64_syscall_handler(VM64* vm) {
     }
 }
 
-/* Execute one instruction */
-void vm64_execute_one(VM64* vm) {
-    if (!vm || vm->halted || vm->rip >= VM64_RAM_SIZE) {
+/* Encoded instruction lengths, 0 for unknown opcodes */
+uint8_t vm64_insn_length(uint8_t opcode) {
+    switch (opcode) {
+        case X64_HALT: case X64_NOP: case X64_SYSCALL: return 1;
+        case X64_OUT: case X64_PUSH: case X64_POP: return 2;
+        case X64_ADD: case X64_SUB: return 3;
+        case X64_VADD: case X64_VSUB: case X64_VMUL: case X64_VAND:
+        case X64_VOR: case X64_VXOR: case X64_VCMPEQ: case X64_VCMPGT:
+        case X64_VSPLAT: case X64_VREDADD: case X64_VREDMIN: case X64_VREDMAX:
+            return 4;
+        case X64_JMP: return 9;
+        case X64_MOVI: case X64_LOAD: case X64_STORE: return 10;
+        case X64_VLOAD: case X64_VSTORE: return 11;
+        case X64_LOADX: case X64_STOREX: return 12;
+        default: return 0;
+    }
+}
+
+static inline uint64_t vm64_be64(const uint8_t* p) {
+    uint64_t v = 0;
+    for (int i = 0; i < 8; i++) {
+        v = (v << 8) | p[i];
+    }
+    return v;
+}
+
+/* Decode the instruction at code (avail bytes readable). Returns its
+ * length, or 0 for an unknown opcode or one cut off by the end of code. */
+int vm64_decode(const uint8_t* code, size_t avail, VM64Insn* insn) {
+    if (!code || !insn || avail == 0) return 0;
+    
+    memset(insn, 0, sizeof(*insn));
+    insn->opcode = code[0];
+    insn->len = vm64_insn_length(code[0]);
+    if (insn->len == 0 || insn->len > avail) return 0;
+    
+    switch (insn->opcode) {
+        case X64_MOVI: case X64_LOAD: case X64_STORE:
+            insn->r1 = code[1];
+            insn->imm = vm64_be64(&code[2]);
+            break;
+        case X64_ADD: case X64_SUB:
+            insn->r1 = code[1];
+            insn->r2 = code[2];
+            break;
+        case X64_OUT: case X64_PUSH: case X64_POP:
+            insn->r1 = code[1];
+            break;
+        case X64_JMP:
+            insn->imm = vm64_be64(&code[1]);
+            break;
+        case X64_LOADX: case X64_STOREX:
+            insn->amode = code[1];
+            insn->r1 = code[2];
+            insn->r2 = code[3];
+            insn->imm = vm64_be64(&code[4]);
+            break;
+        case X64_VLOAD: case X64_VSTORE:
+            insn->shape = code[1];
+            insn->r1 = code[2];
+            insn->imm = vm64_be64(&code[3]);
+            break;
+        default:
+            if (insn->len == 4) {              /* Vector register ops */
+                insn->shape = code[1];
+                insn->r1 = code[2];
+                insn->r2 = code[3];
+            }
+            break;
+    }
+    return insn->len;
+}
+
+static const char* const vm64_reg_names[VM64_REG_COUNT] = {
+    "RAX", "RCX", "RDX", "RBX", "RSP", "RBP", "RSI", "RDI",
+    "R8", "R9", "R10", "R11", "R12", "R13", "R14", "R15"
+};
+
+static const char* vm64_reg_name(uint8_t reg) {
+    return reg < VM64_REG_COUNT ? vm64_reg_names[reg] : "R?";
+}
+
+static const char* vm64_mnemonic(uint8_t opcode) {
+    switch (opcode) {
+        case X64_HALT: return "HALT";       case X64_NOP: return "NOP";
+        case X64_MOVI: return "MOVI";       case X64_ADD: return "ADD";
+        case X64_SUB: return "SUB";         case X64_LOAD: return "LOAD";
+        case X64_STORE: return "STORE";     case X64_LOADX: return "LOADX";
+        case X64_STOREX: return "STOREX";   case X64_OUT: return "OUT";
+        case X64_JMP: return "JMP";         case X64_SYSCALL: return "SYSCALL";
+        case X64_PUSH: return "PUSH";       case X64_POP: return "POP";
+        case X64_VLOAD: return "VLOAD";     case X64_VSTORE: return "VSTORE";
+        case X64_VADD: return "VADD";       case X64_VSUB: return "VSUB";
+        case X64_VMUL: return "VMUL";       case X64_VAND: return "VAND";
+        case X64_VOR: return "VOR";         case X64_VXOR: return "VXOR";
+        case X64_VCMPEQ: return "VCMPEQ";   case X64_VCMPGT: return "VCMPGT";
+        case X64_VSPLAT: return "VSPLAT";   case X64_VREDADD: return "VREDADD";
+        case X64_VREDMIN: return "VREDMIN"; case X64_VREDMAX: return "VREDMAX";
+        default: return "???";
+    }
+}
+
+/* Write one line of disassembly for the instruction at code into out.
+ * Returns the instruction length, or 0 (and a DB line) if it does not
+ * decode. */
+int vm64_disasm(const uint8_t* code, size_t avail, char* out, size_t size) {
+    static const char widths[] = "BWDQ";
+    VM64Insn insn;
+    if (!out || size == 0) return 0;
+    if (!vm64_decode(code, avail, &insn)) {
+        snprintf(out, size, "DB 0x%02X", avail > 0 && code ? code[0] : 0);
+        return 0;
+    }
+    
+    const char* name = vm64_mnemonic(insn.opcode);
+    unsigned long long imm = (unsigned long long)insn.imm;
+    char shape[8];
+    snprintf(shape, sizeof(shape), "%c%d", widths[VM64_VSHAPE_LANE(insn.shape)],
+             (int)VM64_VSHAPE_BYTES(insn.shape) * 8);
+    
+    switch (insn.opcode) {
+        case X64_HALT: case X64_NOP: case X64_SYSCALL:
+            snprintf(out, size, "%s", name);
+            break;
+        case X64_MOVI:
+            snprintf(out, size, "%s %s, 0x%llX", name, vm64_reg_name(insn.r1), imm);
+            break;
+        case X64_ADD: case X64_SUB:
+            snprintf(out, size, "%s %s, %s", name, vm64_reg_name(insn.r1),
+                     vm64_reg_name(insn.r2));
+            break;
+        case X64_LOAD: case X64_STORE:
+            snprintf(out, size, "%s %s, [0x%llX]", name, vm64_reg_name(insn.r1), imm);
+            break;
+        case X64_LOADX: case X64_STOREX: {
+            char operand[48];
+            int64_t disp = (int64_t)insn.imm;
+            switch (VM64_AM_KIND(insn.amode)) {
+                case VM64_AM_ABS:
+                    snprintf(operand, sizeof(operand), "[0x%llX]", imm);
+                    break;
+                case VM64_AM_IND:
+                    snprintf(operand, sizeof(operand), "[%s]", vm64_reg_name(insn.r2));
+                    break;
+                case VM64_AM_DISP:
+                    snprintf(operand, sizeof(operand), "[%s%c0x%llX]",
+                             vm64_reg_name(insn.r2), disp < 0 ? '-' : '+',
+                             disp < 0 ? 0 - imm : imm);
+                    break;
+                default:
+                    snprintf(operand, sizeof(operand), "[?]");
+                    break;
+            }
+            snprintf(out, size, "%s.%c %s, %s", name, widths[insn.amode & 3],
+                     vm64_reg_name(insn.r1), operand);
+            break;
+        }
+        case X64_OUT: case X64_PUSH: case X64_POP:
+            snprintf(out, size, "%s %s", name, vm64_reg_name(insn.r1));
+            break;
+        case X64_JMP:
+            snprintf(out, size, "%s 0x%llX", name, imm);
+            break;
+        case X64_VLOAD: case X64_VSTORE:
+            snprintf(out, size, "%s.%s V%u, [0x%llX]", name, shape, insn.r1, imm);
+            break;
+        case X64_VSPLAT:
+            snprintf(out, size, "%s.%s V%u, %s", name, shape, insn.r1,
+                     vm64_reg_name(insn.r2));
+            break;
+        case X64_VREDADD: case X64_VREDMIN: case X64_VREDMAX:
+            snprintf(out, size, "%s.%s %s, V%u", name, shape,
+                     vm64_reg_name(insn.r1), insn.r2);
+            break;
+        default:
+            snprintf(out, size, "%s.%s V%u, V%u", name, shape, insn.r1, insn.r2);
+            break;
+    }
+    return insn.len;
+}
+
+/* Control flow of the instruction at code, for vm_cfg */
+static int vm64_flow_decode(const uint8_t* code, size_t avail, VMFlowInsn* out) {
+    VM64Insn insn;
+    int len = vm64_decode(code, avail, &insn);
+    if (!len) return 0;
+    
+    out->len = (uint8_t)len;
+    out->target = insn.imm;
+    switch (insn.opcode) {
+        case X64_HALT: out->flow = VM_FLOW_HALT; break;
+        case X64_JMP: out->flow = VM_FLOW_JUMP; break;
+        case X64_SYSCALL: out->flow = VM_FLOW_TRAP; break;
+        default: out->flow = VM_FLOW_NEXT; break;
+    }
+    return len;
+}
+
+const VMCfgIsa vm64_isa = { "vm64", vm64_flow_decode, vm64_disasm };
+
+/* Addressing modes the interpreter is specialised for */
+#define VM64_MODE_FLAT  0                 /* Bounds-checked offsets into RAM */
+#define VM64_MODE_GUARD 1                 /* Unchecked, faults via guard region */
+#define VM64_MODE_PAGED 2                 /* Page tables + software TLB */
+#define VM64_MODE_TRACE 4                 /* Flag: record to vm->trace */
+#define VM64_MODE_PRECISE 8               /* Flag: check limits every insn */
+#define VM64_MODE_COVER 16                /* Flag: record edges to vm->cover */
+#define VM64_MODE_BASE(mode) ((mode) & 3)
+
+#define VM64_ALWAYS_INLINE static inline __attribute__((always_inline))
+
+/* Stop on a guest memory fault */
+static void vm64_fault(VM64* vm) {
+    fprintf(stderr, "Page fault: %s at 0x%llX (RIP 0x%llX)\n",
+            (vm->fault & VM64_PROT_WRITE) ? "write" :
+            (vm->fault & VM64_PROT_EXEC) ? "exec" : "read",
+            (unsigned long long)vm->fault_addr, (unsigned long long)vm->rip);
+    vm->halted = 1;
+}
+
+/* Guard mode host pointer for a guest address; one test on the high bits
+ * keeps addresses of 4 GB and up from wrapping onto RAM */
+VM64_ALWAYS_INLINE uint8_t* vm64_guard_ptr(VM64* vm, uint64_t addr) {
+    if (__builtin_expect(addr >> 32, 0)) {
+        vm->fault_addr = addr;
+        return &vm->ram[VM64_GUARD_HIGH];
+    }
+    return &vm->ram[(uint32_t)addr];
+}
+
+/* Resolve a LOADX/STOREX operand. Returns 0 if the base register or
+ * addressing kind is invalid. */
+VM64_ALWAYS_INLINE int vm64_effective_addr(VM64* vm, uint8_t am, uint8_t base,
+                                           uint64_t disp, uint64_t* addr) {
+    uint8_t kind = VM64_AM_KIND(am);
+    if (kind == VM64_AM_ABS) {
+        *addr = disp;
+        return 1;
+    }
+    if (base >= VM64_REG_COUNT || (kind != VM64_AM_IND && kind != VM64_AM_DISP)) {
+        return 0;
+    }
+    *addr = vm->regs[base] + (kind == VM64_AM_DISP ? disp : 0);
+    return 1;
+}
+
+/* Locate the instruction at RIP. Returns a pointer to its bytes, copying
+ * into buf when it straddles two guest pages, or NULL on fault. */
+VM64_ALWAYS_INLINE const uint8_t* vm64_fetch(VM64* vm, uint8_t* buf,
+                                             const int mode) {
+    if (VM64_MODE_BASE(mode) == VM64_MODE_GUARD) {
+        return vm64_guard_ptr(vm, vm->rip);
+    }
+    if (VM64_MODE_BASE(mode) == VM64_MODE_FLAT) {
+        if (vm->rip >= VM64_RAM_SIZE) return NULL;
+        const uint8_t* p = &vm->ram[vm->rip];
+        uint8_t len = vm64_insn_length(p[0]);
+        if (len > VM64_RAM_SIZE - vm->rip) return NULL;
+        return p;
+    }
+    
+    const uint8_t* p = vm64_xlate(vm, vm->rip, VM64_PROT_EXEC);
+    if (!p) return NULL;
+    uint64_t avail = VM64_PAGE_SIZE - (vm->rip & (VM64_PAGE_SIZE - 1));
+    uint8_t len = vm64_insn_length(p[0]);
+    if (len <= avail) return p;
+    
+    const uint8_t* q = vm64_xlate(vm, vm->rip + avail, VM64_PROT_EXEC);
+    if (!q) return NULL;
+    memcpy(buf, p, avail);
+    memcpy(buf + avail, q, len - avail);
+    return buf;
+}
+
+/* Execute the instruction at RIP. mode is a constant at every call site,
+ * so each caller gets a copy with only its own address checks. RIP is
+ * only advanced once the instruction completes. Returns nonzero when the
+ * instruction ends a basic block (jump, syscall, halt or fault). */
+VM64_ALWAYS_INLINE int vm64_step(VM64* vm, const int mode) {
+    uint8_t buf[VM64_MAX_INSN_LEN];
+    const uint8_t* insn = vm64_fetch(vm, buf, mode);
+    if (!insn) {
+        if (VM64_MODE_BASE(mode) == VM64_MODE_PAGED) {
+            vm64_fault(vm);
+        } else {
+            vm->fault = VM64_PROT_EXEC;
+            vm->fault_addr = vm->rip;
+        }
         vm->halted = 1;
-        return;
+        return 1;
     }
     
-    uint8_t opcode = vm->ram[vm->rip];
-    vm->rip++;
+    uint8_t opcode = insn[0];
+    uint64_t rip = vm->rip;
+    uint64_t next = rip + vm64_insn_length(opcode);
+    uint64_t syscall_no = vm->regs[RAX];
+    uint64_t mem_addr = 0;
+    int mem_flags = 0;
     vm->cycle_count++;
     vm->instruction_count++;
     
-    if (vm->debug_mode) {
+    if ((mode & VM64_MODE_PRECISE) && vm->debug_mode) {
         printf("[RIP: 0x%016llX] Opcode: 0x%02X\n",
-               (unsigned long long)vm->rip - 1, opcode);
+               (unsigned long long)vm->rip, opcode);
     }
     
     switch (opcode) {
@@ -231,30 +838,16 @@ void vm64_execute_one(VM64* vm) {
             break;
         
         case X64_MOVI: {
-            if (vm->rip + 9 >= VM64_RAM_SIZE) {
-                vm->halted = 1;
-                break;
-            }
-            
-            uint8_t reg = vm->ram[vm->rip++];
-            uint64_t imm = 0;
-            for (int i = 0; i < 8; i++) {
-                imm = (imm << 8) | vm->ram[vm->rip++];
-            }
-            
+            uint8_t reg = insn[1];
             if (reg < VM64_REG_COUNT) {
-                vm->regs[reg] = imm;
+                vm->regs[reg] = vm64_be64(&insn[2]);
             }
             break;
         }
         
         case X64_ADD: {
-            if (vm->rip + 1 >= VM64_RAM_SIZE) {
-                vm->halted = 1;
-                break;
-            }
-            uint8_t dst = vm->ram[vm->rip++];
-            uint8_t src = vm->ram[vm->rip++];
+            uint8_t dst = insn[1];
+            uint8_t src = insn[2];
             
             if (dst < VM64_REG_COUNT && src < VM64_REG_COUNT) {
                 vm->regs[dst] += vm->regs[src];
@@ -263,12 +856,8 @@ void vm64_execute_one(VM64* vm) {
         }
         
         case X64_SUB: {
-            if (vm->rip + 1 >= VM64_RAM_SIZE) {
-                vm->halted = 1;
-                break;
-            }
-            uint8_t dst = vm->ram[vm->rip++];
-            uint8_t src = vm->ram[vm->rip++];
+            uint8_t dst = insn[1];
+            uint8_t src = insn[2];
             
             if (dst < VM64_REG_COUNT && src < VM64_REG_COUNT) {
                 vm->regs[dst] -= vm->regs[src];
@@ -277,126 +866,488 @@ void vm64_execute_one(VM64* vm) {
         }
         
         case X64_LOAD: {
-            if (vm->rip + 2 >= VM64_RAM_SIZE) {
-                vm->halted = 1;
-                break;
-            }
-            uint8_t dst = vm->ram[vm->rip++];
-            uint64_t addr = 0;
-            for (int i = 0; i < 8; i++) {
-                addr = (addr << 8) | vm->ram[vm->rip++];
-            }
+            uint8_t dst = insn[1];
+            uint64_t addr = vm64_be64(&insn[2]);
+            if (dst >= VM64_REG_COUNT) break;
+            mem_flags = VM64_TREC_READ;
+            mem_addr = addr;
             
-            if (dst < VM64_REG_COUNT && addr < VM64_RAM_SIZE) {
-                vm->regs[dst] = vm->ram[addr];
+            if (VM64_MODE_BASE(mode) == VM64_MODE_GUARD) {
+                vm->regs[dst] = *vm64_guard_ptr(vm, addr);
+            } else if (VM64_MODE_BASE(mode) == VM64_MODE_FLAT) {
+                if (addr < VM64_RAM_SIZE) vm->regs[dst] = vm->ram[addr];
+            } else {
+                const uint8_t* p = vm64_xlate(vm, addr, VM64_PROT_READ);
+                if (!p) {
+                    vm64_fault(vm);
+                    return 1;
+                }
+                vm->regs[dst] = *p;
             }
             break;
         }
         
         case X64_STORE: {
-            if (vm->rip + 2 >= VM64_RAM_SIZE) {
-                vm->halted = 1;
-                break;
+            uint8_t src = insn[1];
+            uint64_t addr = vm64_be64(&insn[2]);
+            if (src >= VM64_REG_COUNT) break;
+            mem_flags = VM64_TREC_WRITE;
+            mem_addr = addr;
+            
+            if (VM64_MODE_BASE(mode) == VM64_MODE_GUARD) {
+                *vm64_guard_ptr(vm, addr) = vm->regs[src] & 0xFF;
+                VM64_PAGE_WRITTEN(vm, addr / VM64_PAGE_SIZE);
+            } else if (VM64_MODE_BASE(mode) == VM64_MODE_FLAT) {
+                if (addr < VM64_RAM_SIZE) {
+                    vm->ram[addr] = vm->regs[src] & 0xFF;
+                    VM64_PAGE_WRITTEN(vm, addr / VM64_PAGE_SIZE);
+                }
+            } else {
+                uint8_t* p = vm64_xlate(vm, addr, VM64_PROT_WRITE);
+                if (!p) {
+                    vm64_fault(vm);
+                    return 1;
+                }
+                *p = vm->regs[src] & 0xFF;
             }
-            uint8_t src = vm->ram[vm->rip++];
-            uint64_t addr = 0;
-            for (int i = 0; i < 8; i++) {
-                addr = (addr << 8) | vm->ram[vm->rip++];
+            break;
+        }
+        
+        case X64_LOADX: {
+            uint8_t am = insn[1];
+            uint8_t dst = insn[2];
+            unsigned width = VM64_AM_WIDTH(am);
+            uint64_t addr;
+            if (dst >= VM64_REG_COUNT ||
+                !vm64_effective_addr(vm, am, insn[3], vm64_be64(&insn[4]), &addr)) break;
+            mem_flags = VM64_TREC_READ;
+            mem_addr = addr;
+            
+            if (VM64_MODE_BASE(mode) == VM64_MODE_GUARD) {
+                vm->regs[dst] = vm64_get_be(vm64_guard_ptr(vm, addr), width);
+            } else if (VM64_MODE_BASE(mode) == VM64_MODE_FLAT) {
+                if (addr < VM64_RAM_SIZE && width <= VM64_RAM_SIZE - addr) {
+                    vm->regs[dst] = vm64_get_be(&vm->ram[addr], width);
+                }
+            } else {
+                const uint8_t* p = vm64_xlate(vm, addr, VM64_PROT_READ);
+                uint8_t bytes[8];
+                if (p && (addr & (VM64_PAGE_SIZE - 1)) + width > VM64_PAGE_SIZE) {
+                    /* Straddles a page boundary */
+                    p = vm64_read_guest(vm, addr, bytes, width) == 0 ? bytes : NULL;
+                }
+                if (!p) {
+                    vm64_fault(vm);
+                    return 1;
+                }
+                vm->regs[dst] = vm64_get_be(p, width);
             }
+            break;
+        }
+        
+        case X64_STOREX: {
+            uint8_t am = insn[1];
+            uint8_t src = insn[2];
+            unsigned width = VM64_AM_WIDTH(am);
+            uint64_t addr;
+            if (src >= VM64_REG_COUNT ||
+                !vm64_effective_addr(vm, am, insn[3], vm64_be64(&insn[4]), &addr)) break;
+            mem_flags = VM64_TREC_WRITE;
+            mem_addr = addr;
             
-            if (src < VM64_REG_COUNT && addr < VM64_RAM_SIZE) {
-                vm->ram[addr] = vm->regs[src] & 0xFF;
+            if (VM64_MODE_BASE(mode) == VM64_MODE_GUARD) {
+                vm64_put_be(vm64_guard_ptr(vm, addr), width, vm->regs[src]);
+                vm64_mark_dirty(vm, addr, width);
+            } else if (VM64_MODE_BASE(mode) == VM64_MODE_FLAT) {
+                if (addr < VM64_RAM_SIZE && width <= VM64_RAM_SIZE - addr) {
+                    vm64_put_be(&vm->ram[addr], width, vm->regs[src]);
+                    vm64_mark_dirty(vm, addr, width);
+                }
+            } else {
+                uint8_t* p = vm64_xlate(vm, addr, VM64_PROT_WRITE);
+                if (p && (addr & (VM64_PAGE_SIZE - 1)) + width <= VM64_PAGE_SIZE) {
+                    vm64_put_be(p, width, vm->regs[src]);
+                } else {
+                    uint8_t bytes[8];
+                    vm64_put_be(bytes, width, vm->regs[src]);
+                    if (!p || vm64_write_guest(vm, addr, bytes, width) != 0) {
+                        vm64_fault(vm);
+                        return 1;
+                    }
+                }
             }
             break;
         }
         
         case X64_OUT: {
-            if (vm->rip >= VM64_RAM_SIZE) {
-                vm->halted = 1;
-                break;
-            }
-            uint8_t reg = vm->ram[vm->rip++];
+            uint8_t reg = insn[1];
             
             if (reg < VM64_REG_COUNT) {
-                putchar(vm->regs[reg] & 0xFF);
-                fflush(stdout);
+                uint8_t ch = vm->regs[reg] & 0xFF;
+                if (vm->io_write) {
+                    vm->io_write(vm->io_user, STDOUT_FILENO, &ch, 1);
+                } else {
+                    putchar(ch);
+                    fflush(stdout);
+                }
             }
             break;
         }
         
         case X64_SYSCALL:
-            vm64_syscall_handler(vm);
+            vm->rip = next;
+            if (vm->trap_syscalls) {
+                vm->syscall_pending = 1;
+            } else {
+                vm64_syscall_handler(vm);
+            }
             break;
         
-        case X64_JMP: {
-            if (vm->rip + 7 >= VM64_RAM_SIZE) {
-                vm->halted = 1;
-                break;
-            }
-            uint64_t addr = 0;
-            for (int i = 0; i < 8; i++) {
-                addr = (addr << 8) | vm->ram[vm->rip++];
-            }
-            vm->rip = addr;
+        case X64_JMP:
+            next = vm64_be64(&insn[1]);
             break;
-        }
         
         case X64_PUSH: {
-            if (vm->rip >= VM64_RAM_SIZE) {
-                vm->halted = 1;
-                break;
+            uint8_t reg = insn[1];
+            if (reg >= VM64_REG_COUNT) break;
+            mem_flags = VM64_TREC_WRITE;
+            mem_addr = vm->rsp - 8;
+            
+            uint8_t bytes[8];
+            uint64_t val = vm->regs[reg];
+            for (int i = 0; i < 8; i++) {
+                bytes[i] = (val >> (56 - i*8)) & 0xFF;
             }
-            uint8_t reg = vm->ram[vm->rip++];
             
-            if (reg < VM64_REG_COUNT && vm->rsp > 7) {
-                vm->rsp -= 8;
-                uint64_t val = vm->regs[reg];
-                for (int i = 0; i < 8; i++) {
-                    vm->ram[vm->rsp + i] = (val >> (56 - i*8)) & 0xFF;
-                }
+            if (VM64_MODE_BASE(mode) == VM64_MODE_GUARD) {
+                memcpy(vm64_guard_ptr(vm, vm->rsp - 8), bytes, 8);
+                vm64_mark_dirty(vm, vm->rsp - 8, 8);
+            } else if (VM64_MODE_BASE(mode) == VM64_MODE_FLAT) {
+                if (vm->rsp <= 7 ||
+                    vm64_write_guest(vm, vm->rsp - 8, bytes, 8) != 0) break;
+            } else if (vm64_write_guest(vm, vm->rsp - 8, bytes, 8) != 0) {
+                vm64_fault(vm);
+                return 1;
             }
+            vm->rsp -= 8;
             break;
         }
         
         case X64_POP: {
-            if (vm->rip >= VM64_RAM_SIZE) {
-                vm->halted = 1;
+            uint8_t reg = insn[1];
+            if (reg >= VM64_REG_COUNT) break;
+            mem_flags = VM64_TREC_READ;
+            mem_addr = vm->rsp;
+            
+            uint8_t bytes[8];
+            if (VM64_MODE_BASE(mode) == VM64_MODE_GUARD) {
+                memcpy(bytes, vm64_guard_ptr(vm, vm->rsp), 8);
+            } else if (vm64_read_guest(vm, vm->rsp, bytes, 8) != 0) {
+                if (VM64_MODE_BASE(mode) == VM64_MODE_PAGED) {
+                    vm64_fault(vm);
+                    return 1;
+                }
                 break;
             }
-            uint8_t reg = vm->ram[vm->rip++];
+            vm->regs[reg] = vm64_be64(bytes);
+            vm->rsp += 8;
+            break;
+        }
+        
+        case X64_VLOAD: {
+            uint8_t shape = insn[1];
+            uint8_t dst = insn[2];
+            uint64_t addr = vm64_be64(&insn[3]);
+            uint32_t len = VM64_VSHAPE_BYTES(shape);
+            if (dst >= VM64_VREG_COUNT) break;
+            mem_flags = VM64_TREC_READ;
+            mem_addr = addr;
             
-            if (reg < VM64_REG_COUNT && vm->rsp + 8 <= VM64_RAM_SIZE) {
-                uint64_t val = 0;
-                for (int i = 0; i < 8; i++) {
-                    val = (val << 8) | vm->ram[vm->rsp + i];
+            VM64Vec v;
+            memset(&v, 0, sizeof(v));
+            if (VM64_MODE_BASE(mode) == VM64_MODE_GUARD) {
+                memcpy(v.b, vm64_guard_ptr(vm, addr), len);
+            } else if (vm64_read_guest(vm, addr, v.b, len) != 0) {
+                if (VM64_MODE_BASE(mode) == VM64_MODE_PAGED) {
+                    vm64_fault(vm);
+                    return 1;
                 }
-                vm->regs[reg] = val;
-                vm->rsp += 8;
+                break;
+            }
+            vm->vregs[dst] = v;
+            break;
+        }
+        
+        case X64_VSTORE: {
+            uint8_t shape = insn[1];
+            uint8_t src = insn[2];
+            uint64_t addr = vm64_be64(&insn[3]);
+            uint32_t len = VM64_VSHAPE_BYTES(shape);
+            if (src >= VM64_VREG_COUNT) break;
+            mem_flags = VM64_TREC_WRITE;
+            mem_addr = addr;
+            
+            if (VM64_MODE_BASE(mode) == VM64_MODE_GUARD) {
+                memcpy(vm64_guard_ptr(vm, addr), vm->vregs[src].b, len);
+                vm64_mark_dirty(vm, addr, len);
+            } else if (vm64_write_guest(vm, addr, vm->vregs[src].b, len) != 0 &&
+                       VM64_MODE_BASE(mode) == VM64_MODE_PAGED) {
+                vm64_fault(vm);
+                return 1;
+            }
+            break;
+        }
+        
+        case X64_VADD: case X64_VSUB: case X64_VMUL: case X64_VAND:
+        case X64_VOR: case X64_VXOR: case X64_VCMPEQ: case X64_VCMPGT: {
+            uint8_t dst = insn[2];
+            uint8_t src = insn[3];
+            if (dst < VM64_VREG_COUNT && src < VM64_VREG_COUNT) {
+                vm64_vec_alu(opcode, insn[1], &vm->vregs[dst], &vm->vregs[src]);
+            }
+            break;
+        }
+        
+        case X64_VSPLAT: {
+            uint8_t dst = insn[2];
+            uint8_t src = insn[3];
+            if (dst < VM64_VREG_COUNT && src < VM64_REG_COUNT) {
+                vm64_vec_splat(insn[1], &vm->vregs[dst], vm->regs[src]);
+            }
+            break;
+        }
+        
+        case X64_VREDADD: case X64_VREDMIN: case X64_VREDMAX: {
+            uint8_t dst = insn[2];
+            uint8_t src = insn[3];
+            if (dst < VM64_REG_COUNT && src < VM64_VREG_COUNT) {
+                vm->regs[dst] = vm64_vec_reduce(opcode, insn[1], &vm->vregs[src]);
             }
             break;
         }
         
         default:
             fprintf(stderr, "Unknown opcode: 0x%02X at RIP 0x%llX\n",
-                    opcode, (unsigned long long)vm->rip - 1);
+                    opcode, (unsigned long long)vm->rip);
+            vm->fault = VM64_PROT_EXEC;
+            vm->fault_addr = vm->rip;
             vm->halted = 1;
+            return 1;
+    }
+    
+    if (mode & VM64_MODE_TRACE) {
+        vm64_trace_record(vm->trace, vm, rip, opcode, mem_flags, mem_addr,
+                          syscall_no);
     }
+    vm->rip = next;
+    return opcode == X64_JMP || opcode == X64_SYSCALL || opcode == X64_HALT;
+}
+
+/* Check if RIP is at a breakpoint */
+static int vm64_at_breakpoint(VM64* vm) {
+    for (int i = 0; i < vm->breakpoint_count; i++) {
+        if (vm->breakpoints[i] == vm->rip) return 1;
+    }
+    return 0;
 }
 
-/* Run VM64 */
-void vm64_run(VM64* vm) {
+/* Consume a pending vm64_request_stop() */
+static inline int vm64_stop_pending(VM64* vm) {
+    if (!__atomic_load_n(&vm->stop_requested, __ATOMIC_RELAXED)) return 0;
+    __atomic_store_n(&vm->stop_requested, 0, __ATOMIC_RELAXED);
+    return 1;
+}
+
+/* Count the transfer that just ended a block, AFL-style: the edge is
+ * (previous block, this one) */
+static inline void vm64_cover_edge(VM64Cover* cover, uint64_t rip) {
+    uint16_t cur = (uint16_t)((rip * 0x9E3779B97F4A7C15ull) >> 48);
+    uint16_t edge = cur ^ cover->prev;
+    uint8_t count = cover->map[edge];
+    if (count == 0) cover->hits[cover->nhits++] = edge;
+    cover->map[edge] = (uint8_t)(count + 1 + (count == 255));
+    cover->prev = cur >> 1;
+}
+
+/* Interpreter loop, specialised per addressing mode like vm64_step.
+ * The fast variant runs whole basic blocks and only looks at halt,
+ * syscall, budget and stop requests when one ends, so a budget may be
+ * overshot by up to one block. VM64_MODE_PRECISE checks before every
+ * instruction, for breakpoints, single steps, tracing and debug output. */
+VM64_ALWAYS_INLINE VM64Exit vm64_loop(VM64* vm, uint64_t stop,
+                                      uint64_t skip_rip, const int mode) {
+    if (!(mode & VM64_MODE_PRECISE)) {
+        if (vm->halted) return VM64_EXIT_HALTED;
+        for (;;) {
+            while (!vm64_step(vm, mode)) {}
+            if (mode & VM64_MODE_COVER) vm64_cover_edge(vm->cover, vm->rip);
+            
+            if (vm->halted) return VM64_EXIT_HALTED;
+            if (vm->syscall_pending) return VM64_EXIT_SYSCALL;
+            if (vm->instruction_count >= stop) return VM64_EXIT_BUDGET;
+            if (vm64_stop_pending(vm)) return VM64_EXIT_STOPPED;
+        }
+    }
+    
+    while (!vm->halted) {
+        if (vm->instruction_count >= stop) return VM64_EXIT_BUDGET;
+        if (vm64_stop_pending(vm)) return VM64_EXIT_STOPPED;
+        
+        if (vm->breakpoint_count > 0 && vm->rip != skip_rip &&
+            vm64_at_breakpoint(vm)) {
+            vm->resume_rip = vm->rip;
+            return VM64_EXIT_BREAKPOINT;
+        }
+        skip_rip = UINT64_MAX;
+        
+        vm64_step(vm, mode);
+        if (vm->syscall_pending) return VM64_EXIT_SYSCALL;
+    }
+    return VM64_EXIT_HALTED;
+}
+
+static VM64Exit vm64_loop_flat(VM64* vm, uint64_t stop, uint64_t skip_rip) {
+    return vm64_loop(vm, stop, skip_rip, VM64_MODE_FLAT);
+}
+
+static VM64Exit vm64_loop_paged(VM64* vm, uint64_t stop, uint64_t skip_rip) {
+    return vm64_loop(vm, stop, skip_rip, VM64_MODE_PAGED);
+}
+
+/* Fast loops that also record edge coverage */
+static VM64Exit vm64_loop_cover(VM64* vm, uint64_t stop, uint64_t skip_rip) {
+    if (vm->paging) return vm64_loop(vm, stop, skip_rip, VM64_MODE_PAGED | VM64_MODE_COVER);
+    return vm64_loop(vm, stop, skip_rip, VM64_MODE_FLAT | VM64_MODE_COVER);
+}
+
+/* Per-instruction checks; tracing always runs here since it records
+ * every instruction anyway */
+static VM64Exit vm64_loop_precise(VM64* vm, uint64_t stop, uint64_t skip_rip) {
+    const int p = VM64_MODE_PRECISE;
+    const int t = VM64_MODE_PRECISE | VM64_MODE_TRACE;
+    
+    if (vm->paging) {
+        if (vm->trace) return vm64_loop(vm, stop, skip_rip, VM64_MODE_PAGED | t);
+        return vm64_loop(vm, stop, skip_rip, VM64_MODE_PAGED | p);
+    }
+    if (vm->ram_flags & VM64_RAM_GUARD) {
+        if (vm->trace) return vm64_loop(vm, stop, skip_rip, VM64_MODE_GUARD | t);
+        return vm64_loop(vm, stop, skip_rip, VM64_MODE_GUARD | p);
+    }
+    if (vm->trace) return vm64_loop(vm, stop, skip_rip, VM64_MODE_FLAT | t);
+    return vm64_loop(vm, stop, skip_rip, VM64_MODE_FLAT | p);
+}
+
+/* Guard mode loop: a fault in the guard region unwinds back here */
+static VM64Exit vm64_loop_guarded(VM64* vm, uint64_t stop, uint64_t skip_rip,
+                                  int precise) {
+    sigjmp_buf env;
+    VM64* prev_vm = vm64_guard_vm;
+    sigjmp_buf* prev_env = vm64_guard_env;
+    volatile VM64Exit reason = VM64_EXIT_HALTED;
+    
+    vm64_guard_vm = vm;
+    vm64_guard_env = &env;
+    if (sigsetjmp(env, 0) == 0) {
+        reason = precise ? vm64_loop_precise(vm, stop, skip_rip)
+                         : vm64_loop(vm, stop, skip_rip, VM64_MODE_GUARD);
+    } else {
+        fprintf(stderr, "Guard fault: access at 0x%llX (RIP 0x%llX)\n",
+                (unsigned long long)vm->fault_addr,
+                (unsigned long long)vm->rip);
+        vm->fault = VM64_PROT_READ | VM64_PROT_WRITE;
+        vm->halted = 1;
+        reason = VM64_EXIT_HALTED;
+    }
+    vm64_guard_vm = prev_vm;
+    vm64_guard_env = prev_env;
+    return reason;
+}
+
+static VM64Exit vm64_dispatch(VM64* vm, uint64_t stop, uint64_t skip_rip) {
+    int precise = vm->breakpoint_count > 0 || vm->trace || vm->debug_mode ||
+                  stop - vm->instruction_count <= 1;
+    
+    if (vm->ram_flags & VM64_RAM_GUARD && !vm->paging) {
+        return vm64_loop_guarded(vm, stop, skip_rip, precise);
+    }
+    if (precise) return vm64_loop_precise(vm, stop, skip_rip);
+    if (vm->cover) return vm64_loop_cover(vm, stop, skip_rip);
+    if (vm->paging) return vm64_loop_paged(vm, stop, skip_rip);
+    return vm64_loop_flat(vm, stop, skip_rip);
+}
+
+/* Execute one instruction */
+void vm64_execute_one(VM64* vm) {
     if (!vm) return;
+    if (vm->halted) return;
+    
+    /* A breakpoint at RIP must not stop a single step */
+    vm64_dispatch(vm, vm->instruction_count + 1, vm->rip);
+}
+
+/* Run for at most max_insns instructions (0 = no limit) or until an event.
+ * The budget is checked at basic block boundaries, so a run may retire a
+ * few more instructions than asked; it is exact with breakpoints set.
+ * Resumable: calling again continues where the previous call stopped,
+ * stepping over a breakpoint it stopped at. A trapped syscall must be
+ * serviced (vm64_syscall_handler or by setting RAX) before resuming. */
+VM64Exit vm64_run_budget(VM64* vm, uint64_t max_insns) {
+    if (!vm) return VM64_EXIT_HALTED;
+    
+    uint64_t stop = max_insns ? vm->instruction_count + max_insns : UINT64_MAX;
+    uint64_t skip_rip = vm->resume_rip;
+    vm->resume_rip = UINT64_MAX;
+    vm->syscall_pending = 0;
+    
+    return vm64_dispatch(vm, stop, skip_rip);
+}
+
+/* Ask a running vm64_run_budget() to return VM64_EXIT_STOPPED at the
+ * next basic block boundary. Async-signal-safe, callable from any thread. */
+void vm64_request_stop(VM64* vm) {
+    if (vm) __atomic_store_n(&vm->stop_requested, 1, __ATOMIC_RELAXED);
+}
+
+/* Run VM64 until it halts, stops or reaches vm->max_insns */
+VM64Exit vm64_run(VM64* vm) {
+    if (!vm) return VM64_EXIT_HALTED;
     
     printf("Starting VM64 execution from RIP: 0x%llX\n",
            (unsigned long long)vm->rip);
+    fflush(stdout);  /* Guest output may bypass stdio */
+    
+    VM64Exit reason;
+    do {
+        uint64_t budget = 0;
+        if (vm->max_insns) {
+            if (vm->instruction_count >= vm->max_insns) {
+                reason = VM64_EXIT_BUDGET;
+                break;
+            }
+            budget = vm->max_insns - vm->instruction_count;
+        }
+        reason = vm64_run_budget(vm, budget);
+        if (reason == VM64_EXIT_SYSCALL) vm64_syscall_handler(vm);
+    } while (reason == VM64_EXIT_SYSCALL);
+    if (vm->io_flush) vm->io_flush(vm->io_user);
     
-    while (!vm->halted && vm->rip < VM64_RAM_SIZE) {
-        vm64_execute_one(vm);
+    if (reason == VM64_EXIT_BREAKPOINT) {
+        printf("\nBreakpoint hit at RIP: 0x%llX\n", (unsigned long long)vm->rip);
+        return reason;
     }
     
-    printf("\nVM64 halted\n");
+    if (reason == VM64_EXIT_BUDGET) {
+        printf("\nVM64 stopped: instruction limit reached at RIP 0x%llX\n",
+               (unsigned long long)vm->rip);
+    } else if (reason == VM64_EXIT_STOPPED) {
+        printf("\nVM64 stopped at RIP 0x%llX\n", (unsigned long long)vm->rip);
+    } else {
+        printf("\nVM64 halted\n");
+    }
     printf("Total instructions: %llu\n", (unsigned long long)vm->instruction_count);
     printf("Total cycles: %llu\n", (unsigned long long)vm->cycle_count);
+    return reason;
 }
 
 /* Dump VM64 state */
@@ -410,21 +1361,99 @@ void vm64_dump_state(VM64* vm) {
     printf("Instructions: %llu  Cycles: %llu\n",
            (unsigned long long)vm->instruction_count,
            (unsigned long long)vm->cycle_count);
+    printf("RAM: %d MB%s%s%s",
+           (int)(VM64_RAM_SIZE / (1024*1024)),
+           (vm->ram_flags & VM64_RAM_HUGETLB) ? " hugetlbfs" : "",
+           (vm->ram_flags & VM64_RAM_THP) ? " THP" : "",
+           (vm->ram_flags & VM64_RAM_GUARD) ? " guarded" : "");
+    if (vm->numa_node >= 0) printf(" node %d", vm->numa_node);
+    VM64MemUsage usage;
+    vm64_mem_usage(vm, &usage);
+    printf(", %llu KB shared, %llu KB private\n",
+           (unsigned long long)usage.shared_bytes / 1024,
+           (unsigned long long)usage.private_bytes / 1024);
+    if (vm->paging) {
+        printf("Paging: %llu pages mapped, brk 0x%llX, TLB misses %llu\n",
+               (unsigned long long)vm->mapped_pages,
+               (unsigned long long)vm->brk,
+               (unsigned long long)vm->tlb_misses);
+    }
     
     printf("\nRegisters:\n");
-    const char* reg_names[] = {
-        "RAX", "RCX", "RDX", "RBX", "RSP", "RBP", "RSI", "RDI",
-        "R8", "R9", "R10", "R11", "R12", "R13", "R14", "R15"
-    };
-    
     for (int i = 0; i < VM64_REG_COUNT; i++) {
         printf("  %3s: 0x%016llX (%lld)\n",
-               reg_names[i], (unsigned long long)vm->regs[i],
+               vm64_reg_names[i], (unsigned long long)vm->regs[i],
                (long long)vm->regs[i]);
     }
+    
+    /* Vector registers, only those in use (high qword first) */
+    static const VM64Vec zero;
+    for (int i = 0; i < VM64_VREG_COUNT; i++) {
+        const VM64Vec* v = &vm->vregs[i];
+        if (memcmp(v, &zero, sizeof(zero)) == 0) continue;
+        printf("  V%-2d: %016llX %016llX %016llX %016llX\n", i,
+               (unsigned long long)v->q[3], (unsigned long long)v->q[2],
+               (unsigned long long)v->q[1], (unsigned long long)v->q[0]);
+    }
+    printf("  (vector backend: %s)\n", vm64_vec_backend());
 }
 
 /* Set debug mode */
 void vm64_set_debug(VM64* vm, int enable) {
     if (vm) vm->debug_mode = enable;
 }
+
+/* Route guest console and fd I/O through callbacks */
+void vm64_set_io(VM64* vm, VM64WriteFn write_fn, VM64ReadFn read_fn, void* user) {
+    if (!vm) return;
+    
+    vm->io_write = write_fn;
+    vm->io_read = read_fn;
+    vm->io_user = user;
+}
+
+/* Report how much guest RAM is shared vs private to this VM */
+void vm64_mem_usage(VM64* vm, VM64MemUsage* usage) {
+    if (!vm || !usage) return;
+    
+    usage->shared_bytes = 0;
+    usage->private_bytes = 0;
+
+#ifdef __APPLE__
+    char resident[VM64_PAGE_COUNT];
+#else
+    unsigned char resident[VM64_PAGE_COUNT];
+#endif
+    int have_resident = VM64_PAGE_SIZE == sysconf(_SC_PAGESIZE) &&
+                        mincore(vm->ram, VM64_RAM_SIZE, resident) == 0;
+    
+    for (uint64_t p = 0; p < VM64_PAGE_COUNT; p++) {
+        if (vm->page_flags[p] & VM64_PAGE_SHARED) {
+            usage->shared_bytes += VM64_PAGE_SIZE;
+        } else if (!have_resident || (resident[p] & 1)) {
+            usage->private_bytes += VM64_PAGE_SIZE;
+        }
+    }
+}
+
+/* Add a breakpoint */
+void vm64_add_breakpoint(VM64* vm, uint64_t addr) {
+    if (!vm || vm->breakpoint_count >= VM64_MAX_BREAKPOINTS) return;
+    
+    vm->breakpoints[vm->breakpoint_count++] = addr;
+}
+
+/* Remove a breakpoint */
+void vm64_remove_breakpoint(VM64* vm, uint64_t addr) {
+    if (!vm) return;
+    
+    for (int i = 0; i < vm->breakpoint_count; i++) {
+        if (vm->breakpoints[i] == addr) {
+            for (int j = i; j < vm->breakpoint_count - 1; j++) {
+                vm->breakpoints[j] = vm->breakpoints[j+1];
+            }
+            vm->breakpoint_count--;
+            break;
+        }
+    }
+}
@@ -3,12 +3,57 @@
 
 #include <stdint.h>
 #include <stddef.h>
+#include <string.h>
+#include "vm_cfg.h"
 #include <sys/syscall.h>
 
 /* Extended 64-bit VM with Linux compatibility */
 #define VM64_RAM_SIZE (8 * 1024 * 1024)  /* 8 MB */
 #define VM64_REG_COUNT 16                 /* RAX-R15 */
 
+/* Guest page tracking */
+#define VM64_PAGE_SHIFT 12
+#define VM64_PAGE_SIZE 4096
+#define VM64_PAGE_COUNT (VM64_RAM_SIZE / VM64_PAGE_SIZE)
+#define VM64_PAGE_DIRTY 0x1               /* Written since last checkpoint */
+#define VM64_PAGE_SHARED 0x2              /* Still backed by a shared host page */
+
+/* Paged guest address space (see vm64_mmu.h) */
+#define VM64_PROT_READ   0x1              /* Same values as PROT_* */
+#define VM64_PROT_WRITE  0x2
+#define VM64_PROT_EXEC   0x4
+#define VM64_PTE_PRESENT 0x8
+#define VM64_TLB_SIZE 256                 /* Direct-mapped, power of two */
+#define VM64_VA_BITS 48
+#define VM64_STACK_TOP   0x00007ffffffff000ULL
+#define VM64_STACK_SIZE  (256 * 1024)
+#define VM64_MMAP_BASE   0x00007fff00000000ULL /* mmap grows down from here */
+#define VM64_MAX_INSN_LEN 16
+
+/* Software TLB entry */
+typedef struct {
+    uint64_t vpn;                          /* Virtual page number (tag) */
+    uint8_t* host;                         /* Host address of the frame */
+    uint32_t frame;                        /* Physical frame index */
+    uint32_t prot;                         /* VM64_PROT_* */
+} VM64TlbEntry;
+
+/* Guest RAM placement flags (see vm64_create_ex) */
+#define VM64_HUGE_PAGE_SIZE (2 * 1024 * 1024)
+#define VM64_RAM_THP        0x1           /* 2 MB aligned + MADV_HUGEPAGE */
+#define VM64_RAM_HUGETLB    0x2           /* Explicit hugetlbfs pages */
+#define VM64_RAM_NUMA_LOCAL 0x4           /* Bind to the running thread's node */
+#define VM64_RAM_GUARD      0x8           /* Inaccessible reservation after RAM */
+#define VM64_RAM_DEFAULT    (VM64_RAM_THP | VM64_RAM_NUMA_LOCAL)
+
+/* Guard mode: memory opcodes index RAM with a guest address below 4 GB
+ * without a bounds check. RAM sits at the start of a VM64_GUARD_RESERVE
+ * host reservation whose remainder is PROT_NONE, so any such access past
+ * RAM lands in the guard and SIGSEGV is turned into a guest fault.
+ * Addresses of 4 GB and up are sent to VM64_GUARD_HIGH, also in the guard. */
+#define VM64_GUARD_RESERVE (8ULL * 1024 * 1024 * 1024)
+#define VM64_GUARD_HIGH (VM64_GUARD_RESERVE - VM64_PAGE_SIZE)
+
 /* x86-64 Register indices */
 typedef enum {
     RAX = 0, RCX = 1, RDX = 2, RBX = 3,
@@ -43,6 +88,8 @@ typedef enum {
     X64_LOAD = 0x30,
     X64_STORE = 0x31,
     X64_MEMCPY = 0x32,
+    X64_LOADX = 0x33,                      /* mode reg base disp64 */
+    X64_STOREX = 0x34,                     /* mode reg base disp64 */
     
     /* I/O */
     X64_OUT = 0x40,
@@ -61,12 +108,107 @@ typedef enum {
     /* Stack */
     X64_PUSH = 0x90,
     X64_POP = 0x91,
+    
+    /* Vector extension; the byte after the opcode is the shape */
+    X64_VLOAD = 0xA0,                      /* shape v addr64 */
+    X64_VSTORE = 0xA1,                     /* shape v addr64 */
+    X64_VADD = 0xA2,                       /* shape vd vs */
+    X64_VSUB = 0xA3,
+    X64_VMUL = 0xA4,                       /* Low half of each product */
+    X64_VAND = 0xA5,
+    X64_VOR = 0xA6,
+    X64_VXOR = 0xA7,
+    X64_VCMPEQ = 0xA8,                     /* Lane = all ones if equal */
+    X64_VCMPGT = 0xA9,                     /* Signed greater-than */
+    X64_VSPLAT = 0xAA,                     /* shape vd r: broadcast a register */
+    X64_VREDADD = 0xAB,                    /* shape r vs: r = sum of lanes */
+    X64_VREDMIN = 0xAC,                    /* Unsigned minimum lane */
+    X64_VREDMAX = 0xAD,                    /* Unsigned maximum lane */
 } X64Opcode;
 
-/* VM64 State */
+/* LOADX/STOREX mode byte: access width in bits 0-1 (1, 2, 4 or 8 bytes)
+ * and addressing in bits 2-3. Values are big-endian like PUSH/POP and
+ * loads zero-extend. Same layout as the 8-bit VM's VM_AM_* modes. */
+#define VM64_AM_ABS  0x00                  /* [disp64] */
+#define VM64_AM_IND  0x04                  /* [base] */
+#define VM64_AM_DISP 0x08                  /* [base + disp64] */
+#define VM64_AM_KIND(mode) ((mode) & 0x0C)
+#define VM64_AM_WIDTH(mode) (1u << ((mode) & 3))
+
+/* Vector registers and shape byte: lane width in bits 0-1 (8/16/32/64),
+ * bit 2 selects 256-bit vectors. 128-bit results zero the upper half. */
+#define VM64_VREG_COUNT 16
+#define VM64_VREG_BYTES 32
+#define VM64_VSHAPE_256 0x04
+#define VM64_VSHAPE_LANE(shape) ((shape) & 3)
+#define VM64_VSHAPE_BYTES(shape) ((shape) & VM64_VSHAPE_256 ? 32 : 16)
+
+typedef union {
+    uint8_t b[VM64_VREG_BYTES];
+    uint16_t w[VM64_VREG_BYTES / 2];
+    uint32_t d[VM64_VREG_BYTES / 4];
+    uint64_t q[VM64_VREG_BYTES / 8];
+} VM64Vec;
+
+/* A decoded instruction (see vm64_decode) */
+typedef struct {
+    uint8_t opcode;
+    uint8_t len;                           /* Encoded length in bytes */
+    uint8_t r1;                            /* Destination or only register */
+    uint8_t r2;                            /* Source register (ADD/SUB, vector) */
+    uint8_t shape;                         /* Vector shape byte */
+    uint8_t amode;                         /* LOADX/STOREX mode byte */
+    uint64_t imm;                          /* MOVI value, LOAD/STORE address,
+                                              LOADX/STOREX displacement,
+                                              JMP target */
+} VM64Insn;
+
+/* Guest RAM footprint (see vm64_mem_usage) */
+typedef struct {
+    uint64_t shared_bytes;                 /* Pages still shared with other VMs */
+    uint64_t private_bytes;                /* Resident pages owned by this VM */
+} VM64MemUsage;
+
+/* Why vm64_run_budget() returned */
+typedef enum {
+    VM64_EXIT_HALTED = 0,                  /* Guest halted or faulted */
+    VM64_EXIT_SYSCALL,                     /* SYSCALL trapped (trap_syscalls) */
+    VM64_EXIT_BUDGET,                      /* Instruction budget exhausted */
+    VM64_EXIT_BREAKPOINT,                  /* RIP reached a breakpoint */
+    VM64_EXIT_STOPPED,                     /* vm64_request_stop() was called */
+} VM64Exit;
+
+#define VM64_MAX_BREAKPOINTS 16
+#define VM64_COVER_SIZE 65536             /* Edge-coverage bitmap bytes */
+
+/* Edge coverage recorded by the run loops while vm->cover is set. map
+ * counts hits per edge between blocks; hits lists each edge the first
+ * time it is hit, and counters never wrap back to zero (see VMFuzz). */
+typedef struct {
+    uint8_t* map;                          /* VM64_COVER_SIZE hit counters */
+    uint16_t* hits;                        /* VM64_COVER_SIZE entries */
+    uint32_t nhits;
+    uint16_t prev;                         /* Previous block, shifted right */
+} VM64Cover;
+
+/* Guest I/O hooks; return bytes transferred or -1 like write(2)/read(2) */
+typedef long (*VM64WriteFn)(void* user, int fd, const uint8_t* buf, size_t len);
+typedef long (*VM64ReadFn)(void* user, int fd, uint8_t* buf, size_t len);
+typedef void (*VM64FlushFn)(void* user);
+
+/* VM64 State
+ *
+ * Instances share no mutable state, so different threads may drive
+ * different instances concurrently; a single instance must only be used
+ * by one thread at a time. */
 typedef struct {
     uint8_t* ram;                          /* Dynamically allocated memory */
+    void* ram_map;                         /* Host mapping backing ram (or NULL) */
+    size_t ram_map_size;                   /* Size of ram_map in bytes */
+    int ram_flags;                         /* VM64_RAM_* actually in effect */
+    int numa_node;                         /* Node RAM is bound to, -1 if none */
     uint64_t regs[VM64_REG_COUNT];        /* RAX-R15 */
+    VM64Vec vregs[VM64_VREG_COUNT];        /* V0-V15 (vector extension) */
     uint64_t rip;                          /* Instruction pointer */
     uint64_t rsp;                          /* Stack pointer */
     
@@ -78,20 +220,116 @@ typedef struct {
     /* Statistics */
     uint64_t instruction_count;
     
+    /* Per-page state (VM64_PAGE_*) */
+    uint8_t page_flags[VM64_PAGE_COUNT];
+    uint64_t ckpt_id;                      /* Id of last checkpoint written */
+    
+    /* Paged address space (flat physical addressing when paging == 0) */
+    int paging;
+    uint64_t* pt_root;                     /* 4-level table, 512 entries each */
+    uint64_t mapped_pages;
+    uint16_t free_frames[VM64_PAGE_COUNT]; /* Free physical frame stack */
+    int free_count;
+    uint64_t brk_start;                    /* Heap start (end of image) */
+    uint64_t brk;                          /* Current program break */
+    uint64_t mmap_top;                     /* Next anonymous mmap ends here */
+    VM64TlbEntry tlb[VM64_TLB_SIZE];
+    uint64_t tlb_misses;
+    
+    /* Last memory fault */
+    int fault;                             /* VM64_PROT_* access that faulted */
+    uint64_t fault_addr;
+    
+    /* Embedding */
+    VM64WriteFn io_write;                  /* Guest output (NULL = host fd) */
+    VM64ReadFn io_read;                    /* Guest input (NULL = host fd) */
+    void* io_user;                         /* Passed to io_write / io_read */
+    VM64FlushFn io_flush;                  /* Drain buffered output (optional) */
+    int trap_syscalls;                     /* Return VM64_EXIT_SYSCALL instead of
+                                              running vm64_syscall_handler */
+    int syscall_pending;                   /* Trapped SYSCALL awaiting service */
+    int stop_requested;                    /* Set by vm64_request_stop() */
+    uint64_t max_insns;                    /* vm64_run / scheduler instruction limit (0 = none) */
+    
     /* Debug */
     int debug_mode;
+    uint64_t breakpoints[VM64_MAX_BREAKPOINTS];
+    int breakpoint_count;
+    uint64_t resume_rip;                   /* Breakpoint to step over on resume */
+    struct VM64Trace* trace;               /* Execution trace (vm64_trace.h) */
+    VM64Cover* cover;                      /* Edge coverage, or NULL; fast loops only */
 } VM64;
 
 /* Function declarations */
 VM64* vm64_create(void);
+VM64* vm64_create_ex(int ram_flags);
+int vm64_ram_bind_local(VM64* vm);
+void vm64_ram_rebind(VM64* vm);
 void vm64_destroy(VM64* vm);
 void vm64_reset(VM64* vm);
 int vm64_load_image(VM64* vm, const char* filename, uint64_t load_addr);
+int vm64_load_buffer(VM64* vm, const uint8_t* data, size_t size,
+                     uint64_t load_addr);
 int vm64_load_kernel(VM64* vm, const char* filename);
+uint8_t vm64_insn_length(uint8_t opcode);
+int vm64_decode(const uint8_t* code, size_t avail, VM64Insn* insn);
+int vm64_disasm(const uint8_t* code, size_t avail, char* out, size_t size);
+extern const VMCfgIsa vm64_isa;           /* Decoder hooks for vm_cfg_build */
 void vm64_execute_one(VM64* vm);
-void vm64_run(VM64* vm);
+VM64Exit vm64_run_budget(VM64* vm, uint64_t max_insns);
+VM64Exit vm64_run(VM64* vm);
+void vm64_request_stop(VM64* vm);
 void vm64_dump_state(VM64* vm);
 void vm64_set_debug(VM64* vm, int enable);
+void vm64_set_io(VM64* vm, VM64WriteFn write_fn, VM64ReadFn read_fn, void* user);
+void vm64_add_breakpoint(VM64* vm, uint64_t addr);
+void vm64_remove_breakpoint(VM64* vm, uint64_t addr);
+void vm64_mem_usage(VM64* vm, VM64MemUsage* usage);
+
+/* Record a guest write to a page; a shared page is now a private copy */
+#define VM64_PAGE_WRITTEN(vm, page) \
+    ((vm)->page_flags[page] = (uint8_t)(((vm)->page_flags[page] | \
+                               VM64_PAGE_DIRTY) & ~VM64_PAGE_SHARED))
+
+/* Record a guest write to [addr, addr + len) */
+static inline void vm64_mark_dirty(VM64* vm, uint64_t addr, uint64_t len) {
+    if (len == 0 || addr >= VM64_RAM_SIZE) return;
+    uint64_t last = addr + len - 1;
+    if (last >= VM64_RAM_SIZE) last = VM64_RAM_SIZE - 1;
+    for (uint64_t p = addr / VM64_PAGE_SIZE; p <= last / VM64_PAGE_SIZE; p++) {
+        VM64_PAGE_WRITTEN(vm, p);
+    }
+}
+
+/* Big-endian guest access of 1, 2, 4 or 8 bytes at any alignment; memcpy
+ * becomes a single unaligned host load or store */
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+#define VM64_BE16(v) __builtin_bswap16(v)
+#define VM64_BE32(v) __builtin_bswap32(v)
+#define VM64_BE64(v) __builtin_bswap64(v)
+#else
+#define VM64_BE16(v) (v)
+#define VM64_BE32(v) (v)
+#define VM64_BE64(v) (v)
+#endif
+
+static inline uint64_t vm64_get_be(const uint8_t* p, unsigned width) {
+    switch (width) {
+        case 1: return p[0];
+        case 2: { uint16_t v; memcpy(&v, p, 2); return VM64_BE16(v); }
+        case 4: { uint32_t v; memcpy(&v, p, 4); return VM64_BE32(v); }
+        default: { uint64_t v; memcpy(&v, p, 8); return VM64_BE64(v); }
+    }
+}
+
+static inline void vm64_put_be(uint8_t* p, unsigned width, uint64_t value) {
+    switch (width) {
+        case 1: p[0] = (uint8_t)value; break;
+        case 2: { uint16_t v = VM64_BE16((uint16_t)value); memcpy(p, &v, 2); break; }
+        case 4: { uint32_t v = VM64_BE32((uint32_t)value); memcpy(p, &v, 4); break; }
+        default: { uint64_t v = VM64_BE64(value); memcpy(p, &v, 8); break; }
+    }
+}
 
 /* Linux syscall interface */
 void vm64_syscall_handler(VM64* vm);
@@ -0,0 +1,575 @@
+#include "vm64.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Ahead-of-time translator: VM64 image -> C program linked with libvm64.
+ *
+ * Every reachable basic block becomes one C function. Operands are
+ * constants in the image, so JMP targets are known and become direct
+ * tail calls, and bounds checks on constant addresses are resolved at
+ * translation time. The generated program drops back to the libvm64 interpreter
+ * when it reaches code it did not translate (unknown opcodes, code
+ * outside the image) or when the guest overwrites translated bytes. */
+
+#define AOT_MAX_BLOCK 256                  /* Split longer straight-line runs */
+
+typedef struct {
+    const uint8_t* image;
+    size_t size;
+    uint64_t base;
+    VMCfg* cfg;                            /* Blocks reachable from the entry */
+} Aot;
+
+static int aot_in_image(Aot* a, uint64_t addr) {
+    return addr >= a->base && addr - a->base < a->size;
+}
+
+static int aot_decode(Aot* a, uint64_t addr, VM64Insn* insn) {
+    if (!aot_in_image(a, addr)) return 0;
+    size_t off = (size_t)(addr - a->base);
+    return vm64_decode(a->image + off, a->size - off, insn);
+}
+
+static int aot_is_code(Aot* a, uint64_t addr) {
+    return vm_cfg_is_code(a->cfg, addr);
+}
+
+/* pc starts an instruction that was reached during analysis */
+static int aot_is_insn(Aot* a, uint64_t addr) {
+    return aot_in_image(a, addr) && (a->cfg->code[addr - a->base] & VM_CFG_BYTE_INSN);
+}
+
+static int aot_is_leader(Aot* a, uint64_t addr) {
+    return vm_cfg_block_start(a->cfg, addr) >= 0;
+}
+
+/* Retire the instructions emitted since the last flush */
+static void aot_flush(FILE* out, int* pending) {
+    if (*pending > 0) fprintf(out, "    AOT_RETIRE(vm, %d);\n", *pending);
+    *pending = 0;
+}
+
+/* Leave native code; the interpreter continues at pc */
+static void aot_leave(FILE* out, int* pending, uint64_t pc) {
+    aot_flush(out, pending);
+    fprintf(out, "    vm->rip = 0x%llXULL;\n    return;\n", (unsigned long long)pc);
+}
+
+static void aot_goto(Aot* a, FILE* out, int* pending, uint64_t target) {
+    if (!aot_is_leader(a, target)) {
+        aot_leave(out, pending, target);
+        return;
+    }
+    aot_flush(out, pending);
+    fprintf(out, "    b_%llX(vm);\n", (unsigned long long)target);
+}
+
+/* LOADX/STOREX at a constant address: bounds were checked at translation */
+static void aot_emit_abs_x(Aot* a, FILE* out, int* pending, const VM64Insn* insn,
+                           uint64_t next) {
+    unsigned width = VM64_AM_WIDTH(insn->amode);
+    unsigned long long addr = (unsigned long long)insn->imm;
+    if (insn->opcode == X64_LOADX) {
+        fprintf(out, "    r[%d] = vm64_get_be(vm->ram + 0x%llXULL, %u);\n",
+                insn->r1, addr, width);
+        return;
+    }
+    
+    fprintf(out, "    vm64_put_be(vm->ram + 0x%llXULL, %u, r[%d]);\n",
+            addr, width, insn->r1);
+    fprintf(out, "    vm64_mark_dirty(vm, 0x%llXULL, %u);\n", addr, width);
+    for (unsigned i = 0; i < width; i++) {
+        if (!aot_is_code(a, insn->imm + i)) continue;
+        aot_flush(out, pending);
+        fprintf(out, "    if (aot_code_changed(vm)) {\n");
+        fprintf(out, "        vm->rip = 0x%llXULL;\n        return;\n    }\n",
+                (unsigned long long)next);
+        break;
+    }
+}
+
+static void aot_emit_block(Aot* a, FILE* out, uint64_t start) {
+    uint64_t pc = start;
+    int pending = 0;
+    
+    fprintf(out, "\nstatic void b_%llX(VM64* vm) {\n", (unsigned long long)start);
+    fprintf(out, "    uint64_t* r = vm->regs;\n");
+    fprintf(out, "    (void)r;\n");
+    
+    for (;;) {
+        VM64Insn insn;
+        if (pc != start && aot_is_leader(a, pc)) {
+            aot_goto(a, out, &pending, pc);
+            break;
+        }
+        if (!aot_is_insn(a, pc) || !aot_decode(a, pc, &insn)) {
+            fprintf(out, "    /* 0x%llX: not translated */\n", (unsigned long long)pc);
+            aot_leave(out, &pending, pc);
+            break;
+        }
+        
+        uint64_t next = pc + insn.len;
+        int r1 = insn.r1 < VM64_REG_COUNT;
+        int r2 = insn.r2 < VM64_REG_COUNT;
+        pending++;
+        
+        switch (insn.opcode) {
+            case X64_HALT:
+                aot_flush(out, &pending);
+                fprintf(out, "    vm->halted = 1;\n");
+                aot_leave(out, &pending, next);
+                fprintf(out, "}\n");
+                return;
+            
+            case X64_NOP:
+                break;
+            
+            case X64_MOVI:
+                if (r1) fprintf(out, "    r[%d] = 0x%llXULL;\n", insn.r1,
+                                (unsigned long long)insn.imm);
+                break;
+            
+            case X64_ADD:
+            case X64_SUB:
+                if (r1 && r2) fprintf(out, "    r[%d] %c= r[%d];\n", insn.r1,
+                                      insn.opcode == X64_ADD ? '+' : '-', insn.r2);
+                break;
+            
+            case X64_LOAD:
+                if (r1 && insn.imm < VM64_RAM_SIZE) {
+                    fprintf(out, "    r[%d] = vm->ram[0x%llXULL];\n", insn.r1,
+                            (unsigned long long)insn.imm);
+                }
+                break;
+            
+            case X64_STORE:
+                if (!r1 || insn.imm >= VM64_RAM_SIZE) break;
+                fprintf(out, "    vm->ram[0x%llXULL] = (uint8_t)r[%d];\n",
+                        (unsigned long long)insn.imm, insn.r1);
+                fprintf(out, "    VM64_PAGE_WRITTEN(vm, %llu);\n",
+                        (unsigned long long)(insn.imm / VM64_PAGE_SIZE));
+                if (aot_is_code(a, insn.imm)) {
+                    /* Self-modifying store: recheck the translated bytes */
+                    aot_flush(out, &pending);
+                    fprintf(out, "    if (aot_code_changed(vm)) {\n");
+                    fprintf(out, "        vm->rip = 0x%llXULL;\n        return;\n    }\n",
+                            (unsigned long long)next);
+                }
+                break;
+            
+            case X64_LOADX:
+            case X64_STOREX: {
+                unsigned width = VM64_AM_WIDTH(insn.amode);
+                uint8_t kind = VM64_AM_KIND(insn.amode);
+                if (!r1 || (kind != VM64_AM_ABS && !r2) || kind > VM64_AM_DISP) break;
+                if (kind == VM64_AM_ABS) {
+                    if (insn.imm >= VM64_RAM_SIZE || width > VM64_RAM_SIZE - insn.imm) break;
+                    aot_emit_abs_x(a, out, &pending, &insn, next);
+                    break;
+                }
+                
+                /* Register addressing: bounds are checked at run time */
+                char ea[48];
+                if (kind == VM64_AM_IND) snprintf(ea, sizeof(ea), "r[%d]", insn.r2);
+                else snprintf(ea, sizeof(ea), "r[%d] + 0x%llXULL", insn.r2,
+                              (unsigned long long)insn.imm);
+                if (insn.opcode == X64_LOADX) {
+                    fprintf(out, "    aot_loadx(vm, %s, %u, &r[%d]);\n", ea, width, insn.r1);
+                    break;
+                }
+                aot_flush(out, &pending);
+                fprintf(out, "    if (aot_storex(vm, %s, %u, r[%d])) {\n", ea, width, insn.r1);
+                fprintf(out, "        vm->rip = 0x%llXULL;\n        return;\n    }\n",
+                        (unsigned long long)next);
+                break;
+            }
+            
+            case X64_OUT:
+                if (r1) fprintf(out, "    aot_out(vm, r[%d]);\n", insn.r1);
+                break;
+            
+            case X64_PUSH:
+                if (!r1) break;
+                aot_flush(out, &pending);
+                fprintf(out, "    if (aot_push(vm, r[%d])) {\n", insn.r1);
+                fprintf(out, "        vm->rip = 0x%llXULL;\n        return;\n    }\n",
+                        (unsigned long long)next);
+                break;
+            
+            case X64_POP:
+                if (r1) fprintf(out, "    aot_pop(vm, &r[%d]);\n", insn.r1);
+                break;
+            
+            case X64_SYSCALL:
+                aot_flush(out, &pending);
+                fprintf(out, "    vm->rip = 0x%llXULL;\n", (unsigned long long)next);
+                fprintf(out, "    vm64_syscall_handler(vm);\n");
+                fprintf(out, "    if (vm->halted || aot_code_changed(vm)) return;\n");
+                aot_goto(a, out, &pending, next);
+                fprintf(out, "}\n");
+                return;
+            
+            case X64_VLOAD: {
+                uint64_t len = VM64_VSHAPE_BYTES(insn.shape);
+                if (insn.r1 >= VM64_VREG_COUNT || insn.imm > VM64_RAM_SIZE - len) break;
+                fprintf(out, "    memset(&vm->vregs[%d], 0, sizeof(VM64Vec));\n", insn.r1);
+                fprintf(out, "    memcpy(vm->vregs[%d].b, vm->ram + 0x%llXULL, %llu);\n",
+                        insn.r1, (unsigned long long)insn.imm, (unsigned long long)len);
+                break;
+            }
+            
+            case X64_VSTORE: {
+                uint64_t len = VM64_VSHAPE_BYTES(insn.shape);
+                if (insn.r1 >= VM64_VREG_COUNT || insn.imm > VM64_RAM_SIZE - len) break;
+                fprintf(out, "    memcpy(vm->ram + 0x%llXULL, vm->vregs[%d].b, %llu);\n",
+                        (unsigned long long)insn.imm, insn.r1, (unsigned long long)len);
+                fprintf(out, "    vm64_mark_dirty(vm, 0x%llXULL, %llu);\n",
+                        (unsigned long long)insn.imm, (unsigned long long)len);
+                int hits_code = 0;
+                for (uint64_t i = 0; i < len; i++) hits_code |= aot_is_code(a, insn.imm + i);
+                if (hits_code) {
+                    aot_flush(out, &pending);
+                    fprintf(out, "    if (aot_code_changed(vm)) {\n");
+                    fprintf(out, "        vm->rip = 0x%llXULL;\n        return;\n    }\n",
+                            (unsigned long long)next);
+                }
+                break;
+            }
+            
+            case X64_VADD: case X64_VSUB: case X64_VMUL: case X64_VAND:
+            case X64_VOR: case X64_VXOR: case X64_VCMPEQ: case X64_VCMPGT:
+                if (insn.r1 < VM64_VREG_COUNT && insn.r2 < VM64_VREG_COUNT) {
+                    fprintf(out, "    vm64_vec_alu(0x%02X, 0x%02X, &vm->vregs[%d], "
+                            "&vm->vregs[%d]);\n", insn.opcode, insn.shape, insn.r1, insn.r2);
+                }
+                break;
+            
+            case X64_VSPLAT:
+                if (insn.r1 < VM64_VREG_COUNT && r2) {
+                    fprintf(out, "    vm64_vec_splat(0x%02X, &vm->vregs[%d], r[%d]);\n",
+                            insn.shape, insn.r1, insn.r2);
+                }
+                break;
+            
+            case X64_VREDADD: case X64_VREDMIN: case X64_VREDMAX:
+                if (r1 && insn.r2 < VM64_VREG_COUNT) {
+                    fprintf(out, "    r[%d] = vm64_vec_reduce(0x%02X, 0x%02X, &vm->vregs[%d]);\n",
+                            insn.r1, insn.opcode, insn.shape, insn.r2);
+                }
+                break;
+            
+            case X64_JMP:
+                aot_flush(out, &pending);
+                fprintf(out, "    if (AOT_STOP(vm)) {\n");
+                fprintf(out, "        vm->rip = 0x%llXULL;\n        return;\n    }\n",
+                        (unsigned long long)insn.imm);
+                aot_goto(a, out, &pending, insn.imm);
+                fprintf(out, "}\n");
+                return;
+        }
+        pc = next;
+    }
+    fprintf(out, "}\n");
+}
+
+/* Runtime support shared by every translated block */
+static const char* aot_runtime =
+    "#define AOT_RETIRE(vm, n) \\\n"
+    "    ((vm)->instruction_count += (n), (vm)->cycle_count += (n))\n"
+    "#define AOT_STOP(vm) __atomic_load_n(&(vm)->stop_requested, __ATOMIC_RELAXED)\n"
+    "\n"
+    "/* Has the guest overwritten any translated instruction? */\n"
+    "static inline int aot_code_changed(VM64* vm) {\n"
+    "    for (size_t i = 0; i < sizeof(aot_code) / sizeof(aot_code[0]); i++) {\n"
+    "        uint64_t lo = aot_code[i][0], hi = aot_code[i][1];\n"
+    "        if (memcmp(vm->ram + lo, aot_image + (lo - AOT_BASE), hi - lo) != 0) {\n"
+    "            return 1;\n"
+    "        }\n"
+    "    }\n"
+    "    return 0;\n"
+    "}\n"
+    "\n"
+    "static inline void aot_loadx(VM64* vm, uint64_t ea, unsigned width, uint64_t* reg) {\n"
+    "    if (ea < VM64_RAM_SIZE && width <= VM64_RAM_SIZE - ea) {\n"
+    "        *reg = vm64_get_be(vm->ram + ea, width);\n"
+    "    }\n"
+    "}\n"
+    "\n"
+    "/* Returns nonzero if the store overwrote translated code */\n"
+    "static inline int aot_storex(VM64* vm, uint64_t ea, unsigned width, uint64_t value) {\n"
+    "    if (ea >= VM64_RAM_SIZE || width > VM64_RAM_SIZE - ea) return 0;\n"
+    "    vm64_put_be(vm->ram + ea, width, value);\n"
+    "    vm64_mark_dirty(vm, ea, width);\n"
+    "    return ea < AOT_CODE_HI && ea + width > AOT_CODE_LO && aot_code_changed(vm);\n"
+    "}\n"
+    "\n"
+    "static inline void aot_out(VM64* vm, uint64_t value) {\n"
+    "    uint8_t ch = value & 0xFF;\n"
+    "    if (vm->io_write) {\n"
+    "        vm->io_write(vm->io_user, STDOUT_FILENO, &ch, 1);\n"
+    "    } else {\n"
+    "        putchar(ch);\n"
+    "        fflush(stdout);\n"
+    "    }\n"
+    "}\n"
+    "\n"
+    "/* Returns nonzero if the push overwrote translated code */\n"
+    "static inline int aot_push(VM64* vm, uint64_t value) {\n"
+    "    uint8_t bytes[8];\n"
+    "    for (int i = 0; i < 8; i++) bytes[i] = (value >> (56 - i * 8)) & 0xFF;\n"
+    "    if (vm->rsp <= 7 || vm64_write_guest(vm, vm->rsp - 8, bytes, 8) != 0) return 0;\n"
+    "    vm->rsp -= 8;\n"
+    "    return vm->rsp < AOT_CODE_HI && vm->rsp + 8 > AOT_CODE_LO &&\n"
+    "           aot_code_changed(vm);\n"
+    "}\n"
+    "\n"
+    "static inline void aot_pop(VM64* vm, uint64_t* reg) {\n"
+    "    uint8_t bytes[8];\n"
+    "    if (vm64_read_guest(vm, vm->rsp, bytes, 8) != 0) return;\n"
+    "    uint64_t value = 0;\n"
+    "    for (int i = 0; i < 8; i++) value = (value << 8) | bytes[i];\n"
+    "    *reg = value;\n"
+    "    vm->rsp += 8;\n"
+    "}\n";
+
+static const char* aot_main =
+    "\n"
+    "static VM64* aot_vm;\n"
+    "\n"
+    "static void aot_timeout(int sig) {\n"
+    "    (void)sig;\n"
+    "    vm64_request_stop(aot_vm);\n"
+    "}\n"
+    "\n"
+    "int main(int argc, char* argv[]) {\n"
+    "    int interp = 0, stats = 0;\n"
+    "    unsigned long timeout_ms = 0;\n"
+    "    for (int i = 1; i < argc; i++) {\n"
+    "        if (strcmp(argv[i], \"--interp\") == 0) interp = 1;\n"
+    "        else if (strcmp(argv[i], \"--stats\") == 0) stats = 1;\n"
+    "        else if (strcmp(argv[i], \"--timeout\") == 0 && i + 1 < argc) {\n"
+    "            timeout_ms = strtoul(argv[++i], NULL, 0);\n"
+    "        }\n"
+    "    }\n"
+    "    \n"
+    "    VM64* vm = vm64_create();\n"
+    "    if (!vm || vm64_load_buffer(vm, aot_image, sizeof(aot_image), AOT_BASE) != 0) {\n"
+    "        fprintf(stderr, \"Failed to create VM64\\n\");\n"
+    "        return EXIT_FAILURE;\n"
+    "    }\n"
+    "    vm->rip = AOT_ENTRY;\n"
+    "    if (timeout_ms > 0) {\n"
+    "        struct sigaction sa;\n"
+    "        struct itimerval it;\n"
+    "        memset(&sa, 0, sizeof(sa));\n"
+    "        memset(&it, 0, sizeof(it));\n"
+    "        sa.sa_handler = aot_timeout;\n"
+    "        aot_vm = vm;\n"
+    "        sigaction(SIGALRM, &sa, NULL);\n"
+    "        it.it_value.tv_sec = (time_t)(timeout_ms / 1000);\n"
+    "        it.it_value.tv_usec = (suseconds_t)(timeout_ms % 1000) * 1000;\n"
+    "        setitimer(ITIMER_REAL, &it, NULL);\n"
+    "    }\n"
+    "    \n"
+    "    if (!interp) aot_enter(vm);\n"
+    "    uint64_t native = vm->instruction_count;\n"
+    "    uint64_t fallback_rip = vm->rip;\n"
+    "    if (!vm->halted && !AOT_STOP(vm)) vm64_run_budget(vm, 0);\n"
+    "    \n"
+    "    if (stats) {\n"
+    "        fprintf(stderr, \"vm64-aot: %llu instructions native, %llu interpreted\",\n"
+    "                (unsigned long long)native,\n"
+    "                (unsigned long long)(vm->instruction_count - native));\n"
+    "        if (vm->instruction_count > native) {\n"
+    "            fprintf(stderr, \" (from RIP 0x%llX)\", (unsigned long long)fallback_rip);\n"
+    "        }\n"
+    "        fprintf(stderr, \"\\n\");\n"
+    "    }\n"
+    "    if (!vm->halted) {\n"
+    "        fprintf(stderr, \"Guest stopped: time limit reached at RIP 0x%llX\\n\",\n"
+    "                (unsigned long long)vm->rip);\n"
+    "    }\n"
+    "    int status = vm->halted && !vm->fault ? EXIT_SUCCESS : EXIT_FAILURE;\n"
+    "    vm64_destroy(vm);\n"
+    "    return status;\n"
+    "}\n";
+
+/* Write the translated program for a to out */
+static void aot_emit(Aot* a, FILE* out, const char* name, uint64_t entry) {
+    fprintf(out, "/* Generated by vm64-aot from %s - do not edit */\n", name);
+    fprintf(out, "#define _GNU_SOURCE\n#include \"vm64.h\"\n#include \"vm64_mmu.h\"\n"
+            "#include \"vm64_vec.h\"\n");
+    fprintf(out, "#include <stdio.h>\n#include <stdlib.h>\n#include <string.h>\n"
+            "#include <unistd.h>\n#include <signal.h>\n#include <sys/time.h>\n\n");
+    fprintf(out, "#ifndef __OPTIMIZE__\n"
+            "#error \"Build with optimisation: translated blocks chain by tail calls\"\n"
+            "#endif\n\n");
+    fprintf(out, "#define AOT_BASE 0x%llXULL\n#define AOT_ENTRY 0x%llXULL\n",
+            (unsigned long long)a->base, (unsigned long long)entry);
+
+    /* Translated bytes as [lo, hi) ranges, for self-modification checks */
+    uint64_t code_lo = 0, code_hi = 0;
+    int ranges = 0;
+    for (size_t i = 0; i < a->size; i++) {
+        int code = aot_is_code(a, a->base + i);
+        if (code && (i == 0 || !aot_is_code(a, a->base + i - 1))) {
+            if (!ranges) code_lo = a->base + i;
+            ranges++;
+        }
+        if (code) code_hi = a->base + i + 1;
+    }
+    fprintf(out, "#define AOT_CODE_LO 0x%llXULL\n#define AOT_CODE_HI 0x%llXULL\n\n",
+            (unsigned long long)code_lo, (unsigned long long)code_hi);
+
+    fprintf(out, "static const uint8_t aot_image[%zu] = {", a->size);
+    for (size_t i = 0; i < a->size; i++) {
+        fprintf(out, "%s0x%02X,", i % 12 ? " " : "\n    ", a->image[i]);
+    }
+    fprintf(out, "\n};\n\n");
+
+    fprintf(out, "static const uint64_t aot_code[%d][2] = {\n", ranges ? ranges : 1);
+    if (!ranges) fprintf(out, "    { AOT_BASE, AOT_BASE },\n");
+    for (size_t i = 0; i < a->size; i++) {
+        if (!aot_is_code(a, a->base + i) || (i > 0 && aot_is_code(a, a->base + i - 1))) {
+            continue;
+        }
+        size_t j = i;
+        while (j < a->size && aot_is_code(a, a->base + j)) j++;
+        fprintf(out, "    { 0x%llXULL, 0x%llXULL },\n",
+                (unsigned long long)(a->base + i), (unsigned long long)(a->base + j));
+    }
+    fprintf(out, "};\n\n%s\n", aot_runtime);
+
+    for (uint32_t b = 0; b < a->cfg->nblocks; b++) {
+        fprintf(out, "static void b_%llX(VM64* vm);\n",
+                (unsigned long long)a->cfg->blocks[b].start);
+    }
+    for (uint32_t b = 0; b < a->cfg->nblocks; b++) {
+        aot_emit_block(a, out, a->cfg->blocks[b].start);
+    }
+
+    fprintf(out, "\n/* Run translated code from the entry point until it halts or\n"
+            " * leaves for the interpreter */\nstatic void aot_enter(VM64* vm) {\n");
+    if (aot_is_leader(a, entry)) {
+        fprintf(out, "    b_%llX(vm);\n", (unsigned long long)entry);
+    } else {
+        fprintf(out, "    (void)vm;\n");
+    }
+    fprintf(out, "}\n%s", aot_main);
+}
+
+static void print_usage(const char* prog) {
+    printf("Usage: %s [options] image.bin [load_addr]\n", prog);
+    printf("  -o <exe>        - Build a native executable (C source kept as <exe>.c)\n");
+    printf("  --emit-c <file> - Write the translated C source to <file>\n");
+    printf("  --root <dir>    - Tree holding src/vm64.h and lib/libvm64.a (default .)\n");
+    printf("\nload_addr is hex and defaults to 0x400000, like bin/vm64.\n");
+    printf("The executable accepts --interp (interpreter only), --stats and\n");
+    printf("--timeout <ms>.\n");
+}
+
+int main(int argc, char* argv[]) {
+    const char* image_path = NULL;
+    const char* addr_arg = NULL;
+    const char* exe_path = NULL;
+    const char* c_path = NULL;
+    const char* root = ".";
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-o") == 0 && i + 1 < argc) {
+            exe_path = argv[++i];
+        } else if (strcmp(argv[i], "--emit-c") == 0 && i + 1 < argc) {
+            c_path = argv[++i];
+        } else if (strcmp(argv[i], "--root") == 0 && i + 1 < argc) {
+            root = argv[++i];
+        } else if (strcmp(argv[i], "--help") == 0) {
+            print_usage(argv[0]);
+            return EXIT_SUCCESS;
+        } else if (!image_path) {
+            image_path = argv[i];
+        } else {
+            addr_arg = argv[i];
+        }
+    }
+    if (!image_path || (!exe_path && !c_path)) {
+        print_usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    Aot a;
+    memset(&a, 0, sizeof(a));
+    a.base = addr_arg ? strtoull(addr_arg, NULL, 16) : 0x400000;
+
+    FILE* f = fopen(image_path, "rb");
+    if (!f) {
+        fprintf(stderr, "Error: Cannot open image '%s'\n", image_path);
+        return EXIT_FAILURE;
+    }
+    fseek(f, 0, SEEK_END);
+    long size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    if (size <= 0 || a.base >= VM64_RAM_SIZE || (uint64_t)size > VM64_RAM_SIZE - a.base) {
+        fprintf(stderr, "Error: Image '%s' does not fit at 0x%llX\n", image_path,
+                (unsigned long long)a.base);
+        fclose(f);
+        return EXIT_FAILURE;
+    }
+
+    a.size = (size_t)size;
+    uint8_t* image = (uint8_t*)malloc(a.size);
+    if (!image || fread(image, 1, a.size, f) != a.size) {
+        fprintf(stderr, "Error: Cannot read image '%s'\n", image_path);
+        fclose(f);
+        return EXIT_FAILURE;
+    }
+    fclose(f);
+    a.image = image;
+
+    /* Longer straight-line runs are split so the generated functions
+     * stay small enough to compile quickly */
+    a.cfg = vm_cfg_build(&vm64_isa, image, a.size, a.base, &a.base, 1, AOT_MAX_BLOCK);
+    if (!a.cfg) {
+        fprintf(stderr, "Error: Out of memory\n");
+        return EXIT_FAILURE;
+    }
+
+    char c_buf[4096];
+    if (!c_path) {
+        snprintf(c_buf, sizeof(c_buf), "%s.c", exe_path);
+        c_path = c_buf;
+    }
+    FILE* out = fopen(c_path, "w");
+    if (!out) {
+        fprintf(stderr, "Error: Cannot create '%s'\n", c_path);
+        return EXIT_FAILURE;
+    }
+    aot_emit(&a, out, image_path, a.base);
+    if (fclose(out) != 0) {
+        fprintf(stderr, "Error: Cannot write '%s'\n", c_path);
+        return EXIT_FAILURE;
+    }
+
+    printf("Translated %u blocks (%llu of %zu image bytes) into %s\n",
+           a.cfg->nblocks, (unsigned long long)a.cfg->code_bytes, a.size, c_path);
+
+    int status = EXIT_SUCCESS;
+    if (exe_path) {
+        const char* cc = getenv("CC");
+        char cmd[16384];
+        snprintf(cmd, sizeof(cmd),
+                 "%s -O2 -std=c99 -I'%s/src' -o '%s' '%s' '%s/lib/libvm64.a' -lm -pthread",
+                 cc ? cc : "cc", root, exe_path, c_path, root);
+        printf("%s\n", cmd);
+        if (system(cmd) != 0) {
+            fprintf(stderr, "Error: Compiling %s failed\n", c_path);
+            status = EXIT_FAILURE;
+        } else {
+            printf("Built: %s\n", exe_path);
+        }
+    }
+
+    vm_cfg_free(a.cfg);
+    free(image);
+    return status;
+}
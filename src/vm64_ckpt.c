@@ -0,0 +1,271 @@
+#define _GNU_SOURCE
+#include "vm64_ckpt.h"
+#include "vm64_mmu.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#ifdef __linux__
+#include <linux/fs.h>
+#endif
+
+#define CKPT_FILE_SIZE ((off_t)VM64_PAGE_SIZE + VM64_RAM_SIZE)
+
+static uint64_t ckpt_new_id(VM64* vm) {
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    uint64_t id = (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+    id ^= (uint64_t)getpid() << 32;
+    id ^= (uint64_t)(uintptr_t)vm;
+    return id ? id : 1;
+}
+
+static int ckpt_read_header(int fd, VM64CkptHeader* hdr) {
+    if (pread(fd, hdr, sizeof(*hdr), 0) != (ssize_t)sizeof(*hdr)) return -1;
+    if (memcmp(hdr->magic, VM64_CKPT_MAGIC, 8) != 0 ||
+        hdr->version < 1 || hdr->version > VM64_CKPT_VERSION ||
+        hdr->page_size != VM64_PAGE_SIZE ||
+        hdr->ram_size != VM64_RAM_SIZE) {
+        return -1;
+    }
+    return 0;
+}
+
+static int ckpt_write_all(int fd, const void* buf, size_t len, off_t off) {
+    const uint8_t* p = (const uint8_t*)buf;
+    while (len > 0) {
+        ssize_t n = pwrite(fd, p, len, off);
+        if (n <= 0) return -1;
+        p += n;
+        off += n;
+        len -= (size_t)n;
+    }
+    return 0;
+}
+
+static int ckpt_page_is_zero(const uint8_t* page) {
+    static const uint8_t zero[VM64_PAGE_SIZE];
+    return memcmp(page, zero, VM64_PAGE_SIZE) == 0;
+}
+
+static void ckpt_fill_header(VM64* vm, VM64CkptHeader* hdr) {
+    memcpy(hdr->magic, VM64_CKPT_MAGIC, 8);
+    hdr->version = VM64_CKPT_VERSION;
+    hdr->page_size = VM64_PAGE_SIZE;
+    hdr->ram_size = VM64_RAM_SIZE;
+    hdr->ckpt_id = vm->ckpt_id;
+    memcpy(hdr->regs, vm->regs, sizeof(hdr->regs));
+    hdr->rip = vm->rip;
+    hdr->rsp = vm->rsp;
+    hdr->eflags = vm->eflags;
+    hdr->halted = (uint32_t)vm->halted;
+    hdr->instruction_count = vm->instruction_count;
+    hdr->cycle_count = vm->cycle_count;
+    hdr->paging = (uint32_t)vm->paging;
+    hdr->brk_start = vm->brk_start;
+    hdr->brk = vm->brk;
+    hdr->mmap_top = vm->mmap_top;
+    hdr->map_count = 0;
+    memcpy(hdr->vregs, vm->vregs, sizeof(hdr->vregs));
+}
+
+/* Append the page table after the RAM image; sets hdr->map_count */
+static int ckpt_write_mappings(VM64* vm, int fd, VM64CkptHeader* hdr) {
+    size_t count = vm64_get_mappings(vm, NULL, 0);
+    if (count == 0) return 0;
+    
+    VM64Mapping* maps = (VM64Mapping*)malloc(count * sizeof(VM64Mapping));
+    if (!maps) return -1;
+    vm64_get_mappings(vm, maps, count);
+    int ret = ckpt_write_all(fd, maps, count * sizeof(VM64Mapping),
+                             CKPT_FILE_SIZE);
+    free(maps);
+    hdr->map_count = count;
+    return ret;
+}
+
+/* Rebuild the page table saved by ckpt_write_mappings */
+static int ckpt_read_mappings(VM64* vm, int fd, const VM64CkptHeader* hdr) {
+    if (!hdr->paging) return vm->paging ? vm64_set_paging(vm, 0) : 0;
+    if (hdr->map_count > VM64_PAGE_COUNT) return -1;
+    
+    size_t bytes = (size_t)hdr->map_count * sizeof(VM64Mapping);
+    VM64Mapping* maps = (VM64Mapping*)malloc(bytes ? bytes : 1);
+    if (!maps) return -1;
+    int ret = -1;
+    if (pread(fd, maps, bytes, CKPT_FILE_SIZE) == (ssize_t)bytes) {
+        ret = vm64_mmu_restore(vm, maps, (size_t)hdr->map_count);
+    }
+    free(maps);
+    
+    vm->brk_start = hdr->brk_start;
+    vm->brk = hdr->brk;
+    vm->mmap_top = hdr->mmap_top;
+    return ret;
+}
+
+/* Start dst as a reflink of the previous checkpoint. Returns 1 if the
+ * filesystem shared the blocks, 0 if it cannot (clean pages equal vm->ram,
+ * so the caller then writes every non-zero page from RAM), -1 on error. */
+static int ckpt_clone_base(int src, int dst) {
+#ifdef FICLONE
+    if (ioctl(dst, FICLONE, src) != 0) return 0;
+    return ftruncate(dst, CKPT_FILE_SIZE) == 0 ? 1 : -1;
+#else
+    (void)src;
+    (void)dst;
+    return 0;
+#endif
+}
+
+/* Write a checkpoint into a fresh file renamed over the target, so
+ * processes that restored (mmap'ed) an older file at this path are
+ * unaffected. When prev_fd (the previous checkpoint of this chain) can be
+ * reflinked, only dirty pages are written; otherwise every non-zero page
+ * is written and zero pages are left as holes. Returns the pages written. */
+static long ckpt_write(VM64* vm, const char* filename, int prev_fd,
+                       uint64_t prev_generation) {
+    char tmp[4096];
+    snprintf(tmp, sizeof(tmp), "%s.tmp.%ld", filename, (long)getpid());
+    
+    int fd = open(tmp, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        fprintf(stderr, "Error: Cannot create checkpoint '%s'\n", tmp);
+        return -1;
+    }
+    
+    long written = 0;
+    int cloned = prev_fd >= 0 ? ckpt_clone_base(prev_fd, fd) : 0;
+    if (cloned < 0 || (!cloned && ftruncate(fd, CKPT_FILE_SIZE) != 0)) goto fail;
+    
+    for (uint64_t p = 0; p < VM64_PAGE_COUNT; p++) {
+        const uint8_t* page = &vm->ram[p * VM64_PAGE_SIZE];
+        if (cloned ? !(vm->page_flags[p] & VM64_PAGE_DIRTY)
+                   : ckpt_page_is_zero(page)) {
+            continue;
+        }
+        if (ckpt_write_all(fd, page, VM64_PAGE_SIZE,
+                           VM64_PAGE_SIZE + (off_t)(p * VM64_PAGE_SIZE)) != 0) {
+            goto fail;
+        }
+        written++;
+    }
+    
+    if (prev_fd < 0) vm->ckpt_id = ckpt_new_id(vm);
+    VM64CkptHeader hdr;
+    memset(&hdr, 0, sizeof(hdr));
+    ckpt_fill_header(vm, &hdr);
+    hdr.generation = prev_fd >= 0 ? prev_generation + 1 : 1;
+    if (ckpt_write_mappings(vm, fd, &hdr) != 0 ||
+        ckpt_write_all(fd, &hdr, sizeof(hdr), 0) != 0) goto fail;
+    
+    close(fd);
+    if (rename(tmp, filename) != 0) {
+        unlink(tmp);
+        vm->ckpt_id = 0;
+        return -1;
+    }
+    return written;
+
+fail:
+    fprintf(stderr, "Error: Failed to write checkpoint '%s'\n", filename);
+    close(fd);
+    unlink(tmp);
+    vm->ckpt_id = 0;
+    return -1;
+}
+
+/* Save registers and RAM. If the file holds this VM's previous checkpoint
+ * and the filesystem supports reflinks, only pages dirtied since then are
+ * written on top of a clone of it; the file itself is never modified, as
+ * restorers may have it mapped. Returns the number of RAM pages written
+ * or -1. */
+long vm64_checkpoint(VM64* vm, const char* filename) {
+    if (!vm || !filename) return -1;
+    
+    int fd = vm->ckpt_id ? open(filename, O_RDONLY) : -1;
+    VM64CkptHeader hdr;
+    if (fd >= 0 && (ckpt_read_header(fd, &hdr) != 0 ||
+                    hdr.ckpt_id != vm->ckpt_id)) {
+        close(fd);
+        fd = -1;
+    }
+    
+    long written = ckpt_write(vm, filename, fd, fd >= 0 ? hdr.generation : 0);
+    if (fd >= 0) close(fd);
+    if (written < 0) return -1;
+    
+    for (uint64_t p = 0; p < VM64_PAGE_COUNT; p++) {
+        vm->page_flags[p] &= ~VM64_PAGE_DIRTY;
+    }
+    return written;
+}
+
+/* Restore a checkpoint. Guest RAM is mapped copy-on-write from the file,
+ * so only pages the guest later writes are ever copied. */
+int vm64_restore(VM64* vm, const char* filename) {
+    if (!vm || !filename) return -1;
+    
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0) {
+        fprintf(stderr, "Error: Cannot open checkpoint '%s'\n", filename);
+        return -1;
+    }
+    
+    VM64CkptHeader hdr;
+    struct stat st;
+    if (ckpt_read_header(fd, &hdr) != 0 || fstat(fd, &st) != 0 ||
+        st.st_size < CKPT_FILE_SIZE) {
+        fprintf(stderr, "Error: '%s' is not a VM64 checkpoint\n", filename);
+        close(fd);
+        return -1;
+    }
+    
+    int mapped = 0;
+    if (vm->ram_map && (uint8_t*)vm->ram_map == vm->ram) {
+        void* p = mmap(vm->ram, VM64_RAM_SIZE, PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE | MAP_FIXED, fd, VM64_PAGE_SIZE);
+        if (p == (void*)vm->ram) {
+            mapped = 1;
+            vm->ram_flags &= ~(VM64_RAM_THP | VM64_RAM_HUGETLB);
+            vm64_ram_rebind(vm);
+        }
+    }
+    
+    if (!mapped) {
+        ssize_t n = pread(fd, vm->ram, VM64_RAM_SIZE, VM64_PAGE_SIZE);
+        if (n != (ssize_t)VM64_RAM_SIZE) {
+            fprintf(stderr, "Error: Failed to read checkpoint '%s'\n", filename);
+            close(fd);
+            return -1;
+        }
+    }
+    
+    if (ckpt_read_mappings(vm, fd, &hdr) != 0) {
+        fprintf(stderr, "Error: Bad page table in checkpoint '%s'\n", filename);
+        close(fd);
+        return -1;
+    }
+    close(fd);
+    
+    memcpy(vm->regs, hdr.regs, sizeof(vm->regs));
+    if (hdr.version >= 3) memcpy(vm->vregs, hdr.vregs, sizeof(vm->vregs));
+    else memset(vm->vregs, 0, sizeof(vm->vregs));
+    vm->rip = hdr.rip;
+    vm->rsp = hdr.rsp;
+    vm->eflags = hdr.eflags;
+    vm->halted = (int)hdr.halted;
+    vm->instruction_count = hdr.instruction_count;
+    vm->cycle_count = hdr.cycle_count;
+    
+    /* The file may be shared by other restorers; never update it in place */
+    vm->ckpt_id = 0;
+    memset(vm->page_flags, mapped ? VM64_PAGE_SHARED : 0, sizeof(vm->page_flags));
+    
+    return 0;
+}
@@ -0,0 +1,39 @@
+#ifndef VM64_CKPT_H
+#define VM64_CKPT_H
+
+#include "vm64.h"
+
+#define VM64_CKPT_MAGIC "VM64CKPT"
+#define VM64_CKPT_VERSION 3                /* v2 adds the page table, v3 the
+                                              vector registers */
+
+/* On-disk header; guest RAM follows at offset VM64_PAGE_SIZE, and for a
+ * paged VM map_count VM64Mapping entries follow the RAM image */
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t page_size;
+    uint64_t ram_size;
+    uint64_t ckpt_id;                      /* Identifies the checkpoint chain */
+    uint64_t generation;                   /* Bumped by every checkpoint */
+    uint64_t regs[VM64_REG_COUNT];
+    uint64_t rip;
+    uint64_t rsp;
+    uint32_t eflags;
+    uint32_t halted;
+    uint64_t instruction_count;
+    uint64_t cycle_count;
+    uint32_t paging;
+    uint32_t reserved;
+    uint64_t brk_start;
+    uint64_t brk;
+    uint64_t mmap_top;
+    uint64_t map_count;
+    VM64Vec vregs[VM64_VREG_COUNT];
+} VM64CkptHeader;
+
+/* Function declarations */
+long vm64_checkpoint(VM64* vm, const char* filename);
+int vm64_restore(VM64* vm, const char* filename);
+
+#endif /* VM64_CKPT_H */
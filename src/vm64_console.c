@@ -0,0 +1,291 @@
+#define _GNU_SOURCE
+#include "vm64_console.h"
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/uio.h>
+
+static VM64ConsoleSeg* console_seg_new(size_t size) {
+    VM64ConsoleSeg* seg = (VM64ConsoleSeg*)calloc(1, sizeof(VM64ConsoleSeg));
+    if (!seg) return NULL;
+    if (ring_init(&seg->ring, size) != 0) {
+        free(seg);
+        return NULL;
+    }
+    return seg;
+}
+
+static void console_timed_wait(pthread_cond_t* cond, pthread_mutex_t* lock,
+                               long ms) {
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    ts.tv_nsec += ms * 1000000L;
+    ts.tv_sec += ts.tv_nsec / 1000000000L;
+    ts.tv_nsec %= 1000000000L;
+    pthread_cond_timedwait(cond, lock, &ts);
+}
+
+/* Producer side: is everything queued so far written out? */
+static int console_drained(VM64Console* con) {
+    for (int i = 0; i < VM64_CONSOLE_STREAMS; i++) {
+        if (ring_used(&con->streams[i].prod->ring) > 0) return 0;
+    }
+    return 1;
+}
+
+/* Writer side: is there anything to write? */
+static int console_pending(VM64Console* con) {
+    for (int i = 0; i < VM64_CONSOLE_STREAMS; i++) {
+        VM64ConsoleSeg* seg = con->streams[i].cons;
+        if (ring_used(&seg->ring) > 0 ||
+            __atomic_load_n(&seg->next, __ATOMIC_ACQUIRE)) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/* The flag/recheck pairs below are ordered by full fences so a sleeper
+ * either sees the new state or its flag is seen by the other side */
+static void console_wake_writer(VM64Console* con) {
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&con->writer_idle, __ATOMIC_RELAXED)) {
+        pthread_mutex_lock(&con->lock);
+        pthread_cond_signal(&con->data_cond);
+        pthread_mutex_unlock(&con->lock);
+    }
+}
+
+static void console_wake_producer(VM64Console* con) {
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&con->producer_waiting, __ATOMIC_RELAXED)) {
+        pthread_mutex_lock(&con->lock);
+        pthread_cond_broadcast(&con->space_cond);
+        pthread_mutex_unlock(&con->lock);
+    }
+}
+
+/* Write out what one stream has queued with a single writev(); frees
+ * segments the producer has moved past. Returns bytes consumed. */
+static size_t console_drain(VM64Console* con, VM64ConsoleStream* s) {
+    for (;;) {
+        VM64ConsoleSeg* seg = s->cons;
+        struct iovec iov[2];
+        const uint8_t *p1, *p2;
+        size_t n1, n2;
+        
+        size_t used = ring_peek(&seg->ring, &p1, &n1, &p2, &n2);
+        if (used > 0) {
+            iov[0].iov_base = (void*)p1;
+            iov[0].iov_len = n1;
+            iov[1].iov_base = (void*)p2;
+            iov[1].iov_len = n2;
+            
+            ssize_t w = writev(s->fd, iov, n2 ? 2 : 1);
+            if (w < 0 && errno == EINTR) continue;
+            
+            /* On a hard error drop the data rather than wedge the guest */
+            size_t done = w < 0 ? used : (size_t)w;
+            ring_consume(&seg->ring, done);
+            con->bytes_out += done;
+            con->batches++;
+            return done;
+        }
+        
+        VM64ConsoleSeg* next = __atomic_load_n(&seg->next, __ATOMIC_ACQUIRE);
+        if (!next) return 0;
+        
+        /* The producer never writes to a segment after linking the next */
+        if (ring_used(&seg->ring) > 0) continue;
+        s->cons = next;
+        ring_free(&seg->ring);
+        free(seg);
+    }
+}
+
+static void* console_writer(void* arg) {
+    VM64Console* con = (VM64Console*)arg;
+    
+    for (;;) {
+        size_t n = 0;
+        for (int i = 0; i < VM64_CONSOLE_STREAMS; i++) {
+            n += console_drain(con, &con->streams[i]);
+        }
+        if (n > 0) {
+            console_wake_producer(con);
+            continue;
+        }
+        
+        pthread_mutex_lock(&con->lock);
+        __atomic_store_n(&con->writer_idle, 1, __ATOMIC_RELAXED);
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+        if (!console_pending(con)) {
+            if (con->stop) {
+                pthread_mutex_unlock(&con->lock);
+                break;
+            }
+            console_timed_wait(&con->data_cond, &con->lock,
+                               VM64_CONSOLE_POLL_MS);
+        }
+        __atomic_store_n(&con->writer_idle, 0, __ATOMIC_RELAXED);
+        pthread_mutex_unlock(&con->lock);
+    }
+    
+    console_wake_producer(con);
+    return NULL;
+}
+
+/* Create a console with size bytes of ring per stream (0 = default) */
+VM64Console* vm64_console_create(VM64ConsolePolicy policy, size_t size) {
+    VM64Console* con = (VM64Console*)calloc(1, sizeof(VM64Console));
+    if (!con) return NULL;
+    
+    con->policy = policy;
+    if (size == 0) size = VM64_CONSOLE_DEFAULT_SIZE;
+    pthread_mutex_init(&con->lock, NULL);
+    pthread_cond_init(&con->data_cond, NULL);
+    pthread_cond_init(&con->space_cond, NULL);
+    
+    for (int i = 0; i < VM64_CONSOLE_STREAMS; i++) {
+        VM64ConsoleStream* s = &con->streams[i];
+        s->fd = i == 0 ? STDOUT_FILENO : STDERR_FILENO;
+        s->prod = s->cons = console_seg_new(size);
+        if (!s->prod) {
+            vm64_console_destroy(con);
+            return NULL;
+        }
+    }
+    
+    if (pthread_create(&con->thread, NULL, console_writer, con) != 0) {
+        vm64_console_destroy(con);
+        return NULL;
+    }
+    con->running = 1;
+    return con;
+}
+
+/* Flush, stop the writer thread and free the console */
+void vm64_console_destroy(VM64Console* con) {
+    if (!con) return;
+    
+    if (con->running) {
+        pthread_mutex_lock(&con->lock);
+        con->stop = 1;
+        pthread_cond_signal(&con->data_cond);
+        pthread_mutex_unlock(&con->lock);
+        pthread_join(con->thread, NULL);
+    }
+    
+    for (int i = 0; i < VM64_CONSOLE_STREAMS; i++) {
+        VM64ConsoleSeg* seg = con->streams[i].cons;
+        while (seg) {
+            VM64ConsoleSeg* next = seg->next;
+            ring_free(&seg->ring);
+            free(seg);
+            seg = next;
+        }
+    }
+    pthread_cond_destroy(&con->space_cond);
+    pthread_cond_destroy(&con->data_cond);
+    pthread_mutex_destroy(&con->lock);
+    free(con);
+}
+
+/* Route a VM's output through the console (replaces its I/O hooks) */
+void vm64_console_attach(VM64Console* con, VM64* vm) {
+    if (!con || !vm) return;
+    
+    vm64_set_io(vm, vm64_console_write, NULL, con);
+    vm->io_flush = vm64_console_flush;
+}
+
+/* Producer: block until the stream has room or the writer is gone */
+static void console_wait_space(VM64Console* con, VM64ConsoleStream* s) {
+    con->stalls++;
+    console_wake_writer(con);
+    
+    pthread_mutex_lock(&con->lock);
+    __atomic_store_n(&con->producer_waiting, 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    while (ring_space(&s->prod->ring) == 0 && con->running && !con->stop) {
+        console_timed_wait(&con->space_cond, &con->lock, 100);
+    }
+    __atomic_store_n(&con->producer_waiting, 0, __ATOMIC_RELAXED);
+    pthread_mutex_unlock(&con->lock);
+}
+
+/* VM64WriteFn: queue guest fd 1/2 output, pass other fds straight through */
+long vm64_console_write(void* user, int fd, const uint8_t* buf, size_t len) {
+    VM64Console* con = (VM64Console*)user;
+    if (fd < 1 || fd > VM64_CONSOLE_STREAMS) return (long)write(fd, buf, len);
+    
+    VM64ConsoleStream* s = &con->streams[fd - 1];
+    size_t done = 0;
+    
+    while (done < len) {
+        done += ring_write(&s->prod->ring, buf + done, len - done);
+        if (done == len) break;
+        
+        if (con->policy == VM64_CONSOLE_DROP) {
+            con->dropped += len - done;
+            break;
+        }
+        if (con->policy == VM64_CONSOLE_GROW) {
+            size_t size = 2 * ring_capacity(&s->prod->ring);
+            if (size < len - done) size = len - done;
+            VM64ConsoleSeg* seg = console_seg_new(size);
+            if (seg) {
+                __atomic_store_n(&s->prod->next, seg, __ATOMIC_RELEASE);
+                s->prod = seg;
+                con->grows++;
+                continue;
+            }
+        }
+        if (!con->running) break;
+        console_wait_space(con, s);
+    }
+    
+    con->bytes_in += done;
+    
+    /* Small writes accumulate until a batch is ready or the writer polls */
+    if (ring_used(&s->prod->ring) >= VM64_CONSOLE_BATCH) {
+        console_wake_writer(con);
+    }
+    return (long)len;
+}
+
+/* VM64FlushFn: wait until everything queued has been written */
+void vm64_console_flush(void* user) {
+    VM64Console* con = (VM64Console*)user;
+    if (!con || !con->running) return;
+    
+    while (!console_drained(con)) {
+        console_wake_writer(con);
+        pthread_mutex_lock(&con->lock);
+        __atomic_store_n(&con->producer_waiting, 1, __ATOMIC_RELAXED);
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+        if (!console_drained(con)) {
+            console_timed_wait(&con->space_cond, &con->lock, 10);
+        }
+        __atomic_store_n(&con->producer_waiting, 0, __ATOMIC_RELAXED);
+        pthread_mutex_unlock(&con->lock);
+    }
+}
+
+/* Print console statistics; call from the producer thread after a flush */
+void vm64_console_report(VM64Console* con, FILE* out) {
+    if (!con || !out) return;
+    
+    static const char* names[] = { "block", "drop", "grow" };
+    fprintf(out, "Console (%s): %llu bytes in %llu writes",
+            names[con->policy], (unsigned long long)con->bytes_in,
+            (unsigned long long)con->batches);
+    if (con->batches) {
+        fprintf(out, " (%.0f B/write)", (double)con->bytes_out / con->batches);
+    }
+    fprintf(out, ", %llu stalls, %llu bytes dropped, %llu grows\n",
+            (unsigned long long)con->stalls, (unsigned long long)con->dropped,
+            (unsigned long long)con->grows);
+}
@@ -0,0 +1,68 @@
+#ifndef VM64_CONSOLE_H
+#define VM64_CONSOLE_H
+
+#include "vm64.h"
+#include "ring.h"
+#include <stdio.h>
+#include <pthread.h>
+
+/* What the guest does when its output ring is full */
+typedef enum {
+    VM64_CONSOLE_BLOCK = 0,                /* Wait for the writer to drain */
+    VM64_CONSOLE_DROP,                     /* Discard what does not fit */
+    VM64_CONSOLE_GROW,                     /* Chain a larger ring segment */
+} VM64ConsolePolicy;
+
+#define VM64_CONSOLE_DEFAULT_SIZE (256 * 1024)
+#define VM64_CONSOLE_STREAMS 2             /* Guest fd 1 and fd 2 */
+#define VM64_CONSOLE_BATCH 4096            /* Queued bytes that wake the writer */
+#define VM64_CONSOLE_POLL_MS 10            /* Writer wakes at least this often */
+
+/* Ring segment; GROW chains a new one when the last fills up */
+typedef struct VM64ConsoleSeg {
+    Ring ring;
+    struct VM64ConsoleSeg* next;           /* Published by the producer */
+} VM64ConsoleSeg;
+
+/* One guest fd: the VM thread writes to prod, the writer drains cons */
+typedef struct {
+    int fd;                                /* Host fd written to */
+    VM64ConsoleSeg* prod;
+    VM64ConsoleSeg* cons;
+} VM64ConsoleStream;
+
+/* Asynchronous console: guest stdout/stderr go through lock-free SPSC
+ * rings drained by a writer thread with batched writev() calls. Exactly
+ * one thread (the VM's) may produce. */
+typedef struct {
+    VM64ConsolePolicy policy;
+    VM64ConsoleStream streams[VM64_CONSOLE_STREAMS];
+    pthread_t thread;
+    int running;
+    int stop;
+    
+    /* Slow-path wakeups; the fast path never takes the lock */
+    pthread_mutex_t lock;
+    pthread_cond_t data_cond;              /* Writer waits for data */
+    pthread_cond_t space_cond;             /* Producer waits for space */
+    int writer_idle;
+    int producer_waiting;
+    
+    /* Statistics */
+    uint64_t bytes_in;                     /* Accepted from the guest */
+    uint64_t bytes_out;                    /* Written to the host (writer) */
+    uint64_t batches;                      /* writev() calls (writer) */
+    uint64_t dropped;                      /* Bytes lost under DROP */
+    uint64_t stalls;                       /* Producer waits under BLOCK */
+    uint64_t grows;                        /* Segments added under GROW */
+} VM64Console;
+
+/* Function declarations */
+VM64Console* vm64_console_create(VM64ConsolePolicy policy, size_t size);
+void vm64_console_destroy(VM64Console* con);
+void vm64_console_attach(VM64Console* con, VM64* vm);
+long vm64_console_write(void* user, int fd, const uint8_t* buf, size_t len);
+void vm64_console_flush(void* user);
+void vm64_console_report(VM64Console* con, FILE* out);
+
+#endif /* VM64_CONSOLE_H */
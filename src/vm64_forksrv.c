@@ -0,0 +1,207 @@
+#define _GNU_SOURCE
+#include "vm64_forksrv.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+
+/* Limits applied to every run */
+typedef struct {
+    uint64_t max_insns;                    /* Cap on a run's budget (0 = none) */
+    unsigned long timeout_ms;              /* Wall-clock limit per run (0 = none) */
+} ForksrvLimits;
+
+/* Run until RIP reaches stop_rip; returns 0 on arrival, -1 if halted first */
+int vm64_run_to(VM64* vm, uint64_t stop_rip) {
+    if (!vm) return -1;
+    
+    while (!vm->halted) {
+        if (vm->rip == stop_rip) return 0;
+        vm64_execute_one(vm);
+    }
+    return -1;
+}
+
+/* Read one request line byte by byte so guest input is left in the fd */
+static int forksrv_read_line(int fd, char* buf, size_t size) {
+    size_t len = 0;
+    while (len + 1 < size) {
+        char c;
+        ssize_t n = read(fd, &c, 1);
+        if (n <= 0) {
+            if (len == 0) return -1;
+            break;
+        }
+        if (c == '\n') break;
+        buf[len++] = c;
+    }
+    buf[len] = '\0';
+    return (int)len;
+}
+
+/* The child's timer asks its VM to stop at the next block boundary */
+static VM64* forksrv_child_vm;
+
+static void forksrv_timeout(int sig) {
+    (void)sig;
+    vm64_request_stop(forksrv_child_vm);
+}
+
+/* Child side: run the inherited copy-on-write VM and report. The server
+ * limits cap whatever the request asked for. */
+static void forksrv_child(VM64* vm, int in_fd, int out_fd, uint64_t max_insns,
+                          const ForksrvLimits* limits) {
+    if (in_fd != STDIN_FILENO) dup2(in_fd, STDIN_FILENO);
+    if (out_fd != STDOUT_FILENO) dup2(out_fd, STDOUT_FILENO);
+    
+    if (limits->max_insns && (!max_insns || max_insns > limits->max_insns)) {
+        max_insns = limits->max_insns;
+    }
+    if (limits->timeout_ms) {
+        struct sigaction sa;
+        memset(&sa, 0, sizeof(sa));
+        sa.sa_handler = forksrv_timeout;
+        sigemptyset(&sa.sa_mask);
+        forksrv_child_vm = vm;
+        sigaction(SIGALRM, &sa, NULL);
+        
+        struct itimerval it;
+        memset(&it, 0, sizeof(it));
+        it.it_value.tv_sec = (time_t)(limits->timeout_ms / 1000);
+        it.it_value.tv_usec = (suseconds_t)(limits->timeout_ms % 1000) * 1000;
+        setitimer(ITIMER_REAL, &it, NULL);
+    }
+    
+    vm64_run_budget(vm, max_insns);
+    
+    fflush(stdout);
+    dprintf(STDOUT_FILENO, "\n#vm64-exit halted=%d insns=%llu rip=0x%llX\n",
+            vm->halted, (unsigned long long)vm->instruction_count,
+            (unsigned long long)vm->rip);
+    _exit(vm->halted ? 0 : 1);
+}
+
+/* Parse "RUN [n]" / "QUIT"; returns 1 for run, 0 for quit, -1 otherwise */
+static int forksrv_parse(const char* line, uint64_t* max_insns) {
+    *max_insns = 0;
+    if (strncmp(line, "QUIT", 4) == 0) return 0;
+    if (strncmp(line, "RUN", 3) == 0) {
+        if (line[3] == ' ') *max_insns = strtoull(line + 4, NULL, 0);
+        return 1;
+    }
+    return -1;
+}
+
+/* Serve requests on stdin/stdout, one run at a time */
+static int forksrv_pipe_loop(VM64* vm, const ForksrvLimits* limits) {
+    char line[256];
+    uint64_t max_insns;
+    
+    int devnull = open("/dev/null", O_RDONLY);
+    if (devnull < 0) return -1;
+    
+    while (forksrv_read_line(STDIN_FILENO, line, sizeof(line)) >= 0) {
+        int req = forksrv_parse(line, &max_insns);
+        if (req == 0) break;
+        if (req < 0) {
+            fprintf(stderr, "fork-server: bad request '%s'\n", line);
+            continue;
+        }
+        
+        fflush(stdout);
+        pid_t pid = fork();
+        if (pid == 0) {
+            forksrv_child(vm, devnull, STDOUT_FILENO, max_insns, limits);
+        } else if (pid < 0) {
+            perror("fork");
+        } else {
+            waitpid(pid, NULL, 0);
+        }
+    }
+    
+    close(devnull);
+    return 0;
+}
+
+/* Serve requests on a Unix socket; each connection runs concurrently */
+static int forksrv_socket_loop(VM64* vm, const char* socket_path,
+                               const ForksrvLimits* limits) {
+    int srv = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (srv < 0) {
+        perror("socket");
+        return -1;
+    }
+    
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, socket_path, sizeof(addr.sun_path) - 1);
+    unlink(socket_path);
+    
+    if (bind(srv, (struct sockaddr*)&addr, sizeof(addr)) != 0 ||
+        listen(srv, 64) != 0) {
+        perror("bind");
+        close(srv);
+        return -1;
+    }
+    
+    /* Children are reaped automatically */
+    signal(SIGCHLD, SIG_IGN);
+    fprintf(stderr, "fork-server: listening on %s (RIP 0x%llX)\n",
+            socket_path, (unsigned long long)vm->rip);
+    
+    char line[256];
+    uint64_t max_insns;
+    int running = 1;
+    
+    while (running) {
+        int conn = accept(srv, NULL, NULL);
+        if (conn < 0) continue;
+        
+        int req = forksrv_read_line(conn, line, sizeof(line));
+        req = (req < 0) ? -1 : forksrv_parse(line, &max_insns);
+        if (req == 0) {
+            running = 0;
+        } else if (req > 0) {
+            fflush(stdout);
+            pid_t pid = fork();
+            if (pid == 0) {
+                close(srv);
+                forksrv_child(vm, conn, conn, max_insns, limits);
+            } else if (pid < 0) {
+                perror("fork");
+            }
+        }
+        close(conn);
+    }
+    
+    close(srv);
+    unlink(socket_path);
+    return 0;
+}
+
+/* Serve run requests from the current (warm) VM state.
+ * socket_path "-" serves on stdin/stdout instead of a Unix socket. */
+int vm64_fork_server(VM64* vm, const char* socket_path) {
+    return vm64_fork_server_ex(vm, socket_path, 0, 0);
+}
+
+/* vm64_fork_server with limits on every run: max_insns caps the budget a
+ * request asks for (a bare RUN gets max_insns), timeout_ms is wall-clock
+ * time per run, enforced in the child; 0 means no limit */
+int vm64_fork_server_ex(VM64* vm, const char* socket_path, uint64_t max_insns,
+                        unsigned long timeout_ms) {
+    if (!vm || !socket_path) return -1;
+    
+    ForksrvLimits limits = { max_insns, timeout_ms };
+    if (strcmp(socket_path, "-") == 0) {
+        return forksrv_pipe_loop(vm, &limits);
+    }
+    return forksrv_socket_loop(vm, socket_path, &limits);
+}
@@ -0,0 +1,20 @@
+#ifndef VM64_FORKSRV_H
+#define VM64_FORKSRV_H
+
+#include "vm64.h"
+
+/* Fork-server request protocol (one request per connection / line):
+ *   RUN [max_insns]\n   run a fresh copy of the warm VM; on a socket any
+ *                       bytes after the line are the guest's stdin
+ *   QUIT\n              stop the server
+ * Each run streams raw guest output followed by a trailer line:
+ *   #vm64-exit halted=<0|1> insns=<n> rip=0x<rip>
+ */
+
+/* Function declarations */
+int vm64_run_to(VM64* vm, uint64_t stop_rip);
+int vm64_fork_server(VM64* vm, const char* socket_path);
+int vm64_fork_server_ex(VM64* vm, const char* socket_path, uint64_t max_insns,
+                        unsigned long timeout_ms);
+
+#endif /* VM64_FORKSRV_H */
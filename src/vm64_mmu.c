@@ -0,0 +1,365 @@
+#include "vm64_mmu.h"
+#include <stdlib.h>
+#include <string.h>
+
+/* Page table geometry: 4 levels of 512 entries cover 48 bits of VA.
+ * Upper levels hold host pointers to the next table, leaves hold
+ * frame << VM64_PAGE_SHIFT | VM64_PTE_PRESENT | VM64_PROT_*. */
+#define PT_LEVELS 4
+#define PT_ENTRIES 512
+#define PT_INDEX(va, level) (((va) >> (VM64_PAGE_SHIFT + 9 * (level))) & 511)
+#define PTE_FRAME(pte) ((uint32_t)((pte) >> VM64_PAGE_SHIFT))
+#define PTE_PROT(pte) ((uint32_t)((pte) & 7))
+#define VM64_HEAP_BASE 0x0000000001000000ULL  /* brk base with no image */
+
+#define PAGE_ALIGN(x) (((x) + VM64_PAGE_SIZE - 1) & ~(uint64_t)(VM64_PAGE_SIZE - 1))
+
+#define VA_LIMIT (1ULL << VM64_VA_BITS)
+
+static int va_valid(uint64_t va) {
+    return (va >> VM64_VA_BITS) == 0;
+}
+
+/* Free one table level and everything below it */
+static void pt_free(uint64_t* table, int level) {
+    if (!table) return;
+    if (level > 0) {
+        for (int i = 0; i < PT_ENTRIES; i++) {
+            pt_free((uint64_t*)(uintptr_t)table[i], level - 1);
+        }
+    }
+    free(table);
+}
+
+/* Find the leaf PTE for va, allocating intermediate tables if asked */
+static uint64_t* pt_lookup(VM64* vm, uint64_t va, int create) {
+    if (!vm->pt_root) {
+        if (!create) return NULL;
+        vm->pt_root = (uint64_t*)calloc(PT_ENTRIES, sizeof(uint64_t));
+        if (!vm->pt_root) return NULL;
+    }
+    
+    uint64_t* table = vm->pt_root;
+    for (int level = PT_LEVELS - 1; level > 0; level--) {
+        uint64_t* entry = &table[PT_INDEX(va, level)];
+        if (!*entry) {
+            if (!create) return NULL;
+            uint64_t* next = (uint64_t*)calloc(PT_ENTRIES, sizeof(uint64_t));
+            if (!next) return NULL;
+            *entry = (uint64_t)(uintptr_t)next;
+        }
+        table = (uint64_t*)(uintptr_t)*entry;
+    }
+    return &table[PT_INDEX(va, 0)];
+}
+
+/* Reset the frame allocator so frame 0 is handed out first */
+static void frames_init(VM64* vm) {
+    vm->free_count = 0;
+    for (int f = VM64_PAGE_COUNT - 1; f >= 0; f--) {
+        vm->free_frames[vm->free_count++] = (uint16_t)f;
+    }
+}
+
+static void mmu_clear(VM64* vm) {
+    pt_free(vm->pt_root, PT_LEVELS - 1);
+    vm->pt_root = NULL;
+    vm->mapped_pages = 0;
+    vm->brk_start = 0;
+    vm->brk = 0;
+    vm->mmap_top = VM64_MMAP_BASE;
+    vm->fault = 0;
+    vm->fault_addr = 0;
+    vm64_tlb_flush(vm);
+}
+
+/* Free page tables */
+void vm64_mmu_free(VM64* vm) {
+    if (!vm) return;
+    pt_free(vm->pt_root, PT_LEVELS - 1);
+    vm->pt_root = NULL;
+}
+
+/* Invalidate every TLB entry */
+void vm64_tlb_flush(VM64* vm) {
+    for (int i = 0; i < VM64_TLB_SIZE; i++) {
+        vm->tlb[i].vpn = UINT64_MAX;
+    }
+}
+
+/* Switch between flat and paged addressing. Enabling paging starts a
+ * fresh address space holding only the stack below VM64_STACK_TOP. */
+int vm64_set_paging(VM64* vm, int enable) {
+    if (!vm) return -1;
+    
+    mmu_clear(vm);
+    vm->paging = enable ? 1 : 0;
+    if (!enable) {
+        vm->rsp = VM64_RAM_SIZE - 8;
+        return 0;
+    }
+    
+    frames_init(vm);
+    if (vm64_map(vm, VM64_STACK_TOP - VM64_STACK_SIZE, VM64_STACK_SIZE,
+                 VM64_PROT_READ | VM64_PROT_WRITE) != 0) {
+        return -1;
+    }
+    vm->rsp = VM64_STACK_TOP - 8;
+    return 0;
+}
+
+/* Map zeroed anonymous pages over [va, va + len); pages already mapped
+ * keep their contents and take the new protection */
+int vm64_map(VM64* vm, uint64_t va, uint64_t len, int prot) {
+    if (!vm || !vm->paging || len == 0) return -1;
+    
+    if (!va_valid(va) || len > VA_LIMIT - va) return -1;
+    uint64_t start = va & ~(uint64_t)(VM64_PAGE_SIZE - 1);
+    uint64_t end = PAGE_ALIGN(va + len);
+    
+    /* Count the frames needed first so a failed map changes nothing */
+    uint64_t pages = (end - start) / VM64_PAGE_SIZE;
+    if (pages > (uint64_t)vm->free_count + vm->mapped_pages) return -1;
+    uint64_t needed = 0;
+    for (uint64_t page = start; page < end; page += VM64_PAGE_SIZE) {
+        uint64_t* pte = pt_lookup(vm, page, 0);
+        if (!pte || !(*pte & VM64_PTE_PRESENT)) needed++;
+    }
+    if (needed > (uint64_t)vm->free_count) return -1;
+    
+    for (uint64_t page = start; page < end; page += VM64_PAGE_SIZE) {
+        uint64_t* pte = pt_lookup(vm, page, 1);
+        if (!pte) return -1;
+        
+        if (*pte & VM64_PTE_PRESENT) {
+            *pte = (*pte & ~(uint64_t)7) | (uint64_t)(prot & 7);
+        } else {
+            uint32_t frame = vm->free_frames[--vm->free_count];
+            memset(&vm->ram[(uint64_t)frame * VM64_PAGE_SIZE], 0, VM64_PAGE_SIZE);
+            VM64_PAGE_WRITTEN(vm, frame);
+            *pte = ((uint64_t)frame << VM64_PAGE_SHIFT) | VM64_PTE_PRESENT |
+                   (uint64_t)(prot & 7);
+            vm->mapped_pages++;
+        }
+        vm->tlb[(page >> VM64_PAGE_SHIFT) & (VM64_TLB_SIZE - 1)].vpn = UINT64_MAX;
+    }
+    return 0;
+}
+
+/* Unmap the present pages of [start, end) below one table, skipping
+ * tables that were never allocated so huge ranges cost nothing */
+static void pt_unmap(VM64* vm, uint64_t* table, int level, uint64_t base,
+                     uint64_t start, uint64_t end) {
+    uint64_t span = (uint64_t)VM64_PAGE_SIZE << (9 * level);
+    for (int i = 0; i < PT_ENTRIES; i++) {
+        uint64_t lo = base + (uint64_t)i * span;
+        if (lo + span <= start) continue;
+        if (lo >= end) break;
+        if (!table[i]) continue;
+        
+        if (level > 0) {
+            pt_unmap(vm, (uint64_t*)(uintptr_t)table[i], level - 1, lo, start, end);
+        } else if (table[i] & VM64_PTE_PRESENT) {
+            vm->free_frames[vm->free_count++] = (uint16_t)PTE_FRAME(table[i]);
+            table[i] = 0;
+            vm->mapped_pages--;
+            vm->tlb[(lo >> VM64_PAGE_SHIFT) & (VM64_TLB_SIZE - 1)].vpn = UINT64_MAX;
+        }
+    }
+}
+
+/* Unmap [va, va + len) and return its frames to the allocator */
+int vm64_unmap(VM64* vm, uint64_t va, uint64_t len) {
+    if (!vm || !vm->paging || (va & (VM64_PAGE_SIZE - 1))) return -1;
+    
+    if (!va_valid(va) || len > VA_LIMIT - va) return -1;
+    
+    uint64_t end = PAGE_ALIGN(va + len);
+    if (vm->pt_root) pt_unmap(vm, vm->pt_root, PT_LEVELS - 1, 0, va, end);
+    return 0;
+}
+
+/* TLB miss: walk the page table and refill, or record a fault */
+uint8_t* vm64_xlate_slow(VM64* vm, uint64_t va, int access) {
+    vm->tlb_misses++;
+    
+    uint64_t* pte = va_valid(va) ? pt_lookup(vm, va, 0) : NULL;
+    if (!pte || !(*pte & VM64_PTE_PRESENT) ||
+        (PTE_PROT(*pte) & (uint32_t)access) != (uint32_t)access) {
+        vm->fault = access;
+        vm->fault_addr = va;
+        return NULL;
+    }
+    
+    uint64_t vpn = va >> VM64_PAGE_SHIFT;
+    VM64TlbEntry* e = &vm->tlb[vpn & (VM64_TLB_SIZE - 1)];
+    e->vpn = vpn;
+    e->frame = PTE_FRAME(*pte);
+    e->host = &vm->ram[(uint64_t)e->frame * VM64_PAGE_SIZE];
+    e->prot = PTE_PROT(*pte);
+    
+    if (access & VM64_PROT_WRITE) VM64_PAGE_WRITTEN(vm, e->frame);
+    return e->host + (va & (VM64_PAGE_SIZE - 1));
+}
+
+/* Copy between guest and host memory, one page at a time */
+static int copy_guest(VM64* vm, uint64_t va, uint8_t* buf, uint64_t len,
+                      int access) {
+    if (!vm->paging) {
+        uint8_t* p = vm64_guest_ptr(vm, va, len, access);
+        if (!p) return -1;
+        if (access & VM64_PROT_WRITE) memcpy(p, buf, len);
+        else memcpy(buf, p, len);
+        return 0;
+    }
+    
+    while (len > 0) {
+        uint64_t chunk = VM64_PAGE_SIZE - (va & (VM64_PAGE_SIZE - 1));
+        if (chunk > len) chunk = len;
+        
+        uint8_t* p = vm64_xlate(vm, va, access);
+        if (!p) return -1;
+        if (access & VM64_PROT_WRITE) memcpy(p, buf, chunk);
+        else memcpy(buf, p, chunk);
+        
+        va += chunk;
+        buf += chunk;
+        len -= chunk;
+    }
+    return 0;
+}
+
+int vm64_read_guest(VM64* vm, uint64_t va, void* dst, uint64_t len) {
+    return copy_guest(vm, va, (uint8_t*)dst, len, VM64_PROT_READ);
+}
+
+int vm64_write_guest(VM64* vm, uint64_t va, const void* src, uint64_t len) {
+    return copy_guest(vm, va, (uint8_t*)src, len, VM64_PROT_WRITE);
+}
+
+/* Enough free frames for len bytes; checked before any per-page walk so
+ * a huge guest length fails at once */
+static int frames_available(VM64* vm, uint64_t len) {
+    return len / VM64_PAGE_SIZE <= (uint64_t)vm->free_count;
+}
+
+/* Check that no page of [va, va + len) is mapped */
+static int range_free(VM64* vm, uint64_t va, uint64_t len) {
+    for (uint64_t page = va; page < va + len; page += VM64_PAGE_SIZE) {
+        uint64_t* pte = pt_lookup(vm, page, 0);
+        if (pte && (*pte & VM64_PTE_PRESENT)) return 0;
+    }
+    return 1;
+}
+
+/* Anonymous mmap: honour a free, page-aligned hint, else allocate top-down
+ * below VM64_MMAP_BASE. Returns the guest address or (uint64_t)-1. */
+uint64_t vm64_sys_mmap(VM64* vm, uint64_t addr, uint64_t len, int prot) {
+    if (!vm || !vm->paging || len == 0) return (uint64_t)-1;
+    
+    if (len > VA_LIMIT) return (uint64_t)-1;
+    len = PAGE_ALIGN(len);
+    if (!frames_available(vm, len)) return (uint64_t)-1;
+    if (addr && !(addr & (VM64_PAGE_SIZE - 1)) && va_valid(addr) &&
+        len <= VA_LIMIT - addr && range_free(vm, addr, len)) {
+        return vm64_map(vm, addr, len, prot) == 0 ? addr : (uint64_t)-1;
+    }
+    
+    if (len > vm->mmap_top) return (uint64_t)-1;
+    uint64_t va = vm->mmap_top - len;
+    if (!range_free(vm, va, len) || vm64_map(vm, va, len, prot) != 0) {
+        return (uint64_t)-1;
+    }
+    vm->mmap_top = va;
+    return va;
+}
+
+int vm64_sys_munmap(VM64* vm, uint64_t addr, uint64_t len) {
+    return vm64_unmap(vm, addr, len);
+}
+
+/* Move the program break; returns the new (or unchanged) break */
+uint64_t vm64_sys_brk(VM64* vm, uint64_t addr) {
+    if (!vm || !vm->paging) return addr;
+    
+    if (!vm->brk_start) vm->brk_start = vm->brk = VM64_HEAP_BASE;
+    if (addr < vm->brk_start || !va_valid(addr)) return vm->brk;
+    
+    uint64_t old_end = PAGE_ALIGN(vm->brk);
+    uint64_t new_end = PAGE_ALIGN(addr);
+    if (new_end > old_end) {
+        if (!frames_available(vm, new_end - old_end) ||
+            !range_free(vm, old_end, new_end - old_end) ||
+            vm64_map(vm, old_end, new_end - old_end,
+                     VM64_PROT_READ | VM64_PROT_WRITE) != 0) {
+            return vm->brk;
+        }
+    } else if (new_end < old_end) {
+        vm64_unmap(vm, new_end, old_end - new_end);
+    }
+    
+    vm->brk = addr;
+    return vm->brk;
+}
+
+static size_t pt_collect(uint64_t* table, int level, uint64_t base,
+                         VM64Mapping* out, size_t max, size_t count) {
+    for (int i = 0; i < PT_ENTRIES; i++) {
+        if (!table[i]) continue;
+        uint64_t va = base | ((uint64_t)i << (VM64_PAGE_SHIFT + 9 * level));
+        
+        if (level > 0) {
+            count = pt_collect((uint64_t*)(uintptr_t)table[i], level - 1, va,
+                               out, max, count);
+        } else if (table[i] & VM64_PTE_PRESENT) {
+            if (out && count < max) {
+                out[count].va = va;
+                out[count].frame = PTE_FRAME(table[i]);
+                out[count].prot = PTE_PROT(table[i]);
+            }
+            count++;
+        }
+    }
+    return count;
+}
+
+/* Export the page table; returns the total number of mappings, of which
+ * at most max are stored in out */
+size_t vm64_get_mappings(VM64* vm, VM64Mapping* out, size_t max) {
+    if (!vm || !vm->paging || !vm->pt_root) return 0;
+    return pt_collect(vm->pt_root, PT_LEVELS - 1, 0, out, max, 0);
+}
+
+/* Rebuild a paged address space from exported mappings. RAM contents are
+ * restored separately; brk and mmap_top are left to the caller. */
+int vm64_mmu_restore(VM64* vm, const VM64Mapping* maps, size_t count) {
+    if (!vm) return -1;
+    
+    uint8_t* used = (uint8_t*)calloc(VM64_PAGE_COUNT, 1);
+    if (!used) return -1;
+    
+    mmu_clear(vm);
+    vm->paging = 1;
+    
+    int ret = 0;
+    for (size_t i = 0; i < count; i++) {
+        uint64_t* pte = NULL;
+        if (maps[i].frame >= VM64_PAGE_COUNT || used[maps[i].frame] ||
+            !va_valid(maps[i].va) ||
+            !(pte = pt_lookup(vm, maps[i].va, 1))) {
+            ret = -1;
+            break;
+        }
+        used[maps[i].frame] = 1;
+        *pte = ((uint64_t)maps[i].frame << VM64_PAGE_SHIFT) | VM64_PTE_PRESENT |
+               (maps[i].prot & 7);
+        vm->mapped_pages++;
+    }
+    
+    vm->free_count = 0;
+    for (int f = VM64_PAGE_COUNT - 1; f >= 0; f--) {
+        if (!used[f]) vm->free_frames[vm->free_count++] = (uint16_t)f;
+    }
+    free(used);
+    return ret;
+}
@@ -0,0 +1,59 @@
+#ifndef VM64_MMU_H
+#define VM64_MMU_H
+
+#include "vm64.h"
+
+/* Paged guest address space: a 4-level, 48-bit page table mapping guest
+ * virtual pages onto frames of vm->ram, with a direct-mapped software TLB
+ * in front of it. With vm->paging == 0 guest addresses are raw offsets
+ * into vm->ram. */
+
+/* One page mapping, as saved in checkpoints */
+typedef struct {
+    uint64_t va;
+    uint32_t frame;
+    uint32_t prot;
+} VM64Mapping;
+
+/* Function declarations */
+int vm64_set_paging(VM64* vm, int enable);
+int vm64_map(VM64* vm, uint64_t va, uint64_t len, int prot);
+int vm64_unmap(VM64* vm, uint64_t va, uint64_t len);
+void vm64_tlb_flush(VM64* vm);
+void vm64_mmu_free(VM64* vm);
+uint8_t* vm64_xlate_slow(VM64* vm, uint64_t va, int access);
+int vm64_read_guest(VM64* vm, uint64_t va, void* dst, uint64_t len);
+int vm64_write_guest(VM64* vm, uint64_t va, const void* src, uint64_t len);
+uint64_t vm64_sys_mmap(VM64* vm, uint64_t addr, uint64_t len, int prot);
+int vm64_sys_munmap(VM64* vm, uint64_t addr, uint64_t len);
+uint64_t vm64_sys_brk(VM64* vm, uint64_t addr);
+size_t vm64_get_mappings(VM64* vm, VM64Mapping* out, size_t max);
+int vm64_mmu_restore(VM64* vm, const VM64Mapping* maps, size_t count);
+
+/* Translate a guest virtual address; NULL on fault (vm->fault is set).
+ * The returned pointer is valid up to the end of the page. */
+static inline uint8_t* vm64_xlate(VM64* vm, uint64_t va, int access) {
+    uint64_t vpn = va >> VM64_PAGE_SHIFT;
+    VM64TlbEntry* e = &vm->tlb[vpn & (VM64_TLB_SIZE - 1)];
+    
+    if (e->vpn == vpn && (e->prot & access) == (uint32_t)access) {
+        if (access & VM64_PROT_WRITE) VM64_PAGE_WRITTEN(vm, e->frame);
+        return e->host + (va & (VM64_PAGE_SIZE - 1));
+    }
+    return vm64_xlate_slow(vm, va, access);
+}
+
+/* Host pointer for len bytes at a guest address, or NULL if the range is
+ * out of bounds, faults, or (paged) is not contiguous on the host */
+static inline uint8_t* vm64_guest_ptr(VM64* vm, uint64_t addr, uint64_t len,
+                                      int access) {
+    if (!vm->paging) {
+        if (addr >= VM64_RAM_SIZE || len > VM64_RAM_SIZE - addr) return NULL;
+        if (access & VM64_PROT_WRITE) vm64_mark_dirty(vm, addr, len);
+        return &vm->ram[addr];
+    }
+    if ((addr & (VM64_PAGE_SIZE - 1)) + len > VM64_PAGE_SIZE) return NULL;
+    return vm64_xlate(vm, addr, access);
+}
+
+#endif /* VM64_MMU_H */
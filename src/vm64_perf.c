@@ -0,0 +1,165 @@
+#define _GNU_SOURCE
+#include "vm64_perf.h"
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#endif
+
+static const char* perf_event_names[VM64_PERF_EVENT_COUNT] = {
+    "cycles", "instructions", "branch-misses", "cache-misses", "dTLB-misses"
+};
+
+static uint64_t perf_now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+#ifdef __linux__
+static int perf_open_event(uint32_t type, uint64_t config) {
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = type;
+    attr.config = config;
+    attr.disabled = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    
+    return (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}
+#endif
+
+/* Open host counters for the calling thread; returns number opened or -1 */
+int vm64_perf_open(VM64Perf* perf) {
+    if (!perf) return -1;
+    
+    for (int i = 0; i < VM64_PERF_EVENT_COUNT; i++) perf->fds[i] = -1;
+    perf->open_count = 0;
+    if (!perf->out) perf->out = stderr;
+
+#ifdef __linux__
+    perf->fds[VM64_PERF_CYCLES] =
+        perf_open_event(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES);
+    perf->fds[VM64_PERF_INSTRUCTIONS] =
+        perf_open_event(PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS);
+    perf->fds[VM64_PERF_BRANCH_MISSES] =
+        perf_open_event(PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES);
+    perf->fds[VM64_PERF_CACHE_MISSES] =
+        perf_open_event(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES);
+    perf->fds[VM64_PERF_DTLB_MISSES] =
+        perf_open_event(PERF_TYPE_HW_CACHE,
+                        PERF_COUNT_HW_CACHE_DTLB |
+                        (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+                        (PERF_COUNT_HW_CACHE_RESULT_MISS << 16));
+    
+    for (int i = 0; i < VM64_PERF_EVENT_COUNT; i++) {
+        if (perf->fds[i] < 0) continue;
+        ioctl(perf->fds[i], PERF_EVENT_IOC_RESET, 0);
+        ioctl(perf->fds[i], PERF_EVENT_IOC_ENABLE, 0);
+        perf->open_count++;
+    }
+#endif
+    
+    if (perf->open_count == 0) {
+        fprintf(perf->out, "[perf] host counters unavailable, "
+                "reporting wall-clock only\n");
+        return -1;
+    }
+    return perf->open_count;
+}
+
+/* Close host counters */
+void vm64_perf_close(VM64Perf* perf) {
+    if (!perf) return;
+    
+    for (int i = 0; i < VM64_PERF_EVENT_COUNT; i++) {
+        if (perf->fds[i] >= 0) close(perf->fds[i]);
+        perf->fds[i] = -1;
+    }
+    perf->open_count = 0;
+}
+
+/* Read all counters plus guest progress */
+void vm64_perf_sample(VM64Perf* perf, VM64* vm, VM64PerfSample* sample) {
+    memset(sample, 0, sizeof(*sample));
+    
+    for (int i = 0; i < VM64_PERF_EVENT_COUNT; i++) {
+        uint64_t value = 0;
+        if (perf->fds[i] >= 0 &&
+            read(perf->fds[i], &value, sizeof(value)) == sizeof(value)) {
+            sample->values[i] = value;
+        }
+    }
+    sample->guest_insns = vm->instruction_count;
+    sample->wall_ns = perf_now_ns();
+}
+
+/* Print raw deltas and derived per-guest-instruction metrics */
+void vm64_perf_report(VM64Perf* perf, const char* label,
+                      const VM64PerfSample* start, const VM64PerfSample* end) {
+    uint64_t insns = end->guest_insns - start->guest_insns;
+    uint64_t ns = end->wall_ns - start->wall_ns;
+    double per = insns ? (double)insns : 1.0;
+    
+    fprintf(perf->out, "[perf] %s: %llu guest insns in %.3f ms (%.2f MIPS)\n",
+            label, (unsigned long long)insns, ns / 1e6,
+            ns ? insns * 1e3 / ns : 0.0);
+    
+    for (int i = 0; i < VM64_PERF_EVENT_COUNT; i++) {
+        if (perf->fds[i] < 0) continue;
+        uint64_t delta = end->values[i] - start->values[i];
+        fprintf(perf->out, "[perf]   %-14s %14llu  %10.4f per guest insn\n",
+                perf_event_names[i], (unsigned long long)delta, delta / per);
+    }
+    
+    if (perf->fds[VM64_PERF_CYCLES] >= 0 &&
+        perf->fds[VM64_PERF_INSTRUCTIONS] >= 0) {
+        uint64_t cyc = end->values[VM64_PERF_CYCLES] -
+                       start->values[VM64_PERF_CYCLES];
+        uint64_t ins = end->values[VM64_PERF_INSTRUCTIONS] -
+                       start->values[VM64_PERF_INSTRUCTIONS];
+        fprintf(perf->out, "[perf]   host IPC %.2f\n",
+                cyc ? (double)ins / cyc : 0.0);
+    }
+}
+
+/* Run until halt or vm->max_insns, sampling counters per interval and for
+ * the whole run */
+void vm64_perf_run(VM64* vm, VM64Perf* perf) {
+    if (!vm || !perf) return;
+    
+    VM64PerfSample start, mark, now;
+    int interval_no = 0;
+    char label[32];
+    
+    vm64_perf_sample(perf, vm, &start);
+    mark = start;
+    
+    VM64Exit reason = VM64_EXIT_BUDGET;
+    while (reason == VM64_EXIT_BUDGET) {
+        uint64_t budget = perf->interval;
+        if (vm->max_insns) {
+            if (vm->instruction_count >= vm->max_insns) break;
+            uint64_t left = vm->max_insns - vm->instruction_count;
+            if (budget == 0 || left < budget) budget = left;
+        }
+        reason = vm64_run_budget(vm, budget);
+        
+        if (perf->interval) {
+            vm64_perf_sample(perf, vm, &now);
+            snprintf(label, sizeof(label), "interval %d", ++interval_no);
+            vm64_perf_report(perf, label, &mark, &now);
+            mark = now;
+        }
+    }
+    
+    vm64_perf_sample(perf, vm, &now);
+    vm64_perf_report(perf, "run total", &start, &now);
+}
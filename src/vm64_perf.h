@@ -0,0 +1,40 @@
+#ifndef VM64_PERF_H
+#define VM64_PERF_H
+
+#include "vm64.h"
+#include <stdio.h>
+
+/* Host hardware events sampled around the VM64 run loop */
+typedef enum {
+    VM64_PERF_CYCLES = 0,
+    VM64_PERF_INSTRUCTIONS,
+    VM64_PERF_BRANCH_MISSES,
+    VM64_PERF_CACHE_MISSES,
+    VM64_PERF_DTLB_MISSES,
+    VM64_PERF_EVENT_COUNT
+} VM64PerfEvent;
+
+/* Counter snapshot */
+typedef struct {
+    uint64_t values[VM64_PERF_EVENT_COUNT];  /* Host event counts */
+    uint64_t guest_insns;                    /* Guest instructions dispatched */
+    uint64_t wall_ns;                        /* Wall-clock time */
+} VM64PerfSample;
+
+/* perf_event_open state */
+typedef struct {
+    int fds[VM64_PERF_EVENT_COUNT];          /* -1 if event unavailable */
+    int open_count;                          /* Number of events opened */
+    uint64_t interval;                       /* Report every N guest insns, 0 = off */
+    FILE* out;                               /* Report stream (stderr by default) */
+} VM64Perf;
+
+/* Function declarations */
+int vm64_perf_open(VM64Perf* perf);
+void vm64_perf_close(VM64Perf* perf);
+void vm64_perf_sample(VM64Perf* perf, VM64* vm, VM64PerfSample* sample);
+void vm64_perf_report(VM64Perf* perf, const char* label,
+                      const VM64PerfSample* start, const VM64PerfSample* end);
+void vm64_perf_run(VM64* vm, VM64Perf* perf);
+
+#endif /* VM64_PERF_H */
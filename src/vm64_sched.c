@@ -0,0 +1,480 @@
+#define _GNU_SOURCE
+#include "vm64_sched.h"
+#include "vm64_mmu.h"
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+
+#ifdef __APPLE__
+#define SYS_read 3
+#endif
+
+#define SCHED_IDLE_WAIT_NS 5000000         /* Idle worker re-check interval */
+
+static uint64_t sched_thread_cpu_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+/* Append a guest to the tail of a worker's queue */
+static int sched_enqueue(VM64Sched* sched, VM64Guest* guest, int index) {
+    VM64Worker* w = &sched->workers[index];
+    
+    pthread_mutex_lock(&w->lock);
+    if (w->count == w->cap) {
+        size_t cap = w->cap ? w->cap * 2 : 64;
+        VM64Guest** q = (VM64Guest**)malloc(cap * sizeof(*q));
+        if (!q) {
+            pthread_mutex_unlock(&w->lock);
+            return -1;
+        }
+        for (size_t i = 0; i < w->count; i++) {
+            q[i] = w->queue[(w->head + i) % w->cap];
+        }
+        free(w->queue);
+        w->queue = q;
+        w->head = 0;
+        w->cap = cap;
+    }
+    w->queue[(w->head + w->count) % w->cap] = guest;
+    w->count++;
+    guest->home = index;
+    pthread_mutex_unlock(&w->lock);
+    
+    pthread_mutex_lock(&sched->lock);
+    pthread_cond_signal(&sched->work_cond);
+    pthread_mutex_unlock(&sched->lock);
+    return 0;
+}
+
+/* Take the next guest from our own queue */
+static VM64Guest* sched_pop_local(VM64Worker* w) {
+    VM64Guest* guest = NULL;
+    
+    pthread_mutex_lock(&w->lock);
+    if (w->count > 0) {
+        guest = w->queue[w->head];
+        w->head = (w->head + 1) % w->cap;
+        w->count--;
+    }
+    pthread_mutex_unlock(&w->lock);
+    return guest;
+}
+
+/* Take the most recently queued guest from another worker */
+static VM64Guest* sched_steal(VM64Worker* self) {
+    VM64Sched* sched = self->sched;
+    
+    for (int i = 1; i < sched->worker_count; i++) {
+        VM64Worker* victim = &sched->workers[(self->index + i) % sched->worker_count];
+        if (pthread_mutex_trylock(&victim->lock) != 0) continue;
+        
+        VM64Guest* guest = NULL;
+        if (victim->count > 0) {
+            guest = victim->queue[(victim->head + victim->count - 1) % victim->cap];
+            victim->count--;
+        }
+        pthread_mutex_unlock(&victim->lock);
+        
+        if (guest) {
+            self->steals++;
+            return guest;
+        }
+    }
+    return NULL;
+}
+
+/* Complete a pending SYS_read on fd 0 from the guest's input queue.
+ * Returns 1 if serviced, 0 if the guest would block; the caller marks it
+ * BLOCKED once it is done touching the guest. */
+static int sched_service_read(VM64Guest* guest) {
+    VM64* vm = guest->vm;
+    uint64_t buf_addr = vm->regs[RSI];
+    uint64_t count = vm->regs[RDX];
+    int serviced = 1;
+    
+    pthread_mutex_lock(&guest->lock);
+    if (guest->input_pos < guest->input_len) {
+        size_t n = guest->input_len - guest->input_pos;
+        if (n > count) n = (size_t)count;
+        if (vm64_write_guest(vm, buf_addr, guest->input + guest->input_pos,
+                             n) != 0) {
+            vm->regs[RAX] = -1;
+        } else {
+            guest->input_pos += n;
+            vm->regs[RAX] = n;
+        }
+    } else if (guest->input_eof) {
+        vm->regs[RAX] = 0;
+    } else {
+        serviced = 0;
+    }
+    if (serviced) guest->read_pending = 0;
+    pthread_mutex_unlock(&guest->lock);
+    
+    return serviced;
+}
+
+static void sched_guest_done(VM64Sched* sched, VM64Guest* guest) {
+    pthread_mutex_lock(&guest->lock);
+    guest->state = VM64_GUEST_DONE;
+    pthread_mutex_unlock(&guest->lock);
+    
+    pthread_mutex_lock(&sched->lock);
+    if (--sched->live == 0) pthread_cond_broadcast(&sched->done_cond);
+    pthread_mutex_unlock(&sched->lock);
+}
+
+/* Run one time slice of a guest */
+static void sched_run_slice(VM64Worker* w, VM64Guest* guest) {
+    VM64Sched* sched = w->sched;
+    VM64* vm = guest->vm;
+    uint64_t budget = sched->slice;
+    uint64_t start_insns = vm->instruction_count;
+    uint64_t start_ns = sched_thread_cpu_ns();
+    int outcome = VM64_GUEST_RUNNABLE;
+    
+    pthread_mutex_lock(&guest->lock);
+    guest->state = VM64_GUEST_RUNNING;
+    pthread_mutex_unlock(&guest->lock);
+    
+    /* First slice: place RAM on the node of the thread running the guest */
+    if (!guest->numa_bound) {
+        if (vm->ram_flags & VM64_RAM_NUMA_LOCAL) vm64_ram_bind_local(vm);
+        guest->numa_bound = 1;
+    }
+    
+    if (vm->max_insns) {
+        uint64_t left = vm->instruction_count < vm->max_insns
+                        ? vm->max_insns - vm->instruction_count : 0;
+        if (left < budget) budget = left;
+    }
+    
+    if (guest->read_pending && !sched_service_read(guest)) {
+        outcome = VM64_GUEST_BLOCKED;
+        budget = 0;
+    }
+    
+    while (budget > 0) {
+        uint64_t before = vm->instruction_count;
+        VM64Exit reason = vm64_run_budget(vm, budget);
+        uint64_t ran = vm->instruction_count - before;
+        budget = (ran < budget) ? budget - ran : 0;
+        
+        if (reason == VM64_EXIT_BUDGET) break;
+        if (reason != VM64_EXIT_SYSCALL) {
+            outcome = VM64_GUEST_DONE;
+            break;
+        }
+        
+        if (vm->regs[RAX] == SYS_read && vm->regs[RDI] == 0) {
+            guest->read_pending = 1;
+            if (!sched_service_read(guest)) {
+                outcome = VM64_GUEST_BLOCKED;
+                break;
+            }
+        } else {
+            vm64_syscall_handler(vm);
+            if (vm->halted) {
+                outcome = VM64_GUEST_DONE;
+                break;
+            }
+        }
+    }
+    
+    /* vm->max_insns ends the guest like vm64_run does */
+    if (outcome == VM64_GUEST_RUNNABLE && vm->max_insns &&
+        vm->instruction_count >= vm->max_insns) {
+        outcome = VM64_GUEST_DONE;
+    }
+    
+    guest->insns += vm->instruction_count - start_insns;
+    guest->cpu_ns += sched_thread_cpu_ns() - start_ns;
+    guest->slices++;
+    w->slices++;
+    
+    if (outcome == VM64_GUEST_BLOCKED) {
+        /* Input fed since sched_service_read did not see a BLOCKED guest,
+         * so check again before publishing the state */
+        pthread_mutex_lock(&guest->lock);
+        if (guest->input_pos < guest->input_len || guest->input_eof) {
+            outcome = VM64_GUEST_RUNNABLE;
+        } else {
+            guest->state = VM64_GUEST_BLOCKED;
+            guest->blocks++;
+        }
+        pthread_mutex_unlock(&guest->lock);
+    }
+    
+    if (outcome == VM64_GUEST_DONE) {
+        sched_guest_done(sched, guest);
+    } else if (outcome == VM64_GUEST_RUNNABLE) {
+        pthread_mutex_lock(&guest->lock);
+        guest->state = VM64_GUEST_RUNNABLE;
+        pthread_mutex_unlock(&guest->lock);
+        sched_enqueue(sched, guest, w->index);
+    }
+    /* BLOCKED guests are re-queued by vm64_sched_feed; the guest may
+     * already be running elsewhere, so it is not touched past this point */
+}
+
+static void* sched_worker_main(void* arg) {
+    VM64Worker* w = (VM64Worker*)arg;
+    VM64Sched* sched = w->sched;
+    
+    while (1) {
+        VM64Guest* guest = sched_pop_local(w);
+        if (!guest) guest = sched_steal(w);
+        
+        if (guest) {
+            sched_run_slice(w, guest);
+            continue;
+        }
+        
+        pthread_mutex_lock(&sched->lock);
+        if (sched->shutdown) {
+            pthread_mutex_unlock(&sched->lock);
+            break;
+        }
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_nsec += SCHED_IDLE_WAIT_NS;
+        if (deadline.tv_nsec >= 1000000000L) {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000L;
+        }
+        pthread_cond_timedwait(&sched->work_cond, &sched->lock, &deadline);
+        w->idle_waits++;
+        pthread_mutex_unlock(&sched->lock);
+    }
+    return NULL;
+}
+
+/* Create a scheduler with the given number of workers (0 = one per core)
+ * and time slice in guest instructions */
+VM64Sched* vm64_sched_create(int workers, uint64_t slice) {
+    if (workers <= 0) {
+        long cores = sysconf(_SC_NPROCESSORS_ONLN);
+        workers = cores > 0 ? (int)cores : 1;
+    }
+    
+    VM64Sched* sched = (VM64Sched*)calloc(1, sizeof(VM64Sched));
+    if (!sched) return NULL;
+    
+    sched->workers = (VM64Worker*)calloc((size_t)workers, sizeof(VM64Worker));
+    if (!sched->workers) {
+        free(sched);
+        return NULL;
+    }
+    
+    sched->worker_count = workers;
+    sched->worker_alloc = workers;
+    sched->slice = slice ? slice : 10000;
+    pthread_mutex_init(&sched->lock, NULL);
+    pthread_cond_init(&sched->work_cond, NULL);
+    pthread_cond_init(&sched->done_cond, NULL);
+    
+    for (int i = 0; i < workers; i++) {
+        pthread_mutex_init(&sched->workers[i].lock, NULL);
+        sched->workers[i].index = i;
+        sched->workers[i].sched = sched;
+    }
+    return sched;
+}
+
+/* Stop the workers and free scheduler state (guests' VMs are not freed) */
+void vm64_sched_destroy(VM64Sched* sched) {
+    if (!sched) return;
+    
+    pthread_mutex_lock(&sched->lock);
+    sched->shutdown = 1;
+    pthread_cond_broadcast(&sched->work_cond);
+    pthread_mutex_unlock(&sched->lock);
+    
+    for (int i = 0; i < sched->worker_alloc; i++) {
+        if (sched->started && i < sched->worker_count) {
+            pthread_join(sched->workers[i].thread, NULL);
+        }
+        pthread_mutex_destroy(&sched->workers[i].lock);
+        free(sched->workers[i].queue);
+    }
+    
+    for (int i = 0; i < sched->guest_count; i++) {
+        pthread_mutex_destroy(&sched->guests[i]->lock);
+        free(sched->guests[i]->input);
+        free(sched->guests[i]);
+    }
+    
+    pthread_cond_destroy(&sched->done_cond);
+    pthread_cond_destroy(&sched->work_cond);
+    pthread_mutex_destroy(&sched->lock);
+    free(sched->guests);
+    free(sched->workers);
+    free(sched);
+}
+
+/* Hand a VM to the scheduler; it becomes runnable immediately */
+VM64Guest* vm64_sched_add(VM64Sched* sched, VM64* vm) {
+    if (!sched || !vm) return NULL;
+    
+    VM64Guest* guest = (VM64Guest*)calloc(1, sizeof(VM64Guest));
+    if (!guest) return NULL;
+    
+    guest->vm = vm;
+    guest->state = VM64_GUEST_RUNNABLE;
+    pthread_mutex_init(&guest->lock, NULL);
+    
+    /* Syscalls come back to the scheduler so input reads can block */
+    vm->trap_syscalls = 1;
+    
+    pthread_mutex_lock(&sched->lock);
+    if (sched->guest_count == sched->guest_cap) {
+        int cap = sched->guest_cap ? sched->guest_cap * 2 : 64;
+        VM64Guest** g = (VM64Guest**)realloc(sched->guests, (size_t)cap * sizeof(*g));
+        if (!g) {
+            pthread_mutex_unlock(&sched->lock);
+            pthread_mutex_destroy(&guest->lock);
+            free(guest);
+            return NULL;
+        }
+        sched->guests = g;
+        sched->guest_cap = cap;
+    }
+    guest->id = sched->guest_count;
+    sched->guests[sched->guest_count++] = guest;
+    sched->live++;
+    pthread_mutex_unlock(&sched->lock);
+    
+    sched_enqueue(sched, guest, guest->id % sched->worker_count);
+    return guest;
+}
+
+/* Append bytes to a guest's stdin; eof marks the end of input.
+ * A guest blocked on input is rescheduled. */
+int vm64_sched_feed(VM64Sched* sched, VM64Guest* guest,
+                    const uint8_t* data, size_t len, int eof) {
+    if (!sched || !guest) return -1;
+    
+    pthread_mutex_lock(&guest->lock);
+    if (len > 0) {
+        /* Drop consumed bytes before growing */
+        size_t left = guest->input_len - guest->input_pos;
+        uint8_t* buf = (uint8_t*)malloc(left + len);
+        if (!buf) {
+            pthread_mutex_unlock(&guest->lock);
+            return -1;
+        }
+        if (left) memcpy(buf, guest->input + guest->input_pos, left);
+        memcpy(buf + left, data, len);
+        free(guest->input);
+        guest->input = buf;
+        guest->input_len = left + len;
+        guest->input_pos = 0;
+    }
+    if (eof) guest->input_eof = 1;
+    
+    int wake = (guest->state == VM64_GUEST_BLOCKED);
+    if (wake) guest->state = VM64_GUEST_RUNNABLE;
+    pthread_mutex_unlock(&guest->lock);
+    
+    if (wake) sched_enqueue(sched, guest, guest->home);
+    return 0;
+}
+
+/* Start the worker threads */
+int vm64_sched_start(VM64Sched* sched) {
+    if (!sched || sched->started) return -1;
+    
+    int count = sched->worker_count;
+    int started = 0;
+    while (started < count &&
+           pthread_create(&sched->workers[started].thread, NULL,
+                          sched_worker_main, &sched->workers[started]) == 0) {
+        started++;
+    }
+    sched->started = 1;
+    if (started == count) return 0;
+    if (started == 0) {
+        sched->worker_count = 0;
+        return -1;
+    }
+    
+    /* Run with the threads we have: move the queues of the workers that
+     * never started onto the live ones, or their guests would never run */
+    pthread_mutex_lock(&sched->lock);
+    sched->worker_count = started;
+    pthread_mutex_unlock(&sched->lock);
+    for (int i = started; i < count; i++) {
+        VM64Worker* w = &sched->workers[i];
+        VM64Guest* guest;
+        while ((guest = sched_pop_local(w)) != NULL) {
+            if (sched_enqueue(sched, guest, i % started) != 0) return -1;
+        }
+    }
+    return 0;
+}
+
+/* Block until every guest is DONE */
+void vm64_sched_wait(VM64Sched* sched) {
+    if (!sched) return;
+    
+    pthread_mutex_lock(&sched->lock);
+    while (sched->live > 0) {
+        pthread_cond_wait(&sched->done_cond, &sched->lock);
+    }
+    pthread_mutex_unlock(&sched->lock);
+}
+
+/* Print per-guest CPU accounting, fairness and per-worker statistics */
+void vm64_sched_report(VM64Sched* sched, FILE* out) {
+    if (!sched || !out) return;
+    
+    static const char* state_names[] = { "runnable", "running", "blocked", "done" };
+    uint64_t total_insns = 0, total_ns = 0;
+    uint64_t min_ns = UINT64_MAX, max_ns = 0;
+    double sum = 0.0, sum_sq = 0.0;
+    
+    pthread_mutex_lock(&sched->lock);
+    int n = sched->guest_count;
+    
+    fprintf(out, "\n=== VM64 Scheduler: %d guest(s) on %d worker(s), "
+            "slice %llu insns ===\n", n, sched->worker_count,
+            (unsigned long long)sched->slice);
+    
+    for (int i = 0; i < n; i++) {
+        VM64Guest* g = sched->guests[i];
+        total_insns += g->insns;
+        total_ns += g->cpu_ns;
+        if (g->cpu_ns < min_ns) min_ns = g->cpu_ns;
+        if (g->cpu_ns > max_ns) max_ns = g->cpu_ns;
+        sum += (double)g->cpu_ns;
+        sum_sq += (double)g->cpu_ns * (double)g->cpu_ns;
+        
+        if (n <= 32) {
+            fprintf(out, "  guest %3d: %-8s %12llu insns %10.3f ms cpu "
+                    "%8llu slices %6llu blocks\n",
+                    g->id, state_names[g->state], (unsigned long long)g->insns,
+                    g->cpu_ns / 1e6, (unsigned long long)g->slices,
+                    (unsigned long long)g->blocks);
+        }
+    }
+    
+    if (n > 0) {
+        fprintf(out, "  total: %llu insns, %.3f ms cpu; per guest min %.3f ms, "
+                "max %.3f ms\n", (unsigned long long)total_insns, total_ns / 1e6,
+                min_ns / 1e6, max_ns / 1e6);
+        fprintf(out, "  fairness (Jain, cpu time): %.4f\n",
+                sum_sq > 0.0 ? (sum * sum) / (n * sum_sq) : 1.0);
+    }
+    
+    for (int i = 0; i < sched->worker_count; i++) {
+        VM64Worker* w = &sched->workers[i];
+        fprintf(out, "  worker %2d: %10llu slices %8llu steals %8llu idle waits\n",
+                i, (unsigned long long)w->slices, (unsigned long long)w->steals,
+                (unsigned long long)w->idle_waits);
+    }
+    pthread_mutex_unlock(&sched->lock);
+}
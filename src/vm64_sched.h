@@ -0,0 +1,84 @@
+#ifndef VM64_SCHED_H
+#define VM64_SCHED_H
+
+#include "vm64.h"
+#include <stdio.h>
+#include <pthread.h>
+
+/* Guest lifecycle */
+typedef enum {
+    VM64_GUEST_RUNNABLE = 0,               /* Queued on a worker */
+    VM64_GUEST_RUNNING,                    /* Executing a time slice */
+    VM64_GUEST_BLOCKED,                    /* Waiting for input (SYS_read fd 0) */
+    VM64_GUEST_DONE,                       /* Halted, faulted or hit a breakpoint */
+} VM64GuestState;
+
+/* A VM64 instance owned by the scheduler */
+typedef struct {
+    VM64* vm;
+    int id;
+    VM64GuestState state;
+    int home;                              /* Worker it was last queued on */
+    int read_pending;                      /* SYS_read waiting for input */
+    int numa_bound;                        /* RAM bound on first slice */
+    
+    /* Guest stdin (fed by vm64_sched_feed) */
+    uint8_t* input;
+    size_t input_len;
+    size_t input_pos;
+    int input_eof;
+    pthread_mutex_t lock;                  /* Guards state and input */
+    
+    /* Accounting */
+    uint64_t insns;                        /* Guest instructions executed */
+    uint64_t cpu_ns;                       /* Host thread CPU time */
+    uint64_t slices;                       /* Time slices received */
+    uint64_t blocks;                       /* Times descheduled on input */
+} VM64Guest;
+
+/* Per-thread run queue (owner pops the head, thieves take the tail) */
+typedef struct {
+    pthread_t thread;
+    pthread_mutex_t lock;
+    VM64Guest** queue;
+    size_t head;
+    size_t count;
+    size_t cap;
+    int index;
+    struct VM64Sched* sched;
+    
+    uint64_t slices;
+    uint64_t steals;
+    uint64_t idle_waits;
+} VM64Worker;
+
+/* M:N scheduler: many guests on a fixed pool of worker threads */
+typedef struct VM64Sched {
+    VM64Worker* workers;
+    int worker_count;                      /* Workers running (or to run) */
+    int worker_alloc;                      /* Workers allocated */
+    uint64_t slice;                        /* Instructions per time slice */
+    
+    VM64Guest** guests;
+    int guest_count;
+    int guest_cap;
+    int live;                              /* Guests not yet DONE */
+    int started;
+    int shutdown;
+    
+    pthread_mutex_t lock;                  /* Guards guests, live, wakeups */
+    pthread_cond_t work_cond;              /* Signalled when work is queued */
+    pthread_cond_t done_cond;              /* Signalled when live drops to 0 */
+} VM64Sched;
+
+/* Function declarations */
+VM64Sched* vm64_sched_create(int workers, uint64_t slice);
+void vm64_sched_destroy(VM64Sched* sched);
+VM64Guest* vm64_sched_add(VM64Sched* sched, VM64* vm);
+int vm64_sched_feed(VM64Sched* sched, VM64Guest* guest,
+                    const uint8_t* data, size_t len, int eof);
+int vm64_sched_start(VM64Sched* sched);
+void vm64_sched_wait(VM64Sched* sched);
+void vm64_sched_report(VM64Sched* sched, FILE* out);
+
+#endif /* VM64_SCHED_H */
@@ -0,0 +1,188 @@
+#define _GNU_SOURCE
+#include "vm64_share.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+
+/* One cached image: page-padded copy in an unlinked temp file */
+typedef struct ImageEntry {
+    uint64_t hash;
+    size_t size;
+    int fd;
+    const uint8_t* data;                   /* Read-only mapping of fd */
+    size_t map_size;
+    struct ImageEntry* next;
+} ImageEntry;
+
+static ImageEntry* image_cache = NULL;
+static pthread_mutex_t image_cache_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* FNV-1a 64 */
+static uint64_t image_hash(const uint8_t* data, size_t size) {
+    uint64_t h = 0xcbf29ce484222325ULL;
+    for (size_t i = 0; i < size; i++) {
+        h ^= data[i];
+        h *= 0x100000001b3ULL;
+    }
+    return h;
+}
+
+static ImageEntry* image_cache_create(const uint8_t* data, size_t size,
+                                      uint64_t hash) {
+    const char* dir = getenv("TMPDIR");
+    char path[4096];
+    snprintf(path, sizeof(path), "%s/vm64-image-XXXXXX", dir ? dir : "/tmp");
+    
+    int fd = mkstemp(path);
+    if (fd < 0) return NULL;
+    unlink(path);
+    
+    size_t map_size = (size + VM64_PAGE_SIZE - 1) & ~(size_t)(VM64_PAGE_SIZE - 1);
+    size_t off = 0;
+    while (off < size) {
+        ssize_t n = write(fd, data + off, size - off);
+        if (n <= 0) {
+            close(fd);
+            return NULL;
+        }
+        off += (size_t)n;
+    }
+    if (ftruncate(fd, (off_t)map_size) != 0) {
+        close(fd);
+        return NULL;
+    }
+    
+    void* p = mmap(NULL, map_size, PROT_READ, MAP_SHARED, fd, 0);
+    ImageEntry* e = (ImageEntry*)calloc(1, sizeof(ImageEntry));
+    if (p == MAP_FAILED || !e) {
+        if (p != MAP_FAILED) munmap(p, map_size);
+        free(e);
+        close(fd);
+        return NULL;
+    }
+    
+    e->hash = hash;
+    e->size = size;
+    e->fd = fd;
+    e->data = (const uint8_t*)p;
+    e->map_size = map_size;
+    return e;
+}
+
+/* Find or add an image; caller holds image_cache_lock */
+static ImageEntry* image_cache_get(const uint8_t* data, size_t size) {
+    uint64_t hash = image_hash(data, size);
+    
+    for (ImageEntry* e = image_cache; e; e = e->next) {
+        if (e->hash == hash && e->size == size &&
+            memcmp(e->data, data, size) == 0) {
+            return e;
+        }
+    }
+    
+    ImageEntry* e = image_cache_create(data, size, hash);
+    if (e) {
+        e->next = image_cache;
+        image_cache = e;
+    }
+    return e;
+}
+
+/* Load an in-memory image, sharing its whole pages with other instances */
+int vm64_load_buffer_shared(VM64* vm, const uint8_t* data, size_t size,
+                            uint64_t load_addr) {
+    if (!vm || !data || size == 0) return -1;
+    if (vm->paging) return vm64_load_buffer(vm, data, size, load_addr);
+    if (load_addr >= VM64_RAM_SIZE || size > VM64_RAM_SIZE - load_addr) {
+        return -1;
+    }
+    
+    size_t shared = size & ~(size_t)(VM64_PAGE_SIZE - 1);
+    int can_share = vm->ram_map && !(vm->ram_flags & VM64_RAM_HUGETLB) &&
+                    load_addr % VM64_PAGE_SIZE == 0 && shared > 0;
+    if (!can_share) return vm64_load_buffer(vm, data, size, load_addr);
+    
+    pthread_mutex_lock(&image_cache_lock);
+    ImageEntry* e = image_cache_get(data, size);
+    void* p = MAP_FAILED;
+    if (e) {
+        p = mmap(&vm->ram[load_addr], shared, PROT_READ | PROT_WRITE,
+                 MAP_PRIVATE | MAP_FIXED, e->fd, 0);
+    }
+    pthread_mutex_unlock(&image_cache_lock);
+    
+    if (p != (void*)&vm->ram[load_addr]) {
+        return vm64_load_buffer(vm, data, size, load_addr);
+    }
+    
+    /* The mapped range no longer has huge page backing or a NUMA policy */
+    vm->ram_flags &= ~VM64_RAM_THP;
+    vm64_ram_rebind(vm);
+    
+    uint64_t first = load_addr / VM64_PAGE_SIZE;
+    for (uint64_t page = first; page < first + shared / VM64_PAGE_SIZE; page++) {
+        vm->page_flags[page] = VM64_PAGE_SHARED | VM64_PAGE_DIRTY;
+    }
+    
+    /* Partial last page stays private so bytes past the image are kept */
+    if (size > shared) {
+        memcpy(&vm->ram[load_addr + shared], data + shared, size - shared);
+        vm64_mark_dirty(vm, load_addr + shared, size - shared);
+    }
+    
+    vm->rip = load_addr;
+    return 0;
+}
+
+/* Load an image file, sharing its whole pages with other instances */
+int vm64_load_image_shared(VM64* vm, const char* filename, uint64_t load_addr) {
+    if (!vm || !filename) return -1;
+    
+    FILE* f = fopen(filename, "rb");
+    if (!f) {
+        fprintf(stderr, "Error: Cannot open file '%s'\n", filename);
+        return -1;
+    }
+    
+    fseek(f, 0, SEEK_END);
+    long size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    
+    if (size <= 0 || (!vm->paging && (load_addr >= VM64_RAM_SIZE ||
+        (uint64_t)size > VM64_RAM_SIZE - load_addr))) {
+        fprintf(stderr, "Error: File too large or invalid address\n");
+        fclose(f);
+        return -1;
+    }
+    
+    uint8_t* data = (uint8_t*)malloc((size_t)size);
+    if (!data || fread(data, 1, (size_t)size, f) != (size_t)size) {
+        fprintf(stderr, "Error: Failed to read entire file\n");
+        free(data);
+        fclose(f);
+        return -1;
+    }
+    fclose(f);
+    
+    int ret = vm64_load_buffer_shared(vm, data, (size_t)size, load_addr);
+    free(data);
+    return ret;
+}
+
+/* Drop cached images (existing guest mappings stay valid) */
+void vm64_image_cache_clear(void) {
+    pthread_mutex_lock(&image_cache_lock);
+    ImageEntry* e = image_cache;
+    while (e) {
+        ImageEntry* next = e->next;
+        munmap((void*)e->data, e->map_size);
+        close(e->fd);
+        free(e);
+        e = next;
+    }
+    image_cache = NULL;
+    pthread_mutex_unlock(&image_cache_lock);
+}
@@ -0,0 +1,16 @@
+#ifndef VM64_SHARE_H
+#define VM64_SHARE_H
+
+#include "vm64.h"
+
+/* Content-addressed image cache: instances loading identical images map
+ * the same read-only host pages copy-on-write. Only whole pages starting
+ * at a page-aligned load address are shared; the rest is copied. */
+
+/* Function declarations */
+int vm64_load_image_shared(VM64* vm, const char* filename, uint64_t load_addr);
+int vm64_load_buffer_shared(VM64* vm, const uint8_t* data, size_t size,
+                            uint64_t load_addr);
+void vm64_image_cache_clear(void);
+
+#endif /* VM64_SHARE_H */
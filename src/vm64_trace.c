@@ -0,0 +1,349 @@
+#include "vm64_trace.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* ---- LZ block compression ----
+ * LZ4-style sequences: a token byte (literal length << 4 | match length - 4),
+ * extra length bytes when a nibble is 15, the literals, then a 16-bit
+ * little-endian offset and any match length bytes. The last sequence has
+ * literals only. */
+
+#define LZ_HASH_BITS 14
+#define LZ_MIN_MATCH 4
+#define LZ_MAX_OFFSET 65535
+
+/* Upper bound on compressed size for len input bytes */
+#define LZ_BOUND(len) ((len) + (len) / 255 + 16)
+
+static uint32_t lz_read32(const uint8_t* p) {
+    uint32_t v;
+    memcpy(&v, p, 4);
+    return v;
+}
+
+static uint32_t lz_hash(uint32_t v) {
+    return (v * 2654435761U) >> (32 - LZ_HASH_BITS);
+}
+
+static uint8_t* lz_put_length(uint8_t* op, size_t len) {
+    while (len >= 255) {
+        *op++ = 255;
+        len -= 255;
+    }
+    *op++ = (uint8_t)len;
+    return op;
+}
+
+static uint8_t* lz_put_sequence(uint8_t* op, const uint8_t* lit, size_t lit_len,
+                                size_t offset, size_t match_len) {
+    uint8_t* token = op++;
+    *token = (uint8_t)((lit_len >= 15 ? 15 : lit_len) << 4);
+    if (lit_len >= 15) op = lz_put_length(op, lit_len - 15);
+    memcpy(op, lit, lit_len);
+    op += lit_len;
+    
+    if (match_len) {
+        *op++ = (uint8_t)(offset & 0xFF);
+        *op++ = (uint8_t)(offset >> 8);
+        size_t m = match_len - LZ_MIN_MATCH;
+        *token |= (uint8_t)(m >= 15 ? 15 : m);
+        if (m >= 15) op = lz_put_length(op, m - 15);
+    }
+    return op;
+}
+
+/* Compress len bytes into dst (at least LZ_BOUND(len) bytes); returns the
+ * compressed size */
+size_t vm64_lz_compress(const uint8_t* src, size_t len, uint8_t* dst) {
+    static __thread uint32_t table[1 << LZ_HASH_BITS];
+    memset(table, 0, sizeof(table));
+    
+    uint8_t* op = dst;
+    size_t anchor = 0;
+    size_t i = 1;
+    
+    while (i + LZ_MIN_MATCH <= len) {
+        uint32_t v = lz_read32(src + i);
+        uint32_t h = lz_hash(v);
+        size_t cand = table[h];
+        table[h] = (uint32_t)i;
+        
+        if (cand == 0 || i - cand > LZ_MAX_OFFSET || lz_read32(src + cand) != v) {
+            i++;
+            continue;
+        }
+        
+        size_t match = LZ_MIN_MATCH;
+        while (i + match < len && src[cand + match] == src[i + match]) match++;
+        
+        op = lz_put_sequence(op, src + anchor, i - anchor, i - cand, match);
+        i += match;
+        anchor = i;
+    }
+    
+    return (size_t)(lz_put_sequence(op, src + anchor, len - anchor, 0, 0) - dst);
+}
+
+static int lz_get_length(const uint8_t** ip, const uint8_t* end, size_t* len) {
+    uint8_t b;
+    do {
+        if (*ip >= end) return -1;
+        b = *(*ip)++;
+        *len += b;
+    } while (b == 255);
+    return 0;
+}
+
+/* Decompress into dst (cap bytes); returns the output size or -1 */
+long vm64_lz_decompress(const uint8_t* src, size_t len, uint8_t* dst,
+                        size_t cap) {
+    const uint8_t* ip = src;
+    const uint8_t* end = src + len;
+    size_t out = 0;
+    
+    while (ip < end) {
+        uint8_t token = *ip++;
+        size_t lit = token >> 4;
+        if (lit == 15 && lz_get_length(&ip, end, &lit) != 0) return -1;
+        if (lit > (size_t)(end - ip) || lit > cap - out) return -1;
+        memcpy(dst + out, ip, lit);
+        ip += lit;
+        out += lit;
+        if (ip == end) break;
+        
+        if (end - ip < 2) return -1;
+        size_t offset = (size_t)ip[0] | ((size_t)ip[1] << 8);
+        ip += 2;
+        size_t match = token & 15;
+        if (match == 15 && lz_get_length(&ip, end, &match) != 0) return -1;
+        match += LZ_MIN_MATCH;
+        if (offset == 0 || offset > out || match > cap - out) return -1;
+        
+        /* Byte copy: overlapping matches repeat the pattern */
+        for (size_t k = 0; k < match; k++, out++) {
+            dst[out] = dst[out - offset];
+        }
+    }
+    return (long)out;
+}
+
+/* ---- Writer thread ---- */
+
+static void* trace_writer(void* arg) {
+    VM64Trace* t = (VM64Trace*)arg;
+    uint8_t* comp = (uint8_t*)malloc(LZ_BOUND(VM64_TRACE_BLOCK_SIZE));
+    
+    pthread_mutex_lock(&t->lock);
+    for (;;) {
+        while (t->full_count == 0 && !t->stop) {
+            pthread_cond_wait(&t->cond, &t->lock);
+        }
+        if (t->full_count == 0) break;
+        
+        uint8_t* buf = t->full_bufs[t->full_head];
+        size_t len = t->full_lens[t->full_head];
+        uint64_t first = t->full_first[t->full_head];
+        pthread_mutex_unlock(&t->lock);
+        
+        VM64TraceBlock blk;
+        blk.raw_len = (uint32_t)len;
+        blk.first_insn = first;
+        size_t clen = comp ? vm64_lz_compress(buf, len, comp) : len;
+        const uint8_t* data = comp && clen < len ? comp : buf;
+        blk.comp_len = (uint32_t)(data == buf ? len : clen);
+        
+        int ok = fwrite(&blk, sizeof(blk), 1, t->file) == 1 &&
+                 fwrite(data, 1, blk.comp_len, t->file) == blk.comp_len;
+        
+        pthread_mutex_lock(&t->lock);
+        if (!ok) t->error = 1;
+        t->raw_bytes += len;
+        t->file_bytes += sizeof(blk) + blk.comp_len;
+        t->full_head = (t->full_head + 1) % VM64_TRACE_BUFFERS;
+        t->full_count--;
+        t->free_bufs[t->free_count++] = buf;
+        pthread_cond_broadcast(&t->cond);
+    }
+    pthread_mutex_unlock(&t->lock);
+    
+    free(comp);
+    return NULL;
+}
+
+/* Queue the current block for the writer and take a free buffer */
+static void trace_submit(VM64Trace* t) {
+    pthread_mutex_lock(&t->lock);
+    if (t->len > 0) {
+        int tail = (t->full_head + t->full_count) % VM64_TRACE_BUFFERS;
+        t->full_bufs[tail] = t->buf;
+        t->full_lens[tail] = t->len;
+        t->full_first[tail] = t->block_first;
+        t->full_count++;
+        pthread_cond_broadcast(&t->cond);
+        
+        /* Back-pressure: wait for the writer when every buffer is queued */
+        while (t->free_count == 0) {
+            pthread_cond_wait(&t->cond, &t->lock);
+        }
+        t->buf = t->free_bufs[--t->free_count];
+    }
+    pthread_mutex_unlock(&t->lock);
+    
+    t->len = 0;
+    t->block_first = t->insns;
+}
+
+/* ---- Encoder ---- */
+
+static uint8_t* trace_put_varint(uint8_t* p, uint64_t v) {
+    while (v >= 0x80) {
+        *p++ = (uint8_t)(v | 0x80);
+        v >>= 7;
+    }
+    *p++ = (uint8_t)v;
+    return p;
+}
+
+static uint8_t* trace_put_signed(uint8_t* p, uint64_t delta) {
+    int64_t d = (int64_t)delta;
+    return trace_put_varint(p, ((uint64_t)d << 1) ^ (uint64_t)(d >> 63));
+}
+
+/* Append one retired instruction. mem_flags is VM64_TREC_READ/WRITE for a
+ * data access at mem_addr; syscall_no is RAX before a SYSCALL. */
+void vm64_trace_record(VM64Trace* t, VM64* vm, uint64_t rip, uint8_t opcode,
+                       int mem_flags, uint64_t mem_addr, uint64_t syscall_no) {
+    if (t->len + VM64_TRACE_MAX_RECORD > VM64_TRACE_BLOCK_SIZE) trace_submit(t);
+    
+    uint8_t* start = t->buf + t->len;
+    uint8_t* p = start + 2;
+    uint8_t flags = (uint8_t)mem_flags;
+    
+    if (rip != t->next_rip) {
+        flags |= VM64_TREC_JUMP;
+        p = trace_put_signed(p, rip - t->next_rip);
+    }
+    t->next_rip = rip + vm64_insn_length(opcode);
+    
+    if (mem_flags) {
+        p = trace_put_signed(p, mem_addr - t->mem_addr);
+        t->mem_addr = mem_addr;
+    }
+    
+    if (opcode == X64_SYSCALL) {
+        flags |= VM64_TREC_SYSCALL;
+        p = trace_put_varint(p, syscall_no);
+        if (vm->syscall_pending) flags |= VM64_TREC_DEFERRED;
+        else p = trace_put_signed(p, vm->regs[RAX]);
+    }
+    
+    uint32_t mask = 0;
+    for (int r = 0; r < VM64_REG_COUNT; r++) {
+        if (vm->regs[r] != t->regs[r]) mask |= 1u << r;
+    }
+    if (vm->rsp != t->rsp) mask |= 1u << VM64_REG_COUNT;
+    if (mask) {
+        flags |= VM64_TREC_REGS;
+        p = trace_put_varint(p, mask);
+        for (int r = 0; r < VM64_REG_COUNT; r++) {
+            if (!(mask & (1u << r))) continue;
+            p = trace_put_signed(p, vm->regs[r] - t->regs[r]);
+            t->regs[r] = vm->regs[r];
+        }
+        if (mask & (1u << VM64_REG_COUNT)) {
+            p = trace_put_signed(p, vm->rsp - t->rsp);
+            t->rsp = vm->rsp;
+        }
+    }
+    
+    start[0] = flags;
+    start[1] = opcode;
+    t->len += (size_t)(p - start);
+    t->insns++;
+}
+
+/* Start tracing every instruction vm retires into filename */
+int vm64_trace_start(VM64* vm, const char* filename) {
+    if (!vm || !filename || vm->trace) return -1;
+    
+    VM64Trace* t = (VM64Trace*)calloc(1, sizeof(VM64Trace));
+    if (!t) return -1;
+    t->file = fopen(filename, "wb");
+    if (!t->file) {
+        fprintf(stderr, "Error: Cannot create trace '%s'\n", filename);
+        free(t);
+        return -1;
+    }
+    
+    for (int i = 0; i < VM64_TRACE_BUFFERS; i++) {
+        uint8_t* b = (uint8_t*)malloc(VM64_TRACE_BLOCK_SIZE);
+        if (!b) break;
+        t->free_bufs[t->free_count++] = b;
+    }
+    if (t->free_count < 2) {
+        while (t->free_count > 0) free(t->free_bufs[--t->free_count]);
+        fclose(t->file);
+        free(t);
+        return -1;
+    }
+    t->buf = t->free_bufs[--t->free_count];
+    
+    VM64TraceHeader hdr;
+    memset(&hdr, 0, sizeof(hdr));
+    memcpy(hdr.magic, VM64_TRACE_MAGIC, 8);
+    hdr.version = VM64_TRACE_VERSION;
+    hdr.block_size = VM64_TRACE_BLOCK_SIZE;
+    hdr.rip = vm->rip;
+    hdr.rsp = vm->rsp;
+    memcpy(hdr.regs, vm->regs, sizeof(hdr.regs));
+    fwrite(&hdr, sizeof(hdr), 1, t->file);
+    
+    t->next_rip = vm->rip;
+    t->rsp = vm->rsp;
+    memcpy(t->regs, vm->regs, sizeof(t->regs));
+    
+    pthread_mutex_init(&t->lock, NULL);
+    pthread_cond_init(&t->cond, NULL);
+    if (pthread_create(&t->thread, NULL, trace_writer, t) != 0) {
+        fclose(t->file);
+        free(t->buf);
+        while (t->free_count > 0) free(t->free_bufs[--t->free_count]);
+        free(t);
+        return -1;
+    }
+    
+    vm->trace = t;
+    return 0;
+}
+
+/* Flush the last block, stop the writer and close the trace file.
+ * Returns 0 if every block was written. */
+int vm64_trace_stop(VM64* vm) {
+    if (!vm || !vm->trace) return -1;
+    
+    VM64Trace* t = vm->trace;
+    vm->trace = NULL;
+    
+    trace_submit(t);
+    pthread_mutex_lock(&t->lock);
+    t->stop = 1;
+    pthread_cond_broadcast(&t->cond);
+    pthread_mutex_unlock(&t->lock);
+    pthread_join(t->thread, NULL);
+    
+    int error = fclose(t->file) != 0 || t->error;
+    fprintf(stderr, "Trace: %llu instructions, %llu KB encoded, %llu KB on disk "
+            "(%.2f bytes/insn)\n",
+            (unsigned long long)t->insns,
+            (unsigned long long)t->raw_bytes / 1024,
+            (unsigned long long)t->file_bytes / 1024,
+            t->insns ? (double)t->file_bytes / t->insns : 0.0);
+    
+    free(t->buf);
+    while (t->free_count > 0) free(t->free_bufs[--t->free_count]);
+    pthread_cond_destroy(&t->cond);
+    pthread_mutex_destroy(&t->lock);
+    free(t);
+    return error ? -1 : 0;
+}
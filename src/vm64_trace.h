@@ -0,0 +1,96 @@
+#ifndef VM64_TRACE_H
+#define VM64_TRACE_H
+
+#include "vm64.h"
+#include <stdio.h>
+#include <pthread.h>
+
+/* Trace file layout
+ *
+ *   VM64TraceHeader
+ *   blocks: VM64TraceBlock, then comp_len bytes (LZ compressed records,
+ *           or stored as-is when comp_len == raw_len)
+ *
+ * Records are delta encoded against the previous one. Each starts with a
+ * flags byte and the opcode, followed by the fields the flags select, in
+ * this order (varints are LEB128, signed values zigzag encoded):
+ *
+ *   VM64_TREC_JUMP      RIP - (previous RIP + previous insn length)
+ *   VM64_TREC_READ/WRITE address - previous memory address
+ *   VM64_TREC_SYSCALL   number, then result unless VM64_TREC_DEFERRED
+ *   VM64_TREC_REGS      mask (bit 16 = RSP), then new - old per register
+ */
+
+#define VM64_TRACE_MAGIC "VM64TRC\0"
+#define VM64_TRACE_VERSION 1
+#define VM64_TRACE_BLOCK_SIZE (256 * 1024)
+#define VM64_TRACE_MAX_RECORD 256          /* Worst-case encoded record */
+#define VM64_TRACE_BUFFERS 8               /* Blocks in flight to the writer */
+
+#define VM64_TREC_JUMP     0x01
+#define VM64_TREC_REGS     0x02
+#define VM64_TREC_READ     0x04
+#define VM64_TREC_WRITE    0x08
+#define VM64_TREC_SYSCALL  0x10
+#define VM64_TREC_DEFERRED 0x20            /* Trapped; result not known yet */
+
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t block_size;
+    uint64_t rip;                          /* State before the first record */
+    uint64_t rsp;
+    uint64_t regs[VM64_REG_COUNT];
+} VM64TraceHeader;
+
+typedef struct {
+    uint32_t raw_len;
+    uint32_t comp_len;
+    uint64_t first_insn;                   /* Index of the block's first record */
+} VM64TraceBlock;
+
+/* Streaming trace writer. The VM thread encodes records into a block
+ * buffer; full blocks are compressed and written by a writer thread. */
+typedef struct VM64Trace {
+    FILE* file;
+    
+    /* Encoder state (VM thread) */
+    uint8_t* buf;                          /* Block being filled */
+    size_t len;
+    uint64_t block_first;
+    uint64_t insns;
+    uint64_t next_rip;                     /* Predicted RIP of the next record */
+    uint64_t mem_addr;
+    uint64_t regs[VM64_REG_COUNT];
+    uint64_t rsp;
+    
+    /* Hand-off to the writer thread */
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    uint8_t* free_bufs[VM64_TRACE_BUFFERS];
+    int free_count;
+    uint8_t* full_bufs[VM64_TRACE_BUFFERS];
+    size_t full_lens[VM64_TRACE_BUFFERS];
+    uint64_t full_first[VM64_TRACE_BUFFERS];
+    int full_head;
+    int full_count;
+    int stop;
+    int error;
+    
+    /* Statistics (writer) */
+    uint64_t raw_bytes;
+    uint64_t file_bytes;
+} VM64Trace;
+
+/* Function declarations */
+int vm64_trace_start(VM64* vm, const char* filename);
+int vm64_trace_stop(VM64* vm);
+void vm64_trace_record(VM64Trace* trace, VM64* vm, uint64_t rip,
+                       uint8_t opcode, int mem_flags, uint64_t mem_addr,
+                       uint64_t syscall_no);
+size_t vm64_lz_compress(const uint8_t* src, size_t len, uint8_t* dst);
+long vm64_lz_decompress(const uint8_t* src, size_t len, uint8_t* dst,
+                        size_t cap);
+
+#endif /* VM64_TRACE_H */
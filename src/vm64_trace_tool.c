@@ -0,0 +1,470 @@
+#define _GNU_SOURCE
+#include "vm64_trace.h"
+#include "vm_cfg.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/* Offline analyzer for vm64 --trace files */
+
+/* Open-addressing counter table keyed by a 64-bit value */
+typedef struct {
+    uint64_t key;
+    uint64_t count;                        /* Executions / accesses */
+    uint64_t weight;                       /* Instructions / writes */
+    int used;
+} CountEntry;
+
+typedef struct {
+    CountEntry* slots;
+    size_t cap;
+    size_t size;
+} CountTable;
+
+static CountEntry* table_get(CountTable* t, uint64_t key) {
+    if (t->size * 2 >= t->cap) {
+        size_t old_cap = t->cap;
+        CountEntry* old = t->slots;
+        t->cap = old_cap ? old_cap * 2 : 1024;
+        t->slots = (CountEntry*)calloc(t->cap, sizeof(CountEntry));
+        if (!t->slots) {
+            perror("calloc");
+            exit(EXIT_FAILURE);
+        }
+        t->size = 0;
+        for (size_t i = 0; i < old_cap; i++) {
+            if (!old[i].used) continue;
+            CountEntry* e = table_get(t, old[i].key);
+            *e = old[i];
+        }
+        free(old);
+    }
+    
+    size_t i = (size_t)((key * 0x9E3779B97F4A7C15ULL) >> 20) & (t->cap - 1);
+    while (t->slots[i].used && t->slots[i].key != key) i = (i + 1) & (t->cap - 1);
+    if (!t->slots[i].used) {
+        t->slots[i].used = 1;
+        t->slots[i].key = key;
+        t->size++;
+    }
+    return &t->slots[i];
+}
+
+static int cmp_count(const void* a, const void* b) {
+    const CountEntry* x = (const CountEntry*)a;
+    const CountEntry* y = (const CountEntry*)b;
+    if (x->weight != y->weight) return x->weight < y->weight ? 1 : -1;
+    return x->count < y->count ? 1 : (x->count > y->count ? -1 : 0);
+}
+
+/* Compact the used entries to the front and sort by weight */
+static size_t table_sorted(CountTable* t) {
+    size_t n = 0;
+    for (size_t i = 0; i < t->cap; i++) {
+        if (t->slots[i].used) t->slots[n++] = t->slots[i];
+    }
+    qsort(t->slots, n, sizeof(CountEntry), cmp_count);
+    return n;
+}
+
+static const char* syscall_name(uint64_t no) {
+    switch (no) {
+        case 0: return "read";
+        case 1: return "write";
+        case 2: return "open";
+        case 3: return "close";
+        case 8: return "lseek";
+        case 9: return "mmap";
+        case 11: return "munmap";
+        case 12: return "brk";
+        case 60: return "exit";
+        case 231: return "exit_group";
+        default: return "?";
+    }
+}
+
+static int get_varint(const uint8_t** p, const uint8_t* end, uint64_t* v) {
+    uint64_t x = 0;
+    for (int shift = 0; shift < 64; shift += 7) {
+        if (*p >= end) return -1;
+        uint8_t b = *(*p)++;
+        x |= (uint64_t)(b & 0x7F) << shift;
+        if (!(b & 0x80)) {
+            *v = x;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+static int get_signed(const uint8_t** p, const uint8_t* end, uint64_t* v) {
+    uint64_t z;
+    if (get_varint(p, end, &z) != 0) return -1;
+    *v = (z >> 1) ^ (0 - (z & 1));
+    return 0;
+}
+
+/* Analysis state carried across blocks */
+typedef struct {
+    uint64_t next_rip;
+    uint64_t mem_addr;
+    uint64_t regs[VM64_REG_COUNT];
+    uint64_t rsp;
+    uint64_t insns;
+    uint8_t prev_opcode;
+    
+    uint64_t block_rip;                    /* Current basic block */
+    uint64_t block_len;
+    CountTable blocks;
+    
+    CountTable pages;
+    uint64_t reads, writes;
+    uint64_t stride_same, stride_near, stride_far;
+    int have_mem;
+    
+    uint64_t opcodes[256];
+    CountTable syscalls;
+    uint64_t timeline_max;
+    uint64_t timeline_shown;
+} Analysis;
+
+static void end_block(Analysis* a) {
+    if (a->block_len == 0) return;
+    CountEntry* e = table_get(&a->blocks, a->block_rip);
+    e->count++;
+    e->weight += a->block_len;
+    a->block_len = 0;
+}
+
+/* Decode one block of records; returns 0 or -1 on corrupt data */
+static int analyze_block(Analysis* a, const uint8_t* p, const uint8_t* end) {
+    while (p < end) {
+        if (end - p < 2) return -1;
+        uint8_t flags = *p++;
+        uint8_t opcode = *p++;
+        uint64_t v;
+        
+        uint64_t rip = a->next_rip;
+        if (flags & VM64_TREC_JUMP) {
+            if (get_signed(&p, end, &v) != 0) return -1;
+            rip += v;
+        }
+        a->next_rip = rip + vm64_insn_length(opcode);
+        
+        /* Basic blocks start at jump targets and after control transfers */
+        if ((flags & VM64_TREC_JUMP) || a->prev_opcode == X64_JMP ||
+            a->prev_opcode == X64_SYSCALL || a->block_len == 0) {
+            end_block(a);
+            a->block_rip = rip;
+        }
+        a->block_len++;
+        a->prev_opcode = opcode;
+        a->opcodes[opcode]++;
+        
+        if (flags & (VM64_TREC_READ | VM64_TREC_WRITE)) {
+            if (get_signed(&p, end, &v) != 0) return -1;
+            uint64_t delta = v;
+            a->mem_addr += delta;
+            
+            if (a->have_mem) {
+                int64_t d = (int64_t)delta;
+                if (d == 0) a->stride_same++;
+                else if (d >= -64 && d <= 64) a->stride_near++;
+                else a->stride_far++;
+            }
+            a->have_mem = 1;
+            
+            CountEntry* e = table_get(&a->pages, a->mem_addr / VM64_PAGE_SIZE);
+            e->count++;
+            if (flags & VM64_TREC_WRITE) {
+                e->weight++;
+                a->writes++;
+            } else {
+                a->reads++;
+            }
+        }
+        
+        if (flags & VM64_TREC_SYSCALL) {
+            uint64_t no, result = 0;
+            if (get_varint(&p, end, &no) != 0) return -1;
+            if (!(flags & VM64_TREC_DEFERRED) &&
+                get_signed(&p, end, &result) != 0) {
+                return -1;
+            }
+            
+            CountEntry* e = table_get(&a->syscalls, no);
+            e->count++;
+            e->weight++;
+            if (a->timeline_shown < a->timeline_max) {
+                printf("  %12llu  %-10s (%3llu)", (unsigned long long)a->insns,
+                       syscall_name(no), (unsigned long long)no);
+                if (flags & VM64_TREC_DEFERRED) printf(" = <trapped>\n");
+                else if (result + 4096 < 8192) printf(" = %lld\n", (long long)result);
+                else printf(" = 0x%llX\n", (unsigned long long)result);
+                a->timeline_shown++;
+            }
+        }
+        
+        if (flags & VM64_TREC_REGS) {
+            uint64_t mask;
+            if (get_varint(&p, end, &mask) != 0) return -1;
+            for (int r = 0; r < VM64_REG_COUNT; r++) {
+                if (!(mask & (1u << r))) continue;
+                if (get_signed(&p, end, &v) != 0) return -1;
+                a->regs[r] += v;
+            }
+            if (mask & (1u << VM64_REG_COUNT)) {
+                if (get_signed(&p, end, &v) != 0) return -1;
+                a->rsp += v;
+            }
+        }
+        
+        a->insns++;
+    }
+    return 0;
+}
+
+typedef struct {
+    uint32_t loop;
+    uint64_t insns;                        /* Including nested loops */
+    uint64_t entries;                      /* Runs starting at the header */
+} LoopCount;
+
+static int cmp_loop_count(const void* a, const void* b) {
+    const LoopCount* x = (const LoopCount*)a;
+    const LoopCount* y = (const LoopCount*)b;
+    return x->insns < y->insns ? 1 : (x->insns > y->insns ? -1 : 0);
+}
+
+/* Map the hot blocks onto the loops of the traced image. A run is charged
+ * to the static block it starts in and to every loop enclosing that block. */
+static void print_loops(const char* image_path, uint64_t base, uint64_t entry,
+                        const CountEntry* runs, size_t nruns, uint64_t total, size_t top) {
+    printf("\n=== Hot loops (static analysis of %s) ===\n", image_path);
+    FILE* f = fopen(image_path, "rb");
+    if (!f) {
+        printf("  cannot open image\n");
+        return;
+    }
+    fseek(f, 0, SEEK_END);
+    long size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    uint8_t* image = size > 0 ? (uint8_t*)malloc((size_t)size) : NULL;
+    if (!image || fread(image, 1, (size_t)size, f) != (size_t)size) {
+        printf("  cannot read image\n");
+        fclose(f);
+        free(image);
+        return;
+    }
+    fclose(f);
+    
+    uint64_t entries[2] = { entry, base };
+    size_t nentries = entry == base ? 1 : 2;
+    VMCfg* cfg = vm_cfg_build(&vm64_isa, image, (size_t)size, base, entries, nentries, 0);
+    LoopCount* counts = cfg ? (LoopCount*)calloc(cfg->nloops + 1, sizeof(LoopCount)) : NULL;
+    if (!counts) {
+        printf("  out of memory\n");
+        vm_cfg_free(cfg);
+        free(image);
+        return;
+    }
+    for (uint32_t l = 0; l < cfg->nloops; l++) counts[l].loop = l;
+    for (size_t i = 0; i < nruns; i++) {
+        int b = vm_cfg_block_at(cfg, runs[i].key);
+        if (b < 0) continue;
+        for (int32_t l = cfg->blocks[b].loop; l >= 0; l = cfg->loops[l].parent) {
+            counts[l].insns += runs[i].weight;
+            if (cfg->blocks[cfg->loops[l].header].start == runs[i].key) {
+                counts[l].entries += runs[i].count;
+            }
+        }
+    }
+    qsort(counts, cfg->nloops, sizeof(LoopCount), cmp_loop_count);
+    
+    printf("  %u blocks, %u loops, %u functions\n", cfg->nblocks, cfg->nloops,
+           cfg->nfunctions);
+    for (uint32_t i = 0; i < cfg->nloops && i < top; i++) {
+        const VMCfgLoop* loop = &cfg->loops[counts[i].loop];
+        if (!counts[i].insns) break;
+        printf("  0x%016llX  depth %u  %3u blocks  %12llu entries  %14llu insns  %6.2f%%\n",
+               (unsigned long long)cfg->blocks[loop->header].start, loop->depth,
+               loop->nbody, (unsigned long long)counts[i].entries,
+               (unsigned long long)counts[i].insns,
+               total ? 100.0 * counts[i].insns / total : 0.0);
+    }
+    
+    free(counts);
+    vm_cfg_free(cfg);
+    free(image);
+}
+
+static void print_usage(const char* prog) {
+    printf("Usage: %s [--top <n>] [--syscalls <n>] [--image <file> [--base <addr>]] trace.bin\n",
+           prog);
+    printf("  --top <n>       - Rows in the hot block, loop and page tables (default 20)\n");
+    printf("  --syscalls <n>  - Syscall timeline entries to list (default 50)\n");
+    printf("  --image <file>  - Traced image: adds hot loops from its control-flow graph\n");
+    printf("  --base <addr>   - Load address of --image in hex (default 0x400000)\n");
+}
+
+int main(int argc, char* argv[]) {
+    const char* path = NULL;
+    const char* image_path = NULL;
+    uint64_t image_base = 0x400000;
+    size_t top = 20;
+    Analysis a;
+    memset(&a, 0, sizeof(a));
+    a.timeline_max = 50;
+    
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--top") == 0 && i + 1 < argc) {
+            top = (size_t)strtoul(argv[++i], NULL, 0);
+        } else if (strcmp(argv[i], "--syscalls") == 0 && i + 1 < argc) {
+            a.timeline_max = strtoull(argv[++i], NULL, 0);
+        } else if (strcmp(argv[i], "--image") == 0 && i + 1 < argc) {
+            image_path = argv[++i];
+        } else if (strcmp(argv[i], "--base") == 0 && i + 1 < argc) {
+            image_base = strtoull(argv[++i], NULL, 16);
+        } else if (strcmp(argv[i], "--help") == 0) {
+            print_usage(argv[0]);
+            return EXIT_SUCCESS;
+        } else {
+            path = argv[i];
+        }
+    }
+    if (!path) {
+        print_usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+    
+    int fd = open(path, O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(VM64TraceHeader)) {
+        fprintf(stderr, "Error: Cannot read trace '%s'\n", path);
+        return EXIT_FAILURE;
+    }
+    const uint8_t* map = (const uint8_t*)mmap(NULL, (size_t)st.st_size, PROT_READ,
+                                              MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == (const uint8_t*)MAP_FAILED) {
+        perror("mmap");
+        return EXIT_FAILURE;
+    }
+    madvise((void*)map, (size_t)st.st_size, MADV_SEQUENTIAL);
+    
+    VM64TraceHeader hdr;
+    memcpy(&hdr, map, sizeof(hdr));
+    if (memcmp(hdr.magic, VM64_TRACE_MAGIC, 8) != 0 ||
+        hdr.version != VM64_TRACE_VERSION || hdr.block_size == 0) {
+        fprintf(stderr, "Error: '%s' is not a VM64 trace\n", path);
+        return EXIT_FAILURE;
+    }
+    
+    a.next_rip = hdr.rip;
+    a.rsp = hdr.rsp;
+    memcpy(a.regs, hdr.regs, sizeof(a.regs));
+    
+    uint8_t* raw = (uint8_t*)malloc(hdr.block_size);
+    if (!raw) return EXIT_FAILURE;
+    
+    printf("=== Syscall timeline (insn, call = result) ===\n");
+    size_t off = sizeof(hdr);
+    uint64_t nblocks = 0;
+    int status = EXIT_SUCCESS;
+    while (off + sizeof(VM64TraceBlock) <= (size_t)st.st_size) {
+        VM64TraceBlock blk;
+        memcpy(&blk, map + off, sizeof(blk));
+        off += sizeof(blk);
+        if (blk.comp_len > (size_t)st.st_size - off || blk.raw_len > hdr.block_size) {
+            fprintf(stderr, "Error: Truncated block at offset %zu\n", off);
+            status = EXIT_FAILURE;
+            break;
+        }
+        
+        const uint8_t* data = map + off;
+        if (blk.comp_len != blk.raw_len) {
+            if (vm64_lz_decompress(data, blk.comp_len, raw, hdr.block_size) !=
+                (long)blk.raw_len) {
+                fprintf(stderr, "Error: Corrupt block at offset %zu\n", off);
+                status = EXIT_FAILURE;
+                break;
+            }
+            data = raw;
+        }
+        off += blk.comp_len;
+        
+        if (analyze_block(&a, data, data + blk.raw_len) != 0) {
+            fprintf(stderr, "Error: Bad record in block %llu\n",
+                    (unsigned long long)nblocks);
+            status = EXIT_FAILURE;
+            break;
+        }
+        nblocks++;
+    }
+    end_block(&a);
+    if (a.timeline_shown == 0) printf("  (none)\n");
+    
+    printf("\n=== Summary ===\n");
+    printf("  %llu instructions in %llu blocks, %.2f bytes/insn on disk\n",
+           (unsigned long long)a.insns, (unsigned long long)nblocks,
+           a.insns ? (double)st.st_size / a.insns : 0.0);
+    printf("  final RIP 0x%llX  RSP 0x%llX\n",
+           (unsigned long long)a.next_rip, (unsigned long long)a.rsp);
+    
+    printf("\n=== Hot basic blocks (by instructions executed) ===\n");
+    size_t n = table_sorted(&a.blocks);
+    for (size_t i = 0; i < n && i < top; i++) {
+        CountEntry* e = &a.blocks.slots[i];
+        printf("  0x%016llX  %12llu execs  %14llu insns  %6.2f%%\n",
+               (unsigned long long)e->key, (unsigned long long)e->count,
+               (unsigned long long)e->weight,
+               a.insns ? 100.0 * e->weight / a.insns : 0.0);
+    }
+    if (image_path) print_loops(image_path, image_base, hdr.rip, a.blocks.slots, n, a.insns, top);
+    
+    printf("\n=== Memory accesses ===\n");
+    uint64_t accesses = a.reads + a.writes;
+    printf("  %llu reads, %llu writes, %llu distinct pages\n",
+           (unsigned long long)a.reads, (unsigned long long)a.writes,
+           (unsigned long long)a.pages.size);
+    if (accesses > 1) {
+        double pairs = (double)(accesses - 1);
+        printf("  stride: %.1f%% same address, %.1f%% within 64 bytes, "
+               "%.1f%% farther\n",
+               100.0 * a.stride_same / pairs, 100.0 * a.stride_near / pairs,
+               100.0 * a.stride_far / pairs);
+    }
+    n = table_sorted(&a.pages);
+    for (size_t i = 0; i < n && i < top; i++) {
+        CountEntry* e = &a.pages.slots[i];
+        printf("  page 0x%016llX  %12llu accesses  %12llu writes\n",
+               (unsigned long long)(e->key * VM64_PAGE_SIZE),
+               (unsigned long long)e->count, (unsigned long long)e->weight);
+    }
+    
+    printf("\n=== Syscalls ===\n");
+    n = table_sorted(&a.syscalls);
+    for (size_t i = 0; i < n; i++) {
+        CountEntry* e = &a.syscalls.slots[i];
+        printf("  %-10s (%3llu)  %12llu calls\n", syscall_name(e->key),
+               (unsigned long long)e->key, (unsigned long long)e->count);
+    }
+    
+    printf("\n=== Opcodes ===\n");
+    for (int op = 0; op < 256; op++) {
+        if (!a.opcodes[op]) continue;
+        printf("  0x%02X  %14llu  %6.2f%%\n", op, (unsigned long long)a.opcodes[op],
+               100.0 * a.opcodes[op] / a.insns);
+    }
+    
+    free(raw);
+    free(a.blocks.slots);
+    free(a.pages.slots);
+    free(a.syscalls.slots);
+    munmap((void*)map, (size_t)st.st_size);
+    return status;
+}
@@ -0,0 +1,206 @@
+#include "vm64_vec.h"
+#include <stdlib.h>
+#include <string.h>
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__SSE2__) && \
+    defined(__GNUC__)
+#define VM64_VEC_X86 1
+#include <immintrin.h>
+#endif
+
+/* Host backends, best last */
+enum { VEC_SCALAR, VEC_SSE2, VEC_AVX2 };
+
+static int vec_level = -1;
+
+/* Pick the backend once; VM64_VEC=scalar|sse2 forces a lower one */
+static int vec_backend_level(void) {
+    int level = __atomic_load_n(&vec_level, __ATOMIC_RELAXED);
+    if (level >= 0) return level;
+    
+    level = VEC_SCALAR;
+#ifdef VM64_VEC_X86
+    level = VEC_SSE2;
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) level = VEC_AVX2;
+#endif
+    const char* force = getenv("VM64_VEC");
+    if (force && strcmp(force, "scalar") == 0) level = VEC_SCALAR;
+    else if (force && strcmp(force, "sse2") == 0 && level > VEC_SSE2) level = VEC_SSE2;
+    
+    __atomic_store_n(&vec_level, level, __ATOMIC_RELAXED);
+    return level;
+}
+
+const char* vm64_vec_backend(void) {
+    static const char* names[] = { "scalar", "sse2", "avx2" };
+    return names[vec_backend_level()];
+}
+
+/* Portable lane loop; MUL multiplies in 64 bits to avoid int promotion */
+#define VEC_SCALAR(T, S, arr)                                           \
+    for (size_t i = 0; i < bytes / sizeof(T); i++) {                    \
+        T a = d->arr[i], b = s->arr[i];                                 \
+        switch (opcode) {                                               \
+            case X64_VADD: a = (T)(a + b); break;                       \
+            case X64_VSUB: a = (T)(a - b); break;                       \
+            case X64_VMUL: a = (T)((uint64_t)a * b); break;             \
+            case X64_VAND: a = (T)(a & b); break;                       \
+            case X64_VOR: a = (T)(a | b); break;                        \
+            case X64_VXOR: a = (T)(a ^ b); break;                       \
+            case X64_VCMPEQ: a = a == b ? (T)~(T)0 : 0; break;          \
+            case X64_VCMPGT: a = (S)a > (S)b ? (T)~(T)0 : 0; break;     \
+            default: break;                                             \
+        }                                                               \
+        d->arr[i] = a;                                                  \
+    }
+
+static void vec_scalar(uint8_t opcode, int lane, size_t bytes, VM64Vec* d,
+                       const VM64Vec* s) {
+    switch (lane) {
+        case 0: VEC_SCALAR(uint8_t, int8_t, b); break;
+        case 1: VEC_SCALAR(uint16_t, int16_t, w); break;
+        case 2: VEC_SCALAR(uint32_t, int32_t, d); break;
+        default: VEC_SCALAR(uint64_t, int64_t, q); break;
+    }
+}
+
+#ifdef VM64_VEC_X86
+/* 128 bits at a time; returns 0 for ops SSE2 lacks (64-bit compares,
+ * 8/32/64-bit multiplies) before touching d */
+static int vec_sse2(uint8_t opcode, int lane, size_t bytes, VM64Vec* d,
+                    const VM64Vec* s) {
+    if (opcode == X64_VMUL && lane != 1) return 0;
+    if ((opcode == X64_VCMPEQ || opcode == X64_VCMPGT) && lane == 3) return 0;
+    
+    for (size_t off = 0; off < bytes; off += 16) {
+        __m128i a = _mm_loadu_si128((const __m128i*)(d->b + off));
+        __m128i b = _mm_loadu_si128((const __m128i*)(s->b + off));
+        __m128i r;
+        
+        switch (opcode) {
+            case X64_VADD:
+                r = lane == 0 ? _mm_add_epi8(a, b) : lane == 1 ? _mm_add_epi16(a, b) :
+                    lane == 2 ? _mm_add_epi32(a, b) : _mm_add_epi64(a, b);
+                break;
+            case X64_VSUB:
+                r = lane == 0 ? _mm_sub_epi8(a, b) : lane == 1 ? _mm_sub_epi16(a, b) :
+                    lane == 2 ? _mm_sub_epi32(a, b) : _mm_sub_epi64(a, b);
+                break;
+            case X64_VMUL: r = _mm_mullo_epi16(a, b); break;
+            case X64_VAND: r = _mm_and_si128(a, b); break;
+            case X64_VOR: r = _mm_or_si128(a, b); break;
+            case X64_VXOR: r = _mm_xor_si128(a, b); break;
+            case X64_VCMPEQ:
+                r = lane == 0 ? _mm_cmpeq_epi8(a, b) : lane == 1 ?
+                    _mm_cmpeq_epi16(a, b) : _mm_cmpeq_epi32(a, b);
+                break;
+            case X64_VCMPGT:
+                r = lane == 0 ? _mm_cmpgt_epi8(a, b) : lane == 1 ?
+                    _mm_cmpgt_epi16(a, b) : _mm_cmpgt_epi32(a, b);
+                break;
+            default:
+                return 0;
+        }
+        _mm_storeu_si128((__m128i*)(d->b + off), r);
+    }
+    return 1;
+}
+
+/* Whole 256-bit vector; only 8 and 64-bit multiplies fall back */
+__attribute__((target("avx2")))
+static int vec_avx2(uint8_t opcode, int lane, VM64Vec* d, const VM64Vec* s) {
+    if (opcode == X64_VMUL && (lane == 0 || lane == 3)) return 0;
+    
+    __m256i a = _mm256_loadu_si256((const __m256i*)d->b);
+    __m256i b = _mm256_loadu_si256((const __m256i*)s->b);
+    __m256i r;
+    
+    switch (opcode) {
+        case X64_VADD:
+            r = lane == 0 ? _mm256_add_epi8(a, b) : lane == 1 ? _mm256_add_epi16(a, b) :
+                lane == 2 ? _mm256_add_epi32(a, b) : _mm256_add_epi64(a, b);
+            break;
+        case X64_VSUB:
+            r = lane == 0 ? _mm256_sub_epi8(a, b) : lane == 1 ? _mm256_sub_epi16(a, b) :
+                lane == 2 ? _mm256_sub_epi32(a, b) : _mm256_sub_epi64(a, b);
+            break;
+        case X64_VMUL:
+            r = lane == 1 ? _mm256_mullo_epi16(a, b) : _mm256_mullo_epi32(a, b);
+            break;
+        case X64_VAND: r = _mm256_and_si256(a, b); break;
+        case X64_VOR: r = _mm256_or_si256(a, b); break;
+        case X64_VXOR: r = _mm256_xor_si256(a, b); break;
+        case X64_VCMPEQ:
+            r = lane == 0 ? _mm256_cmpeq_epi8(a, b) : lane == 1 ? _mm256_cmpeq_epi16(a, b) :
+                lane == 2 ? _mm256_cmpeq_epi32(a, b) : _mm256_cmpeq_epi64(a, b);
+            break;
+        case X64_VCMPGT:
+            r = lane == 0 ? _mm256_cmpgt_epi8(a, b) : lane == 1 ? _mm256_cmpgt_epi16(a, b) :
+                lane == 2 ? _mm256_cmpgt_epi32(a, b) : _mm256_cmpgt_epi64(a, b);
+            break;
+        default:
+            return 0;
+    }
+    _mm256_storeu_si256((__m256i*)d->b, r);
+    return 1;
+}
+#endif
+
+/* d = d op s, lane-wise (VADD .. VCMPGT) */
+void vm64_vec_alu(uint8_t opcode, uint8_t shape, VM64Vec* d, const VM64Vec* s) {
+    int lane = VM64_VSHAPE_LANE(shape);
+    size_t bytes = VM64_VSHAPE_BYTES(shape);
+    int done = 0;
+
+#ifdef VM64_VEC_X86
+    int level = vec_backend_level();
+    if (level == VEC_AVX2 && bytes == 32) done = vec_avx2(opcode, lane, d, s);
+    if (!done && level >= VEC_SSE2) done = vec_sse2(opcode, lane, bytes, d, s);
+#endif
+    if (!done) vec_scalar(opcode, lane, bytes, d, s);
+    if (bytes < VM64_VREG_BYTES) memset(d->b + bytes, 0, VM64_VREG_BYTES - bytes);
+}
+
+/* Broadcast the low lane of value into every lane of d */
+void vm64_vec_splat(uint8_t shape, VM64Vec* d, uint64_t value) {
+    size_t bytes = VM64_VSHAPE_BYTES(shape);
+    
+    memset(d, 0, sizeof(*d));
+    switch (VM64_VSHAPE_LANE(shape)) {
+        case 0: memset(d->b, (int)(value & 0xFF), bytes); break;
+        case 1: for (size_t i = 0; i < bytes / 2; i++) d->w[i] = (uint16_t)value; break;
+        case 2: for (size_t i = 0; i < bytes / 4; i++) d->d[i] = (uint32_t)value; break;
+        default: for (size_t i = 0; i < bytes / 8; i++) d->q[i] = value; break;
+    }
+}
+
+/* Horizontal reduction over unsigned lanes (VREDADD/VREDMIN/VREDMAX) */
+uint64_t vm64_vec_reduce(uint8_t opcode, uint8_t shape, const VM64Vec* v) {
+    int lane = VM64_VSHAPE_LANE(shape);
+    size_t bytes = VM64_VSHAPE_BYTES(shape);
+
+#ifdef VM64_VEC_X86
+    /* Byte sums are the common checksum case: PSADBW against zero */
+    if (opcode == X64_VREDADD && lane == 0 && vec_backend_level() >= VEC_SSE2) {
+        uint64_t sum = 0;
+        for (size_t off = 0; off < bytes; off += 16) {
+            __m128i x = _mm_loadu_si128((const __m128i*)(v->b + off));
+            __m128i sad = _mm_sad_epu8(x, _mm_setzero_si128());
+            sum += (uint64_t)_mm_cvtsi128_si32(sad) +
+                   (uint64_t)_mm_cvtsi128_si32(_mm_srli_si128(sad, 8));
+        }
+        return sum;
+    }
+#endif
+    
+    uint64_t acc = opcode == X64_VREDMIN ? UINT64_MAX : 0;
+    for (size_t i = 0; i < bytes >> lane; i++) {
+        uint64_t x = lane == 0 ? v->b[i] : lane == 1 ? v->w[i] :
+                     lane == 2 ? v->d[i] : v->q[i];
+        if (opcode == X64_VREDADD) acc += x;
+        else if (opcode == X64_VREDMIN) acc = x < acc ? x : acc;
+        else acc = x > acc ? x : acc;
+    }
+    return acc;
+}
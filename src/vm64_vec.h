@@ -0,0 +1,16 @@
+#ifndef VM64_VEC_H
+#define VM64_VEC_H
+
+#include "vm64.h"
+
+/* Vector extension ALU. On x86-64 the common lane ops run as SSE2
+ * intrinsics, or AVX2 when the host CPU has it (checked once at run
+ * time); the rest, and other hosts, use portable scalar loops. */
+
+/* Function declarations */
+void vm64_vec_alu(uint8_t opcode, uint8_t shape, VM64Vec* d, const VM64Vec* s);
+void vm64_vec_splat(uint8_t shape, VM64Vec* d, uint64_t value);
+uint64_t vm64_vec_reduce(uint8_t opcode, uint8_t shape, const VM64Vec* v);
+const char* vm64_vec_backend(void);
+
+#endif /* VM64_VEC_H */
@@ -0,0 +1,647 @@
+#include "vm_cfg.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define CFG_VROOT UINT32_MAX               /* Virtual root above every function */
+#define CFG_UNSET (UINT32_MAX - 1)
+
+/* Growable array of 64-bit values */
+typedef struct {
+    uint64_t* v;
+    size_t n, cap;
+} U64Vec;
+
+static int vec_push(U64Vec* s, uint64_t x) {
+    if (s->n == s->cap) {
+        size_t cap = s->cap ? s->cap * 2 : 64;
+        uint64_t* grown = (uint64_t*)realloc(s->v, cap * sizeof(uint64_t));
+        if (!grown) return -1;
+        s->v = grown;
+        s->cap = cap;
+    }
+    s->v[s->n++] = x;
+    return 0;
+}
+
+static int cfg_in_image(const VMCfg* cfg, uint64_t addr) {
+    return addr >= cfg->base && addr - cfg->base < cfg->size;
+}
+
+static int cfg_decode(const VMCfg* cfg, uint64_t addr, VMFlowInsn* insn) {
+    if (!cfg_in_image(cfg, addr)) return 0;
+    size_t off = (size_t)(addr - cfg->base);
+    memset(insn, 0, sizeof(*insn));
+    int len = cfg->isa->decode(cfg->image + off, cfg->size - off, insn);
+    return len > 0 && (size_t)len <= cfg->size - off ? len : 0;
+}
+
+/* Recursive descent: mark instruction bytes and block leaders */
+static int cfg_discover(VMCfg* cfg, U64Vec* work) {
+    while (work->n > 0) {
+        uint64_t pc = work->v[--work->n];
+        if (!cfg_in_image(cfg, pc)) continue;
+        uint8_t* at = &cfg->code[pc - cfg->base];
+        if (*at & VM_CFG_BYTE_BODY) {
+            cfg->overlaps++;
+            continue;
+        }
+        *at |= VM_CFG_BYTE_LEADER;
+        if (*at & VM_CFG_BYTE_INSN) continue;
+        
+        for (;;) {
+            VMFlowInsn insn;
+            int len = cfg_decode(cfg, pc, &insn);
+            if (!len) break;
+            size_t off = (size_t)(pc - cfg->base);
+            int clash = 0;
+            for (int i = 0; i < len; i++) clash |= cfg->code[off + i] & (VM_CFG_BYTE_INSN | VM_CFG_BYTE_BODY);
+            if (clash) {
+                cfg->overlaps++;
+                break;
+            }
+            cfg->code[off] |= VM_CFG_BYTE_INSN;
+            for (int i = 1; i < len; i++) cfg->code[off + i] |= VM_CFG_BYTE_BODY;
+            cfg->code_bytes += (uint64_t)len;
+            
+            uint64_t next = pc + (uint64_t)len;
+            int more = 0;
+            switch (insn.flow) {
+                case VM_FLOW_NEXT:
+                    more = 1;
+                    break;
+                case VM_FLOW_JUMP:
+                    if (vec_push(work, insn.target) != 0) return -1;
+                    break;
+                case VM_FLOW_BRANCH:
+                case VM_FLOW_CALL:
+                    if (vec_push(work, insn.target) != 0) return -1;
+                    if (vec_push(work, next) != 0) return -1;
+                    break;
+                case VM_FLOW_TRAP:
+                    if (vec_push(work, next) != 0) return -1;
+                    break;
+                default:
+                    break;
+            }
+            if (!more || !cfg_in_image(cfg, next)) break;
+            
+            /* Running into code found earlier makes a join point */
+            uint8_t c = cfg->code[next - cfg->base];
+            if (c & VM_CFG_BYTE_INSN) {
+                cfg->code[next - cfg->base] |= VM_CFG_BYTE_LEADER;
+                break;
+            }
+            if (c & VM_CFG_BYTE_BODY) {
+                cfg->overlaps++;
+                break;
+            }
+            pc = next;
+        }
+    }
+    return 0;
+}
+
+/* Cut the marked instructions into blocks, in address order */
+static int cfg_blocks(VMCfg* cfg, uint32_t max_block_insns) {
+    size_t cap = 64;
+    cfg->blocks = (VMCfgBlock*)malloc(cap * sizeof(VMCfgBlock));
+    if (!cfg->blocks) return -1;
+    
+    VMCfgBlock* cur = NULL;
+    uint64_t prev_end = 0;
+    for (size_t off = 0; off < cfg->size; off++) {
+        if (!(cfg->code[off] & VM_CFG_BYTE_INSN)) continue;
+        uint64_t pc = cfg->base + off;
+        VMFlowInsn insn;
+        int len = cfg_decode(cfg, pc, &insn);
+        
+        if (!cur || (cfg->code[off] & VM_CFG_BYTE_LEADER) || prev_end != pc ||
+            cur->flow != VM_FLOW_NEXT ||
+            (max_block_insns && cur->insns == max_block_insns)) {
+            if (cfg->nblocks == cap) {
+                cap *= 2;
+                VMCfgBlock* grown = (VMCfgBlock*)realloc(cfg->blocks, cap * sizeof(VMCfgBlock));
+                if (!grown) return -1;
+                cfg->blocks = grown;
+            }
+            cfg->code[off] |= VM_CFG_BYTE_LEADER;
+            cur = &cfg->blocks[cfg->nblocks++];
+            memset(cur, 0, sizeof(*cur));
+            cur->start = pc;
+            cur->idom = -1;
+            cur->loop = -1;
+        }
+        cur->end = pc + (uint64_t)len;
+        cur->last = pc;
+        cur->flow = insn.flow;
+        cur->insns++;
+        prev_end = cur->end;
+    }
+    return 0;
+}
+
+static int cfg_add_edge(VMCfg* cfg, size_t* cap, uint32_t from, uint64_t to, uint8_t kind) {
+    int b = vm_cfg_block_start(cfg, to);
+    if (b < 0) return 0;
+    if (cfg->nedges == *cap) {
+        *cap = *cap ? *cap * 2 : 64;
+        VMCfgEdge* grown = (VMCfgEdge*)realloc(cfg->edges, *cap * sizeof(VMCfgEdge));
+        if (!grown) return -1;
+        cfg->edges = grown;
+    }
+    VMCfgEdge* e = &cfg->edges[cfg->nedges++];
+    e->from = from;
+    e->to = (uint32_t)b;
+    e->kind = kind;
+    e->back = 0;
+    return 0;
+}
+
+static int cfg_edges(VMCfg* cfg) {
+    size_t cap = 0;
+    for (uint32_t i = 0; i < cfg->nblocks; i++) {
+        VMCfgBlock* b = &cfg->blocks[i];
+        VMFlowInsn insn;
+        cfg_decode(cfg, b->last, &insn);
+        b->first_edge = cfg->nedges;
+        
+        int rc = 0;
+        switch (b->flow) {
+            case VM_FLOW_NEXT:
+            case VM_FLOW_TRAP:
+                rc = cfg_add_edge(cfg, &cap, i, b->end, VM_CFG_EDGE_FALL);
+                break;
+            case VM_FLOW_JUMP:
+                rc = cfg_add_edge(cfg, &cap, i, insn.target, VM_CFG_EDGE_JUMP);
+                break;
+            case VM_FLOW_BRANCH:
+                rc = cfg_add_edge(cfg, &cap, i, insn.target, VM_CFG_EDGE_TAKEN);
+                if (rc == 0) rc = cfg_add_edge(cfg, &cap, i, b->end, VM_CFG_EDGE_FALL);
+                break;
+            case VM_FLOW_CALL:
+                rc = cfg_add_edge(cfg, &cap, i, insn.target, VM_CFG_EDGE_CALL);
+                if (rc == 0) rc = cfg_add_edge(cfg, &cap, i, b->end, VM_CFG_EDGE_FALL);
+                break;
+            default:
+                break;
+        }
+        if (rc != 0) return -1;
+        b->nedges = cfg->nedges - b->first_edge;
+    }
+    return 0;
+}
+
+static int cmp_u32(const void* a, const void* b) {
+    uint32_t x = *(const uint32_t*)a, y = *(const uint32_t*)b;
+    return x < y ? -1 : x > y;
+}
+
+/* Function entries: the entry points in order, then call targets */
+static int cfg_functions(VMCfg* cfg, const uint64_t* entries, size_t nentries) {
+    uint32_t* seen = (uint32_t*)calloc(cfg->nblocks ? cfg->nblocks : 1, sizeof(uint32_t));
+    cfg->functions = (uint32_t*)malloc((cfg->nblocks ? cfg->nblocks : 1) * sizeof(uint32_t));
+    if (!seen || !cfg->functions) {
+        free(seen);
+        return -1;
+    }
+    
+    for (size_t i = 0; i < nentries; i++) {
+        int b = vm_cfg_block_start(cfg, entries[i]);
+        if (b >= 0 && !seen[b]) {
+            seen[b] = 1;
+            cfg->functions[cfg->nfunctions++] = (uint32_t)b;
+        }
+    }
+    uint32_t first_call = cfg->nfunctions;
+    for (uint32_t e = 0; e < cfg->nedges; e++) {
+        uint32_t to = cfg->edges[e].to;
+        if (cfg->edges[e].kind == VM_CFG_EDGE_CALL && !seen[to]) {
+            seen[to] = 1;
+            cfg->functions[cfg->nfunctions++] = to;
+        }
+    }
+    qsort(cfg->functions + first_call, cfg->nfunctions - first_call, sizeof(uint32_t), cmp_u32);
+    
+    /* Each block belongs to the first function that reaches it without
+     * following a call */
+    uint32_t* stack = seen;
+    for (uint32_t i = 0; i < cfg->nblocks; i++) cfg->blocks[i].function = CFG_VROOT;
+    for (uint32_t f = 0; f < cfg->nfunctions; f++) {
+        uint32_t entry = cfg->functions[f];
+        if (cfg->blocks[entry].function != CFG_VROOT) continue;
+        size_t sp = 0;
+        stack[sp++] = entry;
+        cfg->blocks[entry].function = entry;
+        while (sp > 0) {
+            const VMCfgBlock* b = &cfg->blocks[stack[--sp]];
+            for (uint32_t e = b->first_edge; e < b->first_edge + b->nedges; e++) {
+                uint32_t to = cfg->edges[e].to;
+                if (cfg->edges[e].kind == VM_CFG_EDGE_CALL ||
+                    cfg->blocks[to].function != CFG_VROOT) {
+                    continue;
+                }
+                cfg->blocks[to].function = entry;
+                stack[sp++] = to;
+            }
+        }
+    }
+    for (uint32_t i = 0; i < cfg->nblocks; i++) {
+        if (cfg->blocks[i].function == CFG_VROOT) cfg->blocks[i].function = i;
+    }
+    free(seen);
+    return 0;
+}
+
+/* Predecessors over intraprocedural edges, in CSR form */
+typedef struct {
+    uint32_t* first;                       /* nblocks + 1 offsets */
+    uint32_t* from;
+} Preds;
+
+static int cfg_preds(const VMCfg* cfg, Preds* p) {
+    p->first = (uint32_t*)calloc(cfg->nblocks + 1, sizeof(uint32_t));
+    p->from = (uint32_t*)malloc((cfg->nedges ? cfg->nedges : 1) * sizeof(uint32_t));
+    if (!p->first || !p->from) return -1;
+    for (uint32_t e = 0; e < cfg->nedges; e++) {
+        if (cfg->edges[e].kind != VM_CFG_EDGE_CALL) p->first[cfg->edges[e].to + 1]++;
+    }
+    for (uint32_t i = 0; i < cfg->nblocks; i++) p->first[i + 1] += p->first[i];
+    uint32_t* fill = (uint32_t*)malloc((cfg->nblocks ? cfg->nblocks : 1) * sizeof(uint32_t));
+    if (!fill) return -1;
+    memcpy(fill, p->first, cfg->nblocks * sizeof(uint32_t));
+    for (uint32_t e = 0; e < cfg->nedges; e++) {
+        if (cfg->edges[e].kind != VM_CFG_EDGE_CALL) {
+            p->from[fill[cfg->edges[e].to]++] = cfg->edges[e].from;
+        }
+    }
+    free(fill);
+    return 0;
+}
+
+/* Dominators by the Cooper-Harvey-Kennedy iteration over reverse
+ * post-order; function entries hang off a virtual root */
+static int cfg_dominators(VMCfg* cfg, const Preds* preds) {
+    uint32_t n = cfg->nblocks ? cfg->nblocks : 1;
+    uint32_t* post = (uint32_t*)malloc(n * sizeof(uint32_t));
+    uint32_t* order = (uint32_t*)malloc(n * sizeof(uint32_t));
+    uint32_t* dom = (uint32_t*)malloc(n * sizeof(uint32_t));
+    uint32_t* stack = (uint32_t*)malloc(n * sizeof(uint32_t));
+    uint32_t* next_edge = (uint32_t*)malloc(n * sizeof(uint32_t));
+    uint8_t* seen = (uint8_t*)calloc(n, 1);
+    int ok = post && order && dom && stack && next_edge && seen;
+    
+    /* Iterative depth-first search for post-order numbers */
+    uint32_t count = 0;
+    for (uint32_t i = 0; ok && i < cfg->nblocks; i++) dom[i] = CFG_UNSET;
+    for (uint32_t f = 0; ok && f < cfg->nfunctions; f++) {
+        uint32_t root = cfg->functions[f];
+        dom[root] = CFG_VROOT;
+        if (seen[root]) continue;
+        size_t sp = 0;
+        seen[root] = 1;
+        stack[sp] = root;
+        next_edge[sp++] = cfg->blocks[root].first_edge;
+        while (sp > 0) {
+            const VMCfgBlock* blk = &cfg->blocks[stack[sp - 1]];
+            if (next_edge[sp - 1] < blk->first_edge + blk->nedges) {
+                const VMCfgEdge* e = &cfg->edges[next_edge[sp - 1]++];
+                if (e->kind != VM_CFG_EDGE_CALL && !seen[e->to]) {
+                    seen[e->to] = 1;
+                    stack[sp] = e->to;
+                    next_edge[sp++] = cfg->blocks[e->to].first_edge;
+                }
+                continue;
+            }
+            post[stack[sp - 1]] = count;
+            order[count++] = stack[--sp];
+        }
+    }
+    
+    /* Refine until stable; the virtual root numbers above every block */
+    int changed = ok;
+    while (changed) {
+        changed = 0;
+        for (uint32_t k = count; k-- > 0;) {
+            uint32_t b = order[k];
+            if (dom[b] == CFG_VROOT) continue;
+            uint32_t idom = CFG_UNSET;
+            for (uint32_t p = preds->first[b]; p < preds->first[b + 1]; p++) {
+                uint32_t x = preds->from[p];
+                if (!seen[x] || dom[x] == CFG_UNSET) continue;
+                if (idom == CFG_UNSET) {
+                    idom = x;
+                    continue;
+                }
+                uint32_t y = idom;
+                while (x != y) {
+                    while (x != CFG_VROOT && (y == CFG_VROOT || post[x] < post[y])) x = dom[x];
+                    while (y != CFG_VROOT && (x == CFG_VROOT || post[y] < post[x])) y = dom[y];
+                }
+                idom = x;
+            }
+            if (idom != CFG_UNSET && dom[b] != idom) {
+                dom[b] = idom;
+                changed = 1;
+            }
+        }
+    }
+    
+    for (uint32_t i = 0; ok && i < cfg->nblocks; i++) {
+        cfg->blocks[i].idom = dom[i] < cfg->nblocks ? (int32_t)dom[i] : -1;
+    }
+    free(post);
+    free(order);
+    free(dom);
+    free(stack);
+    free(next_edge);
+    free(seen);
+    return ok ? 0 : -1;
+}
+
+static int cfg_dominates(const VMCfg* cfg, uint32_t a, uint32_t b) {
+    for (int32_t x = (int32_t)b; x >= 0; x = cfg->blocks[x].idom) {
+        if ((uint32_t)x == a) return 1;
+    }
+    return 0;
+}
+
+static int cmp_loop_size(const void* a, const void* b) {
+    const VMCfgLoop* x = (const VMCfgLoop*)a;
+    const VMCfgLoop* y = (const VMCfgLoop*)b;
+    if (x->nbody != y->nbody) return x->nbody > y->nbody ? -1 : 1;
+    return x->header < y->header ? -1 : x->header > y->header;
+}
+
+/* Natural loops: one per header, merging all of its back edges */
+static int cfg_loops(VMCfg* cfg, const Preds* preds) {
+    uint32_t n = cfg->nblocks;
+    uint32_t* mark = (uint32_t*)calloc(n ? n : 1, sizeof(uint32_t));
+    uint32_t* stack = (uint32_t*)malloc((n ? n : 1) * sizeof(uint32_t));
+    cfg->loops = (VMCfgLoop*)calloc(n ? n : 1, sizeof(VMCfgLoop));
+    if (!mark || !stack || !cfg->loops) {
+        free(mark);
+        free(stack);
+        return -1;
+    }
+    
+    for (uint32_t e = 0; e < cfg->nedges; e++) {
+        VMCfgEdge* edge = &cfg->edges[e];
+        if (edge->kind != VM_CFG_EDGE_CALL && cfg_dominates(cfg, edge->to, edge->from)) {
+            edge->back = 1;
+        }
+    }
+    
+    for (uint32_t h = 0; h < n; h++) {
+        uint32_t nback = 0;
+        size_t sp = 0;
+        uint32_t stamp = cfg->nloops + 1;
+        for (uint32_t p = preds->first[h]; p < preds->first[h + 1]; p++) {
+            uint32_t from = preds->from[p];
+            if (!cfg_dominates(cfg, h, from)) continue;
+            nback++;
+            if (from != h && mark[from] != stamp) {
+                mark[from] = stamp;
+                stack[sp++] = from;
+            }
+        }
+        if (nback == 0) continue;
+        
+        /* Everything that reaches a back edge without passing the header */
+        mark[h] = stamp;
+        uint32_t nbody = 1;
+        while (sp > 0) {
+            uint32_t b = stack[--sp];
+            nbody++;
+            for (uint32_t p = preds->first[b]; p < preds->first[b + 1]; p++) {
+                uint32_t from = preds->from[p];
+                if (mark[from] != stamp) {
+                    mark[from] = stamp;
+                    stack[sp++] = from;
+                }
+            }
+        }
+        
+        VMCfgLoop* loop = &cfg->loops[cfg->nloops++];
+        loop->header = h;
+        loop->nback = nback;
+        loop->body = (uint32_t*)malloc(nbody * sizeof(uint32_t));
+        if (!loop->body) {
+            free(mark);
+            free(stack);
+            return -1;
+        }
+        loop->body[loop->nbody++] = h;
+        for (uint32_t b = 0; b < n; b++) {
+            if (mark[b] == stamp && b != h) loop->body[loop->nbody++] = b;
+        }
+    }
+    
+    /* Larger loops first, so each loop's parent is already placed: the
+     * innermost loop seen so far holding its header */
+    qsort(cfg->loops, cfg->nloops, sizeof(VMCfgLoop), cmp_loop_size);
+    for (uint32_t i = 0; i < cfg->nloops; i++) {
+        VMCfgLoop* loop = &cfg->loops[i];
+        loop->parent = cfg->blocks[loop->header].loop;
+        loop->depth = loop->parent < 0 ? 1 : cfg->loops[loop->parent].depth + 1;
+        for (uint32_t k = 0; k < loop->nbody; k++) {
+            cfg->blocks[loop->body[k]].loop = (int32_t)i;
+            cfg->blocks[loop->body[k]].loop_depth = loop->depth;
+        }
+    }
+    free(mark);
+    free(stack);
+    return 0;
+}
+
+VMCfg* vm_cfg_build(const VMCfgIsa* isa, const uint8_t* image, size_t size,
+                    uint64_t base, const uint64_t* entries, size_t nentries,
+                    uint32_t max_block_insns) {
+    VMCfg* cfg = (VMCfg*)calloc(1, sizeof(VMCfg));
+    if (!cfg) return NULL;
+    cfg->isa = isa;
+    cfg->image = image;
+    cfg->size = size;
+    cfg->base = base;
+    cfg->code = (uint8_t*)calloc(size ? size : 1, 1);
+    
+    U64Vec work = { NULL, 0, 0 };
+    Preds preds = { NULL, NULL };
+    int ok = cfg->code != NULL;
+    for (size_t i = 0; ok && i < nentries; i++) ok = vec_push(&work, entries[nentries - 1 - i]) == 0;
+    ok = ok && cfg_discover(cfg, &work) == 0;
+    ok = ok && cfg_blocks(cfg, max_block_insns) == 0;
+    ok = ok && cfg_edges(cfg) == 0;
+    ok = ok && cfg_functions(cfg, entries, nentries) == 0;
+    ok = ok && cfg_preds(cfg, &preds) == 0;
+    ok = ok && cfg_dominators(cfg, &preds) == 0;
+    ok = ok && cfg_loops(cfg, &preds) == 0;
+    
+    free(work.v);
+    free(preds.first);
+    free(preds.from);
+    if (!ok) {
+        vm_cfg_free(cfg);
+        return NULL;
+    }
+    return cfg;
+}
+
+void vm_cfg_free(VMCfg* cfg) {
+    if (!cfg) return;
+    for (uint32_t i = 0; i < cfg->nloops; i++) free(cfg->loops[i].body);
+    free(cfg->loops);
+    free(cfg->blocks);
+    free(cfg->edges);
+    free(cfg->functions);
+    free(cfg->code);
+    free(cfg);
+}
+
+int vm_cfg_block_at(const VMCfg* cfg, uint64_t pc) {
+    uint32_t lo = 0, hi = cfg->nblocks;
+    while (lo < hi) {
+        uint32_t mid = lo + (hi - lo) / 2;
+        if (cfg->blocks[mid].end <= pc) lo = mid + 1;
+        else hi = mid;
+    }
+    return lo < cfg->nblocks && cfg->blocks[lo].start <= pc ? (int)lo : -1;
+}
+
+int vm_cfg_block_start(const VMCfg* cfg, uint64_t pc) {
+    int b = vm_cfg_block_at(cfg, pc);
+    return b >= 0 && cfg->blocks[b].start == pc ? b : -1;
+}
+
+int vm_cfg_is_code(const VMCfg* cfg, uint64_t pc) {
+    return cfg_in_image(cfg, pc) &&
+           (cfg->code[pc - cfg->base] & (VM_CFG_BYTE_INSN | VM_CFG_BYTE_BODY)) != 0;
+}
+
+int vm_cfg_in_loop(const VMCfg* cfg, uint32_t block, uint32_t loop) {
+    for (int32_t l = cfg->blocks[block].loop; l >= 0; l = cfg->loops[l].parent) {
+        if ((uint32_t)l == loop) return 1;
+    }
+    return 0;
+}
+
+const char* vm_cfg_edge_name(uint8_t kind) {
+    switch (kind) {
+        case VM_CFG_EDGE_FALL: return "fall";
+        case VM_CFG_EDGE_JUMP: return "jump";
+        case VM_CFG_EDGE_TAKEN: return "taken";
+        case VM_CFG_EDGE_CALL: return "call";
+        default: return "?";
+    }
+}
+
+static int cfg_is_function(const VMCfg* cfg, uint32_t block) {
+    return cfg->blocks[block].function == block;
+}
+
+/* DOT string body: quotes and backslashes escaped */
+static void dot_escape(FILE* out, const char* s) {
+    for (; *s; s++) {
+        if (*s == '"' || *s == '\\') fputc('\\', out);
+        fputc(*s, out);
+    }
+}
+
+int vm_cfg_write_dot(const VMCfg* cfg, FILE* out) {
+    fprintf(out, "digraph cfg {\n");
+    fprintf(out, "    node [shape=box, fontname=\"monospace\", fontsize=10];\n");
+    for (uint32_t i = 0; i < cfg->nblocks; i++) {
+        const VMCfgBlock* b = &cfg->blocks[i];
+        fprintf(out, "    b%u [label=\"0x%llX", i, (unsigned long long)b->start);
+        if (cfg_is_function(cfg, i)) fprintf(out, " (function)");
+        if (b->loop >= 0 && cfg->loops[b->loop].header == i) {
+            fprintf(out, " (loop, depth %u)", b->loop_depth);
+        }
+        fprintf(out, "\\l");
+        for (uint64_t pc = b->start; pc < b->end;) {
+            char text[96];
+            size_t off = (size_t)(pc - cfg->base);
+            int len = cfg->isa->disasm(cfg->image + off, cfg->size - off, text, sizeof(text));
+            dot_escape(out, text);
+            fprintf(out, "\\l");
+            pc += len > 0 ? (uint64_t)len : 1;
+        }
+        fprintf(out, "\"");
+        if (b->loop >= 0 && cfg->loops[b->loop].header == i) {
+            fprintf(out, ", style=filled, fillcolor=\"#ffe9a8\"");
+        }
+        if (cfg_is_function(cfg, i)) fprintf(out, ", peripheries=2");
+        fprintf(out, "];\n");
+    }
+    for (uint32_t e = 0; e < cfg->nedges; e++) {
+        const VMCfgEdge* edge = &cfg->edges[e];
+        fprintf(out, "    b%u -> b%u", edge->from, edge->to);
+        const char* style = edge->kind == VM_CFG_EDGE_FALL ? "dashed" :
+                            edge->kind == VM_CFG_EDGE_CALL ? "dotted" : "solid";
+        const char* color = edge->back ? "red" :
+                            edge->kind == VM_CFG_EDGE_TAKEN ? "darkgreen" :
+                            edge->kind == VM_CFG_EDGE_CALL ? "blue" : "black";
+        fprintf(out, " [style=%s, color=%s%s];\n", style, color,
+                edge->back ? ", penwidth=2" : "");
+    }
+    fprintf(out, "}\n");
+    return ferror(out) ? -1 : 0;
+}
+
+static void json_index(FILE* out, int32_t v) {
+    if (v < 0) fprintf(out, "null");
+    else fprintf(out, "%d", v);
+}
+
+int vm_cfg_write_json(const VMCfg* cfg, FILE* out) {
+    fprintf(out, "{\n  \"isa\": \"%s\",\n  \"base\": %llu,\n  \"size\": %zu,\n",
+            cfg->isa->name, (unsigned long long)cfg->base, cfg->size);
+    fprintf(out, "  \"code_bytes\": %llu,\n  \"overlaps\": %u,\n",
+            (unsigned long long)cfg->code_bytes, cfg->overlaps);
+    
+    fprintf(out, "  \"functions\": [");
+    for (uint32_t f = 0; f < cfg->nfunctions; f++) {
+        uint32_t entry = cfg->functions[f];
+        uint32_t nblocks = 0;
+        for (uint32_t i = 0; i < cfg->nblocks; i++) nblocks += cfg->blocks[i].function == entry;
+        fprintf(out, "%s\n    {\"entry\": %llu, \"block\": %u, \"blocks\": %u}",
+                f ? "," : "", (unsigned long long)cfg->blocks[entry].start, entry, nblocks);
+    }
+    fprintf(out, "\n  ],\n");
+    
+    fprintf(out, "  \"blocks\": [");
+    for (uint32_t i = 0; i < cfg->nblocks; i++) {
+        const VMCfgBlock* b = &cfg->blocks[i];
+        fprintf(out, "%s\n    {\"id\": %u, \"start\": %llu, \"end\": %llu, \"insns\": %u, "
+                "\"function\": %u, \"idom\": ", i ? "," : "", i,
+                (unsigned long long)b->start, (unsigned long long)b->end, b->insns,
+                b->function);
+        json_index(out, b->idom);
+        fprintf(out, ", \"loop\": ");
+        json_index(out, b->loop);
+        fprintf(out, ", \"loop_depth\": %u, \"succ\": [", b->loop_depth);
+        for (uint32_t e = b->first_edge; e < b->first_edge + b->nedges; e++) {
+            const VMCfgEdge* edge = &cfg->edges[e];
+            fprintf(out, "%s{\"to\": %u, \"kind\": \"%s\", \"back\": %s}",
+                    e > b->first_edge ? ", " : "", edge->to, vm_cfg_edge_name(edge->kind),
+                    edge->back ? "true" : "false");
+        }
+        fprintf(out, "]}");
+    }
+    fprintf(out, "\n  ],\n");
+    
+    fprintf(out, "  \"loops\": [");
+    for (uint32_t l = 0; l < cfg->nloops; l++) {
+        const VMCfgLoop* loop = &cfg->loops[l];
+        fprintf(out, "%s\n    {\"id\": %u, \"header\": %u, \"header_addr\": %llu, "
+                "\"depth\": %u, \"parent\": ", l ? "," : "", l, loop->header,
+                (unsigned long long)cfg->blocks[loop->header].start, loop->depth);
+        json_index(out, loop->parent);
+        fprintf(out, ", \"back_edges\": %u, \"blocks\": [", loop->nback);
+        for (uint32_t k = 0; k < loop->nbody; k++) {
+            fprintf(out, "%s%u", k ? ", " : "", loop->body[k]);
+        }
+        fprintf(out, "]}");
+    }
+    fprintf(out, "\n  ]\n}\n");
+    return ferror(out) ? -1 : 0;
+}
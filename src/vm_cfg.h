@@ -0,0 +1,125 @@
+#ifndef VM_CFG_H
+#define VM_CFG_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+
+/* Static control-flow analysis of guest images, shared by both ISAs.
+ *
+ * Code is found by recursive descent from the entry points, so data mixed
+ * into an image is left alone. Blocks end at control transfers and where
+ * other code jumps in; loops are natural loops of back edges (the target
+ * dominates the source), computed per function with calls cut out. */
+
+/* How an instruction leaves */
+enum {
+    VM_FLOW_NEXT,                          /* Falls through */
+    VM_FLOW_JUMP,                          /* Unconditional, static target */
+    VM_FLOW_BRANCH,                        /* Target or fall-through */
+    VM_FLOW_CALL,                          /* Target; returns to the next insn */
+    VM_FLOW_RET,                           /* Target taken from the stack */
+    VM_FLOW_HALT,                          /* Stops the machine */
+    VM_FLOW_TRAP                           /* SYSCALL: host runs, then falls through */
+};
+
+typedef struct {
+    uint8_t len;
+    uint8_t flow;                          /* VM_FLOW_* */
+    uint64_t target;                       /* JUMP/BRANCH/CALL destination */
+} VMFlowInsn;
+
+/* ISA hooks; see vm_isa (vm.h) and vm64_isa (vm64.h). Both return the
+ * instruction length, or 0 for bytes that do not decode. */
+typedef struct {
+    const char* name;                      /* "vm" or "vm64" (.isa in vmasm) */
+    int (*decode)(const uint8_t* code, size_t avail, VMFlowInsn* insn);
+    int (*disasm)(const uint8_t* code, size_t avail, char* out, size_t size);
+} VMCfgIsa;
+
+enum {
+    VM_CFG_EDGE_FALL,                      /* Next block in memory */
+    VM_CFG_EDGE_JUMP,
+    VM_CFG_EDGE_TAKEN,                     /* Conditional branch taken */
+    VM_CFG_EDGE_CALL
+};
+
+typedef struct {
+    uint32_t from, to;                     /* Block indices */
+    uint8_t kind;                          /* VM_CFG_EDGE_* */
+    uint8_t back;                          /* Closes a loop */
+} VMCfgEdge;
+
+typedef struct {
+    uint64_t start, end;                   /* [start, end) */
+    uint64_t last;                         /* Address of the final instruction */
+    uint32_t insns;
+    uint8_t flow;                          /* Flow of the final instruction */
+    uint32_t first_edge, nedges;           /* Successors in VMCfg.edges */
+    uint32_t function;                     /* Entry block of its function */
+    int32_t idom;                          /* Immediate dominator, -1 at roots */
+    int32_t loop;                          /* Innermost loop, -1 if none */
+    uint32_t loop_depth;
+} VMCfgBlock;
+
+typedef struct {
+    uint32_t header;                       /* Block index */
+    uint32_t* body;                        /* Block indices, header first */
+    uint32_t nbody;
+    uint32_t nback;                        /* Back edges into the header */
+    int32_t parent;                        /* Enclosing loop, -1 if outermost */
+    uint32_t depth;                        /* 1 for outermost */
+} VMCfgLoop;
+
+typedef struct {
+    const VMCfgIsa* isa;
+    const uint8_t* image;
+    size_t size;
+    uint64_t base;                         /* Guest address of image[0] */
+    
+    VMCfgBlock* blocks;                    /* Sorted by address */
+    uint32_t nblocks;
+    VMCfgEdge* edges;                      /* Grouped by source block */
+    uint32_t nedges;
+    VMCfgLoop* loops;                      /* Outer loops before inner ones */
+    uint32_t nloops;
+    uint32_t* functions;                   /* Entry blocks: entry points, then
+                                              call targets by address */
+    uint32_t nfunctions;
+    
+    uint8_t* code;                         /* Per image byte, VM_CFG_BYTE_* */
+    uint64_t code_bytes;
+    uint32_t overlaps;                     /* Targets inside other instructions */
+} VMCfg;
+
+#define VM_CFG_BYTE_INSN   0x01            /* First byte of an instruction */
+#define VM_CFG_BYTE_BODY   0x02            /* Other instruction bytes */
+#define VM_CFG_BYTE_LEADER 0x04            /* A block starts here */
+
+/* Analyze image (loaded at base) from the given entry points. Blocks are
+ * also split every max_block_insns instructions (0 = no limit). Returns
+ * NULL if out of memory. The image must outlive the result. */
+VMCfg* vm_cfg_build(const VMCfgIsa* isa, const uint8_t* image, size_t size,
+                    uint64_t base, const uint64_t* entries, size_t nentries,
+                    uint32_t max_block_insns);
+void vm_cfg_free(VMCfg* cfg);
+
+/* Block containing pc, or -1 */
+int vm_cfg_block_at(const VMCfg* cfg, uint64_t pc);
+
+/* Block starting exactly at pc, or -1 */
+int vm_cfg_block_start(const VMCfg* cfg, uint64_t pc);
+
+/* pc lies in decoded code (any byte of an instruction) */
+int vm_cfg_is_code(const VMCfg* cfg, uint64_t pc);
+
+/* loop is the innermost loop of block or encloses it */
+int vm_cfg_in_loop(const VMCfg* cfg, uint32_t block, uint32_t loop);
+
+const char* vm_cfg_edge_name(uint8_t kind);
+
+/* Graphviz and JSON export; return 0 or -1 on a write error */
+int vm_cfg_write_dot(const VMCfg* cfg, FILE* out);
+int vm_cfg_write_json(const VMCfg* cfg, FILE* out);
+
+#endif /* VM_CFG_H */
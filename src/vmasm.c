@@ -0,0 +1,1902 @@
+#include "vm.h"
+#include "vm64.h"
+#include <ctype.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+/* Assembler for 8-bit VM and VM64 images.
+ *
+ * Source lines are read with .include and .macro expansion into a list of
+ * items (labels, instructions, data). The peephole pass rewrites that list
+ * in place. Every encoding has a fixed size, so a single layout pass then
+ * assigns addresses and a final pass evaluates operands and emits bytes. */
+
+#define ASM_MAX_LINE 512
+#define ASM_MAX_DEPTH 32                   /* .include / macro nesting */
+#define ASM_HASH_SIZE 1024
+#define ASM_MAX_HOPS 16                    /* Jump threading chain limit */
+#define ASM_MAX_ROUNDS 16                  /* Peephole fixpoint limit */
+
+typedef enum { ISA_VM, ISA_VM64 } Isa;
+
+typedef enum {
+    ITEM_LABEL,
+    ITEM_INSN,
+    ITEM_DATA,                             /* One value of unit bytes */
+    ITEM_BYTES,                            /* String literal */
+    ITEM_ORG,
+    ITEM_ALIGN,
+    ITEM_SPACE
+} ItemKind;
+
+/* Operand forms; the encoder and peephole pass switch on these */
+typedef enum {
+    FORM_NONE,                             /* HALT, RET, NOP, SYSCALL */
+    FORM_R,                                /* OUT, IN, PUSH, POP, NOT */
+    FORM_RR,                               /* ALU dst, src */
+    FORM_RI,                               /* MOVI reg, imm */
+    FORM_RS,                               /* SHL/SHR reg, imm8 */
+    FORM_MEM,                              /* LOAD/STORE[.w] reg, [mem] */
+    FORM_A,                                /* JMP/CALL target */
+    FORM_RA,                               /* Jcc reg, target */
+    FORM_VMEM,                             /* VLOAD/VSTORE v, [addr] */
+    FORM_VV,                               /* Vector ALU vd, vs */
+    FORM_VR,                               /* VSPLAT vd, reg */
+    FORM_RV                                /* VRED* reg, vs */
+} Form;
+
+typedef struct {
+    const char* name;
+    uint8_t opcode;
+    Form form;
+} InsnDef;
+
+static const InsnDef vm_insns[] = {
+    { "HALT", OP_HALT, FORM_NONE },   { "MOVI", OP_MOVI, FORM_RI },
+    { "ADD", OP_ADD, FORM_RR },       { "SUB", OP_SUB, FORM_RR },
+    { "MUL", OP_MUL, FORM_RR },       { "DIV", OP_DIV, FORM_RR },
+    { "MOD", OP_MOD, FORM_RR },       { "AND", OP_AND, FORM_RR },
+    { "OR", OP_OR, FORM_RR },         { "XOR", OP_XOR, FORM_RR },
+    { "NOT", OP_NOT, FORM_R },        { "SHL", OP_SHL, FORM_RS },
+    { "SHR", OP_SHR, FORM_RS },       { "LOAD", OP_LOAD, FORM_MEM },
+    { "STORE", OP_STORE, FORM_MEM },  { "LOADX", OP_LOADX, FORM_MEM },
+    { "STOREX", OP_STOREX, FORM_MEM }, { "OUT", OP_OUT, FORM_R },
+    { "IN", OP_IN, FORM_R },          { "JMP", OP_JMP, FORM_A },
+    { "JNZ", OP_JNZ, FORM_RA },       { "JZ", OP_JZ, FORM_RA },
+    { "JLT", OP_JLT, FORM_RA },       { "JGT", OP_JGT, FORM_RA },
+    { "CMP", OP_CMP, FORM_RR },       { "CALL", OP_CALL, FORM_A },
+    { "RET", OP_RET, FORM_NONE },     { "PUSH", OP_PUSH, FORM_R },
+    { "POP", OP_POP, FORM_R },
+    { NULL, 0, FORM_NONE }
+};
+
+static const InsnDef vm64_insns[] = {
+    { "HALT", X64_HALT, FORM_NONE },   { "NOP", X64_NOP, FORM_NONE },
+    { "MOVI", X64_MOVI, FORM_RI },     { "ADD", X64_ADD, FORM_RR },
+    { "SUB", X64_SUB, FORM_RR },       { "LOAD", X64_LOAD, FORM_MEM },
+    { "STORE", X64_STORE, FORM_MEM },  { "LOADX", X64_LOADX, FORM_MEM },
+    { "STOREX", X64_STOREX, FORM_MEM }, { "OUT", X64_OUT, FORM_R },
+    { "JMP", X64_JMP, FORM_A },        { "SYSCALL", X64_SYSCALL, FORM_NONE },
+    { "PUSH", X64_PUSH, FORM_R },      { "POP", X64_POP, FORM_R },
+    { "VLOAD", X64_VLOAD, FORM_VMEM }, { "VSTORE", X64_VSTORE, FORM_VMEM },
+    { "VADD", X64_VADD, FORM_VV },     { "VSUB", X64_VSUB, FORM_VV },
+    { "VMUL", X64_VMUL, FORM_VV },     { "VAND", X64_VAND, FORM_VV },
+    { "VOR", X64_VOR, FORM_VV },       { "VXOR", X64_VXOR, FORM_VV },
+    { "VCMPEQ", X64_VCMPEQ, FORM_VV }, { "VCMPGT", X64_VCMPGT, FORM_VV },
+    { "VSPLAT", X64_VSPLAT, FORM_VR }, { "VREDADD", X64_VREDADD, FORM_RV },
+    { "VREDMIN", X64_VREDMIN, FORM_RV }, { "VREDMAX", X64_VREDMAX, FORM_RV },
+    { NULL, 0, FORM_NONE }
+};
+
+typedef enum { SYM_LABEL, SYM_CONST } SymKind;
+
+typedef struct Symbol {
+    char* name;
+    SymKind kind;
+    uint64_t value;                        /* Label address after layout */
+    char* expr;                            /* Constant definition */
+    size_t item;                           /* Label: index of its item */
+    int evaluating;                        /* Cycle check for constants */
+    const char* file;
+    int line;
+    struct Symbol* next;
+} Symbol;
+
+typedef struct {
+    ItemKind kind;
+    const char* file;
+    int line;
+    uint64_t addr;
+    uint64_t size;
+    int deleted;
+    
+    /* Instructions */
+    const InsnDef* def;
+    uint8_t opcode;                        /* Final opcode (LOAD vs LOADX) */
+    uint8_t amode;                         /* LOADX/STOREX mode byte */
+    uint8_t shape;                         /* Vector shape byte */
+    int r1, r2;                            /* Registers, -1 if unused */
+    char* expr;                            /* Immediate/target/address/count */
+    char* fill;                            /* .space fill byte */
+    
+    /* Data */
+    int unit;                              /* ITEM_DATA width in bytes */
+    uint8_t* bytes;                        /* ITEM_BYTES contents */
+    
+    Symbol* label;
+} Item;
+
+typedef struct {
+    char* name;
+    char** params;
+    int nparams;
+    char** body;
+    int* body_lines;
+    int nbody;
+} Macro;
+
+typedef struct {
+    char* text;
+    const char* file;
+    int line;
+} Line;
+
+typedef struct {
+    Isa isa;
+    int isa_fixed;                         /* .isa seen or code emitted */
+    uint64_t base;
+    int base_set;
+    
+    Line* lines;
+    size_t nlines, cap_lines;
+    Item* items;
+    size_t nitems, cap_items;
+    Symbol* symbols[ASM_HASH_SIZE];
+    Macro* macros;
+    int nmacros;
+    Macro* defining;                       /* Inside .macro ... .endm */
+    int macro_serial;                      /* \@ in macro bodies */
+    char** files;                          /* Names kept for diagnostics */
+    int nfiles;
+    
+    int errors;
+    int layout_done;
+    
+    /* Peephole statistics */
+    int removed_movi, folded, threaded, dropped_jumps, shortened;
+} Asm;
+
+static void asm_error(Asm* as, const char* file, int line, const char* fmt, ...) {
+    va_list ap;
+    fprintf(stderr, "%s:%d: error: ", file ? file : "?", line);
+    va_start(ap, fmt);
+    vfprintf(stderr, fmt, ap);
+    va_end(ap);
+    fputc('\n', stderr);
+    as->errors++;
+}
+
+static void* xmalloc(size_t size) {
+    void* p = malloc(size ? size : 1);
+    if (!p) {
+        fprintf(stderr, "vmasm: out of memory\n");
+        exit(EXIT_FAILURE);
+    }
+    return p;
+}
+
+static void* xrealloc(void* p, size_t size) {
+    p = realloc(p, size ? size : 1);
+    if (!p) {
+        fprintf(stderr, "vmasm: out of memory\n");
+        exit(EXIT_FAILURE);
+    }
+    return p;
+}
+
+static char* xstrndup(const char* s, size_t n) {
+    char* d = (char*)xmalloc(n + 1);
+    memcpy(d, s, n);
+    d[n] = '\0';
+    return d;
+}
+
+static char* xstrdup(const char* s) {
+    return xstrndup(s, strlen(s));
+}
+
+static char* trim(char* s) {
+    while (isspace((unsigned char)*s)) s++;
+    size_t n = strlen(s);
+    while (n > 0 && isspace((unsigned char)s[n - 1])) s[--n] = '\0';
+    return s;
+}
+
+static int is_ident_start(int c) {
+    return isalpha(c) || c == '_' || c == '.';
+}
+
+static int is_ident_char(int c) {
+    return isalnum(c) || c == '_' || c == '.';
+}
+
+/* ---- Symbols ---- */
+
+static unsigned sym_hash(const char* name) {
+    unsigned h = 5381;
+    while (*name) h = h * 33 + (unsigned char)*name++;
+    return h % ASM_HASH_SIZE;
+}
+
+static Symbol* sym_find(Asm* as, const char* name) {
+    for (Symbol* s = as->symbols[sym_hash(name)]; s; s = s->next) {
+        if (strcmp(s->name, name) == 0) return s;
+    }
+    return NULL;
+}
+
+static Symbol* sym_define(Asm* as, const char* name, SymKind kind,
+                          const char* file, int line) {
+    Symbol* s = sym_find(as, name);
+    if (s) {
+        asm_error(as, file, line, "'%s' already defined at %s:%d", name,
+                  s->file, s->line);
+        return NULL;
+    }
+    s = (Symbol*)xmalloc(sizeof(Symbol));
+    memset(s, 0, sizeof(*s));
+    s->name = xstrdup(name);
+    s->kind = kind;
+    s->file = file;
+    s->line = line;
+    unsigned h = sym_hash(name);
+    s->next = as->symbols[h];
+    as->symbols[h] = s;
+    return s;
+}
+
+/* ---- Registers ---- */
+
+static int parse_reg(Isa isa, const char* name) {
+    static const char* const x86[] = {
+        "RAX", "RCX", "RDX", "RBX", "RSP", "RBP", "RSI", "RDI"
+    };
+    int count = isa == ISA_VM ? VM_REG_COUNT : VM64_REG_COUNT;
+    
+    if ((name[0] == 'r' || name[0] == 'R') && isdigit((unsigned char)name[1])) {
+        char* end;
+        long n = strtol(name + 1, &end, 10);
+        if (*end == '\0' && n >= 0 && n < count) return (int)n;
+        return -1;
+    }
+    if (isa == ISA_VM64) {
+        for (int i = 0; i < 8; i++) {
+            if (strcasecmp(name, x86[i]) == 0) return i;
+        }
+    }
+    return -1;
+}
+
+static int parse_vreg(Isa isa, const char* name) {
+    if (isa != ISA_VM64 || (name[0] != 'v' && name[0] != 'V')) return -1;
+    if (!isdigit((unsigned char)name[1])) return -1;
+    char* end;
+    long n = strtol(name + 1, &end, 10);
+    return *end == '\0' && n >= 0 && n < VM64_VREG_COUNT ? (int)n : -1;
+}
+
+/* ---- Expressions ---- */
+
+enum { EVAL_OK, EVAL_NOTCONST, EVAL_ERROR };
+
+typedef struct {
+    Asm* as;
+    const char* p;
+    uint64_t here;                         /* Value of $ */
+    int have_here;
+    int status;
+    char err[160];
+} Eval;
+
+static uint64_t eval_or(Eval* ev);
+
+static void eval_fail(Eval* ev, int status, const char* fmt, ...) {
+    if (ev->status != EVAL_OK) return;
+    ev->status = status;
+    va_list ap;
+    va_start(ap, fmt);
+    vsnprintf(ev->err, sizeof(ev->err), fmt, ap);
+    va_end(ap);
+}
+
+static void eval_space(Eval* ev) {
+    while (isspace((unsigned char)*ev->p)) ev->p++;
+}
+
+/* Decode one character of a quoted literal, advancing *p */
+static int parse_char(const char** p) {
+    const char* s = *p;
+    int c = (unsigned char)*s++;
+    if (c == '\\') {
+        c = (unsigned char)*s++;
+        switch (c) {
+            case 'n': c = '\n'; break;
+            case 't': c = '\t'; break;
+            case 'r': c = '\r'; break;
+            case '0': c = 0; break;
+            case 'x': {
+                int v = 0;
+                for (int i = 0; i < 2 && isxdigit((unsigned char)*s); i++, s++) {
+                    v = v * 16 + (isdigit((unsigned char)*s) ? *s - '0' :
+                                  (tolower((unsigned char)*s) - 'a' + 10));
+                }
+                c = v;
+                break;
+            }
+            default: break;                /* \\ \' \" */
+        }
+    }
+    *p = s;
+    return c;
+}
+
+static uint64_t eval_symbol(Eval* ev, const char* name) {
+    Symbol* s = sym_find(ev->as, name);
+    if (!s) {
+        eval_fail(ev, EVAL_ERROR, "undefined symbol '%s'", name);
+        return 0;
+    }
+    if (s->kind == SYM_LABEL) {
+        if (!ev->as->layout_done) eval_fail(ev, EVAL_NOTCONST, "label");
+        return s->value;
+    }
+    if (s->evaluating) {
+        eval_fail(ev, EVAL_ERROR, "'%s' is defined in terms of itself", name);
+        return 0;
+    }
+    
+    Eval sub = *ev;
+    sub.p = s->expr;
+    sub.have_here = 0;
+    sub.status = EVAL_OK;
+    s->evaluating = 1;
+    uint64_t v = eval_or(&sub);
+    eval_space(&sub);
+    if (sub.status == EVAL_OK && *sub.p) {
+        eval_fail(&sub, EVAL_ERROR, "junk after expression in '%s'", name);
+    }
+    s->evaluating = 0;
+    if (sub.status != EVAL_OK) {
+        ev->status = sub.status;
+        memcpy(ev->err, sub.err, sizeof(ev->err));
+    }
+    return v;
+}
+
+static uint64_t eval_primary(Eval* ev) {
+    eval_space(ev);
+    const char* p = ev->p;
+    
+    if (*p == '(') {
+        ev->p++;
+        uint64_t v = eval_or(ev);
+        eval_space(ev);
+        if (*ev->p != ')') eval_fail(ev, EVAL_ERROR, "missing ')'");
+        else ev->p++;
+        return v;
+    }
+    if (*p == '-') { ev->p++; return 0 - eval_primary(ev); }
+    if (*p == '+') { ev->p++; return eval_primary(ev); }
+    if (*p == '~') { ev->p++; return ~eval_primary(ev); }
+    if (*p == '$') {
+        ev->p++;
+        if (!ev->have_here) eval_fail(ev, EVAL_ERROR, "'$' is not allowed here");
+        else if (!ev->as->layout_done) eval_fail(ev, EVAL_NOTCONST, "$");
+        return ev->here;
+    }
+    if (*p == '\'') {
+        p++;
+        int c = parse_char(&p);
+        if (*p != '\'') {
+            eval_fail(ev, EVAL_ERROR, "bad character literal");
+            return 0;
+        }
+        ev->p = p + 1;
+        return (uint64_t)c;
+    }
+    if (isdigit((unsigned char)*p)) {
+        char* end;
+        uint64_t v;
+        if (p[0] == '0' && (p[1] == 'b' || p[1] == 'B')) {
+            v = strtoull(p + 2, &end, 2);
+        } else {
+            v = strtoull(p, &end, 0);
+        }
+        if (is_ident_char((unsigned char)*end)) {
+            eval_fail(ev, EVAL_ERROR, "bad number");
+        }
+        ev->p = end;
+        return v;
+    }
+    if (is_ident_start((unsigned char)*p)) {
+        const char* start = p;
+        while (is_ident_char((unsigned char)*p)) p++;
+        char name[128];
+        size_t n = (size_t)(p - start) < sizeof(name) - 1 ?
+                   (size_t)(p - start) : sizeof(name) - 1;
+        memcpy(name, start, n);
+        name[n] = '\0';
+        ev->p = p;
+        return eval_symbol(ev, name);
+    }
+    eval_fail(ev, EVAL_ERROR, "expected a value at '%s'", p);
+    return 0;
+}
+
+static uint64_t eval_mul(Eval* ev) {
+    uint64_t v = eval_primary(ev);
+    for (;;) {
+        eval_space(ev);
+        char op = *ev->p;
+        if (op != '*' && op != '/' && op != '%') return v;
+        ev->p++;
+        uint64_t r = eval_primary(ev);
+        if (op != '*' && r == 0) {
+            eval_fail(ev, EVAL_ERROR, "division by zero");
+            return 0;
+        }
+        v = op == '*' ? v * r : op == '/' ? v / r : v % r;
+    }
+}
+
+static uint64_t eval_add(Eval* ev) {
+    uint64_t v = eval_mul(ev);
+    for (;;) {
+        eval_space(ev);
+        char op = *ev->p;
+        if (op != '+' && op != '-') return v;
+        ev->p++;
+        uint64_t r = eval_mul(ev);
+        v = op == '+' ? v + r : v - r;
+    }
+}
+
+static uint64_t eval_shift(Eval* ev) {
+    uint64_t v = eval_add(ev);
+    for (;;) {
+        eval_space(ev);
+        if ((ev->p[0] != '<' && ev->p[0] != '>') || ev->p[1] != ev->p[0]) return v;
+        int left = ev->p[0] == '<';
+        ev->p += 2;
+        uint64_t r = eval_add(ev);
+        v = r >= 64 ? 0 : left ? v << r : v >> r;
+    }
+}
+
+static uint64_t eval_and(Eval* ev) {
+    uint64_t v = eval_shift(ev);
+    for (;;) {
+        eval_space(ev);
+        if (*ev->p != '&') return v;
+        ev->p++;
+        v &= eval_shift(ev);
+    }
+}
+
+static uint64_t eval_xor(Eval* ev) {
+    uint64_t v = eval_and(ev);
+    for (;;) {
+        eval_space(ev);
+        if (*ev->p != '^') return v;
+        ev->p++;
+        v ^= eval_and(ev);
+    }
+}
+
+static uint64_t eval_or(Eval* ev) {
+    uint64_t v = eval_xor(ev);
+    for (;;) {
+        eval_space(ev);
+        if (*ev->p != '|') return v;
+        ev->p++;
+        v |= eval_xor(ev);
+    }
+}
+
+/* Evaluate text. Before layout, anything that depends on a label address
+ * or $ yields EVAL_NOTCONST. Errors are reported only when report is set. */
+static int eval_expr(Asm* as, const Item* it, const char* text, uint64_t* out,
+                     int report) {
+    Eval ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.as = as;
+    ev.p = text;
+    ev.here = it ? it->addr : 0;
+    ev.have_here = it != NULL;
+    *out = eval_or(&ev);
+    eval_space(&ev);
+    if (ev.status == EVAL_OK && *ev.p) {
+        eval_fail(&ev, EVAL_ERROR, "junk after expression: '%s'", ev.p);
+    }
+    if (ev.status != EVAL_OK && report) {
+        if (ev.status == EVAL_NOTCONST) {
+            snprintf(ev.err, sizeof(ev.err), "'%s' must not depend on label addresses",
+                     text);
+        }
+        asm_error(as, it ? it->file : NULL, it ? it->line : 0, "%s", ev.err);
+    }
+    return ev.status;
+}
+
+/* ---- Reading source: .include and macros ---- */
+
+static void add_line(Asm* as, const char* text, const char* file, int line) {
+    if (as->nlines == as->cap_lines) {
+        as->cap_lines = as->cap_lines ? as->cap_lines * 2 : 256;
+        as->lines = (Line*)xrealloc(as->lines, as->cap_lines * sizeof(Line));
+    }
+    as->lines[as->nlines].text = xstrdup(text);
+    as->lines[as->nlines].file = file;
+    as->lines[as->nlines].line = line;
+    as->nlines++;
+}
+
+/* Remove a ';' comment, ignoring semicolons inside quotes */
+static void strip_comment(char* s) {
+    char quote = 0;
+    for (; *s; s++) {
+        if (quote) {
+            if (*s == '\\' && s[1]) s++;
+            else if (*s == quote) quote = 0;
+        } else if (*s == '"' || *s == '\'') {
+            quote = *s;
+        } else if (*s == ';') {
+            *s = '\0';
+            return;
+        }
+    }
+}
+
+/* Split s at top-level commas (outside quotes, brackets and parens) into
+ * trimmed fields. Returns the count; s is modified. */
+static int split_args(char* s, char** out, int max) {
+    int n = 0, depth = 0;
+    char quote = 0;
+    s = trim(s);
+    if (*s == '\0') return 0;
+    out[n++] = s;
+    for (; *s; s++) {
+        if (quote) {
+            if (*s == '\\' && s[1]) s++;
+            else if (*s == quote) quote = 0;
+        } else if (*s == '"' || *s == '\'') {
+            quote = *s;
+        } else if (*s == '(' || *s == '[') {
+            depth++;
+        } else if (*s == ')' || *s == ']') {
+            depth--;
+        } else if (*s == ',' && depth == 0) {
+            *s = '\0';
+            if (n == max) return -1;
+            out[n++] = s + 1;
+        }
+    }
+    for (int i = 0; i < n; i++) out[i] = trim(out[i]);
+    return n;
+}
+
+static Macro* macro_find(Asm* as, const char* name) {
+    for (int i = 0; i < as->nmacros; i++) {
+        if (strcasecmp(as->macros[i].name, name) == 0) return &as->macros[i];
+    }
+    return NULL;
+}
+
+static int read_source(Asm* as, const char* path, int depth);
+static void process_line(Asm* as, const char* raw, const char* file, int line,
+                         int depth);
+
+/* Substitute \param and \@ in one macro body line */
+static void macro_subst(const Macro* m, const char* src, char** args, int nargs,
+                        int serial, char* out, size_t size) {
+    size_t n = 0;
+    while (*src && n + 1 < size) {
+        if (*src == '\\') {
+            if (src[1] == '@') {
+                n += (size_t)snprintf(out + n, size - n, "%d", serial);
+                if (n >= size) n = size - 1;
+                src += 2;
+                continue;
+            }
+            int best = -1;
+            size_t best_len = 0;
+            for (int i = 0; i < m->nparams; i++) {
+                size_t len = strlen(m->params[i]);
+                if (len > best_len && strncmp(src + 1, m->params[i], len) == 0 &&
+                    !is_ident_char((unsigned char)src[1 + len])) {
+                    best = i;
+                    best_len = len;
+                }
+            }
+            if (best >= 0) {
+                const char* arg = best < nargs ? args[best] : "";
+                n += (size_t)snprintf(out + n, size - n, "%s", arg);
+                if (n >= size) n = size - 1;
+                src += 1 + best_len;
+                continue;
+            }
+        }
+        out[n++] = *src++;
+    }
+    out[n] = '\0';
+}
+
+static void macro_expand(Asm* as, Macro* m, char* args_text, const char* file,
+                         int line, int depth) {
+    char* args[32];
+    int nargs = split_args(args_text, args, 32);
+    if (nargs < 0 || nargs > m->nparams) {
+        asm_error(as, file, line, "too many arguments to macro '%s'", m->name);
+        return;
+    }
+    int serial = ++as->macro_serial;
+    for (int i = 0; i < m->nbody; i++) {
+        char text[ASM_MAX_LINE * 2];
+        macro_subst(m, m->body[i], args, nargs, serial, text, sizeof(text));
+        process_line(as, text, file, line, depth + 1);
+    }
+}
+
+static void macro_begin(Asm* as, char* rest, const char* file, int line) {
+    char* fields[33];
+    char* name = rest;
+    while (*rest && !isspace((unsigned char)*rest) && *rest != ',') rest++;
+    if (*rest) *rest++ = '\0';
+    if (!is_ident_start((unsigned char)*name) || macro_find(as, name)) {
+        asm_error(as, file, line, "bad or duplicate macro name '%s'", name);
+    }
+    int n = split_args(rest, fields, 32);
+    if (n < 0) {
+        asm_error(as, file, line, "too many macro parameters");
+        n = 0;
+    }
+    
+    as->macros = (Macro*)xrealloc(as->macros, (as->nmacros + 1) * sizeof(Macro));
+    Macro* m = &as->macros[as->nmacros++];
+    memset(m, 0, sizeof(*m));
+    m->name = xstrdup(name);
+    m->params = (char**)xmalloc((size_t)(n + 1) * sizeof(char*));
+    for (int i = 0; i < n; i++) m->params[i] = xstrdup(fields[i]);
+    m->nparams = n;
+    as->defining = m;
+}
+
+/* Handle one raw source line: macro recording, .include, .macro, macro
+ * calls (including after a label) and finally plain lines */
+static void process_line(Asm* as, const char* raw, const char* file, int line,
+                         int depth) {
+    char buf[ASM_MAX_LINE * 2];
+    snprintf(buf, sizeof(buf), "%s", raw);
+    strip_comment(buf);
+    char* s = trim(buf);
+    
+    if (as->defining) {
+        if (strncasecmp(s, ".endm", 5) == 0 && !is_ident_char((unsigned char)s[5])) {
+            as->defining = NULL;
+            return;
+        }
+        Macro* m = as->defining;
+        m->body = (char**)xrealloc(m->body, (m->nbody + 1) * sizeof(char*));
+        m->body[m->nbody++] = xstrdup(s);
+        return;
+    }
+    if (*s == '\0') return;
+    if (depth > ASM_MAX_DEPTH) {
+        asm_error(as, file, line, "macro or include nesting too deep");
+        return;
+    }
+    
+    if (strncasecmp(s, ".macro", 6) == 0 && isspace((unsigned char)s[6])) {
+        macro_begin(as, trim(s + 6), file, line);
+        return;
+    }
+    if (strncasecmp(s, ".endm", 5) == 0) {
+        asm_error(as, file, line, ".endm without .macro");
+        return;
+    }
+    if (strncasecmp(s, ".include", 8) == 0 && isspace((unsigned char)s[8])) {
+        char* q = trim(s + 8);
+        size_t n = strlen(q);
+        if (n < 2 || q[0] != '"' || q[n - 1] != '"') {
+            asm_error(as, file, line, ".include needs a quoted file name");
+            return;
+        }
+        q[n - 1] = '\0';
+        char path[1024];
+        const char* slash = strrchr(file, '/');
+        if (q[1] != '/' && slash) {
+            snprintf(path, sizeof(path), "%.*s/%s", (int)(slash - file), file, q + 1);
+        } else {
+            snprintf(path, sizeof(path), "%s", q + 1);
+        }
+        if (read_source(as, path, depth + 1) != 0) {
+            asm_error(as, file, line, "cannot read '%s'", path);
+        }
+        return;
+    }
+    
+    /* Leading labels go out as their own lines so macros can follow them */
+    char* p = s;
+    while (is_ident_start((unsigned char)*p)) {
+        char* q = p;
+        while (is_ident_char((unsigned char)*q)) q++;
+        if (*q != ':') break;
+        char label[ASM_MAX_LINE];
+        snprintf(label, sizeof(label), "%.*s", (int)(q + 1 - p), p);
+        add_line(as, label, file, line);
+        p = q + 1;
+        while (isspace((unsigned char)*p)) p++;
+    }
+    if (*p == '\0') return;
+    
+    char word[64];
+    size_t n = 0;
+    while (is_ident_char((unsigned char)p[n]) && n < sizeof(word) - 1) n++;
+    snprintf(word, sizeof(word), "%.*s", (int)n, p);
+    Macro* m = n > 0 ? macro_find(as, word) : NULL;
+    if (m && (p[n] == '\0' || isspace((unsigned char)p[n]))) {
+        char args[ASM_MAX_LINE * 2];
+        snprintf(args, sizeof(args), "%s", p + n);
+        macro_expand(as, m, args, file, line, depth);
+        return;
+    }
+    add_line(as, p, file, line);
+}
+
+static int read_source(Asm* as, const char* path, int depth) {
+    FILE* f = strcmp(path, "-") == 0 ? stdin : fopen(path, "r");
+    if (!f) return -1;
+    
+    as->files = (char**)xrealloc(as->files, (as->nfiles + 1) * sizeof(char*));
+    const char* name = as->files[as->nfiles++] = xstrdup(path);
+    
+    char text[ASM_MAX_LINE];
+    int line = 0;
+    while (fgets(text, sizeof(text), f)) {
+        line++;
+        size_t len = strlen(text);
+        if (len == sizeof(text) - 1 && text[len - 1] != '\n') {
+            asm_error(as, name, line, "line too long");
+            int c;
+            while ((c = fgetc(f)) != EOF && c != '\n') {}
+        }
+        process_line(as, text, name, line, depth);
+    }
+    if (f != stdin) fclose(f);
+    if (depth == 0 && as->defining) {
+        asm_error(as, name, line, "missing .endm for macro '%s'", as->defining->name);
+        as->defining = NULL;
+    }
+    return 0;
+}
+
+/* ---- Parsing lines into items ---- */
+
+static Item* add_item(Asm* as, ItemKind kind, const Line* ln) {
+    if (as->nitems == as->cap_items) {
+        as->cap_items = as->cap_items ? as->cap_items * 2 : 256;
+        as->items = (Item*)xrealloc(as->items, as->cap_items * sizeof(Item));
+    }
+    Item* it = &as->items[as->nitems++];
+    memset(it, 0, sizeof(*it));
+    it->kind = kind;
+    it->file = ln->file;
+    it->line = ln->line;
+    it->r1 = it->r2 = -1;
+    return it;
+}
+
+static const InsnDef* find_insn(Isa isa, const char* name) {
+    for (const InsnDef* d = isa == ISA_VM ? vm_insns : vm64_insns; d->name; d++) {
+        if (strcasecmp(d->name, name) == 0) return d;
+    }
+    return NULL;
+}
+
+/* Parse a quoted string into a new buffer; returns its length or -1 */
+static long parse_string(const char* s, uint8_t** out) {
+    size_t n = strlen(s);
+    if (n < 2 || s[0] != '"' || s[n - 1] != '"') return -1;
+    uint8_t* buf = (uint8_t*)xmalloc(n);  /* Room for a .asciz NUL */
+    memset(buf, 0, n);
+    long len = 0;
+    const char* p = s + 1;
+    while (p < s + n - 1) buf[len++] = (uint8_t)parse_char(&p);
+    *out = buf;
+    return len;
+}
+
+/* Memory operand "[...]": ABS expr, [reg] or [reg +/- expr] */
+static int parse_mem(Asm* as, const Line* ln, const char* text, int* base,
+                     uint8_t* kind, char** expr) {
+    size_t n = strlen(text);
+    if (n < 2 || text[0] != '[' || text[n - 1] != ']') {
+        asm_error(as, ln->file, ln->line, "expected a memory operand '[...]'");
+        return -1;
+    }
+    char inner[ASM_MAX_LINE];
+    snprintf(inner, sizeof(inner), "%.*s", (int)(n - 2), text + 1);
+    char* s = trim(inner);
+    
+    char* p = s;
+    while (is_ident_char((unsigned char)*p)) p++;
+    char reg[32];
+    snprintf(reg, sizeof(reg), "%.*s", (int)(p - s), s);
+    int r = p > s ? parse_reg(as->isa, reg) : -1;
+    if (r < 0) {
+        *base = -1;
+        *kind = VM_AM_ABS;
+        *expr = xstrdup(s);
+        return 0;
+    }
+    
+    while (isspace((unsigned char)*p)) p++;
+    *base = r;
+    if (*p == '\0') {
+        *kind = VM_AM_IND;
+        *expr = xstrdup("0");
+        return 0;
+    }
+    if (*p != '+' && *p != '-') {
+        asm_error(as, ln->file, ln->line, "bad memory operand '%s'", text);
+        return -1;
+    }
+    *kind = VM_AM_DISP;
+    char e[ASM_MAX_LINE + 8];
+    snprintf(e, sizeof(e), "%s(%s)", *p == '-' ? "-" : "", trim(p + 1));
+    *expr = xstrdup(e);
+    return 0;
+}
+
+static int want_reg(Asm* as, const Line* ln, const char* text) {
+    int r = parse_reg(as->isa, text);
+    if (r < 0) asm_error(as, ln->file, ln->line, "expected a register, got '%s'", text);
+    return r;
+}
+
+static int want_vreg(Asm* as, const Line* ln, const char* text) {
+    int r = parse_vreg(as->isa, text);
+    if (r < 0) {
+        asm_error(as, ln->file, ln->line, "expected a vector register, got '%s'", text);
+    }
+    return r;
+}
+
+/* Width suffix .B/.W/.D/.Q -> log2 bytes, -1 if absent, -2 if bad */
+static int parse_width(const char* suffix) {
+    if (!suffix) return -1;
+    if (strlen(suffix) != 1) return -2;
+    switch (toupper((unsigned char)suffix[0])) {
+        case 'B': return 0;
+        case 'W': return 1;
+        case 'D': return 2;
+        case 'Q': return 3;
+        default: return -2;
+    }
+}
+
+/* Vector shape suffix: lane letter and optional 128/256 */
+static int parse_shape(const char* suffix) {
+    if (!suffix || !suffix[0]) return -1;
+    char lane[2] = { suffix[0], '\0' };
+    int w = parse_width(lane);
+    if (w < 0) return -1;
+    if (suffix[1] == '\0' || strcmp(suffix + 1, "128") == 0) return w;
+    if (strcmp(suffix + 1, "256") == 0) return w | VM64_VSHAPE_256;
+    return -1;
+}
+
+static void parse_insn(Asm* as, const Line* ln, char* mnemonic, char* operands) {
+    char* suffix = strchr(mnemonic, '.');
+    if (suffix) *suffix++ = '\0';
+    const InsnDef* def = find_insn(as->isa, mnemonic);
+    if (!def) {
+        asm_error(as, ln->file, ln->line, "unknown instruction '%s' for %s", mnemonic,
+                  as->isa == ISA_VM ? "vm" : "vm64");
+        return;
+    }
+    as->isa_fixed = 1;
+    
+    char* ops[4];
+    int nops = split_args(operands, ops, 4);
+    static const int want[] = {
+        [FORM_NONE] = 0, [FORM_R] = 1, [FORM_RR] = 2, [FORM_RI] = 2, [FORM_RS] = 2,
+        [FORM_MEM] = 2, [FORM_A] = 1, [FORM_RA] = 2, [FORM_VMEM] = 2,
+        [FORM_VV] = 2, [FORM_VR] = 2, [FORM_RV] = 2
+    };
+    if (nops != want[def->form]) {
+        asm_error(as, ln->file, ln->line, "%s takes %d operand(s)", def->name,
+                  want[def->form]);
+        return;
+    }
+    int vector = def->form >= FORM_VMEM;
+    if (suffix && def->form != FORM_MEM && !vector) {
+        asm_error(as, ln->file, ln->line, "%s takes no size suffix", def->name);
+        return;
+    }
+    
+    Item* it = add_item(as, ITEM_INSN, ln);
+    it->def = def;
+    it->opcode = def->opcode;
+    switch (def->form) {
+        case FORM_NONE:
+            break;
+        case FORM_R:
+            it->r1 = want_reg(as, ln, ops[0]);
+            break;
+        case FORM_RR:
+            it->r1 = want_reg(as, ln, ops[0]);
+            it->r2 = want_reg(as, ln, ops[1]);
+            break;
+        case FORM_RI:
+        case FORM_RS:
+        case FORM_RA:
+            it->r1 = want_reg(as, ln, ops[0]);
+            it->expr = xstrdup(ops[1]);
+            break;
+        case FORM_A:
+            it->expr = xstrdup(ops[0]);
+            break;
+        case FORM_MEM: {
+            int width = parse_width(suffix);
+            uint8_t kind;
+            if (width == -2) {
+                asm_error(as, ln->file, ln->line, "bad size suffix '.%s'", suffix);
+                break;
+            }
+            it->r1 = want_reg(as, ln, ops[0]);
+            if (parse_mem(as, ln, ops[1], &it->r2, &kind, &it->expr) != 0) break;
+            
+            /* LOAD/STORE is byte-sized and absolute; anything else needs
+             * the X form, which is also used when asked for by name */
+            int store = def->opcode == (as->isa == ISA_VM ? OP_STORE : X64_STORE) ||
+                        def->opcode == (as->isa == ISA_VM ? OP_STOREX : X64_STOREX);
+            int explicit_x = strcasecmp(def->name, "LOADX") == 0 ||
+                             strcasecmp(def->name, "STOREX") == 0;
+            if (width < 0) width = 0;
+            it->amode = (uint8_t)(kind | width);
+            if (explicit_x || width != 0 || kind != VM_AM_ABS) {
+                it->opcode = as->isa == ISA_VM ? (store ? OP_STOREX : OP_LOADX) :
+                             (store ? X64_STOREX : X64_LOADX);
+            } else {
+                it->opcode = as->isa == ISA_VM ? (store ? OP_STORE : OP_LOAD) :
+                             (store ? X64_STORE : X64_LOAD);
+            }
+            break;
+        }
+        case FORM_VMEM:
+        case FORM_VV:
+        case FORM_VR:
+        case FORM_RV: {
+            int shape = parse_shape(suffix);
+            if (shape < 0) {
+                asm_error(as, ln->file, ln->line, "%s needs a shape such as .D256",
+                          def->name);
+                break;
+            }
+            it->shape = (uint8_t)shape;
+            if (def->form == FORM_RV) it->r1 = want_reg(as, ln, ops[0]);
+            else it->r1 = want_vreg(as, ln, ops[0]);
+            
+            if (def->form == FORM_VMEM) {
+                uint8_t kind;
+                if (parse_mem(as, ln, ops[1], &it->r2, &kind, &it->expr) == 0 &&
+                    kind != VM_AM_ABS) {
+                    asm_error(as, ln->file, ln->line, "%s takes an absolute address",
+                              def->name);
+                }
+            } else if (def->form == FORM_VR) {
+                it->r2 = want_reg(as, ln, ops[1]);
+            } else {
+                it->r2 = want_vreg(as, ln, ops[1]);
+            }
+            break;
+        }
+    }
+}
+
+static void parse_data(Asm* as, const Line* ln, int unit, char* operands,
+                       int allow_strings) {
+    char* vals[256];
+    int n = split_args(operands, vals, 256);
+    if (n <= 0) {
+        asm_error(as, ln->file, ln->line, n < 0 ? "too many values" : "missing value");
+        return;
+    }
+    for (int i = 0; i < n; i++) {
+        if (vals[i][0] == '"') {
+            uint8_t* bytes;
+            long len = parse_string(vals[i], &bytes);
+            if (!allow_strings || len < 0) {
+                asm_error(as, ln->file, ln->line, "bad string %s", vals[i]);
+                if (len >= 0) free(bytes);
+                continue;
+            }
+            Item* it = add_item(as, ITEM_BYTES, ln);
+            it->bytes = bytes;
+            it->size = (uint64_t)len;
+            continue;
+        }
+        Item* it = add_item(as, ITEM_DATA, ln);
+        it->unit = unit;
+        it->size = (uint64_t)unit;
+        it->expr = xstrdup(vals[i]);
+    }
+}
+
+static int const_operand(Asm* as, const Line* ln, const char* text, uint64_t* out) {
+    Item tmp;
+    memset(&tmp, 0, sizeof(tmp));
+    tmp.file = ln->file;
+    tmp.line = ln->line;
+    return eval_expr(as, NULL, text, out, 0) == EVAL_OK ? 0 :
+           (eval_expr(as, &tmp, text, out, 1), -1);
+}
+
+static void parse_directive(Asm* as, const Line* ln, char* name, char* rest) {
+    if (strcasecmp(name, ".isa") == 0) {
+        char* v = trim(rest);
+        Isa isa;
+        if (strcasecmp(v, "vm") == 0) isa = ISA_VM;
+        else if (strcasecmp(v, "vm64") == 0) isa = ISA_VM64;
+        else {
+            asm_error(as, ln->file, ln->line, "unknown ISA '%s' (vm or vm64)", v);
+            return;
+        }
+        if (as->isa_fixed && isa != as->isa) {
+            asm_error(as, ln->file, ln->line, ".isa must come before any code");
+            return;
+        }
+        as->isa = isa;
+        as->isa_fixed = 1;
+    } else if (strcasecmp(name, ".base") == 0) {
+        uint64_t v;
+        if (as->nitems > 0) {
+            asm_error(as, ln->file, ln->line, ".base must come before any code");
+        } else if (const_operand(as, ln, trim(rest), &v) == 0) {
+            if (as->isa == ISA_VM && v != 0) {
+                asm_error(as, ln->file, ln->line, "vm images always load at 0");
+            }
+            as->base = v;
+            as->base_set = 1;
+        }
+    } else if (strcasecmp(name, ".equ") == 0 || strcasecmp(name, ".set") == 0) {
+        char* f[2];
+        if (split_args(rest, f, 2) != 2 || !is_ident_start((unsigned char)f[0][0])) {
+            asm_error(as, ln->file, ln->line, "usage: %s NAME, value", name);
+            return;
+        }
+        Symbol* s = sym_define(as, f[0], SYM_CONST, ln->file, ln->line);
+        if (s) s->expr = xstrdup(f[1]);
+    } else if (strcasecmp(name, ".byte") == 0 || strcasecmp(name, "db") == 0) {
+        parse_data(as, ln, 1, rest, 1);
+    } else if (strcasecmp(name, ".word") == 0) {
+        parse_data(as, ln, 2, rest, 0);
+    } else if (strcasecmp(name, ".dword") == 0) {
+        parse_data(as, ln, 4, rest, 0);
+    } else if (strcasecmp(name, ".qword") == 0) {
+        parse_data(as, ln, 8, rest, 0);
+    } else if (strcasecmp(name, ".ascii") == 0 || strcasecmp(name, ".asciz") == 0) {
+        uint8_t* bytes;
+        long len = parse_string(trim(rest), &bytes);
+        if (len < 0) {
+            asm_error(as, ln->file, ln->line, "%s needs a quoted string", name);
+            return;
+        }
+        Item* it = add_item(as, ITEM_BYTES, ln);
+        it->bytes = bytes;
+        it->size = (uint64_t)len + (strcasecmp(name, ".asciz") == 0);
+    } else if (strcasecmp(name, ".space") == 0) {
+        char* f[2];
+        int n = split_args(rest, f, 2);
+        if (n < 1) {
+            asm_error(as, ln->file, ln->line, "usage: .space count[, fill]");
+            return;
+        }
+        Item* it = add_item(as, ITEM_SPACE, ln);
+        it->expr = xstrdup(f[0]);
+        it->fill = xstrdup(n > 1 ? f[1] : "0");
+    } else if (strcasecmp(name, ".org") == 0) {
+        Item* it = add_item(as, ITEM_ORG, ln);
+        it->expr = xstrdup(trim(rest));
+    } else if (strcasecmp(name, ".align") == 0) {
+        Item* it = add_item(as, ITEM_ALIGN, ln);
+        it->expr = xstrdup(trim(rest));
+    } else {
+        asm_error(as, ln->file, ln->line, "unknown directive '%s'", name);
+    }
+}
+
+static void parse_line(Asm* as, const Line* ln) {
+    char buf[ASM_MAX_LINE * 2];
+    snprintf(buf, sizeof(buf), "%s", ln->text);
+    char* s = trim(buf);
+    size_t n = strlen(s);
+    
+    /* Labels were split onto their own lines while reading */
+    if (n > 1 && s[n - 1] == ':') {
+        s[n - 1] = '\0';
+        if (parse_reg(as->isa, s) >= 0) {
+            asm_error(as, ln->file, ln->line, "'%s' is a register name", s);
+            return;
+        }
+        Symbol* sym = sym_define(as, s, SYM_LABEL, ln->file, ln->line);
+        if (!sym) return;
+        Item* it = add_item(as, ITEM_LABEL, ln);
+        it->label = sym;
+        sym->item = as->nitems - 1;
+        return;
+    }
+    
+    char* p = s;
+    while (*p && !isspace((unsigned char)*p) && *p != '=') p++;
+    char* word_end = p;
+    while (isspace((unsigned char)*p)) p++;
+    
+    /* NAME = expr */
+    if (*p == '=' && p[1] != '=') {
+        *word_end = '\0';
+        if (!is_ident_start((unsigned char)s[0])) {
+            asm_error(as, ln->file, ln->line, "bad constant name '%s'", s);
+            return;
+        }
+        Symbol* sym = sym_define(as, s, SYM_CONST, ln->file, ln->line);
+        if (sym) sym->expr = xstrdup(trim(p + 1));
+        return;
+    }
+    
+    *word_end = '\0';
+    if (s[0] == '.' || strcasecmp(s, "db") == 0) parse_directive(as, ln, s, p);
+    else parse_insn(as, ln, s, p);
+}
+
+/* ---- Peephole optimizer ---- */
+
+enum {
+    FLOW_NONE,
+    FLOW_BRANCH,                           /* Conditional: falls through too */
+    FLOW_JUMP,                             /* Unconditional, no fall-through */
+    FLOW_CALL,                             /* Callee may change anything */
+    FLOW_STOP,                             /* HALT, RET */
+    FLOW_SYSCALL                           /* Reads and may change registers */
+};
+
+#define REG_ALL 0xFFFFFFFFu
+#define REG_BIT(r) ((r) >= 0 ? 1u << (r) : 0u)
+
+static int is_op(const Asm* as, const Item* it, uint8_t vm_op, int vm64_op) {
+    return it->opcode == (as->isa == ISA_VM ? vm_op : vm64_op);
+}
+
+/* Registers an instruction reads and writes, and its control flow */
+static int insn_effects(const Asm* as, const Item* it, uint32_t* reads,
+                        uint32_t* writes) {
+    *reads = *writes = 0;
+    uint8_t op = it->opcode;
+    Form form = it->def->form;
+    
+    if (as->isa == ISA_VM) {
+        switch (op) {
+            case OP_HALT: case OP_RET: return FLOW_STOP;
+            case OP_JMP: return FLOW_JUMP;
+            case OP_CALL: *reads = REG_ALL; *writes = REG_ALL; return FLOW_CALL;
+            case OP_JNZ: case OP_JZ: case OP_JLT: case OP_JGT:
+                *reads = REG_BIT(it->r1);
+                return FLOW_BRANCH;
+            case OP_OUT: case OP_PUSH: *reads = REG_BIT(it->r1); return FLOW_NONE;
+            case OP_IN: case OP_POP: *writes = REG_BIT(it->r1); return FLOW_NONE;
+            default: break;
+        }
+    } else {
+        switch (op) {
+            case X64_HALT: return FLOW_STOP;
+            case X64_JMP: return FLOW_JUMP;
+            case X64_SYSCALL: *reads = REG_ALL; *writes = REG_ALL; return FLOW_SYSCALL;
+            case X64_OUT: case X64_PUSH: *reads = REG_BIT(it->r1); return FLOW_NONE;
+            case X64_POP: *writes = REG_BIT(it->r1); return FLOW_NONE;
+            default: break;
+        }
+    }
+    
+    switch (form) {
+        case FORM_RI:
+            *writes = REG_BIT(it->r1);
+            break;
+        case FORM_RR:
+            /* SUB/XOR r, r only writes */
+            if (!(it->r1 == it->r2 && (is_op(as, it, OP_SUB, X64_SUB) ||
+                                       is_op(as, it, OP_XOR, -1)))) {
+                *reads = REG_BIT(it->r1) | REG_BIT(it->r2);
+            }
+            *writes = REG_BIT(it->r1);
+            break;
+        case FORM_R:                       /* NOT */
+        case FORM_RS:
+            *reads = *writes = REG_BIT(it->r1);
+            break;
+        case FORM_MEM: {
+            int store = is_op(as, it, OP_STORE, X64_STORE) ||
+                        is_op(as, it, OP_STOREX, X64_STOREX);
+            *reads = REG_BIT(it->r2) | (store ? REG_BIT(it->r1) : 0);
+            *writes = store ? 0 : REG_BIT(it->r1);
+            break;
+        }
+        case FORM_VR:
+            *reads = REG_BIT(it->r2);
+            break;
+        case FORM_RV:
+            *writes = REG_BIT(it->r1);
+            break;
+        default:
+            break;
+    }
+    return FLOW_NONE;
+}
+
+/* Constant immediate of a MOVI/SHL/SHR, without label addresses */
+static int item_const(Asm* as, const Item* it, uint64_t* v) {
+    return it->expr && eval_expr(as, NULL, it->expr, v, 0) == EVAL_OK;
+}
+
+/* Constant a MOVI loads: the VM zero-extends its 32-bit immediate. Fails
+ * for immediates the encoder will reject, so they reach the error. */
+static int movi_const(Asm* as, const Item* it, uint64_t* v) {
+    if (!item_const(as, it, v)) return 0;
+    if (as->isa == ISA_VM64) return 1;
+    int64_t sv = (int64_t)*v;
+    if (*v > 0xFFFFFFFFu && (sv >= 0 || sv < -((int64_t)1 << 31))) return 0;
+    *v = (uint32_t)*v;
+    return 1;
+}
+
+static int movi_fits(const Asm* as, uint64_t v) {
+    return as->isa == ISA_VM64 || v <= 0xFFFFFFFFu;
+}
+
+static void make_movi(Asm* as, Item* it, int reg, uint64_t v) {
+    const InsnDef* def = find_insn(as->isa, "MOVI");
+    char text[32];
+    snprintf(text, sizeof(text), "0x%llX", (unsigned long long)v);
+    it->def = def;
+    it->opcode = def->opcode;
+    it->r1 = reg;
+    it->r2 = -1;
+    free(it->expr);
+    it->expr = xstrdup(text);
+}
+
+/* Fold dst op= src for known operands. Returns 0 if op is not foldable. */
+static int fold_alu(const Asm* as, uint8_t op, uint64_t a, uint64_t b, uint64_t* r) {
+    if (as->isa == ISA_VM64) {
+        if (op == X64_ADD) *r = a + b;
+        else if (op == X64_SUB) *r = a - b;
+        else return 0;
+        return 1;
+    }
+    switch (op) {
+        case OP_ADD: *r = a + b; return 1;
+        case OP_SUB: *r = a - b; return 1;
+        case OP_MUL: *r = a * b; return 1;
+        case OP_DIV: *r = b ? a / b : a; return 1;
+        case OP_MOD: *r = b ? a % b : a; return 1;
+        case OP_AND: *r = a & b; return 1;
+        case OP_OR: *r = a | b; return 1;
+        case OP_XOR: *r = a ^ b; return 1;
+        case OP_CMP: *r = a != b; return 1;
+        default: return 0;
+    }
+}
+
+/* Track constant registers through each straight-line run: drop MOVIs
+ * that reload a known value and fold ALU ops on known operands */
+static int peep_constants(Asm* as) {
+    int changed = 0;
+    int known[VM64_REG_COUNT];
+    uint64_t value[VM64_REG_COUNT];
+    memset(known, 0, sizeof(known));
+    
+    for (size_t i = 0; i < as->nitems; i++) {
+        Item* it = &as->items[i];
+        if (it->deleted) continue;
+        if (it->kind != ITEM_INSN) {
+            memset(known, 0, sizeof(known));   /* Label or data: anything goes */
+            continue;
+        }
+        
+        uint32_t reads, writes;
+        int flow = insn_effects(as, it, &reads, &writes);
+        Form form = it->def->form;
+        int d = it->r1, s = it->r2;
+        uint64_t v, r;
+        
+        if (form == FORM_RI && d >= 0) {
+            if (movi_const(as, it, &v)) {
+                if (known[d] && value[d] == v) {
+                    it->deleted = 1;
+                    as->removed_movi++;
+                    changed = 1;
+                    continue;
+                }
+                known[d] = 1;
+                value[d] = v;
+            } else {
+                known[d] = 0;
+            }
+            continue;
+        }
+        if (form == FORM_RR && d >= 0 && s >= 0) {
+            int zeroing = d == s && (is_op(as, it, OP_SUB, X64_SUB) ||
+                                     is_op(as, it, OP_XOR, -1));
+            if (zeroing || (known[d] && known[s] &&
+                            fold_alu(as, it->opcode, value[d], value[s], &r))) {
+                if (zeroing) r = 0;
+                if (known[d] && value[d] == r) {
+                    it->deleted = 1;           /* No change, e.g. ADD r, zero */
+                    as->folded++;
+                    changed = 1;
+                    continue;
+                }
+                if (!zeroing && movi_fits(as, r)) {
+                    make_movi(as, it, d, r);
+                    as->folded++;
+                    changed = 1;
+                }
+                if (zeroing || movi_fits(as, r)) {
+                    known[d] = 1;
+                    value[d] = r;
+                    continue;
+                }
+            }
+        }
+        if (form == FORM_RS && d >= 0 && known[d] && item_const(as, it, &v) && v < 64) {
+            r = is_op(as, it, OP_SHL, -1) ? value[d] << v : value[d] >> v;
+            if (r == value[d]) {
+                it->deleted = 1;
+                as->folded++;
+                changed = 1;
+                continue;
+            }
+            if (movi_fits(as, r)) {
+                make_movi(as, it, d, r);
+                as->folded++;
+                changed = 1;
+                value[d] = r;
+                continue;
+            }
+        }
+        if (form == FORM_R && is_op(as, it, OP_NOT, -1) && d >= 0 && known[d] &&
+            movi_fits(as, ~value[d])) {
+            make_movi(as, it, d, ~value[d]);
+            as->folded++;
+            changed = 1;
+            value[d] = ~value[d];
+            continue;
+        }
+        
+        for (int r2 = 0; r2 < VM64_REG_COUNT; r2++) {
+            if (writes & (1u << r2)) known[r2] = 0;
+        }
+        if (flow == FLOW_JUMP || flow == FLOW_STOP || flow == FLOW_CALL ||
+            flow == FLOW_SYSCALL) {
+            memset(known, 0, sizeof(known));
+        }
+    }
+    return changed;
+}
+
+/* Delete a MOVI whose register is overwritten before anything reads it */
+static int peep_dead_movi(Asm* as) {
+    int changed = 0;
+    for (size_t i = 0; i < as->nitems; i++) {
+        Item* it = &as->items[i];
+        if (it->deleted || it->kind != ITEM_INSN || it->def->form != FORM_RI ||
+            it->r1 < 0) {
+            continue;
+        }
+        uint32_t bit = 1u << it->r1;
+        for (size_t j = i + 1; j < as->nitems; j++) {
+            Item* next = &as->items[j];
+            if (next->deleted) continue;
+            if (next->kind != ITEM_INSN) break;
+            uint32_t reads, writes;
+            int flow = insn_effects(as, next, &reads, &writes);
+            if (reads & bit) break;
+            if (writes & bit) {
+                it->deleted = 1;
+                as->removed_movi++;
+                changed = 1;
+                break;
+            }
+            if (flow != FLOW_NONE) break;
+        }
+    }
+    return changed;
+}
+
+static Symbol* bare_label(Asm* as, const char* expr) {
+    if (!expr || !is_ident_start((unsigned char)expr[0])) return NULL;
+    for (const char* p = expr; *p; p++) {
+        if (!is_ident_char((unsigned char)*p)) return NULL;
+    }
+    Symbol* s = sym_find(as, expr);
+    return s && s->kind == SYM_LABEL ? s : NULL;
+}
+
+/* First live item after a label, skipping other labels */
+static size_t next_live(Asm* as, size_t i) {
+    while (i < as->nitems && (as->items[i].deleted || as->items[i].kind == ITEM_LABEL)) {
+        i++;
+    }
+    return i;
+}
+
+static int is_jump(const Asm* as, const Item* it) {
+    return it->kind == ITEM_INSN && !it->deleted && is_op(as, it, OP_JMP, X64_JMP);
+}
+
+/* Retarget jumps to unconditional jumps and drop jumps to the next
+ * instruction */
+static int peep_jumps(Asm* as) {
+    int changed = 0;
+    for (size_t i = 0; i < as->nitems; i++) {
+        Item* it = &as->items[i];
+        if (it->deleted || it->kind != ITEM_INSN ||
+            (it->def->form != FORM_A && it->def->form != FORM_RA)) {
+            continue;
+        }
+        
+        Symbol* target = bare_label(as, it->expr);
+        for (int hop = 0; target && hop < ASM_MAX_HOPS; hop++) {
+            size_t t = next_live(as, target->item);
+            if (t >= as->nitems || t == i || !is_jump(as, &as->items[t])) break;
+            Symbol* further = bare_label(as, as->items[t].expr);
+            if (!further || further == target) break;
+            free(it->expr);
+            it->expr = xstrdup(further->name);
+            target = further;
+            as->threaded++;
+            changed = 1;
+        }
+        
+        /* A jump or branch to the very next instruction does nothing */
+        if (target && !is_op(as, it, OP_CALL, -1) && target->item > i &&
+            next_live(as, i + 1) == next_live(as, target->item)) {
+            int only_labels = 1;
+            for (size_t j = i + 1; j < target->item; j++) {
+                if (!as->items[j].deleted && as->items[j].kind != ITEM_LABEL) only_labels = 0;
+            }
+            if (only_labels) {
+                it->deleted = 1;
+                as->dropped_jumps++;
+                changed = 1;
+            }
+        }
+    }
+    return changed;
+}
+
+/* Pick the shortest encoding: byte LOADX/STOREX at a constant address
+ * become LOAD/STORE, and MOVI r, 0 becomes SUB r, r */
+static int peep_encodings(Asm* as) {
+    int changed = 0;
+    for (size_t i = 0; i < as->nitems; i++) {
+        Item* it = &as->items[i];
+        if (it->deleted || it->kind != ITEM_INSN) continue;
+        uint64_t v;
+        
+        if ((is_op(as, it, OP_LOADX, X64_LOADX) || is_op(as, it, OP_STOREX, X64_STOREX)) &&
+            it->amode == (VM_AM_ABS | 0)) {
+            int store = is_op(as, it, OP_STOREX, X64_STOREX);
+            it->opcode = as->isa == ISA_VM ? (store ? OP_STORE : OP_LOAD) :
+                         (store ? X64_STORE : X64_LOAD);
+            as->shortened++;
+            changed = 1;
+        } else if (it->def->form == FORM_RI && it->r1 >= 0 && movi_const(as, it, &v) &&
+                   v == 0) {
+            const InsnDef* sub = find_insn(as->isa, "SUB");
+            it->def = sub;
+            it->opcode = sub->opcode;
+            it->r2 = it->r1;
+            as->shortened++;
+            changed = 1;
+        }
+    }
+    return changed;
+}
+
+static void optimize(Asm* as) {
+    /* Register tracking assumes every branch lands on a label; a computed
+     * target such as "$-6" could enter a block anywhere */
+    int labels_only = 1;
+    for (size_t i = 0; i < as->nitems; i++) {
+        Item* it = &as->items[i];
+        if (it->kind == ITEM_INSN && (it->def->form == FORM_A || it->def->form == FORM_RA) &&
+            !bare_label(as, it->expr)) {
+            labels_only = 0;
+        }
+    }
+    
+    for (int round = 0; round < ASM_MAX_ROUNDS; round++) {
+        int changed = 0;
+        if (labels_only) {
+            changed |= peep_constants(as);
+            changed |= peep_dead_movi(as);
+        }
+        changed |= peep_jumps(as);
+        if (!changed) break;
+    }
+    peep_encodings(as);
+}
+
+/* ---- Layout and encoding ---- */
+
+static uint64_t insn_size(const Asm* as, uint8_t opcode) {
+    if (as->isa == ISA_VM) {
+        switch (opcode) {
+            case OP_HALT: case OP_RET: return 1;
+            case OP_NOT: case OP_OUT: case OP_IN: case OP_PUSH: case OP_POP: return 2;
+            case OP_JMP: case OP_CALL: return 3;
+            case OP_LOAD: case OP_STORE:
+            case OP_JNZ: case OP_JZ: case OP_JLT: case OP_JGT: return 4;
+            case OP_MOVI: case OP_LOADX: case OP_STOREX: return 6;
+            default: return 3;                 /* Register-register ALU, SHL/SHR */
+        }
+    }
+    switch (opcode) {
+        case X64_HALT: case X64_NOP: case X64_SYSCALL: return 1;
+        case X64_OUT: case X64_PUSH: case X64_POP: return 2;
+        case X64_ADD: case X64_SUB: return 3;
+        case X64_JMP: return 9;
+        case X64_MOVI: case X64_LOAD: case X64_STORE: return 10;
+        case X64_VLOAD: case X64_VSTORE: return 11;
+        case X64_LOADX: case X64_STOREX: return 12;
+        default: return 4;                     /* Vector register ops */
+    }
+}
+
+/* Assign addresses. Returns the end address. */
+static uint64_t layout(Asm* as) {
+    uint64_t pc = as->base;
+    for (size_t i = 0; i < as->nitems; i++) {
+        Item* it = &as->items[i];
+        it->addr = pc;
+        if (it->deleted) {
+            it->size = 0;
+            continue;
+        }
+        uint64_t v;
+        switch (it->kind) {
+            case ITEM_LABEL:
+                it->label->value = pc;
+                break;
+            case ITEM_INSN:
+                it->size = insn_size(as, it->opcode);
+                break;
+            case ITEM_ORG:
+                if (eval_expr(as, it, it->expr, &v, 0) != EVAL_OK || v < pc) {
+                    if (!as->layout_done) break;
+                    asm_error(as, it->file, it->line, v < pc ?
+                              ".org 0x%llX is behind 0x%llX" : "bad .org",
+                              (unsigned long long)v, (unsigned long long)pc);
+                    break;
+                }
+                it->size = v - pc;
+                break;
+            case ITEM_ALIGN:
+                if (eval_expr(as, NULL, it->expr, &v, 0) != EVAL_OK || v == 0 ||
+                    (v & (v - 1))) {
+                    if (as->layout_done) {
+                        asm_error(as, it->file, it->line, ".align needs a power of two");
+                    }
+                    break;
+                }
+                it->size = (v - (pc & (v - 1))) & (v - 1);
+                break;
+            case ITEM_SPACE:
+                if (eval_expr(as, NULL, it->expr, &v, 0) != EVAL_OK) {
+                    if (as->layout_done) eval_expr(as, it, it->expr, &v, 1);
+                    break;
+                }
+                it->size = v;
+                break;
+            default:
+                break;
+        }
+        pc += it->size;
+    }
+    return pc;
+}
+
+static void put_be(uint8_t* p, uint64_t v, int bytes) {
+    for (int i = bytes - 1; i >= 0; i--) {
+        p[i] = v & 0xFF;
+        v >>= 8;
+    }
+}
+
+/* Evaluate an operand and check it fits in bits (signed or unsigned) */
+static int operand(Asm* as, const Item* it, int bits, uint64_t* v) {
+    if (eval_expr(as, it, it->expr, v, 1) != EVAL_OK) return -1;
+    if (bits >= 64) return 0;
+    int64_t s = (int64_t)*v;
+    if (*v >> bits && (s < -((int64_t)1 << (bits - 1)) || s >= 0)) {
+        asm_error(as, it->file, it->line, "value 0x%llX does not fit in %d bits",
+                  (unsigned long long)*v, bits);
+        return -1;
+    }
+    return 0;
+}
+
+static void encode_insn(Asm* as, Item* it, uint8_t* out) {
+    uint64_t v = 0;
+    int vm = as->isa == ISA_VM;
+    int abits = vm ? 16 : 64;                  /* Address operands */
+    int r1 = it->r1 < 0 ? 0 : it->r1;
+    int r2 = it->r2 < 0 ? 0 : it->r2;
+    out[0] = it->opcode;
+    
+    switch (it->def->form) {
+        case FORM_NONE:
+            break;
+        case FORM_R:
+            out[1] = (uint8_t)r1;
+            break;
+        case FORM_RR:
+            out[1] = (uint8_t)r1;
+            out[2] = (uint8_t)r2;
+            break;
+        case FORM_RI:
+            out[1] = (uint8_t)r1;
+            if (operand(as, it, vm ? 32 : 64, &v) == 0) put_be(out + 2, v, vm ? 4 : 8);
+            break;
+        case FORM_RS:
+            out[1] = (uint8_t)r1;
+            if (operand(as, it, 8, &v) == 0) {
+                if (v >= 64) asm_error(as, it->file, it->line, "shift count %llu >= 64",
+                                       (unsigned long long)v);
+                out[2] = (uint8_t)v;
+            }
+            break;
+        case FORM_A:
+            if (operand(as, it, abits, &v) == 0) put_be(out + 1, v, vm ? 2 : 8);
+            break;
+        case FORM_RA:
+            out[1] = (uint8_t)r1;
+            if (operand(as, it, abits, &v) == 0) put_be(out + 2, v, 2);
+            break;
+        case FORM_MEM:
+            if (operand(as, it, abits, &v) != 0) break;
+            if (is_op(as, it, OP_LOAD, X64_LOAD) || is_op(as, it, OP_STORE, X64_STORE)) {
+                out[1] = (uint8_t)r1;
+                put_be(out + 2, v, vm ? 2 : 8);
+            } else {
+                out[1] = it->amode;
+                out[2] = (uint8_t)r1;
+                out[3] = (uint8_t)r2;
+                put_be(out + 4, v, vm ? 2 : 8);
+            }
+            break;
+        case FORM_VMEM:
+            out[1] = it->shape;
+            out[2] = (uint8_t)r1;
+            if (operand(as, it, 64, &v) == 0) put_be(out + 3, v, 8);
+            break;
+        case FORM_VV:
+        case FORM_VR:
+        case FORM_RV:
+            out[1] = it->shape;
+            out[2] = (uint8_t)r1;
+            out[3] = (uint8_t)r2;
+            break;
+    }
+}
+
+static uint8_t* assemble(Asm* as, uint64_t end) {
+    uint64_t size = end - as->base;
+    uint8_t* image = (uint8_t*)xmalloc((size_t)size);
+    memset(image, 0, (size_t)size);
+    
+    for (size_t i = 0; i < as->nitems; i++) {
+        Item* it = &as->items[i];
+        if (it->deleted || it->size == 0) continue;
+        uint8_t* out = image + (it->addr - as->base);
+        uint64_t v;
+        switch (it->kind) {
+            case ITEM_INSN:
+                encode_insn(as, it, out);
+                break;
+            case ITEM_DATA:
+                if (operand(as, it, it->unit * 8, &v) == 0) put_be(out, v, it->unit);
+                break;
+            case ITEM_BYTES:
+                memcpy(out, it->bytes, (size_t)it->size);
+                break;
+            case ITEM_SPACE:
+                if (eval_expr(as, it, it->fill, &v, 1) == EVAL_OK) {
+                    memset(out, (int)(v & 0xFF), (size_t)it->size);
+                }
+                break;
+            default:
+                break;
+        }
+    }
+    return image;
+}
+
+static int symbol_cmp(const void* a, const void* b) {
+    const Symbol* x = *(const Symbol* const*)a;
+    const Symbol* y = *(const Symbol* const*)b;
+    if (x->kind != y->kind) return x->kind == SYM_LABEL ? -1 : 1;
+    if (x->value != y->value) return x->value < y->value ? -1 : 1;
+    return strcmp(x->name, y->name);
+}
+
+static int write_map(Asm* as, const char* path, const char* source) {
+    FILE* f = fopen(path, "w");
+    if (!f) return -1;
+    
+    size_t count = 0;
+    for (int h = 0; h < ASM_HASH_SIZE; h++) {
+        for (Symbol* s = as->symbols[h]; s; s = s->next) count++;
+    }
+    Symbol** all = (Symbol**)xmalloc(count * sizeof(Symbol*));
+    count = 0;
+    for (int h = 0; h < ASM_HASH_SIZE; h++) {
+        for (Symbol* s = as->symbols[h]; s; s = s->next) {
+            if (s->kind == SYM_CONST && eval_expr(as, NULL, s->expr, &s->value, 0) != EVAL_OK) {
+                continue;
+            }
+            all[count++] = s;
+        }
+    }
+    qsort(all, count, sizeof(Symbol*), symbol_cmp);
+    
+    fprintf(f, "; vmasm symbol map for %s (isa %s, base 0x%llX)\n", source,
+            as->isa == ISA_VM ? "vm" : "vm64", (unsigned long long)as->base);
+    int consts = 0;
+    for (size_t i = 0; i < count; i++) {
+        if (all[i]->kind == SYM_CONST && !consts++) fprintf(f, "; constants\n");
+        fprintf(f, "0x%08llX  %s\n", (unsigned long long)all[i]->value, all[i]->name);
+    }
+    free(all);
+    fclose(f);
+    return 0;
+}
+
+static void print_usage(const char* prog) {
+    printf("Usage: %s [options] source.s\n", prog);
+    printf("  -o <file>       - Output image (default: source with .bin)\n");
+    printf("  -m <file>       - Also write a symbol map\n");
+    printf("  --isa <vm|vm64> - Target ISA (default vm, or .isa in the source)\n");
+    printf("  --base <addr>   - VM64 load address (default 0x400000, or .base)\n");
+    printf("  -O0             - Disable the peephole optimizer\n");
+    printf("  --stats         - Report what the optimizer changed\n");
+    printf("\nSyntax: 'label:', 'NAME = expr' or '.equ NAME, expr', '.macro name\n");
+    printf("args' ... '.endm' (\\arg, \\@), '.include \"file\"', '.byte/.word/.dword/\n");
+    printf(".qword', '.ascii/.asciz', '.space n[, fill]', '.org', '.align'.\n");
+    printf("Memory operands: [addr], [reg] or [reg +/- disp]; LOAD.W etc. pick the\n");
+    printf("width. Comments start with ';'.\n");
+}
+
+int main(int argc, char* argv[]) {
+    const char* source = NULL;
+    const char* out_path = NULL;
+    const char* map_path = NULL;
+    const char* isa_arg = NULL;
+    const char* base_arg = NULL;
+    int optimize_on = 1, stats = 0;
+    
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-o") == 0 && i + 1 < argc) {
+            out_path = argv[++i];
+        } else if (strcmp(argv[i], "-m") == 0 && i + 1 < argc) {
+            map_path = argv[++i];
+        } else if (strcmp(argv[i], "--isa") == 0 && i + 1 < argc) {
+            isa_arg = argv[++i];
+        } else if (strcmp(argv[i], "--base") == 0 && i + 1 < argc) {
+            base_arg = argv[++i];
+        } else if (strcmp(argv[i], "-O0") == 0) {
+            optimize_on = 0;
+        } else if (strcmp(argv[i], "-O") == 0 || strcmp(argv[i], "-O1") == 0) {
+            optimize_on = 1;
+        } else if (strcmp(argv[i], "--stats") == 0) {
+            stats = 1;
+        } else if (strcmp(argv[i], "-h") == 0 || strcmp(argv[i], "--help") == 0) {
+            print_usage(argv[0]);
+            return EXIT_SUCCESS;
+        } else if (argv[i][0] == '-' && argv[i][1] != '\0') {
+            fprintf(stderr, "Unknown option: %s\n", argv[i]);
+            return EXIT_FAILURE;
+        } else {
+            source = argv[i];
+        }
+    }
+    if (!source) {
+        print_usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+    
+    static Asm as;
+    as.isa = ISA_VM;
+    if (isa_arg) {
+        if (strcmp(isa_arg, "vm64") == 0) as.isa = ISA_VM64;
+        else if (strcmp(isa_arg, "vm") != 0) {
+            fprintf(stderr, "Unknown ISA: %s (vm or vm64)\n", isa_arg);
+            return EXIT_FAILURE;
+        }
+        as.isa_fixed = 1;
+    }
+    
+    if (read_source(&as, source, 0) != 0) {
+        fprintf(stderr, "Cannot read %s\n", source);
+        return EXIT_FAILURE;
+    }
+    for (size_t i = 0; i < as.nlines; i++) parse_line(&as, &as.lines[i]);
+    if (!as.base_set) as.base = as.isa == ISA_VM64 ? 0x400000 : 0;
+    if (base_arg) {
+        if (as.isa == ISA_VM) {
+            fprintf(stderr, "--base only applies to vm64 images\n");
+            return EXIT_FAILURE;
+        }
+        as.base = strtoull(base_arg, NULL, 16);
+    }
+    if (as.errors) return EXIT_FAILURE;
+    
+    uint64_t before = layout(&as) - as.base;
+    if (optimize_on) optimize(&as);
+    as.layout_done = 1;
+    uint64_t end = layout(&as);
+    if (as.isa == ISA_VM && end > VM_RAM_SIZE) {
+        fprintf(stderr, "%s: image is %llu bytes, more than the VM's 64 KB\n", source,
+                (unsigned long long)end);
+        return EXIT_FAILURE;
+    }
+    uint8_t* image = assemble(&as, end);
+    if (as.errors) return EXIT_FAILURE;
+    
+    char default_out[1024];
+    if (!out_path) {
+        const char* dot = strrchr(source, '.');
+        const char* slash = strrchr(source, '/');
+        int stem = dot && (!slash || dot > slash) ? (int)(dot - source) : (int)strlen(source);
+        snprintf(default_out, sizeof(default_out), "%.*s.bin", stem, source);
+        out_path = default_out;
+    }
+    FILE* f = fopen(out_path, "wb");
+    if (!f || fwrite(image, 1, (size_t)(end - as.base), f) != end - as.base) {
+        fprintf(stderr, "Cannot write %s\n", out_path);
+        if (f) fclose(f);
+        return EXIT_FAILURE;
+    }
+    fclose(f);
+    if (map_path && write_map(&as, map_path, source) != 0) {
+        fprintf(stderr, "Cannot write %s\n", map_path);
+        return EXIT_FAILURE;
+    }
+    
+    printf("Assembled %s -> %s (%llu bytes, %s", source, out_path,
+           (unsigned long long)(end - as.base), as.isa == ISA_VM ? "vm" : "vm64");
+    if (as.isa == ISA_VM64) printf(", load at 0x%llX", (unsigned long long)as.base);
+    printf(")\n");
+    if (stats) {
+        printf("Peephole: %d MOVI removed, %d folded, %d jumps threaded, "
+               "%d jumps dropped, %d shorter encodings; %llu -> %llu bytes\n",
+               as.removed_movi, as.folded, as.threaded, as.dropped_jumps, as.shortened,
+               (unsigned long long)before, (unsigned long long)(end - as.base));
+    }
+    free(image);
+    return EXIT_SUCCESS;
+}
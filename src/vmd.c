@@ -0,0 +1,626 @@
+#define _GNU_SOURCE
+#include "vm.h"
+#include "vm64.h"
+#include "vmd.h"
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/un.h>
+
+#ifdef __APPLE__
+#define SYS_write 4
+#define SYS_read 3
+#define SYS_open 2
+#define SYS_close 6
+#define SYS_lseek 19
+#endif
+
+/* Emulator daemon. Pools of VM and VM64 instances are allocated and reset
+ * at start, and jobs from a Unix socket run on them, so a job pays no
+ * process start-up, RAM allocation or zeroing. Each connection gets a
+ * thread; the size of a pool bounds how many jobs of its ISA run at once.
+ * An instance is reset after its reply has gone out, off the job's path. */
+
+#define VMD_VM_POOL 4
+#define VMD_VM64_POOL 2
+#define VMD_MAX_INPUT (64 * 1024 * 1024)
+#define VMD_SLICE 1000000                  /* Instructions between limit checks */
+#define VMD_OUT_BUF 4096
+#define VMD_MAX_FILES 16                   /* Host files a VM64 job may hold open */
+
+/* Ready instances of one ISA */
+typedef struct {
+    void** free;
+    int nfree, size;
+    uint64_t jobs, waited;                 /* Jobs served, and how many waited */
+    pthread_mutex_t lock;
+    pthread_cond_t ready;
+} VmdPool;
+
+typedef struct {
+    VmdPool vm, vm64;
+    const char* path;
+    int quit;
+    int active;                            /* Connections being served */
+    pthread_mutex_t lock;
+    pthread_cond_t idle;
+} Vmd;
+
+/* One run. Guest output is buffered on its way to the connection. */
+typedef struct {
+    int fd;
+    uint8_t out[VMD_OUT_BUF];
+    size_t out_len;
+    int broken;                            /* Client went away */
+    const uint8_t* input;
+    size_t input_len, input_pos;
+    int files[VMD_MAX_FILES];              /* Host fds the guest opened */
+    int nfiles;
+} VmdJob;
+
+/* A parsed RUN request */
+typedef struct {
+    int vm64;
+    const char* image;                     /* Path, or NULL for inline bytes */
+    size_t size, input;
+    uint64_t addr, max_insns, timeout_ms;
+} VmdRequest;
+
+typedef struct {
+    Vmd* vmd;
+    int fd;
+} VmdConn;
+
+static uint64_t vmd_now_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000u + (uint64_t)ts.tv_nsec / 1000u;
+}
+
+static int vmd_write_all(int fd, const void* buf, size_t len) {
+    const uint8_t* p = (const uint8_t*)buf;
+    while (len > 0) {
+        ssize_t n = write(fd, p, len);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return -1;
+        p += n;
+        len -= (size_t)n;
+    }
+    return 0;
+}
+
+static int vmd_read_all(int fd, void* buf, size_t len) {
+    uint8_t* p = (uint8_t*)buf;
+    while (len > 0) {
+        ssize_t n = read(fd, p, len);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return -1;
+        p += n;
+        len -= (size_t)n;
+    }
+    return 0;
+}
+
+/* Read the request line byte by byte, leaving the payload in the fd */
+static int vmd_read_line(int fd, char* buf, size_t size) {
+    size_t len = 0;
+    while (len + 1 < size) {
+        char c;
+        ssize_t n = read(fd, &c, 1);
+        if (n <= 0) {
+            if (len == 0) return -1;
+            break;
+        }
+        if (c == '\n') break;
+        buf[len++] = c;
+    }
+    buf[len] = '\0';
+    return (int)len;
+}
+
+/* --- Pools --- */
+
+static int pool_init(VmdPool* pool, int size, int vm64) {
+    memset(pool, 0, sizeof(*pool));
+    pool->free = (void**)calloc((size_t)(size > 0 ? size : 1), sizeof(void*));
+    if (!pool->free) return -1;
+    pool->size = size;
+    for (int i = 0; i < size; i++) {
+        void* inst = vm64 ? (void*)vm64_create() : (void*)vm_create();
+        if (!inst) return -1;
+        pool->free[pool->nfree++] = inst;
+    }
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->ready, NULL);
+    return 0;
+}
+
+static void* pool_take(VmdPool* pool, uint64_t* wait_us) {
+    uint64_t start = vmd_now_us();
+    pthread_mutex_lock(&pool->lock);
+    if (pool->nfree == 0) pool->waited++;
+    while (pool->nfree == 0) pthread_cond_wait(&pool->ready, &pool->lock);
+    void* inst = pool->free[--pool->nfree];
+    pool->jobs++;
+    pthread_mutex_unlock(&pool->lock);
+    *wait_us = vmd_now_us() - start;
+    return inst;
+}
+
+static void pool_give(VmdPool* pool, void* inst) {
+    pthread_mutex_lock(&pool->lock);
+    pool->free[pool->nfree++] = inst;
+    pthread_cond_signal(&pool->ready);
+    pthread_mutex_unlock(&pool->lock);
+}
+
+/* --- Guest I/O --- */
+
+static void job_flush(VmdJob* job) {
+    if (!job->broken && job->out_len && vmd_write_all(job->fd, job->out, job->out_len) != 0) {
+        job->broken = 1;
+    }
+    job->out_len = 0;
+}
+
+static void job_put(VmdJob* job, const uint8_t* buf, size_t len) {
+    while (len > 0) {
+        size_t n = VMD_OUT_BUF - job->out_len;
+        if (n > len) n = len;
+        memcpy(job->out + job->out_len, buf, n);
+        job->out_len += n;
+        buf += n;
+        len -= n;
+        if (job->out_len == VMD_OUT_BUF) job_flush(job);
+    }
+}
+
+static size_t job_get(VmdJob* job, uint8_t* buf, size_t len) {
+    size_t left = job->input_len - job->input_pos;
+    if (len > left) len = left;
+    memcpy(buf, job->input + job->input_pos, len);
+    job->input_pos += len;
+    return len;
+}
+
+static void vmd_vm_output(void* ctx, uint8_t byte) {
+    job_put((VmdJob*)ctx, &byte, 1);
+}
+
+static int vmd_vm_input(void* ctx) {
+    uint8_t c;
+    return job_get((VmdJob*)ctx, &c, 1) ? c : -1;
+}
+
+/* fds 0-2 are the job's, in their own direction only (EBADF otherwise);
+ * others were opened by the guest (see vmd_syscall) */
+static long vmd_vm64_write(void* user, int fd, const uint8_t* buf, size_t len) {
+    if (fd == STDIN_FILENO) return -1;
+    if (fd != STDOUT_FILENO && fd != STDERR_FILENO) return (long)write(fd, buf, len);
+    job_put((VmdJob*)user, buf, len);
+    return (long)len;
+}
+
+static long vmd_vm64_read(void* user, int fd, uint8_t* buf, size_t len) {
+    if (fd == STDOUT_FILENO || fd == STDERR_FILENO) return -1;
+    if (fd != STDIN_FILENO) return (long)read(fd, buf, len);
+    return (long)job_get((VmdJob*)user, buf, len);
+}
+
+static int job_owns(const VmdJob* job, int fd) {
+    for (int i = 0; i < job->nfiles; i++) {
+        if (job->files[i] == fd) return i;
+    }
+    return -1;
+}
+
+/* Syscalls are trapped so a guest only reaches the host fds it opened
+ * itself, never the daemon's sockets or stdio */
+static void vmd_syscall(VM64* vm, VmdJob* job) {
+    uint64_t id = vm->regs[RAX];
+    int fd = (int)vm->regs[RDI];
+    int owned = job_owns(job, fd);
+    
+    switch (id) {
+        case SYS_read:
+        case SYS_write:
+        case SYS_lseek:
+            if ((fd < 0 || fd > STDERR_FILENO) && owned < 0) {
+                vm->regs[RAX] = (uint64_t)-1;
+                return;
+            }
+            if (fd <= STDERR_FILENO && id == SYS_lseek) {
+                vm->regs[RAX] = (uint64_t)-1;
+                return;
+            }
+            break;
+        case SYS_close:
+            if (owned < 0) {
+                vm->regs[RAX] = fd >= 0 && fd <= STDERR_FILENO ? 0 : (uint64_t)-1;
+                return;
+            }
+            job->files[owned] = job->files[--job->nfiles];
+            break;
+        case SYS_open:
+            vm64_syscall_handler(vm);
+            fd = (int)vm->regs[RAX];
+            if (fd >= 0 && job->nfiles == VMD_MAX_FILES) {
+                close(fd);
+                vm->regs[RAX] = (uint64_t)-1;
+            } else if (fd >= 0) {
+                job->files[job->nfiles++] = fd;
+            }
+            return;
+        default:
+            break;
+    }
+    vm64_syscall_handler(vm);
+}
+
+/* --- Jobs --- */
+
+static int vmd_past(uint64_t deadline) {
+    return deadline && vmd_now_us() >= deadline;
+}
+
+/* A client that closed its connection cancels the job, even a silent one.
+ * POLLHUP needs both directions closed, so a half-close still runs. */
+static int vmd_hung_up(VmdJob* job) {
+    struct pollfd pfd = {job->fd, 0, 0};
+    if (poll(&pfd, 1, 0) > 0 && (pfd.revents & (POLLHUP | POLLERR))) job->broken = 1;
+    return job->broken;
+}
+
+/* Returns 1 if the guest halted, 0 if a limit stopped it */
+static int vmd_run_vm(VM* vm, VmdJob* job, const VmdRequest* req, uint64_t deadline) {
+    vm_set_output(vm, vmd_vm_output, job);
+    vm_set_input(vm, vmd_vm_input, job);
+    while (!vm->halted && !vmd_hung_up(job) && !vmd_past(deadline)) {
+        uint64_t n = VMD_SLICE;
+        if (req->max_insns) {
+            if (vm->cycle_count >= req->max_insns) break;
+            if (n > req->max_insns - vm->cycle_count) n = req->max_insns - vm->cycle_count;
+        }
+        for (uint64_t i = 0; i < n && !vm->halted; i++) vm_execute_one(vm);
+    }
+    return vm->halted;
+}
+
+static int vmd_run_vm64(VM64* vm, VmdJob* job, const VmdRequest* req, uint64_t deadline) {
+    vm64_set_io(vm, vmd_vm64_write, vmd_vm64_read, job);
+    vm->trap_syscalls = 1;
+    while (!vm->halted && !vmd_hung_up(job) && !vmd_past(deadline)) {
+        uint64_t n = VMD_SLICE;
+        if (req->max_insns) {
+            if (vm->instruction_count >= req->max_insns) break;
+            if (n > req->max_insns - vm->instruction_count) {
+                n = req->max_insns - vm->instruction_count;
+            }
+        }
+        VM64Exit reason = vm64_run_budget(vm, n);
+        if (reason == VM64_EXIT_SYSCALL) vmd_syscall(vm, job);
+        else if (reason != VM64_EXIT_BUDGET) break;
+    }
+    for (int i = 0; i < job->nfiles; i++) close(job->files[i]);
+    return vm->halted;
+}
+
+/* Back to the state a fresh instance has */
+static void vmd_reset_vm(VM* vm) {
+    vm_reset(vm);
+    vm_set_output(vm, NULL, NULL);
+    vm_set_input(vm, NULL, NULL);
+}
+
+static void vmd_reset_vm64(VM64* vm) {
+    vm64_reset(vm);
+    vm64_set_io(vm, NULL, NULL, NULL);
+    vm->io_flush = NULL;
+    vm->trap_syscalls = 0;
+    vm->max_insns = 0;
+    vm->breakpoint_count = 0;
+}
+
+static void vmd_reply_error(int fd, const char* error) {
+    dprintf(fd, "%sstatus=error insns=0 us=0 wait_us=0 error=%.160s\n", VMD_TRAILER, error);
+}
+
+/* Parse "RUN <isa> key=value..."; returns NULL or an error message */
+static const char* vmd_parse(char* line, VmdRequest* req) {
+    memset(req, 0, sizeof(*req));
+    req->addr = 0x400000;
+    char* p = line + 3;
+    while (*p == ' ') p++;
+    if (strncmp(p, "vm64", 4) == 0 && (p[4] == ' ' || p[4] == '\0')) {
+        req->vm64 = 1;
+        p += 4;
+    } else if (strncmp(p, "vm", 2) == 0 && (p[2] == ' ' || p[2] == '\0')) {
+        p += 2;
+    } else {
+        return "unknown ISA (vm or vm64)";
+    }
+    
+    while (*p) {
+        while (*p == ' ') p++;
+        if (!*p) break;
+        if (strncmp(p, "image=", 6) == 0) {
+            req->image = p + 6;
+            break;
+        }
+        char* end = strchr(p, ' ');
+        if (end) *end = '\0';
+        if (strncmp(p, "size=", 5) == 0) req->size = strtoull(p + 5, NULL, 0);
+        else if (strncmp(p, "input=", 6) == 0) req->input = strtoull(p + 6, NULL, 0);
+        else if (strncmp(p, "addr=", 5) == 0) req->addr = strtoull(p + 5, NULL, 16);
+        else if (strncmp(p, "max-insns=", 10) == 0) req->max_insns = strtoull(p + 10, NULL, 0);
+        else if (strncmp(p, "timeout=", 8) == 0) req->timeout_ms = strtoull(p + 8, NULL, 0);
+        else return "unknown key";
+        p = end ? end + 1 : p + strlen(p);
+    }
+    
+    size_t limit = req->vm64 ? VM64_RAM_SIZE : VM_RAM_SIZE;
+    if (!req->image && (req->size == 0 || req->size > limit)) return "bad image size";
+    if (req->input > VMD_MAX_INPUT) return "input too large";
+    return NULL;
+}
+
+/* Read a whole image file, at most limit bytes of it like the loaders */
+static uint8_t* vmd_read_file(const char* path, size_t limit, size_t* size) {
+    FILE* f = fopen(path, "rb");
+    if (!f) return NULL;
+    uint8_t* data = (uint8_t*)malloc(limit);
+    *size = data ? fread(data, 1, limit, f) : 0;
+    fclose(f);
+    if (*size == 0) {
+        free(data);
+        return NULL;
+    }
+    return data;
+}
+
+static void vmd_run(Vmd* vmd, int fd, char* line) {
+    VmdRequest req;
+    const char* error = vmd_parse(line, &req);
+    if (error) {
+        vmd_reply_error(fd, error);
+        return;
+    }
+    
+    /* Payload first, so the instance is held only while running */
+    uint8_t* input = (uint8_t*)malloc(req.input ? req.input : 1);
+    uint8_t* image = NULL;
+    size_t size = req.size;
+    if (!input || vmd_read_all(fd, input, req.input) != 0) {
+        free(input);
+        return;
+    }
+    if (req.image) {
+        image = vmd_read_file(req.image, req.vm64 ? VM64_RAM_SIZE : VM_RAM_SIZE, &size);
+        if (!image) error = "cannot read image";
+    } else {
+        image = (uint8_t*)malloc(size);
+        if (!image || vmd_read_all(fd, image, size) != 0) {
+            free(image);
+            free(input);
+            return;
+        }
+    }
+    if (error) {
+        vmd_reply_error(fd, error);
+        free(input);
+        return;
+    }
+    
+    VmdJob job;
+    memset(&job, 0, sizeof(job));
+    job.fd = fd;
+    job.input = input;
+    job.input_len = req.input;
+    
+    VmdPool* pool = req.vm64 ? &vmd->vm64 : &vmd->vm;
+    uint64_t wait_us;
+    void* inst = pool_take(pool, &wait_us);
+    uint64_t start = vmd_now_us();
+    uint64_t deadline = req.timeout_ms ? start + req.timeout_ms * 1000 : 0;
+    uint64_t insns = 0;
+    int halted = 0;
+    
+    if (req.vm64) {
+        VM64* vm = (VM64*)inst;
+        if (vm64_load_buffer(vm, image, size, req.addr) != 0) {
+            error = "image does not fit at load address";
+        } else {
+            halted = vmd_run_vm64(vm, &job, &req, deadline);
+            insns = vm->instruction_count;
+        }
+    } else {
+        VM* vm = (VM*)inst;
+        memcpy(vm->ram, image, size);
+        halted = vmd_run_vm(vm, &job, &req, deadline);
+        insns = vm->cycle_count;
+    }
+    
+    uint64_t us = vmd_now_us() - start;
+    job_flush(&job);
+    if (error) {
+        vmd_reply_error(fd, error);
+    } else if (!job.broken) {
+        dprintf(fd, "%sstatus=%s insns=%llu us=%llu wait_us=%llu\n", VMD_TRAILER,
+                halted ? "halted" : "limit", (unsigned long long)insns,
+                (unsigned long long)us, (unsigned long long)wait_us);
+    }
+    shutdown(fd, SHUT_WR);
+    
+    if (req.vm64) vmd_reset_vm64((VM64*)inst);
+    else vmd_reset_vm((VM*)inst);
+    pool_give(pool, inst);
+    free(image);
+    free(input);
+}
+
+static void vmd_stats(Vmd* vmd, int fd) {
+    VmdPool* pools[2] = {&vmd->vm, &vmd->vm64};
+    int nfree[2];
+    uint64_t jobs[2], waited[2];
+    for (int i = 0; i < 2; i++) {
+        pthread_mutex_lock(&pools[i]->lock);
+        nfree[i] = pools[i]->nfree;
+        jobs[i] = pools[i]->jobs;
+        waited[i] = pools[i]->waited;
+        pthread_mutex_unlock(&pools[i]->lock);
+    }
+    dprintf(fd, "#vmd-stats vm=%d/%d vm64=%d/%d jobs=%llu/%llu waited=%llu/%llu\n",
+            nfree[0], vmd->vm.size, nfree[1], vmd->vm64.size,
+            (unsigned long long)jobs[0], (unsigned long long)jobs[1],
+            (unsigned long long)waited[0], (unsigned long long)waited[1]);
+}
+
+/* Wake the accept() in main by connecting to ourselves */
+static void vmd_wake(const char* path) {
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) return;
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+    connect(fd, (struct sockaddr*)&addr, sizeof(addr));
+    close(fd);
+}
+
+static void* vmd_serve(void* arg) {
+    VmdConn* conn = (VmdConn*)arg;
+    Vmd* vmd = conn->vmd;
+    char line[4352];                       /* Room for a PATH_MAX image path */
+    
+    if (vmd_read_line(conn->fd, line, sizeof(line)) >= 0) {
+        if (strncmp(line, "RUN", 3) == 0) {
+            vmd_run(vmd, conn->fd, line);
+        } else if (strncmp(line, "STATS", 5) == 0) {
+            vmd_stats(vmd, conn->fd);
+        } else if (strncmp(line, "QUIT", 4) == 0) {
+            __atomic_store_n(&vmd->quit, 1, __ATOMIC_RELEASE);
+            vmd_wake(vmd->path);
+        } else {
+            vmd_reply_error(conn->fd, "bad request");
+        }
+    }
+    close(conn->fd);
+    free(conn);
+    
+    pthread_mutex_lock(&vmd->lock);
+    if (--vmd->active == 0) pthread_cond_signal(&vmd->idle);
+    pthread_mutex_unlock(&vmd->lock);
+    return NULL;
+}
+
+static void print_usage(const char* prog) {
+    printf("Usage: %s [options]\n", prog);
+    printf("  --socket <path> - Listen on <path> (default $%s or /tmp/vmd-<uid>.sock)\n",
+           VMD_SOCKET_ENV);
+    printf("  --vm <n>        - 8-bit VM instances kept ready (default %d)\n", VMD_VM_POOL);
+    printf("  --vm64 <n>      - VM64 instances kept ready (default %d)\n", VMD_VM64_POOL);
+}
+
+int main(int argc, char* argv[]) {
+    char default_path[64];
+    const char* path = vmd_socket_path(default_path, sizeof(default_path));
+    int nvm = VMD_VM_POOL, nvm64 = VMD_VM64_POOL;
+    
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--socket") == 0 && i + 1 < argc) {
+            path = argv[++i];
+        } else if (strcmp(argv[i], "--vm") == 0 && i + 1 < argc) {
+            nvm = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--vm64") == 0 && i + 1 < argc) {
+            nvm64 = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--help") == 0 || strcmp(argv[i], "-h") == 0) {
+            print_usage(argv[0]);
+            return EXIT_SUCCESS;
+        } else {
+            fprintf(stderr, "Unknown option: %s\n", argv[i]);
+            print_usage(argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+    if (!path || nvm < 1 || nvm64 < 1) {
+        fprintf(stderr, "vmd: need a socket path and at least one instance per pool\n");
+        return EXIT_FAILURE;
+    }
+    
+    Vmd vmd;
+    memset(&vmd, 0, sizeof(vmd));
+    vmd.path = path;
+    pthread_mutex_init(&vmd.lock, NULL);
+    pthread_cond_init(&vmd.idle, NULL);
+    if (pool_init(&vmd.vm, nvm, 0) != 0 || pool_init(&vmd.vm64, nvm64, 1) != 0) {
+        fprintf(stderr, "vmd: cannot allocate the VM pools\n");
+        return EXIT_FAILURE;
+    }
+    
+    int srv = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (srv < 0) {
+        perror("socket");
+        return EXIT_FAILURE;
+    }
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+    unlink(path);
+    if (bind(srv, (struct sockaddr*)&addr, sizeof(addr)) != 0 || listen(srv, 64) != 0) {
+        perror("bind");
+        close(srv);
+        return EXIT_FAILURE;
+    }
+    
+    /* A client that disconnects early must not kill the daemon */
+    signal(SIGPIPE, SIG_IGN);
+    fprintf(stderr, "vmd: listening on %s (%d VM, %d VM64)\n", path, nvm, nvm64);
+    
+    while (!__atomic_load_n(&vmd.quit, __ATOMIC_ACQUIRE)) {
+        int fd = accept(srv, NULL, NULL);
+        if (fd < 0) continue;
+        if (__atomic_load_n(&vmd.quit, __ATOMIC_ACQUIRE)) {
+            close(fd);
+            break;
+        }
+        
+        VmdConn* conn = (VmdConn*)malloc(sizeof(VmdConn));
+        pthread_t thread;
+        if (!conn) {
+            close(fd);
+            continue;
+        }
+        conn->vmd = &vmd;
+        conn->fd = fd;
+        pthread_mutex_lock(&vmd.lock);
+        vmd.active++;
+        pthread_mutex_unlock(&vmd.lock);
+        if (pthread_create(&thread, NULL, vmd_serve, conn) != 0) {
+            close(fd);
+            free(conn);
+            pthread_mutex_lock(&vmd.lock);
+            vmd.active--;
+            pthread_mutex_unlock(&vmd.lock);
+            continue;
+        }
+        pthread_detach(thread);
+    }
+    
+    /* Let running jobs finish */
+    close(srv);
+    unlink(path);
+    pthread_mutex_lock(&vmd.lock);
+    while (vmd.active > 0) pthread_cond_wait(&vmd.idle, &vmd.lock);
+    pthread_mutex_unlock(&vmd.lock);
+    fprintf(stderr, "vmd: stopped\n");
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,36 @@
+#ifndef VMD_H
+#define VMD_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+/* vmd request protocol (one request per connection):
+ *   RUN <vm|vm64> [key=value ...]\n
+ *       input=<n>       n bytes of guest stdin follow the line
+ *       size=<n>        n image bytes follow (after the input)
+ *       addr=<hex>      VM64 load address (default 400000)
+ *       max-insns=<n>   instruction limit
+ *       timeout=<ms>    wall-clock limit
+ *       image=<path>    image file read by the daemon; must come last,
+ *                       the path runs to the end of the line
+ *   STATS\n             reply with one #vmd-stats line
+ *   QUIT\n              stop the daemon
+ * A run streams raw guest output (stdout and stderr) followed by a
+ * trailer line:
+ *   #vmd-exit status=<halted|limit|error> insns=<n> us=<n> wait_us=<n>[ error=<text>]
+ */
+
+#define VMD_SOCKET_ENV "VMD_SOCKET"
+#define VMD_TRAILER "\n#vmd-exit "
+#define VMD_TRAILER_MAX 256                /* Longest trailer, leading newline included */
+
+/* $VMD_SOCKET, or /tmp/vmd-<uid>.sock; NULL when $VMD_SOCKET is empty */
+static inline const char* vmd_socket_path(char* buf, size_t size) {
+    const char* env = getenv(VMD_SOCKET_ENV);
+    if (env) return env[0] ? env : NULL;
+    snprintf(buf, size, "/tmp/vmd-%u.sock", (unsigned)getuid());
+    return buf;
+}
+
+#endif /* VMD_H */
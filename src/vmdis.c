@@ -0,0 +1,271 @@
+#include "vm.h"
+#include "vm64.h"
+#include "vm_cfg.h"
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Static disassembler for VM and VM64 images.
+ *
+ * Code is found by recursive descent from the entry points (vm_cfg), so
+ * data stays data. The listing labels every branch target and function and
+ * assembles back to the same bytes with vmasm -O0. */
+
+#define DIS_MAX_ENTRIES 64
+#define DIS_DATA_PER_LINE 8
+
+typedef struct {
+    const VMCfg* cfg;
+    uint64_t entry;
+    uint8_t* labelled;                     /* Per block: referenced by an edge */
+    int width;                             /* Hex digits in addresses */
+} Dis;
+
+static void block_label(const Dis* d, uint32_t b, char* out, size_t size) {
+    const VMCfgBlock* blk = &d->cfg->blocks[b];
+    if (blk->start == d->entry) snprintf(out, size, "start");
+    else if (blk->function == b) snprintf(out, size, "fn_%0*llX", d->width, (unsigned long long)blk->start);
+    else snprintf(out, size, "L_%0*llX", d->width, (unsigned long long)blk->start);
+}
+
+static int has_label(const Dis* d, uint32_t b) {
+    return d->labelled[b] || d->cfg->blocks[b].function == b;
+}
+
+/* One instruction; a branch target that has a label replaces the address */
+static void print_insn(const Dis* d, FILE* out, uint64_t pc, int* len) {
+    const VMCfg* cfg = d->cfg;
+    size_t off = (size_t)(pc - cfg->base);
+    char text[128];
+    *len = cfg->isa->disasm(cfg->image + off, cfg->size - off, text, sizeof(text));
+    
+    VMFlowInsn insn;
+    memset(&insn, 0, sizeof(insn));
+    cfg->isa->decode(cfg->image + off, cfg->size - off, &insn);
+    if (insn.flow == VM_FLOW_JUMP || insn.flow == VM_FLOW_BRANCH || insn.flow == VM_FLOW_CALL) {
+        int b = vm_cfg_block_start(cfg, insn.target);
+        char* operand = strrchr(text, ' ');
+        if (b >= 0 && operand && has_label(d, (uint32_t)b)) {
+            block_label(d, (uint32_t)b, operand + 1, sizeof(text) - (size_t)(operand + 1 - text));
+        }
+    }
+    fprintf(out, "        %-32s ; %0*llX\n", text, d->width, (unsigned long long)pc);
+}
+
+/* Bytes outside decoded code, as .byte lines with a printable preview */
+static void print_data(const Dis* d, FILE* out, uint64_t pc, uint64_t end) {
+    const VMCfg* cfg = d->cfg;
+    while (pc < end) {
+        char line[64] = "";
+        char preview[DIS_DATA_PER_LINE + 1];
+        size_t n = 0, used = 0;
+        for (; n < DIS_DATA_PER_LINE && pc + n < end; n++) {
+            uint8_t byte = cfg->image[pc + n - cfg->base];
+            used += (size_t)snprintf(line + used, sizeof(line) - used, "%s0x%02X", n ? ", " : "",
+                                     byte);
+            preview[n] = isprint(byte) ? (char)byte : '.';
+        }
+        preview[n] = '\0';
+        fprintf(out, "        .byte %-26s ; %0*llX  %s\n", line, d->width,
+                (unsigned long long)pc, preview);
+        pc += n;
+    }
+}
+
+static void print_listing(const Dis* d, FILE* out, const char* path) {
+    const VMCfg* cfg = d->cfg;
+    fprintf(out, "; vmdis %s: %s, %zu bytes, %llu in code\n", path, cfg->isa->name,
+            cfg->size, (unsigned long long)cfg->code_bytes);
+    fprintf(out, "; %u blocks, %u functions, %u loops", cfg->nblocks, cfg->nfunctions,
+            cfg->nloops);
+    if (cfg->overlaps) fprintf(out, ", %u jumps into instructions", cfg->overlaps);
+    fprintf(out, "\n; Reassemble with: vmasm -O0\n");
+    for (uint32_t l = 0; l < cfg->nloops; l++) {
+        const VMCfgLoop* loop = &cfg->loops[l];
+        char name[32];
+        block_label(d, loop->header, name, sizeof(name));
+        fprintf(out, ";   loop %-12s depth %u, %u blocks, %u back edge%s\n", name,
+                loop->depth, loop->nbody, loop->nback, loop->nback == 1 ? "" : "s");
+    }
+    fprintf(out, "\n.isa %s\n", cfg->isa->name);
+    if (strcmp(cfg->isa->name, "vm") != 0) {
+        fprintf(out, ".base 0x%llX\n", (unsigned long long)cfg->base);
+    }
+    
+    uint64_t pc = cfg->base, end = cfg->base + cfg->size;
+    uint32_t next_block = 0;
+    while (pc < end) {
+        if (next_block < cfg->nblocks && cfg->blocks[next_block].start == pc) {
+            uint32_t b = next_block++;
+            const VMCfgBlock* blk = &cfg->blocks[b];
+            uint8_t prev_flow = b ? cfg->blocks[b - 1].flow : VM_FLOW_HALT;
+            int boundary = b == 0 || cfg->blocks[b - 1].end != pc ||
+                           (prev_flow != VM_FLOW_NEXT && prev_flow != VM_FLOW_CALL &&
+                            prev_flow != VM_FLOW_TRAP);
+            if (has_label(d, b)) {
+                char name[32];
+                block_label(d, b, name, sizeof(name));
+                fprintf(out, "\n%s:", name);
+                int col = (int)strlen(name) + 1;
+                fprintf(out, "%*s;", col < 41 ? 41 - col : 1, "");
+                if (blk->function == b) fprintf(out, " function");
+                if (blk->loop >= 0 && cfg->loops[blk->loop].header == b) {
+                    fprintf(out, " loop header");
+                }
+                if (blk->loop_depth) fprintf(out, " depth %u", blk->loop_depth);
+                fprintf(out, " (block %u)\n", b);
+            } else if (boundary) {
+                fprintf(out, "\n");
+            }
+            for (uint64_t at = blk->start; at < blk->end;) {
+                int len;
+                print_insn(d, out, at, &len);
+                at += len > 0 ? (uint64_t)len : 1;
+            }
+            pc = blk->end;
+            continue;
+        }
+        
+        uint64_t data_end = next_block < cfg->nblocks ? cfg->blocks[next_block].start : end;
+        fprintf(out, "\n");
+        print_data(d, out, pc, data_end);
+        pc = data_end;
+    }
+}
+
+static int write_file(const char* path, const VMCfg* cfg,
+                      int (*writer)(const VMCfg*, FILE*)) {
+    FILE* f = fopen(path, "w");
+    if (!f) {
+        fprintf(stderr, "Error: Cannot create '%s'\n", path);
+        return -1;
+    }
+    int rc = writer(cfg, f);
+    if (fclose(f) != 0) rc = -1;
+    if (rc != 0) fprintf(stderr, "Error: Cannot write '%s'\n", path);
+    return rc;
+}
+
+static void print_usage(const char* prog) {
+    printf("Usage: %s [options] image.bin\n", prog);
+    printf("  --isa <vm|vm64> - Image ISA (default vm)\n");
+    printf("  --base <addr>   - VM64 load address in hex (default 0x400000)\n");
+    printf("  --entry <addr>  - Entry point in hex (default: load address; repeatable)\n");
+    printf("  -o <file>       - Write the listing to <file> instead of stdout\n");
+    printf("  --dot <file>    - Write the control-flow graph as Graphviz DOT\n");
+    printf("  --json <file>   - Write blocks, edges, functions and loops as JSON\n");
+    printf("  -q              - No listing (with --dot/--json)\n");
+}
+
+int main(int argc, char* argv[]) {
+    const char* image_path = NULL;
+    const char* out_path = NULL;
+    const char* dot_path = NULL;
+    const char* json_path = NULL;
+    const VMCfgIsa* isa = &vm_isa;
+    uint64_t base = 0x400000;
+    uint64_t entries[DIS_MAX_ENTRIES];
+    size_t nentries = 0;
+    int quiet = 0;
+    
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--isa") == 0 && i + 1 < argc) {
+            const char* name = argv[++i];
+            if (strcmp(name, "vm") == 0) isa = &vm_isa;
+            else if (strcmp(name, "vm64") == 0) isa = &vm64_isa;
+            else {
+                fprintf(stderr, "Unknown ISA: %s (vm or vm64)\n", name);
+                return EXIT_FAILURE;
+            }
+        } else if (strcmp(argv[i], "--base") == 0 && i + 1 < argc) {
+            base = strtoull(argv[++i], NULL, 16);
+        } else if (strcmp(argv[i], "--entry") == 0 && i + 1 < argc) {
+            if (nentries == DIS_MAX_ENTRIES) {
+                fprintf(stderr, "Too many entry points (max %d)\n", DIS_MAX_ENTRIES);
+                return EXIT_FAILURE;
+            }
+            entries[nentries++] = strtoull(argv[++i], NULL, 16);
+        } else if (strcmp(argv[i], "-o") == 0 && i + 1 < argc) {
+            out_path = argv[++i];
+        } else if (strcmp(argv[i], "--dot") == 0 && i + 1 < argc) {
+            dot_path = argv[++i];
+        } else if (strcmp(argv[i], "--json") == 0 && i + 1 < argc) {
+            json_path = argv[++i];
+        } else if (strcmp(argv[i], "-q") == 0) {
+            quiet = 1;
+        } else if (strcmp(argv[i], "--help") == 0 || strcmp(argv[i], "-h") == 0) {
+            print_usage(argv[0]);
+            return EXIT_SUCCESS;
+        } else if (argv[i][0] == '-') {
+            fprintf(stderr, "Unknown option: %s\n", argv[i]);
+            return EXIT_FAILURE;
+        } else {
+            image_path = argv[i];
+        }
+    }
+    if (!image_path) {
+        print_usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+    if (isa == &vm_isa) base = 0;
+    if (nentries == 0) entries[nentries++] = base;
+    
+    FILE* f = fopen(image_path, "rb");
+    if (!f) {
+        fprintf(stderr, "Error: Cannot open image '%s'\n", image_path);
+        return EXIT_FAILURE;
+    }
+    fseek(f, 0, SEEK_END);
+    long size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    uint64_t limit = isa == &vm_isa ? VM_RAM_SIZE : VM64_RAM_SIZE;
+    if (size <= 0 || base >= limit || (uint64_t)size > limit - base) {
+        fprintf(stderr, "Error: Image '%s' does not fit at 0x%llX\n", image_path,
+                (unsigned long long)base);
+        fclose(f);
+        return EXIT_FAILURE;
+    }
+    uint8_t* image = (uint8_t*)malloc((size_t)size);
+    if (!image || fread(image, 1, (size_t)size, f) != (size_t)size) {
+        fprintf(stderr, "Error: Cannot read image '%s'\n", image_path);
+        fclose(f);
+        return EXIT_FAILURE;
+    }
+    fclose(f);
+    
+    VMCfg* cfg = vm_cfg_build(isa, image, (size_t)size, base, entries, nentries, 0);
+    if (!cfg) {
+        fprintf(stderr, "Error: Out of memory\n");
+        return EXIT_FAILURE;
+    }
+    
+    Dis d;
+    d.cfg = cfg;
+    d.entry = entries[0];
+    d.width = isa == &vm_isa ? 4 : 6;
+    d.labelled = (uint8_t*)calloc(cfg->nblocks ? cfg->nblocks : 1, 1);
+    if (!d.labelled) return EXIT_FAILURE;
+    for (uint32_t e = 0; e < cfg->nedges; e++) {
+        if (cfg->edges[e].kind != VM_CFG_EDGE_FALL) d.labelled[cfg->edges[e].to] = 1;
+    }
+    
+    int status = EXIT_SUCCESS;
+    if (!quiet) {
+        FILE* out = out_path ? fopen(out_path, "w") : stdout;
+        if (!out) {
+            fprintf(stderr, "Error: Cannot create '%s'\n", out_path);
+            status = EXIT_FAILURE;
+        } else {
+            print_listing(&d, out, image_path);
+            if (out != stdout && fclose(out) != 0) status = EXIT_FAILURE;
+        }
+    }
+    if (dot_path && write_file(dot_path, cfg, vm_cfg_write_dot) != 0) status = EXIT_FAILURE;
+    if (json_path && write_file(json_path, cfg, vm_cfg_write_json) != 0) status = EXIT_FAILURE;
+    
+    free(d.labelled);
+    vm_cfg_free(cfg);
+    free(image);
+    return status;
+}
@@ -0,0 +1,636 @@
+#define _GNU_SOURCE
+#include "vm.h"
+#include "vm64.h"
+#include <dirent.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+
+#ifdef __APPLE__
+#define SYS_write 4
+#define SYS_read 3
+#define SYS_exit 1
+#define SYS_exit_group 231
+#define SYS_mmap 9
+#define SYS_brk 17
+#define SYS_munmap 11
+#endif
+
+/* Coverage-guided fuzzer for guest images, in the style of AFL.
+ *
+ * The guest runs in-process and persistently: one VM or VM64 is loaded
+ * once (optionally run up to --stop-at) and snapshotted, and every input
+ * restores only the RAM pages the previous run wrote before running
+ * again. Inputs reach the guest through IN (VM) or read(0) (VM64). Each
+ * run fills an edge bitmap (vm_execute_fuzz, or VM64 cover mode); runs
+ * that hit a new edge or a new hit-count bucket join the queue and are
+ * saved to the corpus directory, crashes and hangs that do so go to its
+ * crashes/ and hangs/ subdirectories. New inputs come from stacked
+ * havoc mutations of queue entries, using bytes from the image's MOVI
+ * immediates as a dictionary. */
+
+#define FUZZ_MAP_SIZE VM_COVER_SIZE
+#define FUZZ_MAX_LEN 4096                  /* Default input size limit */
+#define FUZZ_MAX_INSNS 1000000             /* Default hang threshold per run */
+#define FUZZ_HAVOC 256                     /* Children per queue entry visit */
+#define FUZZ_STACK 8                       /* Most mutations stacked per child */
+#define FUZZ_DICT_MAX 256
+#define FUZZ_STATUS_MS 1000
+
+#if VM_COVER_SIZE != VM64_COVER_SIZE
+#error "vmfuzz shares one bitmap between both ISAs"
+#endif
+
+enum { FUZZ_OK, FUZZ_CRASH, FUZZ_HANG };
+
+typedef struct {
+    uint8_t* data;
+    size_t len;
+} FuzzInput;
+
+typedef struct {
+    int is64;                              /* Fuzzing a VM64 image */
+    uint64_t max_insns;
+    size_t max_len;
+    const char* dir;
+    
+    /* Guest and its snapshot */
+    VM* vm;
+    VM* vm_snap;
+    VMFuzz fuzz;
+    VM64* vm64;
+    VM64Cover cover;
+    VM64* vm64_snap;                       /* Registers; RAM is in ram_snap */
+    uint8_t* ram_snap;
+    
+    /* Current input */
+    const uint8_t* input;
+    size_t input_len, input_pos;
+    
+    /* Coverage: this run's hits, and bits not yet seen per outcome */
+    uint8_t* trace;
+    uint16_t* hits;                        /* Edges in trace, for either ISA */
+    uint8_t virgin[FUZZ_MAP_SIZE];
+    uint8_t virgin_crash[FUZZ_MAP_SIZE];
+    uint8_t virgin_hang[FUZZ_MAP_SIZE];
+    
+    FuzzInput* queue;
+    size_t nqueue, queue_cap;
+    uint8_t dict[FUZZ_DICT_MAX];
+    int ndict;
+    uint64_t rng;
+    
+    uint64_t execs;
+    unsigned edges, crashes, hangs, saved;
+} Fuzz;
+
+static volatile sig_atomic_t fuzz_stop;
+
+static void fuzz_on_signal(int sig) {
+    (void)sig;
+    fuzz_stop = 1;
+}
+
+static void* xmalloc(size_t size) {
+    void* p = malloc(size ? size : 1);
+    if (!p) {
+        fprintf(stderr, "vmfuzz: out of memory\n");
+        exit(EXIT_FAILURE);
+    }
+    return p;
+}
+
+static uint64_t fuzz_now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000u + (uint64_t)ts.tv_nsec / 1000000u;
+}
+
+/* xorshift64* */
+static uint64_t fuzz_rand(Fuzz* f) {
+    f->rng ^= f->rng >> 12;
+    f->rng ^= f->rng << 25;
+    f->rng ^= f->rng >> 27;
+    return f->rng * 0x2545F4914F6CDD1Dull;
+}
+
+static size_t fuzz_below(Fuzz* f, size_t n) {
+    return n ? (size_t)(fuzz_rand(f) % n) : 0;
+}
+
+/* --- Guest I/O --- */
+
+static int fuzz_vm_input(void* ctx) {
+    Fuzz* f = (Fuzz*)ctx;
+    return f->input_pos < f->input_len ? f->input[f->input_pos++] : -1;
+}
+
+static void fuzz_vm_output(void* ctx, uint8_t byte) {
+    (void)ctx;
+    (void)byte;
+}
+
+static long fuzz_vm64_write(void* user, int fd, const uint8_t* buf, size_t len) {
+    (void)user;
+    (void)buf;
+    return fd == STDOUT_FILENO || fd == STDERR_FILENO ? (long)len : -1;
+}
+
+static long fuzz_vm64_read(void* user, int fd, uint8_t* buf, size_t len) {
+    Fuzz* f = (Fuzz*)user;
+    if (fd != STDIN_FILENO) return -1;
+    size_t left = f->input_len - f->input_pos;
+    if (len > left) len = left;
+    memcpy(buf, f->input + f->input_pos, len);
+    f->input_pos += len;
+    return (long)len;
+}
+
+/* Only console I/O, exit and memory syscalls reach the handler; the
+ * guest never touches host files */
+static void fuzz_syscall(VM64* vm) {
+    switch (vm->regs[RAX]) {
+        case SYS_read:
+        case SYS_write:
+        case SYS_exit:
+        case SYS_exit_group:
+        case SYS_mmap:
+        case SYS_munmap:
+        case SYS_brk:
+            vm64_syscall_handler(vm);
+            break;
+        default:
+            vm->regs[RAX] = (uint64_t)-1;
+            break;
+    }
+}
+
+/* --- Runs --- */
+
+/* Back to the snapshot: copy back written pages, then registers */
+static void fuzz_restore_vm(Fuzz* f) {
+    VM* vm = f->vm;
+    for (size_t p = 0; p < sizeof(f->fuzz.dirty); p++) {
+        if (!f->fuzz.dirty[p]) continue;
+        memcpy(&vm->ram[p * VM_FUZZ_PAGE], &f->vm_snap->ram[p * VM_FUZZ_PAGE], VM_FUZZ_PAGE);
+        f->fuzz.dirty[p] = 0;
+    }
+    memcpy(vm->regs, f->vm_snap->regs, sizeof(vm->regs));
+    vm->pc = f->vm_snap->pc;
+    vm->sp = f->vm_snap->sp;
+    vm->halted = 0;
+    vm->cycle_count = 0;
+    f->fuzz.prev = 0;
+}
+
+static void fuzz_restore_vm64(Fuzz* f) {
+    VM64* vm = f->vm64;
+    const VM64* snap = f->vm64_snap;
+    for (size_t p = 0; p < VM64_PAGE_COUNT; p++) {
+        if (!(vm->page_flags[p] & VM64_PAGE_DIRTY)) continue;
+        memcpy(&vm->ram[p * VM64_PAGE_SIZE], &f->ram_snap[p * VM64_PAGE_SIZE], VM64_PAGE_SIZE);
+        vm->page_flags[p] &= ~VM64_PAGE_DIRTY;
+    }
+    memcpy(vm->regs, snap->regs, sizeof(vm->regs));
+    memcpy(vm->vregs, snap->vregs, sizeof(vm->vregs));
+    vm->rip = snap->rip;
+    vm->rsp = snap->rsp;
+    vm->eflags = snap->eflags;
+    vm->brk = snap->brk;
+    vm->mmap_top = snap->mmap_top;
+    vm->halted = 0;
+    vm->fault = 0;
+    vm->cycle_count = 0;
+    vm->instruction_count = 0;
+    vm->syscall_pending = 0;
+    vm->resume_rip = UINT64_MAX;
+    f->cover.prev = 0;
+}
+
+static int fuzz_run(Fuzz* f, const uint8_t* data, size_t len) {
+    f->input = data;
+    f->input_len = len;
+    f->input_pos = 0;
+    f->execs++;
+    
+    if (!f->is64) {
+        VM* vm = f->vm;
+        fuzz_restore_vm(f);
+        while (!vm->halted) {
+            if (vm->cycle_count >= f->max_insns) return FUZZ_HANG;
+            if (vm_execute_fuzz(vm, &f->fuzz) != 0) return FUZZ_CRASH;
+        }
+        return FUZZ_OK;
+    }
+    
+    VM64* vm = f->vm64;
+    fuzz_restore_vm64(f);
+    while (!vm->halted) {
+        if (vm->instruction_count >= f->max_insns) return FUZZ_HANG;
+        VM64Exit reason = vm64_run_budget(vm, f->max_insns - vm->instruction_count);
+        if (reason == VM64_EXIT_SYSCALL) fuzz_syscall(vm);
+        else if (reason != VM64_EXIT_BUDGET) break;
+    }
+    return vm->fault ? FUZZ_CRASH : FUZZ_OK;
+}
+
+/* --- Coverage --- */
+
+static uint8_t fuzz_bucket[256];
+
+/* AFL hit-count buckets: 1, 2, 3, 4-7, 8-15, 16-31, 32-127, 128+ */
+static void fuzz_init_buckets(void) {
+    for (int i = 1; i < 256; i++) {
+        fuzz_bucket[i] = i == 1 ? 1 : i == 2 ? 2 : i == 3 ? 4 : i < 8 ? 8 :
+                         i < 16 ? 16 : i < 32 ? 32 : i < 128 ? 64 : 128;
+    }
+}
+
+/* Clear the bits this run set in virgin; nonzero if there were any.
+ * edges, if given, counts edges hit for the first time. Only the edges
+ * the run hit are visited, and they are zeroed for the next run. */
+static int fuzz_novel(Fuzz* f, uint8_t* virgin, unsigned* edges) {
+    uint32_t* nhits = f->is64 ? &f->cover.nhits : &f->fuzz.nhits;
+    int novel = 0;
+    for (uint32_t k = 0; k < *nhits; k++) {
+        uint16_t i = f->hits[k];
+        uint8_t bits = fuzz_bucket[f->trace[i]] & virgin[i];
+        f->trace[i] = 0;
+        if (!bits) continue;
+        if (edges && virgin[i] == 0xFF) (*edges)++;
+        virgin[i] &= (uint8_t)~bits;
+        novel = 1;
+    }
+    *nhits = 0;
+    return novel;
+}
+
+/* --- Corpus --- */
+
+static void fuzz_save(Fuzz* f, const char* sub, const uint8_t* data, size_t len) {
+    char path[4096];
+    snprintf(path, sizeof(path), "%s%s/id-%06u", f->dir, sub, f->saved++);
+    FILE* out = fopen(path, "wb");
+    if (!out) return;
+    fwrite(data, 1, len, out);
+    fclose(out);
+}
+
+static void fuzz_enqueue(Fuzz* f, const uint8_t* data, size_t len) {
+    if (f->nqueue == f->queue_cap) {
+        f->queue_cap = f->queue_cap ? f->queue_cap * 2 : 64;
+        f->queue = (FuzzInput*)realloc(f->queue, f->queue_cap * sizeof(FuzzInput));
+        if (!f->queue) {
+            fprintf(stderr, "vmfuzz: out of memory\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    FuzzInput* in = &f->queue[f->nqueue++];
+    in->data = (uint8_t*)xmalloc(len);
+    memcpy(in->data, data, len);
+    in->len = len;
+}
+
+/* Run one input and keep it if it found something */
+static int fuzz_one(Fuzz* f, const uint8_t* data, size_t len, int seed) {
+    int result = fuzz_run(f, data, len);
+    if (result == FUZZ_CRASH) {
+        if (fuzz_novel(f, f->virgin_crash, NULL)) {
+            f->crashes++;
+            fuzz_save(f, "/crashes", data, len);
+        }
+    } else if (result == FUZZ_HANG) {
+        if (fuzz_novel(f, f->virgin_hang, NULL)) {
+            f->hangs++;
+            fuzz_save(f, "/hangs", data, len);
+        }
+    } else if (fuzz_novel(f, f->virgin, &f->edges) || seed) {
+        fuzz_enqueue(f, data, len);
+        if (!seed) fuzz_save(f, "", data, len);
+    }
+    return result;
+}
+
+/* Queue every file already in the corpus directory */
+static void fuzz_load_seeds(Fuzz* f, uint8_t* buf) {
+    DIR* d = opendir(f->dir);
+    struct dirent* e;
+    while (d && (e = readdir(d)) != NULL) {
+        char path[4096];
+        struct stat st;
+        snprintf(path, sizeof(path), "%s/%s", f->dir, e->d_name);
+        if (stat(path, &st) != 0 || !S_ISREG(st.st_mode)) continue;
+        
+        FILE* in = fopen(path, "rb");
+        if (!in) continue;
+        size_t len = fread(buf, 1, f->max_len, in);
+        fclose(in);
+        fuzz_one(f, buf, len, 1);
+        
+        unsigned id;
+        if (sscanf(e->d_name, "id-%u", &id) == 1 && id >= f->saved) f->saved = id + 1;
+    }
+    if (d) closedir(d);
+    
+    /* Start from an empty input, even if it crashes */
+    if (f->nqueue == 0) fuzz_one(f, buf, 0, 1);
+    if (f->nqueue == 0) fuzz_enqueue(f, buf, 0);
+}
+
+/* Byte-sized MOVI immediates, which input bytes are usually compared to */
+static void fuzz_build_dict(Fuzz* f, const uint8_t* image, size_t size) {
+    uint8_t seen[256] = {0};
+    for (size_t pc = 0; pc < size;) {
+        uint64_t imm = 256;
+        size_t len;
+        if (f->is64) {
+            VM64Insn insn;
+            len = (size_t)vm64_decode(&image[pc], size - pc, &insn);
+            if (len && insn.opcode == X64_MOVI) imm = insn.imm;
+        } else {
+            VMInsn insn;
+            len = (size_t)vm_decode(&image[pc], size - pc, &insn);
+            if (len && insn.opcode == OP_MOVI) imm = insn.imm;
+        }
+        if (imm < 256 && !seen[imm] && f->ndict < FUZZ_DICT_MAX) {
+            seen[imm] = 1;
+            f->dict[f->ndict++] = (uint8_t)imm;
+        }
+        pc += len ? len : 1;
+    }
+}
+
+/* --- Mutation --- */
+
+static const uint8_t fuzz_interesting[] = {0x00, 0x01, 0x10, 0x20, 0x40, 0x64, 0x7F, 0x80, 0xFF};
+
+/* Stacked havoc: buf holds len bytes and has room for f->max_len */
+static size_t fuzz_mutate(Fuzz* f, uint8_t* buf, size_t len) {
+    int stack = 1 << (1 + fuzz_below(f, 3));
+    if (stack > FUZZ_STACK) stack = FUZZ_STACK;
+    
+    for (int i = 0; i < stack; i++) {
+        size_t pos = fuzz_below(f, len);
+        switch (fuzz_below(f, len ? 9 : 1)) {
+            case 0:                        /* Insert bytes */
+                if (len < f->max_len) {
+                    size_t n = 1 + fuzz_below(f, 8);
+                    if (n > f->max_len - len) n = f->max_len - len;
+                    pos = fuzz_below(f, len + 1);
+                    memmove(&buf[pos + n], &buf[pos], len - pos);
+                    for (size_t k = 0; k < n; k++) {
+                        buf[pos + k] = f->ndict && fuzz_below(f, 2) ?
+                            f->dict[fuzz_below(f, (size_t)f->ndict)] : (uint8_t)fuzz_rand(f);
+                    }
+                    len += n;
+                }
+                break;
+            case 1:                        /* Flip a bit */
+                buf[pos] ^= (uint8_t)(1u << fuzz_below(f, 8));
+                break;
+            case 2:                        /* Random byte */
+                buf[pos] = (uint8_t)fuzz_rand(f);
+                break;
+            case 3:                        /* Interesting byte */
+                buf[pos] = fuzz_interesting[fuzz_below(f, sizeof(fuzz_interesting))];
+                break;
+            case 4:                        /* Small add or subtract */
+                if (fuzz_below(f, 2)) buf[pos] += (uint8_t)(1 + fuzz_below(f, 35));
+                else buf[pos] -= (uint8_t)(1 + fuzz_below(f, 35));
+                break;
+            case 5:                        /* Dictionary byte */
+                if (f->ndict) buf[pos] = f->dict[fuzz_below(f, (size_t)f->ndict)];
+                break;
+            case 6: {                      /* Delete a range */
+                size_t n = 1 + fuzz_below(f, len - pos < 16 ? len - pos : 16);
+                memmove(&buf[pos], &buf[pos + n], len - pos - n);
+                len -= n;
+                break;
+            }
+            case 7: {                      /* Copy a range within the input */
+                size_t from = fuzz_below(f, len);
+                size_t n = 1 + fuzz_below(f, len - (from > pos ? from : pos));
+                memmove(&buf[pos], &buf[from], n);
+                break;
+            }
+            default: {                     /* Splice in part of another entry */
+                const FuzzInput* other = &f->queue[fuzz_below(f, f->nqueue)];
+                if (other->len == 0) break;
+                size_t from = fuzz_below(f, other->len);
+                size_t n = 1 + fuzz_below(f, other->len - from);
+                if (n > len - pos) n = len - pos;
+                memcpy(&buf[pos], &other->data[from], n);
+                break;
+            }
+        }
+    }
+    return len;
+}
+
+/* --- Setup --- */
+
+static uint8_t* fuzz_read_image(const char* path, size_t limit, size_t* size) {
+    FILE* in = fopen(path, "rb");
+    if (!in) {
+        fprintf(stderr, "Error: Cannot open image '%s'\n", path);
+        return NULL;
+    }
+    uint8_t* image = (uint8_t*)xmalloc(limit);
+    *size = fread(image, 1, limit, in);
+    fclose(in);
+    if (*size == 0) {
+        fprintf(stderr, "Error: Image '%s' is empty\n", path);
+        free(image);
+        return NULL;
+    }
+    return image;
+}
+
+/* Load the guest, run it to stop_at if given, and snapshot it there */
+static int fuzz_setup(Fuzz* f, const uint8_t* image, size_t size, uint64_t addr,
+                      int have_stop, uint64_t stop_at) {
+    f->input = NULL;
+    f->input_len = f->input_pos = 0;
+    
+    if (!f->is64) {
+        f->vm = vm_create();
+        f->vm_snap = vm_create();
+        if (!f->vm || !f->vm_snap) return -1;
+        memcpy(f->vm->ram, image, size);
+        vm_set_input(f->vm, fuzz_vm_input, f);
+        vm_set_output(f->vm, fuzz_vm_output, f);
+        f->fuzz.map = f->trace;
+        f->fuzz.hits = f->hits;
+        if (have_stop) {
+            while (!f->vm->halted && f->vm->pc != (uint16_t)stop_at &&
+                   f->vm->cycle_count < f->max_insns) {
+                vm_execute_one(f->vm);
+            }
+            if (f->vm->pc != (uint16_t)stop_at) return -1;
+        }
+        memcpy(f->vm_snap, f->vm, sizeof(VM));
+        return 0;
+    }
+    
+    f->vm64 = vm64_create();
+    f->vm64_snap = (VM64*)xmalloc(sizeof(VM64));
+    f->ram_snap = (uint8_t*)xmalloc(VM64_RAM_SIZE);
+    if (!f->vm64 || vm64_load_buffer(f->vm64, image, size, addr) != 0) return -1;
+    vm64_set_io(f->vm64, fuzz_vm64_write, fuzz_vm64_read, f);
+    f->vm64->trap_syscalls = 1;
+    if (have_stop) {
+        vm64_add_breakpoint(f->vm64, stop_at);
+        VM64Exit reason;
+        do {
+            reason = vm64_run_budget(f->vm64, f->max_insns);
+            if (reason == VM64_EXIT_SYSCALL) fuzz_syscall(f->vm64);
+        } while (reason == VM64_EXIT_SYSCALL);
+        vm64_remove_breakpoint(f->vm64, stop_at);
+        if (reason != VM64_EXIT_BREAKPOINT) return -1;
+    }
+    f->cover.map = f->trace;
+    f->cover.hits = f->hits;
+    f->vm64->cover = &f->cover;
+    memcpy(f->vm64_snap, f->vm64, sizeof(VM64));
+    memcpy(f->ram_snap, f->vm64->ram, VM64_RAM_SIZE);
+    memset(f->vm64->page_flags, 0, sizeof(f->vm64->page_flags));
+    return 0;
+}
+
+static void fuzz_status(Fuzz* f, uint64_t start, uint64_t now, const char* end) {
+    double secs = (double)(now - start) / 1000.0;
+    printf("\rvmfuzz: %llu execs (%.0f/s) | corpus %zu | edges %u | crashes %u | hangs %u   %s",
+           (unsigned long long)f->execs, secs > 0 ? (double)f->execs / secs : 0.0,
+           f->nqueue, f->edges, f->crashes, f->hangs, end);
+    fflush(stdout);
+}
+
+static void print_usage(const char* prog) {
+    printf("Usage: %s [options] image.bin [load_addr]\n", prog);
+    printf("  --corpus <dir>    - Seeds and findings (default corpus)\n");
+    printf("  --vm64            - Fuzz a VM64 image (load_addr default 400000)\n");
+    printf("  --stop-at <addr>  - Snapshot at this PC/RIP instead of the entry (hex)\n");
+    printf("  --max-insns <n>   - Instructions before a run counts as a hang (default %d)\n",
+           FUZZ_MAX_INSNS);
+    printf("  --max-len <n>     - Largest input in bytes (default %d)\n", FUZZ_MAX_LEN);
+    printf("  --runs <n>        - Stop after n executions\n");
+    printf("  --time <s>        - Stop after s seconds\n");
+    printf("  --seed <n>        - Random seed (default: time)\n");
+}
+
+int main(int argc, char* argv[]) {
+    const char* image_path = NULL;
+    const char* addr_arg = NULL;
+    uint64_t stop_at = 0, runs = 0, seconds = 0;
+    int have_stop = 0;
+    
+    Fuzz* f = (Fuzz*)xmalloc(sizeof(Fuzz));
+    memset(f, 0, sizeof(*f));
+    f->dir = "corpus";
+    f->max_insns = FUZZ_MAX_INSNS;
+    f->max_len = FUZZ_MAX_LEN;
+    f->rng = (uint64_t)time(NULL) ^ ((uint64_t)getpid() << 32);
+    
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--corpus") == 0 && i + 1 < argc) {
+            f->dir = argv[++i];
+        } else if (strcmp(argv[i], "--vm64") == 0) {
+            f->is64 = 1;
+        } else if (strcmp(argv[i], "--stop-at") == 0 && i + 1 < argc) {
+            stop_at = strtoull(argv[++i], NULL, 16);
+            have_stop = 1;
+        } else if (strcmp(argv[i], "--max-insns") == 0 && i + 1 < argc) {
+            f->max_insns = strtoull(argv[++i], NULL, 0);
+        } else if (strcmp(argv[i], "--max-len") == 0 && i + 1 < argc) {
+            f->max_len = strtoull(argv[++i], NULL, 0);
+        } else if (strcmp(argv[i], "--runs") == 0 && i + 1 < argc) {
+            runs = strtoull(argv[++i], NULL, 0);
+        } else if (strcmp(argv[i], "--time") == 0 && i + 1 < argc) {
+            seconds = strtoull(argv[++i], NULL, 0);
+        } else if (strcmp(argv[i], "--seed") == 0 && i + 1 < argc) {
+            f->rng = strtoull(argv[++i], NULL, 0);
+        } else if (strcmp(argv[i], "--help") == 0 || strcmp(argv[i], "-h") == 0) {
+            print_usage(argv[0]);
+            return EXIT_SUCCESS;
+        } else if (argv[i][0] == '-') {
+            fprintf(stderr, "Unknown option: %s\n", argv[i]);
+            return EXIT_FAILURE;
+        } else if (!image_path) {
+            image_path = argv[i];
+        } else {
+            addr_arg = argv[i];
+        }
+    }
+    if (!image_path || f->max_insns == 0 || f->max_len == 0) {
+        print_usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+    if (f->rng == 0) f->rng = 1;
+    
+    size_t size;
+    uint64_t addr = addr_arg ? strtoull(addr_arg, NULL, 16) : 0x400000;
+    uint8_t* image = fuzz_read_image(image_path, f->is64 ? VM64_RAM_SIZE : VM_RAM_SIZE, &size);
+    if (!image) return EXIT_FAILURE;
+    
+    char path[4096];
+    snprintf(path, sizeof(path), "%s/crashes", f->dir);
+    mkdir(f->dir, 0755);
+    mkdir(path, 0755);
+    snprintf(path, sizeof(path), "%s/hangs", f->dir);
+    mkdir(path, 0755);
+    
+    f->trace = (uint8_t*)xmalloc(FUZZ_MAP_SIZE);
+    memset(f->trace, 0, FUZZ_MAP_SIZE);
+    f->hits = (uint16_t*)xmalloc(FUZZ_MAP_SIZE * sizeof(uint16_t));
+    memset(f->virgin, 0xFF, sizeof(f->virgin));
+    memset(f->virgin_crash, 0xFF, sizeof(f->virgin_crash));
+    memset(f->virgin_hang, 0xFF, sizeof(f->virgin_hang));
+    fuzz_init_buckets();
+    fuzz_build_dict(f, image, size);
+    if (fuzz_setup(f, image, size, addr, have_stop, stop_at) != 0) {
+        fprintf(stderr, "vmfuzz: cannot load '%s'%s\n", image_path,
+                have_stop ? " or reach --stop-at" : "");
+        return EXIT_FAILURE;
+    }
+    
+    /* Emulator diagnostics for faulting inputs would flood the terminal */
+    int devnull = open("/dev/null", O_WRONLY);
+    if (devnull >= 0) {
+        dup2(devnull, STDERR_FILENO);
+        close(devnull);
+    }
+    signal(SIGINT, fuzz_on_signal);
+    signal(SIGTERM, fuzz_on_signal);
+    
+    uint8_t* buf = (uint8_t*)xmalloc(f->max_len);
+    fuzz_load_seeds(f, buf);
+    printf("vmfuzz: %s (%zu bytes, %s), %zu seeds, %d dictionary bytes -> %s/\n",
+           image_path, size, f->is64 ? "vm64" : "vm", f->nqueue, f->ndict, f->dir);
+    
+    uint64_t start = fuzz_now_ms();
+    uint64_t last = start;
+    for (size_t cur = 0; !fuzz_stop; cur = (cur + 1) % f->nqueue) {
+        for (int child = 0; child < FUZZ_HAVOC && !fuzz_stop; child++) {
+            const FuzzInput* parent = &f->queue[cur];
+            memcpy(buf, parent->data, parent->len);
+            size_t len = fuzz_mutate(f, buf, parent->len);
+            fuzz_one(f, buf, len, 0);
+            if (runs && f->execs >= runs) fuzz_stop = 1;
+        }
+        
+        uint64_t now = fuzz_now_ms();
+        if (seconds && now - start >= seconds * 1000) fuzz_stop = 1;
+        if (now - last >= FUZZ_STATUS_MS) {
+            fuzz_status(f, start, now, "");
+            last = now;
+        }
+    }
+    fuzz_status(f, start, fuzz_now_ms(), "\n");
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,1393 @@
+#define _POSIX_C_SOURCE 200809L
+#include "vm.h"
+#include "vm_cfg.h"
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+/* Offline optimizer for VM images: image in, equivalent image out.
+ *
+ * The image is cut into blocks with vm_cfg and rewritten until nothing
+ * changes: constant propagation (also resolving branches on known
+ * registers), dead code elimination, hoisting of loop-invariant MOVIs into
+ * loop preheaders and jump threading. The blocks are then laid out again in
+ * their original order and every jump, call and data address is relocated.
+ *
+ * Registers start at zero as after vm_reset(), and every register stays
+ * live at HALT and RET, so the final state dump does not change. Images
+ * that read or write their own code, or jump into the middle of an
+ * instruction, are copied unchanged. */
+
+#define OPT_MAX_ROUNDS 16
+#define OPT_MAX_HOPS 16                    /* Jump threading chain limit */
+#define OPT_LOOP_WEIGHT 10                 /* Estimated iterations per loop level */
+#define OPT_REG_ALL 0xFFu
+#define OPT_REG_BIT(r) ((r) < VM_REG_COUNT ? 1u << (r) : 0u)
+
+#define OPT_NONE (-1)
+#define OPT_END (-2)                       /* Falls off the end of the image */
+#define OPT_TERM_FALL 0xFF                 /* Block ends without a transfer */
+
+typedef struct {
+    VMInsn in;
+    uint16_t pc;                           /* Original address */
+} OptInsn;
+
+typedef struct {
+    OptInsn* body;                         /* Everything but the terminator */
+    uint32_t n, cap;
+    uint8_t term;                          /* JMP, Jcc, CALL, RET, HALT or OPT_TERM_FALL */
+    uint8_t term_reg;                      /* Jcc condition register */
+    uint16_t term_pc;
+    int32_t target;                        /* Jump/call target block or OPT_NONE */
+    uint16_t target_addr;                  /* Target outside the image */
+    int32_t fall;                          /* Next block, OPT_NONE or OPT_END */
+    
+    uint16_t start;                        /* Original address */
+    int32_t loop;                          /* Innermost loop, -1 if none */
+    uint32_t depth;
+    int32_t func;                          /* Entry block of its function */
+    uint8_t reachable;
+    uint8_t called;                        /* Entered by CALL */
+    uint8_t live_in;                       /* Registers read before written */
+    
+    uint8_t visited;                       /* Constant propagation state */
+    uint8_t known;
+    uint64_t value[VM_REG_COUNT];
+    
+    uint32_t addr, size;                   /* New layout */
+} OptBlock;
+
+typedef struct {
+    int32_t block;                         /* Block, or OPT_NONE for data */
+    uint32_t start, len;                   /* Data: original bytes */
+    uint32_t addr;                         /* New address */
+} OptItem;
+
+typedef struct {
+    uint8_t op, reg;
+    int32_t target;                        /* Block, or OPT_NONE for target_addr */
+    uint16_t target_addr;
+} OptEmit;
+
+typedef struct {
+    const VMCfg* cfg;
+    const uint8_t* image;
+    size_t size;
+    int verbose;
+    
+    OptBlock* blocks;
+    uint32_t nblocks, cap;
+    int32_t* preheader;                    /* Per loop, OPT_NONE until needed */
+    uint8_t* clobber;                      /* Per function entry: registers changed */
+    int32_t entry;
+    int pin_data;                          /* Keep data at its original addresses */
+    
+    OptItem* items;
+    uint32_t nitems;
+    
+    uint32_t movis_dropped, folded, branches;
+    uint32_t dead, unreachable, data_dropped, hoisted;
+    uint32_t threaded, jumps_removed;
+} Opt;
+
+static void* xmalloc(size_t size) {
+    void* p = malloc(size ? size : 1);
+    if (!p) {
+        fprintf(stderr, "vmopt: out of memory\n");
+        exit(EXIT_FAILURE);
+    }
+    return p;
+}
+
+static void* xrealloc(void* p, size_t size) {
+    p = realloc(p, size ? size : 1);
+    if (!p) {
+        fprintf(stderr, "vmopt: out of memory\n");
+        exit(EXIT_FAILURE);
+    }
+    return p;
+}
+
+static void note(const Opt* o, uint16_t pc, const char* fmt, ...) {
+    if (!o->verbose) return;
+    va_list ap;
+    va_start(ap, fmt);
+    printf("  0x%04X: ", pc);
+    vprintf(fmt, ap);
+    printf("\n");
+    va_end(ap);
+}
+
+static int is_jcc(uint8_t op) {
+    return op == OP_JNZ || op == OP_JZ || op == OP_JLT || op == OP_JGT;
+}
+
+static int is_alu(uint8_t op) {
+    return (op >= OP_ADD && op <= OP_XOR) || op == OP_CMP;
+}
+
+/* Registers an instruction reads and writes. Returns 1 if it has no other
+ * effect, so it can go when nothing reads what it writes. An instruction
+ * naming a register past R7 does nothing at all. */
+static int insn_effects(const VMInsn* in, uint8_t* uses, uint8_t* defs) {
+    uint8_t r1 = OPT_REG_BIT(in->r1), r2 = OPT_REG_BIT(in->r2);
+    *uses = *defs = 0;
+    switch (in->opcode) {
+        case OP_MOVI:
+            *defs = r1;
+            return 1;
+        case OP_NOT: case OP_SHL: case OP_SHR:
+            *uses = *defs = r1;
+            return 1;
+        case OP_LOAD:
+            *defs = r1;
+            return 1;
+        case OP_LOADX:
+            if (VM_AM_KIND(in->mode) != VM_AM_ABS) {
+                if (!r2) return 1;
+                *uses = r2;
+            }
+            *defs = r1;
+            return 1;
+        case OP_STORE:
+            *uses = r1;
+            return 0;
+        case OP_STOREX:
+            *uses = r1 | (VM_AM_KIND(in->mode) != VM_AM_ABS ? r2 : 0);
+            return 0;
+        case OP_OUT: case OP_PUSH:
+            *uses = r1;
+            return 0;
+        case OP_IN: case OP_POP:
+            *defs = r1;
+            return 0;
+        default:
+            break;
+    }
+    if (is_alu(in->opcode)) {
+        if (!r1 || !r2) return 1;
+        /* SUB/XOR/CMP r, r do not depend on r */
+        if (!(in->r1 == in->r2 && (in->opcode == OP_SUB || in->opcode == OP_XOR ||
+                                   in->opcode == OP_CMP))) {
+            *uses = r1 | r2;
+        }
+        *defs = r1;
+        return 1;
+    }
+    return 0;
+}
+
+/* dst op= src on known values, as vm_execute_one computes it */
+static uint64_t fold_alu(uint8_t op, uint64_t a, uint64_t b) {
+    switch (op) {
+        case OP_ADD: return a + b;
+        case OP_SUB: return a - b;
+        case OP_MUL: return a * b;
+        case OP_DIV: return b ? a / b : a;
+        case OP_MOD: return b ? a % b : a;
+        case OP_AND: return a & b;
+        case OP_OR: return a | b;
+        case OP_XOR: return a ^ b;
+        default: return a != b;            /* CMP */
+    }
+}
+
+/* Constant value an instruction leaves in its destination, given the known
+ * registers before it. Returns 0 if the result is not known. */
+static int insn_result(const VMInsn* in, uint8_t known, const uint64_t* value,
+                       uint64_t* out) {
+    uint8_t r1 = in->r1, r2 = in->r2;
+    if (r1 >= VM_REG_COUNT) return 0;
+    int k1 = (known >> r1) & 1;
+    switch (in->opcode) {
+        case OP_MOVI:
+            *out = in->imm;
+            return 1;
+        case OP_NOT:
+            *out = ~value[r1];
+            return k1;
+        case OP_SHL: case OP_SHR:
+            if (!k1) return 0;
+            if (in->imm >= 64) *out = value[r1];
+            else *out = in->opcode == OP_SHL ? value[r1] << in->imm : value[r1] >> in->imm;
+            return 1;
+        default:
+            break;
+    }
+    if (!is_alu(in->opcode) || r2 >= VM_REG_COUNT) return 0;
+    if (r1 == r2 && (in->opcode == OP_SUB || in->opcode == OP_XOR || in->opcode == OP_CMP)) {
+        *out = 0;
+        return 1;
+    }
+    int k2 = (known >> r2) & 1;
+    if ((in->opcode == OP_AND || in->opcode == OP_MUL) && k2 && value[r2] == 0) {
+        *out = 0;
+        return 1;
+    }
+    if (!k1 || !k2) return 0;
+    *out = fold_alu(in->opcode, value[r1], value[r2]);
+    return 1;
+}
+
+/* The instruction leaves its destination as it was: adding zero, dividing
+ * by one or by zero (a no-op in the VM), shifting by zero... */
+static int insn_identity(const VMInsn* in, uint8_t known, const uint64_t* value) {
+    if (in->r1 >= VM_REG_COUNT) return 0;
+    if ((in->opcode == OP_SHL || in->opcode == OP_SHR) && in->imm == 0) return 1;
+    if (!is_alu(in->opcode) || in->opcode == OP_CMP || in->r2 >= VM_REG_COUNT ||
+        !((known >> in->r2) & 1) || (in->r1 == in->r2)) {
+        return 0;
+    }
+    uint64_t v = value[in->r2];
+    switch (in->opcode) {
+        case OP_ADD: case OP_SUB: case OP_OR: case OP_XOR: return v == 0;
+        case OP_MUL: return v == 1;
+        case OP_DIV: case OP_MOD: return v == 0 || (in->opcode == OP_DIV && v == 1);
+        case OP_AND: return v == UINT64_MAX;
+        default: return 0;
+    }
+}
+
+static void block_add(OptBlock* b, const OptInsn* insn) {
+    if (b->n == b->cap) {
+        b->cap = b->cap ? b->cap * 2 : 8;
+        b->body = (OptInsn*)xrealloc(b->body, b->cap * sizeof(OptInsn));
+    }
+    b->body[b->n++] = *insn;
+}
+
+static int32_t new_block(Opt* o) {
+    if (o->nblocks == o->cap) {
+        o->cap = o->cap ? o->cap * 2 : 64;
+        o->blocks = (OptBlock*)xrealloc(o->blocks, o->cap * sizeof(OptBlock));
+    }
+    OptBlock* b = &o->blocks[o->nblocks];
+    memset(b, 0, sizeof(*b));
+    b->target = OPT_NONE;
+    b->fall = OPT_NONE;
+    b->loop = -1;
+    return (int32_t)o->nblocks++;
+}
+
+/* 1 if width bytes at addr are data in the image, 0 if addr is past the
+ * image, -1 if they touch code or run off the end */
+static int data_in_image(const Opt* o, uint32_t addr, uint32_t width) {
+    if (addr >= o->size) return 0;
+    for (uint32_t i = 0; i < width; i++) {
+        if (addr + i >= o->size) return -1;
+        if (vm_cfg_is_code(o->cfg, addr + i)) return -1;
+    }
+    return 1;
+}
+
+/* Build the IR from the CFG. Returns NULL, or why the image cannot be
+ * rewritten safely. */
+static const char* opt_build(Opt* o) {
+    const VMCfg* cfg = o->cfg;
+    if (cfg->overlaps) return "code jumps into the middle of instructions";
+    
+    for (uint32_t i = 0; i < cfg->nblocks; i++) {
+        const VMCfgBlock* cb = &cfg->blocks[i];
+        int32_t bi = new_block(o);
+        OptBlock* b = &o->blocks[bi];
+        b->start = (uint16_t)cb->start;
+        b->loop = cb->loop;
+        b->depth = cb->loop_depth;
+        b->func = (int32_t)cb->function;
+        b->term = OPT_TERM_FALL;
+        
+        for (uint64_t pc = cb->start; pc < cb->end;) {
+            OptInsn insn;
+            insn.pc = (uint16_t)pc;
+            vm_decode(o->image + pc, o->size - pc, &insn.in);
+            pc += insn.in.len;
+            
+            uint8_t op = insn.in.opcode;
+            if (op == OP_JMP || op == OP_CALL || is_jcc(op) || op == OP_RET || op == OP_HALT) {
+                b->term = op;
+                b->term_reg = insn.in.r1;
+                b->term_pc = insn.pc;
+                if (op == OP_JMP || op == OP_CALL || is_jcc(op)) {
+                    int t = vm_cfg_block_start(cfg, insn.in.imm);
+                    if (t < 0 && insn.in.imm < o->size) {
+                        return "a jump target is not decoded code";
+                    }
+                    b->target = t;
+                    b->target_addr = (uint16_t)insn.in.imm;
+                }
+                continue;
+            }
+            
+            /* Absolute accesses must stay out of code so it can move */
+            if (op == OP_LOAD || op == OP_STORE ||
+                ((op == OP_LOADX || op == OP_STOREX) && VM_AM_KIND(insn.in.mode) == VM_AM_ABS)) {
+                uint32_t width = op == OP_LOAD || op == OP_STORE ? 1 : VM_AM_WIDTH(insn.in.mode);
+                if (data_in_image(o, insn.in.imm, width) < 0) {
+                    return "the program reads or writes its own code";
+                }
+            } else if (op == OP_LOADX || op == OP_STOREX) {
+                o->pin_data = 1;
+            }
+            block_add(b, &insn);
+        }
+        
+        if (b->term == OPT_TERM_FALL || b->term == OP_CALL || is_jcc(b->term)) {
+            if (cb->end >= o->size) {
+                b->fall = OPT_END;
+            } else {
+                b->fall = vm_cfg_block_start(cfg, cb->end);
+                if (b->fall < 0) return "code runs into bytes that do not decode";
+            }
+        }
+    }
+    
+    o->entry = vm_cfg_block_start(cfg, 0);
+    o->preheader = (int32_t*)xmalloc((cfg->nloops + 1) * sizeof(int32_t));
+    for (uint32_t l = 0; l < cfg->nloops; l++) o->preheader[l] = OPT_NONE;
+    return NULL;
+}
+
+/* Successors in the CFG: jump/branch target and fall-through. A CALL's
+ * target is the callee, so it is returned separately. */
+static int block_succs(const OptBlock* b, int32_t* out) {
+    int n = 0;
+    if ((b->term == OP_JMP || is_jcc(b->term)) && b->target >= 0) out[n++] = b->target;
+    if (b->fall >= 0) out[n++] = b->fall;
+    return n;
+}
+
+static int block_in_loop(const Opt* o, uint32_t b, int32_t loop) {
+    for (int32_t l = o->blocks[b].loop; l >= 0; l = o->cfg->loops[l].parent) {
+        if (l == loop) return 1;
+    }
+    return 0;
+}
+
+static void opt_reach(Opt* o) {
+    uint32_t* work = (uint32_t*)xmalloc(o->nblocks * sizeof(uint32_t));
+    uint32_t n = 0;
+    uint8_t* was = (uint8_t*)xmalloc(o->nblocks);
+    for (uint32_t b = 0; b < o->nblocks; b++) {
+        was[b] = o->blocks[b].reachable;
+        o->blocks[b].reachable = 0;
+        o->blocks[b].called = 0;
+    }
+    if (o->entry >= 0) {
+        o->blocks[o->entry].reachable = 1;
+        work[n++] = (uint32_t)o->entry;
+    }
+    while (n > 0) {
+        OptBlock* b = &o->blocks[work[--n]];
+        int32_t succ[3];
+        int ns = block_succs(b, succ);
+        if (b->term == OP_CALL && b->target >= 0) {
+            o->blocks[b->target].called = 1;
+            succ[ns++] = b->target;
+        }
+        for (int i = 0; i < ns; i++) {
+            if (o->blocks[succ[i]].reachable) continue;
+            o->blocks[succ[i]].reachable = 1;
+            work[n++] = (uint32_t)succ[i];
+        }
+    }
+    for (uint32_t b = 0; b < o->nblocks; b++) {
+        if (was[b] && !o->blocks[b].reachable) {
+            OptBlock* blk = &o->blocks[b];
+            note(o, blk->start, "block unreachable, %u instructions removed",
+                 blk->n + (blk->term != OPT_TERM_FALL));
+            o->unreachable += blk->n + (blk->term != OPT_TERM_FALL);
+        }
+    }
+    free(was);
+    free(work);
+}
+
+/* Registers a function changes for its caller. Callee-saved registers,
+ * pushed on entry and popped in reverse order before every RET, do not
+ * count. */
+static uint8_t function_saved(const Opt* o, uint32_t entry, const uint8_t* in_func) {
+    const OptBlock* e = &o->blocks[entry];
+    uint8_t pushed[VM_REG_COUNT];
+    uint32_t npushed = 0;
+    uint8_t saved = 0;
+    while (npushed < e->n && npushed < VM_REG_COUNT && e->body[npushed].in.opcode == OP_PUSH) {
+        uint8_t r = e->body[npushed].in.r1;
+        if (r >= VM_REG_COUNT || (saved & (1u << r))) break;
+        saved |= (uint8_t)(1u << r);
+        pushed[npushed++] = r;
+    }
+    if (!npushed) return 0;
+    
+    int rets = 0;
+    for (uint32_t b = 0; b < o->nblocks; b++) {
+        const OptBlock* blk = &o->blocks[b];
+        if (!in_func[b] || blk->term != OP_RET) continue;
+        if (blk->n < npushed) return 0;
+        for (uint32_t i = 0; i < npushed; i++) {
+            const VMInsn* in = &blk->body[blk->n - 1 - i].in;
+            if (in->opcode != OP_POP || in->r1 != pushed[i]) return 0;
+        }
+        rets++;
+    }
+    return rets ? saved : 0;
+}
+
+static void opt_clobbers(Opt* o) {
+    o->clobber = (uint8_t*)calloc(o->nblocks, 1);
+    uint8_t* in_func = (uint8_t*)xmalloc(o->nblocks);
+    uint32_t* work = (uint32_t*)xmalloc(o->nblocks * sizeof(uint32_t));
+    if (!o->clobber) {
+        fprintf(stderr, "vmopt: out of memory\n");
+        exit(EXIT_FAILURE);
+    }
+    
+    for (int changed = 1, round = 0; changed && round <= (int)o->nblocks; round++) {
+        changed = 0;
+        for (uint32_t f = 0; f < o->nblocks; f++) {
+            if (!o->blocks[f].called) continue;
+            memset(in_func, 0, o->nblocks);
+            uint32_t n = 0;
+            in_func[f] = 1;
+            work[n++] = f;
+            uint8_t mask = 0;
+            while (n > 0) {
+                const OptBlock* b = &o->blocks[work[--n]];
+                for (uint32_t i = 0; i < b->n; i++) {
+                    uint8_t uses, defs;
+                    insn_effects(&b->body[i].in, &uses, &defs);
+                    mask |= defs;
+                }
+                if (b->term == OP_CALL) mask |= b->target >= 0 ? o->clobber[b->target] : OPT_REG_ALL;
+                int32_t succ[2];
+                int ns = block_succs(b, succ);
+                for (int i = 0; i < ns; i++) {
+                    if (in_func[succ[i]]) continue;
+                    in_func[succ[i]] = 1;
+                    work[n++] = (uint32_t)succ[i];
+                }
+            }
+            mask &= (uint8_t)~function_saved(o, f, in_func);
+            if ((mask | o->clobber[f]) != o->clobber[f]) {
+                o->clobber[f] |= mask;
+                changed = 1;
+            }
+        }
+    }
+    free(work);
+    free(in_func);
+}
+
+static uint8_t call_clobber(const Opt* o, const OptBlock* b) {
+    return b->target >= 0 ? o->clobber[b->target] : OPT_REG_ALL;
+}
+
+/* --- Constant propagation --- */
+
+static void apply_insn(const VMInsn* in, uint8_t* known, uint64_t* value) {
+    uint8_t uses, defs;
+    insn_effects(in, &uses, &defs);
+    if (!defs) return;
+    uint64_t v;
+    if (insn_result(in, *known, value, &v)) {
+        *known |= defs;
+        value[in->r1] = v;
+    } else if (!insn_identity(in, *known, value)) {
+        *known &= (uint8_t)~defs;
+    }
+}
+
+static void merge_state(Opt* o, uint32_t b, uint8_t known, const uint64_t* value,
+                        uint32_t* work, uint32_t* n, uint8_t* queued) {
+    OptBlock* blk = &o->blocks[b];
+    uint8_t merged;
+    if (!blk->visited) {
+        blk->visited = 1;
+        merged = known;
+        memcpy(blk->value, value, sizeof(blk->value));
+    } else {
+        merged = blk->known & known;
+        for (int r = 0; r < VM_REG_COUNT; r++) {
+            if ((merged >> r) & 1 && blk->value[r] != value[r]) merged &= (uint8_t)~(1u << r);
+        }
+        if (merged == blk->known) return;
+    }
+    blk->known = merged;
+    if (!queued[b]) {
+        queued[b] = 1;
+        work[(*n)++] = b;
+    }
+}
+
+static void block_out_state(const OptBlock* b, uint8_t* known, uint64_t* value) {
+    *known = b->known;
+    memcpy(value, b->value, sizeof(b->value));
+    for (uint32_t i = 0; i < b->n; i++) apply_insn(&b->body[i].in, known, value);
+}
+
+static void const_dataflow(Opt* o) {
+    uint32_t* work = (uint32_t*)xmalloc(o->nblocks * sizeof(uint32_t));
+    uint8_t* queued = (uint8_t*)calloc(o->nblocks, 1);
+    if (!queued) exit(EXIT_FAILURE);
+    uint32_t n = 0;
+    uint64_t zero[VM_REG_COUNT];
+    memset(zero, 0, sizeof(zero));
+    
+    for (uint32_t b = 0; b < o->nblocks; b++) o->blocks[b].visited = 0;
+    for (uint32_t b = 0; b < o->nblocks; b++) {
+        if (!o->blocks[b].reachable || !o->blocks[b].called) continue;
+        merge_state(o, b, 0, zero, work, &n, queued);
+    }
+    if (o->entry >= 0) merge_state(o, (uint32_t)o->entry, OPT_REG_ALL, zero, work, &n, queued);
+    
+    while (n > 0) {
+        uint32_t bi = work[--n];
+        queued[bi] = 0;
+        const OptBlock* b = &o->blocks[bi];
+        uint8_t known;
+        uint64_t value[VM_REG_COUNT];
+        block_out_state(b, &known, value);
+        
+        if ((b->term == OP_JMP || is_jcc(b->term)) && b->target >= 0) {
+            merge_state(o, (uint32_t)b->target, known, value, work, &n, queued);
+        }
+        if (b->term == OP_CALL) known &= (uint8_t)~call_clobber(o, b);
+        if (b->fall >= 0) merge_state(o, (uint32_t)b->fall, known, value, work, &n, queued);
+    }
+    free(queued);
+    free(work);
+}
+
+static void make_const(OptInsn* insn, uint64_t v) {
+    uint8_t r = insn->in.r1;
+    memset(&insn->in, 0, sizeof(insn->in));
+    insn->in.r1 = r;
+    if (v == 0) {
+        insn->in.opcode = OP_SUB;
+        insn->in.r2 = r;
+        insn->in.len = 3;
+    } else {
+        insn->in.opcode = OP_MOVI;
+        insn->in.imm = (uint32_t)v;
+        insn->in.len = 6;
+    }
+}
+
+static int branch_taken(uint8_t op, uint64_t v) {
+    switch (op) {
+        case OP_JNZ: return v != 0;
+        case OP_JZ: return v == 0;
+        case OP_JLT: return (int64_t)v < 0;
+        default: return (int64_t)v > 0;
+    }
+}
+
+static int opt_constants(Opt* o) {
+    int changed = 0;
+    const_dataflow(o);
+    
+    for (uint32_t bi = 0; bi < o->nblocks; bi++) {
+        OptBlock* b = &o->blocks[bi];
+        if (!b->reachable || !b->visited) continue;
+        uint8_t known = b->known;
+        uint64_t value[VM_REG_COUNT];
+        memcpy(value, b->value, sizeof(value));
+        
+        uint32_t kept = 0;
+        for (uint32_t i = 0; i < b->n; i++) {
+            OptInsn* insn = &b->body[i];
+            uint8_t uses, defs;
+            insn_effects(&insn->in, &uses, &defs);
+            uint64_t v;
+            if (defs && insn_result(&insn->in, known, value, &v)) {
+                uint8_t r = insn->in.r1;
+                if ((known >> r) & 1 && value[r] == v) {
+                    note(o, insn->pc, "R%u already holds 0x%llX", r, (unsigned long long)v);
+                    if (insn->in.opcode == OP_MOVI) o->movis_dropped++;
+                    else o->folded++;
+                    changed = 1;
+                    continue;
+                }
+                int is_const_form = insn->in.opcode == OP_MOVI ||
+                                    (insn->in.opcode == OP_SUB && insn->in.r2 == r);
+                if (!is_const_form && v <= 0xFFFFFFFFu) {
+                    note(o, insn->pc, "folded to R%u = 0x%llX", r, (unsigned long long)v);
+                    make_const(insn, v);
+                    o->folded++;
+                    changed = 1;
+                }
+            } else if (defs && insn_identity(&insn->in, known, value)) {
+                note(o, insn->pc, "no effect on R%u", insn->in.r1);
+                o->folded++;
+                changed = 1;
+                continue;
+            }
+            apply_insn(&insn->in, &known, value);
+            b->body[kept++] = *insn;
+        }
+        b->n = kept;
+        
+        if (is_jcc(b->term) && b->term_reg < VM_REG_COUNT && ((known >> b->term_reg) & 1)) {
+            if (branch_taken(b->term, value[b->term_reg])) {
+                note(o, b->term_pc, "branch always taken");
+                b->term = OP_JMP;
+                b->fall = OPT_NONE;
+            } else {
+                note(o, b->term_pc, "branch never taken");
+                b->term = OPT_TERM_FALL;
+                b->target = OPT_NONE;
+            }
+            o->branches++;
+            changed = 1;
+        } else if (is_jcc(b->term) && b->term_reg >= VM_REG_COUNT) {
+            b->term = OPT_TERM_FALL;   /* Invalid register: never taken */
+            b->target = OPT_NONE;
+            o->branches++;
+            changed = 1;
+        }
+    }
+    return changed;
+}
+
+/* --- Liveness and dead code --- */
+
+static uint8_t block_live_out(const Opt* o, const OptBlock* b) {
+    if (b->term == OP_RET || b->term == OP_HALT || b->term == OP_CALL) return OPT_REG_ALL;
+    uint8_t out = 0;
+    if (b->term == OP_JMP || is_jcc(b->term)) {
+        out |= b->target >= 0 ? o->blocks[b->target].live_in : OPT_REG_ALL;
+    }
+    if (b->fall >= 0) out |= o->blocks[b->fall].live_in;
+    else if (b->fall == OPT_END) out = OPT_REG_ALL;
+    return out;
+}
+
+static uint8_t block_live_in(const Opt* o, const OptBlock* b) {
+    uint8_t live = block_live_out(o, b);
+    if (is_jcc(b->term)) live |= OPT_REG_BIT(b->term_reg);
+    for (uint32_t i = b->n; i-- > 0;) {
+        uint8_t uses, defs;
+        insn_effects(&b->body[i].in, &uses, &defs);
+        live = (uint8_t)((live & ~defs) | uses);
+    }
+    return live;
+}
+
+static void opt_liveness(Opt* o) {
+    for (uint32_t b = 0; b < o->nblocks; b++) o->blocks[b].live_in = 0;
+    for (int changed = 1; changed;) {
+        changed = 0;
+        for (uint32_t b = o->nblocks; b-- > 0;) {
+            OptBlock* blk = &o->blocks[b];
+            if (!blk->reachable) continue;
+            uint8_t live = block_live_in(o, blk);
+            if (live != blk->live_in) {
+                blk->live_in = live;
+                changed = 1;
+            }
+        }
+    }
+}
+
+static int opt_dead_code(Opt* o) {
+    int changed = 0;
+    opt_liveness(o);
+    for (uint32_t bi = 0; bi < o->nblocks; bi++) {
+        OptBlock* b = &o->blocks[bi];
+        if (!b->reachable) continue;
+        uint8_t live = block_live_out(o, b);
+        if (is_jcc(b->term)) live |= OPT_REG_BIT(b->term_reg);
+        
+        /* Walk backwards, then close the gaps */
+        uint8_t* drop = (uint8_t*)calloc(b->n ? b->n : 1, 1);
+        if (!drop) exit(EXIT_FAILURE);
+        for (uint32_t i = b->n; i-- > 0;) {
+            uint8_t uses, defs;
+            int pure = insn_effects(&b->body[i].in, &uses, &defs);
+            if (pure && defs && !(defs & live)) {
+                note(o, b->body[i].pc, "result never used");
+                drop[i] = 1;
+                o->dead++;
+                changed = 1;
+                continue;
+            }
+            live = (uint8_t)((live & ~defs) | uses);
+        }
+        uint32_t kept = 0;
+        for (uint32_t i = 0; i < b->n; i++) {
+            if (!drop[i]) b->body[kept++] = b->body[i];
+        }
+        b->n = kept;
+        free(drop);
+    }
+    return changed;
+}
+
+/* --- Jump threading --- */
+
+/* Final destination of a jump to b, through empty blocks */
+static int32_t jump_dest(const Opt* o, int32_t b) {
+    for (int hops = 0; b >= 0 && hops < OPT_MAX_HOPS; hops++) {
+        const OptBlock* blk = &o->blocks[b];
+        if (blk->n) break;
+        if (blk->term == OP_JMP && blk->target >= 0 && blk->target != b) b = blk->target;
+        else if (blk->term == OPT_TERM_FALL && blk->fall >= 0 && blk->fall != b) b = blk->fall;
+        else break;
+    }
+    return b;
+}
+
+static int opt_jumps(Opt* o) {
+    int changed = 0;
+    for (uint32_t bi = 0; bi < o->nblocks; bi++) {
+        OptBlock* b = &o->blocks[bi];
+        if (!b->reachable) continue;
+        if ((b->term == OP_JMP || is_jcc(b->term)) && b->target >= 0) {
+            int32_t dest = jump_dest(o, b->target);
+            if (dest != b->target) {
+                note(o, b->term_pc, "jump threaded to 0x%04X", o->blocks[dest].start);
+                b->target = dest;
+                o->threaded++;
+                changed = 1;
+            }
+        }
+        /* A jump to HALT or RET becomes that instruction */
+        if (b->term == OP_JMP && b->target >= 0) {
+            const OptBlock* t = &o->blocks[b->target];
+            if (!t->n && (t->term == OP_HALT || t->term == OP_RET)) {
+                note(o, b->term_pc, "jump replaced by %s", t->term == OP_HALT ? "HALT" : "RET");
+                b->term = t->term;
+                b->target = OPT_NONE;
+                o->threaded++;
+                changed = 1;
+            }
+        }
+        if (is_jcc(b->term) && b->target >= 0 && b->target == b->fall) {
+            note(o, b->term_pc, "branch to the next instruction removed");
+            b->term = OPT_TERM_FALL;
+            b->target = OPT_NONE;
+            o->threaded++;
+            changed = 1;
+        }
+    }
+    if (changed) opt_reach(o);
+    return changed;
+}
+
+/* --- Loop-invariant code motion --- */
+
+static int32_t loop_preheader(Opt* o, int32_t loop) {
+    uint32_t header = o->cfg->loops[loop].header;
+    int32_t p = o->preheader[loop];
+    if (p < 0) {
+        p = new_block(o);
+        OptBlock* pb = &o->blocks[p];
+        const OptBlock* hb = &o->blocks[header];
+        pb->start = hb->start;
+        pb->loop = o->cfg->loops[loop].parent;
+        pb->depth = o->cfg->loops[loop].depth - 1;
+        pb->func = hb->func;
+        pb->term = OPT_TERM_FALL;
+        pb->fall = (int32_t)header;
+        pb->reachable = 1;
+        pb->term_pc = hb->start;
+        o->preheader[loop] = p;
+    }
+    
+    /* Entries from outside the loop go through the preheader */
+    for (uint32_t b = 0; b < o->nblocks; b++) {
+        OptBlock* blk = &o->blocks[b];
+        if ((int32_t)b == p || !blk->reachable || block_in_loop(o, b, loop)) continue;
+        if ((blk->term == OP_JMP || is_jcc(blk->term)) && blk->target == (int32_t)header) {
+            blk->target = p;
+        }
+        if (blk->fall == (int32_t)header) blk->fall = p;
+    }
+    return p;
+}
+
+/* The loop is entered only through its header, and not by CALL */
+static int loop_single_entry(const Opt* o, int32_t loop) {
+    uint32_t header = o->cfg->loops[loop].header;
+    if (!o->blocks[header].reachable || o->blocks[header].called) return 0;
+    for (uint32_t b = 0; b < o->nblocks; b++) {
+        const OptBlock* blk = &o->blocks[b];
+        if (!blk->reachable || block_in_loop(o, b, loop)) continue;
+        int32_t succ[3];
+        int ns = block_succs(blk, succ);
+        if (blk->term == OP_CALL && blk->target >= 0) succ[ns++] = blk->target;
+        for (int i = 0; i < ns; i++) {
+            if (succ[i] != (int32_t)header && block_in_loop(o, (uint32_t)succ[i], loop)) return 0;
+        }
+    }
+    return 1;
+}
+
+/* a dominates b. A preheader stands in for its loop header, and edges
+ * removed since the CFG was built only make dominance hold more often. */
+static int dominates(const Opt* o, uint32_t a, uint32_t b) {
+    const VMCfg* cfg = o->cfg;
+    if (a >= cfg->nblocks) a = (uint32_t)vm_cfg_block_start(cfg, o->blocks[a].start);
+    if (b >= cfg->nblocks) b = (uint32_t)vm_cfg_block_start(cfg, o->blocks[b].start);
+    for (int32_t d = (int32_t)b; d >= 0; d = cfg->blocks[d].idom) {
+        if ((uint32_t)d == a) return 1;
+    }
+    return 0;
+}
+
+static int opt_hoist(Opt* o) {
+    int changed = 0;
+    uint8_t* exiting = (uint8_t*)xmalloc(o->nblocks + o->cfg->nloops);
+    for (int32_t l = (int32_t)o->cfg->nloops - 1; l >= 0; l--) {
+        if (!loop_single_entry(o, l)) continue;
+        uint32_t header = o->cfg->loops[l].header;
+        opt_liveness(o);
+        
+        /* Writes per register inside the loop, what its exits read, and
+         * which blocks leave it */
+        uint32_t writes[VM_REG_COUNT];
+        memset(writes, 0, sizeof(writes));
+        uint8_t exit_live = 0;
+        memset(exiting, 0, o->nblocks);
+        for (uint32_t b = 0; b < o->nblocks; b++) {
+            const OptBlock* blk = &o->blocks[b];
+            if (!blk->reachable || !block_in_loop(o, b, l)) continue;
+            for (uint32_t i = 0; i < blk->n; i++) {
+                uint8_t uses, defs;
+                insn_effects(&blk->body[i].in, &uses, &defs);
+                for (int r = 0; r < VM_REG_COUNT; r++) writes[r] += (defs >> r) & 1;
+            }
+            if (blk->term == OP_CALL) {
+                uint8_t defs = call_clobber(o, blk);
+                for (int r = 0; r < VM_REG_COUNT; r++) writes[r] += (defs >> r) & 1;
+            }
+            if (blk->term == OP_RET || blk->term == OP_HALT || blk->fall == OPT_END ||
+                ((blk->term == OP_JMP || is_jcc(blk->term)) && blk->target < 0)) {
+                exit_live = OPT_REG_ALL;
+                exiting[b] = 1;
+            }
+            int32_t succ[2];
+            int ns = block_succs(blk, succ);
+            for (int i = 0; i < ns; i++) {
+                if (block_in_loop(o, (uint32_t)succ[i], l)) continue;
+                exit_live |= o->blocks[succ[i]].live_in;
+                exiting[b] = 1;
+            }
+        }
+        
+        /* MOVI r, c that is the loop's only write to r and r unused on
+         * entry can run once before the loop. At the exits r must be dead,
+         * or already hold c because every way out passes the MOVI. */
+        for (uint32_t b = 0; b < o->nblocks; b++) {
+            OptBlock* blk = &o->blocks[b];
+            if (!blk->reachable || !block_in_loop(o, b, l)) continue;
+            uint32_t kept = 0;
+            for (uint32_t i = 0; i < blk->n; i++) {
+                OptInsn insn = blk->body[i];
+                uint8_t r = insn.in.r1;
+                int invariant = (insn.in.opcode == OP_MOVI ||
+                                 ((insn.in.opcode == OP_SUB || insn.in.opcode == OP_XOR) &&
+                                  insn.in.r2 == r)) &&
+                                r < VM_REG_COUNT && writes[r] == 1 &&
+                                !((o->blocks[header].live_in >> r) & 1);
+                for (uint32_t e = 0; invariant && (exit_live >> r) & 1 && e < o->nblocks; e++) {
+                    if (exiting[e] && !dominates(o, b, e)) invariant = 0;
+                }
+                if (!invariant) {
+                    blk->body[kept++] = insn;
+                    continue;
+                }
+                int32_t p = loop_preheader(o, l);
+                blk = &o->blocks[b];        /* new_block may have moved the array */
+                note(o, insn.pc, "R%u is loop-invariant, hoisted before 0x%04X", r,
+                     o->blocks[header].start);
+                block_add(&o->blocks[p], &insn);
+                o->hoisted++;
+                changed = 1;
+            }
+            blk->n = kept;
+        }
+    }
+    free(exiting);
+    return changed;
+}
+
+/* --- Layout and encoding --- */
+
+/* How a block leaves, given the block laid out after it (OPT_NONE if data
+ * or nothing follows). Returns the number of transfer instructions. */
+static int plan_exit(const OptBlock* b, int32_t next, OptEmit* out, int* removed) {
+    int n = 0;
+    int32_t fall = b->fall;
+    *removed = 0;
+    OptEmit e;
+    memset(&e, 0, sizeof(e));
+    e.target = b->target;
+    e.target_addr = b->target_addr;
+    e.reg = b->term_reg;
+    
+    switch (b->term) {
+        case OP_RET: case OP_HALT:
+            e.op = b->term;
+            out[n++] = e;
+            return n;
+        case OP_JMP:
+            if (b->target >= 0 && b->target == next) {
+                *removed = 1;
+                return 0;
+            }
+            e.op = OP_JMP;
+            out[n++] = e;
+            return n;
+        case OP_CALL:
+            e.op = OP_CALL;
+            out[n++] = e;
+            break;
+        case OPT_TERM_FALL:
+            break;
+        default:                           /* Jcc */
+            if (b->target >= 0 && b->target == next && fall >= 0 && fall != next &&
+                (b->term == OP_JNZ || b->term == OP_JZ)) {
+                /* JNZ r, next; JMP f  ->  JZ r, f */
+                e.op = b->term == OP_JNZ ? OP_JZ : OP_JNZ;
+                e.target = fall;
+                out[n++] = e;
+                *removed = 1;
+                return n;
+            }
+            e.op = b->term;
+            out[n++] = e;
+            break;
+    }
+    
+    if (fall == OPT_END) {
+        /* Running off the end executes zeros, which are HALTs */
+        if (next != OPT_NONE) {
+            memset(&e, 0, sizeof(e));
+            e.op = OP_HALT;
+            out[n++] = e;
+        }
+    } else if (fall >= 0 && fall != next) {
+        memset(&e, 0, sizeof(e));
+        e.op = OP_JMP;
+        e.target = fall;
+        out[n++] = e;
+    }
+    return n;
+}
+
+static void add_item(Opt* o, uint32_t* cap, int32_t block, uint32_t start, uint32_t len) {
+    if (o->nitems == *cap) {
+        *cap = *cap ? *cap * 2 : 64;
+        o->items = (OptItem*)xrealloc(o->items, *cap * sizeof(OptItem));
+    }
+    OptItem* it = &o->items[o->nitems++];
+    it->block = block;
+    it->start = start;
+    it->len = len;
+    it->addr = 0;
+}
+
+/* Data some reachable LOAD/STORE touches. Without computed pointers, the
+ * rest is never read and can be left out. */
+static int data_used(const Opt* o, uint32_t start, uint32_t len) {
+    if (o->pin_data) return 1;
+    for (uint32_t b = 0; b < o->nblocks; b++) {
+        const OptBlock* blk = &o->blocks[b];
+        if (!blk->reachable) continue;
+        for (uint32_t i = 0; i < blk->n; i++) {
+            const VMInsn* in = &blk->body[i].in;
+            uint32_t width;
+            if (in->opcode == OP_LOAD || in->opcode == OP_STORE) width = 1;
+            else if (in->opcode == OP_LOADX || in->opcode == OP_STOREX) width = VM_AM_WIDTH(in->mode);
+            else continue;
+            if (in->imm < start + len && in->imm + width > start) return 1;
+        }
+    }
+    return 0;
+}
+
+static void add_data(Opt* o, uint32_t* cap, uint32_t start, uint32_t len) {
+    if (data_used(o, start, len)) add_item(o, cap, OPT_NONE, start, len);
+    else o->data_dropped += len;
+}
+
+static int32_t item_next_block(const Opt* o, uint32_t i) {
+    return i + 1 < o->nitems ? o->items[i + 1].block : OPT_NONE;
+}
+
+static uint32_t new_data_addr(const Opt* o, uint32_t addr) {
+    for (uint32_t i = 0; i < o->nitems; i++) {
+        const OptItem* it = &o->items[i];
+        if (it->block == OPT_NONE && addr >= it->start && addr - it->start < it->len) {
+            return it->addr + (addr - it->start);
+        }
+    }
+    return addr;
+}
+
+static void put16(uint8_t* p, uint32_t v) {
+    p[0] = (uint8_t)(v >> 8);
+    p[1] = (uint8_t)v;
+}
+
+static uint32_t encode(const VMInsn* in, uint8_t* p) {
+    p[0] = in->opcode;
+    switch (in->opcode) {
+        case OP_MOVI:
+            p[1] = in->r1;
+            p[2] = (uint8_t)(in->imm >> 24);
+            p[3] = (uint8_t)(in->imm >> 16);
+            p[4] = (uint8_t)(in->imm >> 8);
+            p[5] = (uint8_t)in->imm;
+            return 6;
+        case OP_LOADX: case OP_STOREX:
+            p[1] = in->mode;
+            p[2] = in->r1;
+            p[3] = in->r2;
+            put16(p + 4, in->imm);
+            return 6;
+        case OP_LOAD: case OP_STORE: case OP_JNZ: case OP_JZ: case OP_JLT: case OP_JGT:
+            p[1] = in->r1;
+            put16(p + 2, in->imm);
+            return 4;
+        case OP_JMP: case OP_CALL:
+            put16(p + 1, in->imm);
+            return 3;
+        case OP_SHL: case OP_SHR:
+            p[1] = in->r1;
+            p[2] = (uint8_t)in->imm;
+            return 3;
+        default:
+            break;
+    }
+    uint32_t len = vm_insn_length(in->opcode);
+    if (len >= 2) p[1] = in->r1;
+    if (len == 3) p[2] = in->r2;
+    return len;
+}
+
+/* Lay the blocks out in their original order, with each preheader just
+ * before its loop, and encode. Returns NULL or why it failed. */
+static const char* opt_layout(Opt* o, uint8_t** out, uint32_t* out_size) {
+    const VMCfg* cfg = o->cfg;
+    uint32_t cap = 0, pc = 0;
+    o->nitems = 0;
+    for (uint32_t b = 0; b < cfg->nblocks; b++) {
+        const VMCfgBlock* cb = &cfg->blocks[b];
+        if (cb->start > pc) add_data(o, &cap, pc, (uint32_t)cb->start - pc);
+        pc = (uint32_t)cb->end;
+        for (uint32_t l = 0; l < cfg->nloops; l++) {
+            if (cfg->loops[l].header == b && o->preheader[l] >= 0 &&
+                o->blocks[o->preheader[l]].reachable) {
+                add_item(o, &cap, o->preheader[l], 0, 0);
+            }
+        }
+        if (o->blocks[b].reachable) add_item(o, &cap, (int32_t)b, 0, 0);
+    }
+    if (pc < o->size) add_data(o, &cap, pc, (uint32_t)o->size - pc);
+    if (o->nitems == 0) return "no code";
+    
+    /* Sizes, then addresses */
+    OptEmit ex[3];
+    int removed;
+    uint32_t addr = 0;
+    for (uint32_t i = 0; i < o->nitems; i++) {
+        OptItem* it = &o->items[i];
+        if (it->block == OPT_NONE) {
+            if (o->pin_data) {
+                if (addr > it->start) return "code before pinned data grew";
+                addr = it->start;
+            }
+            it->addr = addr;
+            addr += it->len;
+            continue;
+        }
+        OptBlock* b = &o->blocks[it->block];
+        uint32_t size = 0;
+        for (uint32_t k = 0; k < b->n; k++) size += vm_insn_length(b->body[k].in.opcode);
+        int ne = plan_exit(b, item_next_block(o, i), ex, &removed);
+        for (int k = 0; k < ne; k++) size += vm_insn_length(ex[k].op);
+        it->addr = addr;
+        b->addr = addr;
+        b->size = size;
+        addr += size;
+    }
+    if (addr > o->size) return "the optimized image would be larger";
+    
+    uint8_t* img = (uint8_t*)calloc(addr ? addr : 1, 1);
+    if (!img) return "out of memory";
+    for (uint32_t i = 0; i < o->nitems; i++) {
+        const OptItem* it = &o->items[i];
+        if (it->block == OPT_NONE) {
+            memcpy(img + it->addr, o->image + it->start, it->len);
+            continue;
+        }
+        const OptBlock* b = &o->blocks[it->block];
+        uint8_t* p = img + b->addr;
+        for (uint32_t k = 0; k < b->n; k++) {
+            VMInsn in = b->body[k].in;
+            if (!o->pin_data &&
+                (in.opcode == OP_LOAD || in.opcode == OP_STORE ||
+                 ((in.opcode == OP_LOADX || in.opcode == OP_STOREX) &&
+                  VM_AM_KIND(in.mode) == VM_AM_ABS))) {
+                in.imm = new_data_addr(o, in.imm);
+            }
+            p += encode(&in, p);
+        }
+        int ne = plan_exit(b, item_next_block(o, i), ex, &removed);
+        o->jumps_removed += (uint32_t)removed;
+        for (int k = 0; k < ne; k++) {
+            VMInsn in;
+            memset(&in, 0, sizeof(in));
+            in.opcode = ex[k].op;
+            in.r1 = ex[k].reg;
+            in.imm = ex[k].target >= 0 ? o->blocks[ex[k].target].addr : ex[k].target_addr;
+            p += encode(&in, p);
+        }
+    }
+    *out = img;
+    *out_size = addr;
+    return NULL;
+}
+
+/* --- Reporting --- */
+
+static uint64_t loop_weight(uint32_t depth) {
+    uint64_t w = 1;
+    for (uint32_t i = 0; i < depth && i < 6; i++) w *= OPT_LOOP_WEIGHT;
+    return w;
+}
+
+static uint64_t weighted_before(const VMCfg* cfg) {
+    uint64_t total = 0;
+    for (uint32_t b = 0; b < cfg->nblocks; b++) {
+        total += cfg->blocks[b].insns * loop_weight(cfg->blocks[b].loop_depth);
+    }
+    return total;
+}
+
+static uint64_t weighted_after(const Opt* o) {
+    uint64_t total = 0;
+    OptEmit ex[3];
+    int removed;
+    for (uint32_t i = 0; i < o->nitems; i++) {
+        if (o->items[i].block == OPT_NONE) continue;
+        const OptBlock* b = &o->blocks[o->items[i].block];
+        uint64_t insns = b->n + (uint64_t)plan_exit(b, item_next_block(o, i), ex, &removed);
+        total += insns * loop_weight(b->depth);
+    }
+    return total;
+}
+
+static double percent(uint64_t before, uint64_t after) {
+    return before ? 100.0 * ((double)after - (double)before) / (double)before : 0.0;
+}
+
+typedef struct {
+    uint64_t cycles;
+    int halted;
+    uint64_t regs[VM_REG_COUNT];
+    char* output;
+    long output_len;
+} OptRun;
+
+/* Run an image in a fresh VM with stdin at EOF, capturing its output */
+static int run_image(const uint8_t* image, uint32_t size, uint64_t max_insns, OptRun* r) {
+    VM* vm = vm_create();
+    FILE* cap = tmpfile();
+    int null_fd = open("/dev/null", O_RDONLY);
+    if (!vm || !cap || null_fd < 0) {
+        if (vm) vm_destroy(vm);
+        if (cap) fclose(cap);
+        if (null_fd >= 0) close(null_fd);
+        return -1;
+    }
+    memcpy(vm->ram, image, size);
+    
+    fflush(stdout);
+    int saved_out = dup(STDOUT_FILENO), saved_in = dup(STDIN_FILENO);
+    dup2(fileno(cap), STDOUT_FILENO);
+    dup2(null_fd, STDIN_FILENO);
+    while (!vm->halted && vm->cycle_count < max_insns) vm_execute_one(vm);
+    fflush(stdout);
+    dup2(saved_out, STDOUT_FILENO);
+    dup2(saved_in, STDIN_FILENO);
+    close(saved_out);
+    close(saved_in);
+    close(null_fd);
+    clearerr(stdin);
+    
+    r->cycles = vm->cycle_count;
+    r->halted = vm->halted;
+    memcpy(r->regs, vm->regs, sizeof(r->regs));
+    r->output_len = ftell(cap);
+    r->output = (char*)xmalloc(r->output_len > 0 ? (size_t)r->output_len : 1);
+    rewind(cap);
+    if (r->output_len > 0 && fread(r->output, 1, (size_t)r->output_len, cap) != (size_t)r->output_len) {
+        r->output_len = 0;
+    }
+    fclose(cap);
+    vm_destroy(vm);
+    return 0;
+}
+
+/* Returns 0 if both runs halted with the same output and registers */
+static int report_run(const uint8_t* before, uint32_t before_size, const uint8_t* after,
+                      uint32_t after_size, uint64_t max_insns) {
+    OptRun a, b;
+    if (run_image(before, before_size, max_insns, &a) != 0 ||
+        run_image(after, after_size, max_insns, &b) != 0) {
+        printf("  measured:    could not run the images\n");
+        return -1;
+    }
+    int status = 0;
+    if (!a.halted || !b.halted) {
+        printf("  measured:    no HALT within %llu instructions, not compared\n",
+               (unsigned long long)max_insns);
+    } else {
+        int same = a.output_len == b.output_len &&
+                   memcmp(a.output, b.output, (size_t)a.output_len) == 0 &&
+                   memcmp(a.regs, b.regs, sizeof(a.regs)) == 0;
+        printf("  measured:    %llu -> %llu cycles (%+.1f%%), %s (%ld bytes of output)\n",
+               (unsigned long long)a.cycles, (unsigned long long)b.cycles,
+               percent(a.cycles, b.cycles), same ? "same output and registers" : "MISMATCH",
+               a.output_len);
+        if (!same) status = -1;
+    }
+    free(a.output);
+    free(b.output);
+    return status;
+}
+
+static void print_usage(const char* prog) {
+    printf("Usage: %s [options] image.bin\n", prog);
+    printf("  -o <file>         - Write the optimized image (default: report only)\n");
+    printf("  -v                - List every change with its original address\n");
+    printf("  --run             - Run both images and compare cycles and output\n");
+    printf("  --max-insns <n>   - Instruction limit per run (default 100000000)\n");
+}
+
+int main(int argc, char* argv[]) {
+    const char* in_path = NULL;
+    const char* out_path = NULL;
+    int run = 0, verbose = 0;
+    uint64_t max_insns = 100000000ULL;
+    
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-o") == 0 && i + 1 < argc) {
+            out_path = argv[++i];
+        } else if (strcmp(argv[i], "-v") == 0) {
+            verbose = 1;
+        } else if (strcmp(argv[i], "--run") == 0) {
+            run = 1;
+        } else if (strcmp(argv[i], "--max-insns") == 0 && i + 1 < argc) {
+            max_insns = strtoull(argv[++i], NULL, 0);
+        } else if (strcmp(argv[i], "--help") == 0 || strcmp(argv[i], "-h") == 0) {
+            print_usage(argv[0]);
+            return EXIT_SUCCESS;
+        } else if (argv[i][0] == '-') {
+            fprintf(stderr, "Unknown option: %s\n", argv[i]);
+            return EXIT_FAILURE;
+        } else {
+            in_path = argv[i];
+        }
+    }
+    if (!in_path) {
+        print_usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+    
+    FILE* f = fopen(in_path, "rb");
+    if (!f) {
+        fprintf(stderr, "Error: Cannot open image '%s'\n", in_path);
+        return EXIT_FAILURE;
+    }
+    uint8_t* image = (uint8_t*)xmalloc(VM_RAM_SIZE);
+    size_t size = fread(image, 1, VM_RAM_SIZE, f);
+    fclose(f);
+    if (size == 0) {
+        fprintf(stderr, "Error: Image '%s' is empty\n", in_path);
+        return EXIT_FAILURE;
+    }
+    
+    uint64_t entry = 0;
+    VMCfg* cfg = vm_cfg_build(&vm_isa, image, size, 0, &entry, 1, 0);
+    if (!cfg) {
+        fprintf(stderr, "vmopt: out of memory\n");
+        return EXIT_FAILURE;
+    }
+    
+    Opt o;
+    memset(&o, 0, sizeof(o));
+    o.cfg = cfg;
+    o.image = image;
+    o.size = size;
+    o.verbose = verbose;
+    
+    printf("vmopt: %s (%zu bytes, %u blocks, %u loops)\n", in_path, size, cfg->nblocks,
+           cfg->nloops);
+    const char* why = opt_build(&o);
+    uint8_t* result = NULL;
+    uint32_t result_size = 0;
+    if (!why) {
+        opt_reach(&o);
+        opt_clobbers(&o);
+        for (int round = 0; round < OPT_MAX_ROUNDS; round++) {
+            int changed = opt_constants(&o);
+            changed |= opt_jumps(&o);
+            changed |= opt_dead_code(&o);
+            changed |= opt_hoist(&o);
+            if (!changed) break;
+        }
+        why = opt_layout(&o, &result, &result_size);
+    }
+    
+    int status = EXIT_SUCCESS;
+    if (why) {
+        printf("  not optimized: %s; the image is copied unchanged\n", why);
+        result = (uint8_t*)xmalloc(size);
+        memcpy(result, image, size);
+        result_size = (uint32_t)size;
+    } else {
+        printf("  constants:   %u MOVIs dropped, %u ops folded, %u branches resolved\n",
+               o.movis_dropped, o.folded, o.branches);
+        printf("  dead code:   %u instructions, %u unreachable, %u bytes never read\n", o.dead,
+               o.unreachable, o.data_dropped);
+        printf("  loops:       %u invariant MOVIs hoisted%s\n", o.hoisted,
+               o.pin_data ? " (data kept in place: pointers are computed)" : "");
+        printf("  jumps:       %u threaded, %u removed\n", o.threaded, o.jumps_removed);
+        printf("  size:        %zu -> %u bytes (%+.1f%%)\n", size, result_size,
+               percent(size, result_size));
+        uint64_t before = weighted_before(cfg), after = weighted_after(&o);
+        printf("  est. cycles: %llu -> %llu (%+.1f%%, each loop level counted x%d)\n",
+               (unsigned long long)before, (unsigned long long)after, percent(before, after),
+               OPT_LOOP_WEIGHT);
+    }
+    if (run && report_run(image, (uint32_t)size, result, result_size, max_insns) != 0) {
+        status = EXIT_FAILURE;
+    }
+    
+    if (out_path) {
+        FILE* out = fopen(out_path, "wb");
+        if (!out || fwrite(result, 1, result_size, out) != result_size || fclose(out) != 0) {
+            fprintf(stderr, "Error: Cannot write '%s'\n", out_path);
+            status = EXIT_FAILURE;
+        } else {
+            printf("Wrote %s\n", out_path);
+        }
+    }
+    
+    for (uint32_t b = 0; b < o.nblocks; b++) free(o.blocks[b].body);
+    free(o.blocks);
+    free(o.preheader);
+    free(o.clobber);
+    free(o.items);
+    free(result);
+    vm_cfg_free(cfg);
+    free(image);
+    return status;
+}